@@ -0,0 +1,9 @@
+-- recursive calls, compare+branch, small-constant arithmetic
+local function fib(n)
+  if n < 2 then return n end
+  return fib(n - 1) + fib(n - 2)
+end
+
+local t0 = os.clock()
+assert(fib(30) == 832040)
+print(string.format("%-10s %7.3fs", "fib", os.clock() - t0))
@@ -0,0 +1,13 @@
+-- field reads off upvalues and globals
+local v = { x = 1, y = 2 }
+local function sum(n)
+  local s = 0
+  for i = 1, n do
+    s = s + v.x + v.y + math.pi
+  end
+  return s
+end
+
+local t0 = os.clock()
+assert(sum(2000000) > 0)
+print(string.format("%-10s %7.3fs", "fields", os.clock() - t0))
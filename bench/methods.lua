@@ -0,0 +1,17 @@
+-- method dispatch on lib/class.c objects through the __index chain
+local Shape = class({ name = "Shape",
+  init = function(self, w, h) self.w = w; self.h = h end,
+  compute = function(self) return self.w * self.h end })
+local sdef = { name = "Square", init = function(self, s) self.w = s; self.h = s end }
+sdef["extends"] = Shape   -- "extends" is a keyword in table constructors
+local Square = class(sdef)
+
+local t0 = os.clock()
+local objs = {}
+for i = 1, 100 do objs[i] = Class.new(i % 2 == 0 and Shape or Square, i, 2) end
+local s = 0
+for r = 1, 5000 do
+  for i = 1, 100 do s = s + objs[i]:compute() end
+end
+assert(s > 0)
+print(string.format("%-10s %7.3fs", "methods", os.clock() - t0))
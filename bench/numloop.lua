@@ -0,0 +1,9 @@
+-- tight numeric loop: compares, branches and small-constant adds
+local t0 = os.clock()
+local s, i = 0, 0
+while i < 5000000 do
+  if i < 2500000 then s = s + 2 else s = s - 1 end
+  i = i + 1
+end
+assert(s == 2500000)
+print(string.format("%-10s %7.3fs", "numloop", os.clock() - t0))
@@ -0,0 +1,32 @@
+// arena.h — per-chunk AST arenas (see src/arena.c)
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct Str;
+struct FieldIC;
+
+/* Everything the parser and resolver build for one chunk (nodes, names,
+   ASTVec storage, scope layouts) is bump-allocated from its AstArena and
+   released in one go.
+
+   The arena is reference counted: the chunk's root block holds one
+   reference (dropped by ast_free) and every Func made from the chunk
+   holds another, so the tree lives until the chunk's last closure is
+   collected. Literal and name strings stay reachable while the arena
+   lives; inline caches hung off its nodes and anything registered with
+   ast_arena_on_free (compiled bytecode) go with it. */
+typedef struct AstArena AstArena;
+
+AstArena *ast_arena_new(void);                        /* one reference */
+void      ast_arena_retain(AstArena *a);
+void      ast_arena_release(AstArena *a);
+
+void       *ast_arena_alloc(AstArena *a, size_t n);   /* zeroed */
+char       *ast_arena_strdup(AstArena *a, const char *s);
+struct Str *ast_arena_str(AstArena *a, const char *s);   /* kept alive by the arena */
+void        ast_arena_track_ic(AstArena *a, struct FieldIC **ic);
+void        ast_arena_on_free(AstArena *a, void (*fn)(void *), void *arg);
+
+#endif /* ARENA_H */
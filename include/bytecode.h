@@ -0,0 +1,141 @@
+// bytecode.h — register bytecode engine (luaX --engine=bc)
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "interpreter.h"
+
+/* The bytecode engine compiles a resolved chunk into one BcProto per
+   function and runs it on a register VM. It shares Values, tables, the
+   global env and all operator semantics (vm_binop & co) with the AST
+   walker, which stays the reference implementation: anything the
+   compiler does not handle makes the chunk fall back to the walker. */
+
+/* Instruction word: op:8 | A:8 | B:8 | C:8, or op:8 | A:8 | Bx:16.
+   sBx is Bx with a bias so jumps can go both ways. */
+typedef uint32_t BcInst;
+#define BC_OP(i)   ((int)((i) & 0xff))
+#define BC_A(i)    ((int)(((i) >> 8) & 0xff))
+#define BC_B(i)    ((int)(((i) >> 16) & 0xff))
+#define BC_C(i)    ((int)(((i) >> 24) & 0xff))
+#define BC_Bx(i)   ((int)((i) >> 16))
+#define BC_sBx(i)  (BC_Bx(i) - BC_MAXSBX)
+#define BC_ABC(op,a,b,c) ((BcInst)(op) | ((BcInst)(a) << 8) | ((BcInst)(b) << 16) | ((BcInst)(c) << 24))
+#define BC_ABx(op,a,bx)  ((BcInst)(op) | ((BcInst)(a) << 8) | ((BcInst)(bx) << 16))
+#define BC_MAXARG  0xff
+#define BC_MAXBX   0xffff
+#define BC_MAXSBX  0x7fff
+
+/* R = registers, K = constants, U = upvalue cells, C = the frame's cells
+   (locals captured by nested functions live in heap cells). A call or
+   `...` whose value count is only known at run time leaves its values
+   "open" on the VM value stack, for the instruction right after it. */
+#define BC_OPCODES(X) \
+  X(MOVE)      /* A B     R[A] = R[B] */                                   \
+  X(LOADK)     /* A Bx    R[A] = K[Bx] */                                  \
+  X(LOADNIL)   /* A B     R[A..A+B] = nil */                               \
+  X(LOADBOOL)  /* A B     R[A] = (bool)B */                                \
+  X(GETGLOBAL) /* A Bx    R[A] = G[K[Bx]] */                               \
+  X(SETGLOBAL) /* A Bx    G[K[Bx]] = R[A] */                               \
+  X(GETUPVAL)  /* A B     R[A] = U[B] */                                   \
+  X(SETUPVAL)  /* A B     U[B] = R[A] */                                   \
+  X(NEWCELL)   /* A       C[A] = fresh cell */                             \
+  X(GETCELL)   /* A B     R[A] = C[B] */                                   \
+  X(SETCELL)   /* A B     C[A] = R[B] */                                   \
+  X(GETTABLE)  /* A B C   R[A] = R[B][R[C]] */                             \
+  X(GETFIELD)  /* A B C   R[A] = R[B][K[C]] */                             \
+  X(SETTABLE)  /* A B C   R[A][R[B]] = R[C] */                             \
+  X(SETFIELD)  /* A B C   R[A][K[B]] = R[C] */                             \
+  X(SELF)      /* A B C   R[A+1] = R[B]; R[A] = R[B][K[C]] */              \
+  X(NEWTABLE)  /* A       R[A] = {} */                                     \
+  X(APPENDV)   /* A B     R[A][R[B]..] = the open values */                \
+  X(ADD) X(SUB) X(MUL) X(DIV) X(MOD) X(POW) X(IDIV) X(CONCAT)              \
+  X(ADDI)      /* A B C   R[A] = R[B] + (C - 128) */                       \
+  X(SUBI)      /* A B C   R[A] = R[B] - (C - 128) */                       \
+  X(EQ) X(NE) X(LT) X(LE) X(GT) X(GE) /* A B C  R[A] = R[B] op R[C] */     \
+  X(UNM) X(NOT) X(LEN)                /* A B    R[A] = op R[B] */          \
+  X(JMP)       /* sBx     pc += sBx */                                     \
+  X(JMPIF)     /* A sBx   if R[A] then pc += sBx */                        \
+  X(JMPIFNOT)  /* A sBx   if not R[A] then pc += sBx */                    \
+  X(CALL)      /* A B C   R[A..A+C-1] = R[A](R[A+1..A+B]); C=0: open */    \
+  X(CALLV)     /* A B C   as CALL, the open values following the B args */ \
+  X(VARARG)    /* A B     R[A..A+B-1] = ...; B=0: open */                  \
+  X(RETURN)    /* A B     return R[A..A+B-1] */                            \
+  X(RETURNV)   /* A B     return R[A..A+B-1] and the open values */        \
+  X(TAILCALL)  /* A B C   return R[A](R[A+1..A+B]); C=1: the open values too */ \
+  X(CLOSURE)   /* A Bx    R[A] = closure(P[Bx]) */                         \
+  X(FORPREP)   /* A sBx   numeric for setup on R[A..A+3] */                \
+  X(FORLOOP)   /* A sBx   step; loop back to the body if in range */       \
+  X(TFORPREP)  /* A B     generic for setup from B iterators; 0: open */   \
+  X(TFORCALL)  /* A B     next step into R[A+4..A+5]; skip if exhausted */ \
+  /* superinstructions: fused with the unchanged instruction that follows,  \
+     which stays in place so jumps into it still work */                   \
+  X(EQJ) X(NEJ) X(LTJ) X(LEJ) X(GTJ) X(GEJ) /* compare + JMPIF/JMPIFNOT */ \
+  X(GETUPFIELD)   /* GETUPVAL + GETFIELD on its result */                  \
+  X(GETGLOBFIELD) /* GETGLOBAL + GETFIELD on its result */
+
+/* Build knobs, mostly for `make bench`:
+   -DBC_SWITCH_DISPATCH        portable switch instead of computed goto
+   -DBC_SUPERINSTRUCTIONS=0    compiler emits no ADDI/SUBI or fused ops */
+#ifndef BC_SUPERINSTRUCTIONS
+#define BC_SUPERINSTRUCTIONS 1
+#endif
+#define BC_IMM_BIAS 128
+
+typedef enum {
+#define BC_ENUM(n) BC_##n,
+  BC_OPCODES(BC_ENUM)
+#undef BC_ENUM
+  BC_NUM_OPCODES
+} BcOp;
+
+/* A heap box for a local captured by a closure. */
+typedef struct BcCell {
+  Value v;
+} BcCell;
+
+/* How a closure captures upvalue i: from a cell of the enclosing frame,
+   or from one of the enclosing closure's own upvalues. */
+typedef struct BcUpvalDesc {
+  bool from_cell;
+  int  index;
+} BcUpvalDesc;
+
+typedef struct BcProto {
+  BcInst *code;  int ncode, capcode;
+  int    *lines;                       /* source line per instruction */
+  Value  *k;     int nk, capk;         /* constants */
+  struct BcProto **protos; int nprotos, capprotos;
+  BcUpvalDesc *upvals; int nupvals, capupvals;
+  int    *gcache;                      /* per instruction: global slot + 1 */
+  struct FieldIC **fic;                /* per instruction: field inline cache */
+  struct Env *groot;                   /* root env gcache refers to */
+  int nparams;
+  bool vararg;                         /* `...` (a stack window) lives in R[nparams] */
+  int maxregs;
+  int ncells;
+  AST *fn;                             /* source function/chunk node */
+} BcProto;
+
+/* Selected with luaX --engine=bc */
+extern int bc_engine;
+
+/* Compiles a resolved chunk; NULL if it uses something the bytecode
+   engine does not support (the caller then runs the AST). */
+BcProto *bc_compile_chunk(AST *program);
+
+/* Frees a compiled chunk and its nested functions. */
+void bc_proto_free(BcProto *p);
+
+/* Runs a call of a compiled closure; results as for call_multi. */
+int bc_call(struct VM *vm, Func *fn, int argc, Value *argv);
+
+/* Compiles program and, on success, points fn at the bytecode, which is
+   freed with the chunk's arena. Returns 0 when the chunk must stay on the
+   AST walker. */
+int bc_attach_chunk(Func *fn, AST *program);
+
+void bc_dump(FILE *out, BcProto *p);
+
+#endif /* BYTECODE_H */
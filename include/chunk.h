@@ -0,0 +1,29 @@
+// chunk.h — binary chunks and the require cache (see src/chunk.c)
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "parser.h"
+
+/* A binary chunk is the parsed tree of a source file, serialized node by
+   node after a header naming the source it came from (mtime, size and a
+   hash of its bytes). Loading one skips lexing and parsing; the resolver
+   still runs, so the format does not depend on either engine. */
+#define CHUNK_EXT ".luaxc"
+
+bool chunk_is_binary(const char *data, size_t len);
+
+/* Unresolved tree from a binary chunk; NULL if it is corrupt or was
+   written by another version. */
+AST *chunk_undump(const char *data, size_t len);
+
+/* luaX -c: compiles src into a binary chunk at out. 0 on success. */
+int chunk_compile_file(const char *src, const char *out);
+
+/* compile_file for modules: reuses <path minus extension>.luaxc while it
+   matches the source and refreshes it otherwise (best effort; set
+   LUAX_NOCACHE to bypass). Returns a resolved chunk or NULL. */
+AST *compile_module(const char *path);
+
+#endif /* CHUNK_H */
@@ -0,0 +1,49 @@
+// coctx.h — machine contexts for stackful coroutines (see src/coctx.c)
+#ifndef COCTX_H
+#define COCTX_H
+
+#include <stddef.h>
+
+/* A suspended C execution: the stack pointer it stopped at, with its
+   callee-saved registers pushed just below (or, in the ucontext build,
+   the ucontext). The collector scans [sp, the stack's outer end) of
+   every context that is not running.
+
+   x86-64 and aarch64 switch with a few hand-written instructions; other
+   targets, or -DCOCTX_UCONTEXT, use swapcontext. */
+#if !defined(COCTX_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define COCTX_UCONTEXT 1
+#endif
+#ifdef COCTX_UCONTEXT
+#include <ucontext.h>
+#endif
+
+typedef struct CoCtx {
+  void *sp;
+#ifdef COCTX_UCONTEXT
+  ucontext_t uc;
+#endif
+  /* the stack this context runs on, for AddressSanitizer's fiber API;
+     learned on the first switch away from the main stack */
+  const void *stk_lo;
+  size_t stk_size;
+  void (*entry)(void *);   /* until the first switch into it */
+  void *arg;
+} CoCtx;
+
+/* Prepares ctx to run entry(arg) on [stack, stack + size) at its first
+   switch. entry must never return: it ends with a final switch away. */
+void coctx_make(CoCtx *ctx, void *stack, size_t size, void (*entry)(void *), void *arg);
+
+/* Saves the running context into from and continues to. Returns when
+   something switches back to from. final: from is never resumed. */
+void coctx_switch(CoCtx *from, CoCtx *to, int final);
+
+/* C stacks: mmap'd with an inaccessible guard page below them.
+   Pages are committed as the stack grows into them. Sizes round up to a
+   power-of-two class; freed stacks are pooled per class and reused, so
+   free with the size that was asked for. */
+void *coctx_stack_alloc(size_t size);
+void  coctx_stack_free(void *stack, size_t size);
+
+#endif /* COCTX_H */
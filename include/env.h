@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include "interpreter.h" 
+#include "gc.h"
 extern Env *VM_env;  /* pointer to current lexical environment */
 
 extern Value builtin_select(struct VM *vm, int argc, Value *argv);
@@ -34,6 +35,14 @@ extern void env_add(Env *e, const char *name, Value v, bool is_local);
 extern int env_get(Env *e, const char *name, Value *out);
 extern Env* env_root(Env *e);
 
+/* A scope env whose slots live on the value stack (resolver heap_env
+   false, outside coroutines). The header sits in the C frame of the
+   activation, behind a GCObj that reads as gray so gc_mark and
+   gc_barrier pass over it; the slots are marked with the value stack and
+   the parent through the conservative C stack scan. */
+typedef struct StackEnv { GCObj h; Env e; } StackEnv;
+extern Env* env_push_stack(VM *vm, StackEnv *se, Env *parent, int n, const char **names);
+
 /* Close variable support */
 extern void env_register_close(Env *e, int slot);
 extern void env_close_all(VM *vm, Env *e, Value err_obj);
@@ -12,6 +12,9 @@ typedef struct ErrFrame {
   jmp_buf jb;
   struct ErrFrame *prev;
   struct Env *env_at_push;
+  unsigned long scratch;   /* gc_scratch_mark() at push */
+  int top;                 /* value stack top at push */
+  struct CallFrame *frame; /* innermost walker call at push */
 } ErrFrame;
 
 void vm_err_push(struct VM *vm, ErrFrame *f);
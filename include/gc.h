@@ -0,0 +1,80 @@
+// gc.h — incremental mark & sweep collector (see src/gc.c)
+#ifndef GC_H
+#define GC_H
+
+#include "interpreter.h"
+
+/* Every heap object (strings, tables, closures, envs, bytecode cells,
+   coroutines, promises) comes from gc_alloc and sits behind a GCObj header on the
+   collector's allocation list.
+
+   Roots are the attached VMs, Values registered with gc_root, modules'
+   mark callbacks (gc_root_fn), scratch Value buffers (gc_scratch) and,
+   conservatively, the C stack: any word that points at or just into an
+   object keeps it alive, so C code may hold Values in locals across
+   allocations. Values kept in malloc'd memory must live in a scratch
+   buffer or be reported by a mark callback.
+
+   Marking runs in steps between allocations. A table, env or cell that
+   was already traversed (black) must be passed to gc_barrier after a
+   store into it. In generational mode old objects stay black, so the
+   same barrier records old objects that may point at young ones. */
+typedef enum { GC_STR, GC_TABLE, GC_FUNC, GC_ENV, GC_CELL, GC_CO, GC_PROMISE } GCType;
+
+typedef struct GCObj {
+  struct GCObj *next;   /* allocation list */
+  unsigned size;        /* bytes after the header */
+  unsigned char type, mark, flags, age;
+} GCObj;
+
+#define GC_WHITE0 1
+#define GC_WHITE1 2
+#define GC_BLACK  4
+
+/* flags */
+#define GC_FIXED   1   /* gc_fix */
+#define GC_INCHUNK 2   /* bump-allocated in a nursery chunk */
+#define GC_FREED   4   /* dead chunk slot, waiting for its chunk to empty */
+
+#define gc_hdr(o)   ((GCObj*)(void*)(o) - 1)
+#define gc_barrier(o) do { if (gc_hdr(o)->mark & GC_BLACK) gc_barrier_back(o); } while (0)
+
+void  gc_init(void *stack_base);      /* from main: the outermost frame */
+void  gc_attach(struct VM *vm);
+void  gc_detach(struct VM *vm);
+
+void *gc_alloc(GCType type, size_t size);   /* zeroed */
+void  gc_fix(void *o);                      /* never collected (C caches) */
+void  gc_account(long long delta);          /* bytes an object keeps outside its block */
+int   gc_isdead(void *o);                   /* white once marking is over */
+
+void  gc_mark(void *o);
+void  gc_mark_value(Value v);
+void  gc_root(Value *slot);
+void  gc_root_fn(void (*mark)(void));
+void  gc_barrier_back(void *o);
+
+/* Nil-filled Value buffers the collector scans; vm_raise releases the
+   ones a longjmp skips over. */
+Value *gc_scratch(size_t n);
+void   gc_scratch_free(Value *v);
+unsigned long gc_scratch_mark(void);
+void   gc_scratch_unwind(unsigned long mark);
+
+/* Each coroutine has its own C stack and scratch list. A switch installs
+   the next context's (the old one comes back); a suspended context's are
+   marked by its owner. */
+void  *gc_scratch_switch(void *list);
+void   gc_scratch_mark_list(void *list);
+void   gc_scratch_release(void *list);
+void  *gc_stack_switch(void *base);   /* outer end of the running C stack */
+void   gc_mark_stack_range(const void *lo, const void *hi);
+
+/* type-specific hooks owned by other modules */
+void co_gc_traverse(Coroutine *co);
+void co_gc_free(Coroutine *co);
+void promise_gc_traverse(Promise *p);
+void promise_gc_free(Promise *p);
+void strtab_prune(void);
+
+#endif /* GC_H */
@@ -0,0 +1,45 @@
+// icache.h — per-site inline caches for t.name lookups (see src/icache.c)
+#ifndef ICACHE_H
+#define ICACHE_H
+
+#include "interpreter.h"
+
+/* A site (an AST_FIELD/AST_INDEX node, or a GETFIELD/SETFIELD/SELF
+   instruction) remembers up to IC_WAYS ways its string key resolved:
+
+   - an own field: just the hash slot. A hit compares the interned key
+     stored in that slot, so it validates itself, and every table built
+     the same way (instances of one class) shares the entry.
+   - a field found along the __index chain: the receiver's metatable and
+     the slot of "_mt" in the receiver, plus the table and slot that held
+     the key. Those entries are stamped with ic_epoch, which is bumped by
+     any write changing the key set of a table the chain went through.
+     A receiver of the entry's shape is known not to shadow the key; any
+     other receiver is probed once and its shape becomes the entry's. */
+#define IC_WAYS 4
+
+/* __index tables followed before giving up (loops, absurd chains) */
+#define IC_MAX_CHAIN 100
+
+typedef struct ICEntry {
+  Table *mt;         /* NULL: own field of the receiver */
+  Table *holder;     /* chain entries: the table holding the key */
+  int slot;          /* hash slot of the key in the receiver or holder */
+  int mt_slot;       /* chain entries: hash slot of "_mt" in the receiver */
+  unsigned shape;    /* chain entries: a receiver shape without the key */
+  unsigned epoch;
+} ICEntry;
+
+typedef struct FieldIC {
+  ICEntry e[IC_WAYS];
+  int n, next;
+} FieldIC;
+
+extern unsigned ic_epoch;
+
+/* t[key] / t[key] = v with the semantics of vm_index / vm_setindex;
+   *ic is allocated on first use. */
+Value ic_index(struct VM *vm, FieldIC **ic, Value t, Str *key);
+void  ic_setindex(struct VM *vm, FieldIC **ic, Value t, Str *key, Value v);
+
+#endif /* ICACHE_H */
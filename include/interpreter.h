@@ -5,12 +5,14 @@
 #include <stdbool.h>
 #include "parser.h"  /* for AST, ASTKind, ASTVec, etc. */
 typedef struct Coroutine Coroutine; /* fwd so VM can refer to it */
+typedef struct Promise Promise;     /* lib/async.c */
 typedef enum {
   VAL_NIL, VAL_BOOL, VAL_INT, VAL_NUM, VAL_STR, VAL_TABLE,
   VAL_COROUTINE,
   VAL_CFUNC,          /* builtin C function */
   VAL_FUNC,           /* user-defined Lua function (closure) */
-  VAL_MULTI           /* multiple-return bundle */
+  VAL_MULTI,          /* a window of the VM value stack (results, varargs) */
+  VAL_PROMISE         /* async's promise, a userdata with promise_mt's methods */
 } ValTag;
 
 struct VM; /* fwd */
@@ -20,7 +22,6 @@ typedef struct Str Str;
 typedef struct Table Table;
 typedef struct TableEntry TableEntry;
 typedef struct Func Func;
-typedef struct Multi Multi;
 
 typedef struct Value Value;
 typedef Value (*CFunc)(struct VM *vm, int argc, Value *argv);
@@ -30,13 +31,13 @@ void exec_stmt_repl(struct VM *vm, AST *n);
 struct Str {
   int   len;
   char *data;
+  unsigned long long hash;  /* valid when hashed */
+  unsigned char hashed;
+  unsigned char interned;   /* unique by content: equal iff same pointer */
 };
 
-/* Multi-return bundle */
-struct Multi {
-  int count;
-  Value *items;
-};
+/* strings up to this length built from existing bytes are interned */
+#define STR_SHORT_MAX 40
 
 /* Value */
 struct Value {
@@ -49,21 +50,29 @@ struct Value {
     Table    *t;
     CFunc     cfunc;
     Func     *fn;   /* VAL_FUNC */
-    Multi    *m;    /* VAL_MULTI */
+    Coroutine *co;  /* VAL_COROUTINE */
+    Promise  *pr;   /* VAL_PROMISE */
   } as;
 };
 
 /* Tables */
 struct TableEntry {
   Value key;
-  Value val;
-  TableEntry *next;
+  Value val;  /* nil: empty (key nil) or dead (key kept) */
 };
 
 struct Table {
-  int cap;
-  TableEntry **buckets;
+  Value *arr;  /* array part: keys 1..asize (nil = absent) */
+  int asize;
+  int alen;    /* arr[0..alen) all non-nil; arr[alen] nil or alen==asize */
+  int cap;     /* hash slots, power of two (0 until first insert) */
+  int count;   /* live hash entries */
+  int used;    /* live + dead hash slots */
+  TableEntry *entries;
+  unsigned char proto;  /* an inline cache resolved through it (metatable or __index table) */
+  unsigned shape;       /* its string keys (see src/table.c); TBL_SHAPE_NONE: untracked */
 };
+#define TBL_SHAPE_NONE 0xffffffffu
 
 /* Closure */
 struct Func {
@@ -71,6 +80,11 @@ struct Func {
   bool   vararg;
   AST   *body;       /* a block AST */
   struct Env *env;   /* captured lexical env */
+  const char **pnames; /* params env layout from the resolver (may be NULL) */
+  bool   heap_env;   /* params env may be captured (resolver); else it lives on the value stack */
+  struct BcProto *proto;   /* compiled body when run by the bytecode engine */
+  struct BcCell **upvals;  /* bytecode closures: captured variable cells */
+  AstArena *arena;         /* the chunk's tree, pinned while the function lives */
 };
 
 /* ===== to-be-closed locals support =====
@@ -81,45 +95,67 @@ typedef struct CloseReg {
   bool open;  /* still needs closing? */
 } CloseReg;
 
+/* Envs are slot-indexed: the resolver fixes every local's (depth, slot)
+   ahead of execution, so scope envs are flat Value arrays and names are
+   kept for debugging only. The root env holds the globals and is the only
+   one that grows; its index maps an interned name to its first slot. */
 typedef struct Env {
   struct Env *parent;
   int count, cap;
-  char **names;
+  const char **names;   /* root: owned copies; scopes: borrowed from the AST */
   Value *vals;
-  bool  *is_local;
+  bool  *is_local;      /* root only */
+  struct Table *index;  /* root only: name -> slot */
 
   /* <close> tracking */
   CloseReg *closers;
   int ccount, ccap;
 } Env;
 
-/* ====== Yield plumbing for statement-boundary coroutines ====== */
-typedef struct {
-  AST   *blk;      /* block we were executing */
-  size_t pc;       /* next statement index to run */
-} CoResumePoint;
+/* A running walker closure. Frames sit in call_function's C frame and
+   link through vm->frame; a frame's parameters and stack-resident block
+   locals occupy the value stack from base up. The rest is the caller's
+   control state, restored on return. */
+typedef struct CallFrame {
+  struct CallFrame *prev;
+  Func *fn;
+  int base;
+  Env *env;
+  bool has_ret, break_flag, pending_goto;
+  Value ret_val;
+  const char *goto_label;
+} CallFrame;
 
 typedef struct VM {
   Env *env;        /* current lexical env */
+  CallFrame *frame;   /* innermost walker call (NULL at top level) */
   bool break_flag; /* used by loops */
   bool has_ret;
   Value ret_val;
   void *err_frame;
   Value err_obj;
-  int top;
-  Value stack[256];
+  Value *stack;    /* value stack: arguments, results and varargs */
+  int top;         /* first free slot */
+  int stack_max;   /* slots in stack */
+  int nret;        /* values a return statement left on the stack */
+  bool tailcall;   /* those values are a callee and its args (`return f(x)`) */
   /* goto plumbing across nested blocks */
   bool        pending_goto;
   const char *goto_label;
   int has_exception;
   Value last_exception;
-  /* ---- coroutine yield plumbing ---- */
-  bool  co_yielding;       /* set by coroutine.yield(...) */
-  Value co_yield_vals;     /* a table [1..n] of yielded values */
-  CoResumePoint co_point;  /* where to resume inside a block */
-  Env  *co_call_env;       /* the coroutine's active call env (saved across yields) */
+  /* Coroutines run on their own C stack and value stack; switching
+     swaps the per-thread fields above (see src/coroutine.c) */
   Coroutine *active_co;    /* which coroutine (if any) is running on this VM */
+  char *cstack_limit;      /* calls raise "stack overflow" below it; NULL: unchecked */
   int current_line;
+  /* ---- step budget (see vm_sethook) ---- */
+  int hook_left;           /* steps until vm_hook_fire; counts down */
+  int hook_count;          /* 0: no hook */
+  bool in_hook;
+  void (*hook)(struct VM *vm, void *ud);
+  void *hook_ud;
+  Value hook_fn;           /* debug.sethook's function */
 } VM;
 
 /* API */
@@ -142,62 +178,67 @@ Value call_any_public(struct VM *vm, Value cal, int argc, Value *argv);
 /* VM error raise (longjmp). Usable from other modules (coroutines, libs). */
 void vm_raise(struct VM *vm, Value err);
 
-#ifndef LUA_PLUS_MAX_LOOP_ITERS
-#define LUA_PLUS_MAX_LOOP_ITERS 10000000  
-#endif
-#if defined(__GNUC__) || defined(__clang__)
-__attribute__((weak))
-#endif
-void vm_gc_collect(struct VM *vm) { (void)vm; }
-
-#if defined(__GNUC__) || defined(__clang__)
-__attribute__((weak))
-#endif
-void vm_gc_stop(struct VM *vm) { (void)vm; }
-
-#if defined(__GNUC__) || defined(__clang__)
-__attribute__((weak))
-#endif
-void vm_gc_restart(struct VM *vm) { (void)vm; }
-
-#if defined(__GNUC__) || defined(__clang__)
-__attribute__((weak))
-#endif
-int vm_gc_isrunning(struct VM *vm) { (void)vm; return 0; }
-
-#if defined(__GNUC__) || defined(__clang__)
-__attribute__((weak))
-#endif
-int vm_gc_step(struct VM *vm, int kb) { (void)vm; (void)kb; return 0; } /* return 1 if cycle finished */
-
-#if defined(__GNUC__) || defined(__clang__)
-__attribute__((weak))
-#endif
-int vm_gc_setpause(struct VM *vm, int pause) { (void)vm; (void)pause; return 0; } /* return old */
-
-#if defined(__GNUC__) || defined(__clang__)
-__attribute__((weak))
-#endif
-int vm_gc_setstepmul(struct VM *vm, int mul) { (void)vm; (void)mul; return 0; }   /* return old */
-
-#if defined(__GNUC__) || defined(__clang__)
-__attribute__((weak))
-#endif
-void vm_gc_set_incremental(struct VM *vm, int pause, int stepmul, int stepsize_kb) {
-  (void)vm; (void)pause; (void)stepmul; (void)stepsize_kb;
+/* Multiple values travel on the VM value stack. A call leaves its n
+   results in stack[top-n, top); a VAL_MULTI names such a window, count
+   values from base. C functions return several values with
+   vm_return_values, a vararg function's `...` is a VAL_MULTI over the
+   arguments it was called with. */
+#define STACK_MAX (1 << 20)
+#define MULTI_BASE(v)  ((int)((unsigned long long)(v).as.i >> 32))
+#define MULTI_COUNT(v) ((int)((v).as.i & 0xffffffff))
+void  vm_stack_init(struct VM *vm);
+void  vm_cstack_init(struct VM *vm);
+void  vm_stack_overflow(struct VM *vm);
+static inline Value V_multi(int base, int count){
+  Value v; v.tag = VAL_MULTI;
+  v.as.i = (long long)(((unsigned long long)(unsigned)base << 32) | (unsigned)count);
+  return v;
 }
-
-#if defined(__GNUC__) || defined(__clang__)
-__attribute__((weak))
+static inline void vm_stack_check(struct VM *vm, int n){
+  if (vm->top + n > vm->stack_max) vm_stack_overflow(vm);
+}
+/* C stack kept free below the deepest Lua call, for the C functions and
+   error handling that run on top of it */
+#ifndef CSTACK_MARGIN
+#define CSTACK_MARGIN (256u << 10)
 #endif
-void vm_gc_set_generational(struct VM *vm, int minormul, int majormul) {
-  (void)vm; (void)minormul; (void)majormul;
+/* Calls stop short of the end of the C stack (the main thread's rlimit,
+   a coroutine's mapping) with a catchable error. */
+static inline void vm_cstack_check(struct VM *vm){
+  if (vm->cstack_limit && (char *)__builtin_frame_address(0) < vm->cstack_limit) vm_stack_overflow(vm);
 }
+static inline void vm_push(struct VM *vm, Value v){
+  vm_stack_check(vm, 1);
+  vm->stack[vm->top++] = v;
+}
+Value vm_return_values(struct VM *vm, int n, const Value *v);
+int   call_multi(struct VM *vm, Value cal, int argc, Value *argv);
+int   vm_push_varargs(struct VM *vm, Value va);
+Value vm_vararg(struct VM *vm, Value va, int i);
+int   call_iter(struct VM *vm, Value f, int argc, Value *argv, Value *a, Value *b);
 
-#if defined(__GNUC__) || defined(__clang__)
-__attribute__((weak))
-#endif
-size_t vm_gc_total_bytes(struct VM *vm) { (void)vm; return 0; }
+/* Count hook. A step is one loop iteration (a backward jump in
+   bytecode) or one call into a Lua function; every count steps the hook
+   runs, and may raise to stop the script (a sandbox budget) or switch
+   work (a scheduler). It does not run recursively. count 0 or a NULL
+   hook turns it off. With no hook a step is a decrement and a branch. */
+typedef void (*VmHook)(struct VM *vm, void *ud);
+void vm_sethook(struct VM *vm, VmHook hook, void *ud, int count);
+void vm_hook_fire(struct VM *vm);
+static inline void vm_step(struct VM *vm){
+  if (--vm->hook_left < 0) vm_hook_fire(vm);
+}
+/* Collector control (src/gc.c) */
+void   vm_gc_collect(struct VM *vm);
+void   vm_gc_stop(struct VM *vm);
+void   vm_gc_restart(struct VM *vm);
+int    vm_gc_isrunning(struct VM *vm);
+int    vm_gc_step(struct VM *vm, int kb);           /* 1 if a cycle finished */
+int    vm_gc_setpause(struct VM *vm, int pause);    /* returns old; <0 keeps it */
+int    vm_gc_setstepmul(struct VM *vm, int mul);    /* returns old; <0 keeps it */
+int    vm_gc_set_incremental(struct VM *vm, int pause, int stepmul, int stepsize_kb);  /* old mode */
+int    vm_gc_set_generational(struct VM *vm, int minormul, int majormul);              /* old mode */
+size_t vm_gc_total_bytes(struct VM *vm);
 /* fwd decls we actually use before definition */
 struct Func; 
 struct Table; 
@@ -206,35 +247,63 @@ struct VM;
 typedef struct TableEntry TableEntry;
 
 typedef enum { GC_MODE_INCREMENTAL = 0, GC_MODE_GENERATIONAL = 1 } GCMode;
-typedef struct {
-  int running;
-  GCMode mode;
-  int pause;          /* % */
-  int stepmul;       /* % */
-  int stepsize_kb;   /* for incremental */
-  int minormul;      /* for generational */
-  int majormul;      /* for generational */
-  unsigned tick;     /* fake progress so step() sometimes returns true */
-} GCShim;
-
-static GCShim g_gc = {
-  1, GC_MODE_INCREMENTAL, 200, 200, 64, 200, 200, 0
-};
 /* fwd helpers that are defined later in this file */
 Value mm_of(Value v, const char *name);
+/* Metatable shared by all promises, set up by the async library */
+extern Value promise_mt;
 static int   try_bin_mm(struct VM *vm, const char *mm, Value a, Value b, Value *out);
 static int   try_un_mm (struct VM *vm, const char *mm, Value a, Value *out);
 static Value eval_index(VM *vm, Value table, Value key);
 static void  assign_index(VM *vm, Value table, Value key, Value val);
 
 /* from other compilation units */
-static Value call_function(VM *vm, Func *fn, int argc, Value *argv);
+static int   call_function(VM *vm, Func *fn, int argc, Value *argv);
 void register_coroutine_lib(VM *vm);
 
 void  tbl_set(struct Table *t, Value key, Value val);
 int   tbl_get(struct Table *t, Value key, Value *out);
+int   tbl_next(struct Table *t, int *iter, Value *key, Value *val);
+int   tbl_next_key(struct Table *t, Value key, Value *nkey, Value *nval);
+int   tbl_geti(struct Table *t, long long i, Value *out);
+void  tbl_seti(struct Table *t, long long i, Value val);
+long long tbl_len(struct Table *t);
+Value *tbl_array_part(struct Table *t, long long n);
 void  env_add(struct Env *e, const char *name, Value v, bool is_local);
 Value call_any(struct VM *vm, Value cal, int argc, Value *argv);
+/* operator and indexing semantics shared by the AST walker and the bytecode VM */
+Value vm_binop(struct VM *vm, OpKind op, Value L, Value R);
+Value vm_unop(struct VM *vm, OpKind op, Value r);
+Value vm_index(struct VM *vm, Value t, Value k);
+void  vm_setindex(struct VM *vm, Value t, Value k, Value v);
+
+/* Numeric for state, as in Lua 5.4: with an integral start and step the
+   loop is an integer one that runs a precomputed count (it cannot
+   overflow, and a float limit is floored/ceiled); otherwise every value
+   is a float and the limit is compared each step. */
+typedef struct {
+  bool isint;
+  long long i, step;             /* integer loop: current value, step */
+  unsigned long long count;      /* iterations left after the current one */
+  double x, limit, fstep;        /* float loop */
+} ForNum;
+/* Raises for a non-number or zero step; false when the loop runs no times. */
+bool vm_forprep(struct VM *vm, Value start, Value limit, Value step, ForNum *f);
+static inline Value vm_forvalue(const ForNum *f){
+  Value v;
+  if (f->isint) { v.tag = VAL_INT; v.as.i = f->i; }
+  else { v.tag = VAL_NUM; v.as.n = f->x; }
+  return v;
+}
+static inline bool vm_fornext(ForNum *f){
+  if (f->isint) {
+    if (!f->count) return false;
+    f->count--;
+    f->i = (long long)((unsigned long long)f->i + (unsigned long long)f->step);
+    return true;
+  }
+  f->x += f->fstep;
+  return f->fstep > 0 ? f->x <= f->limit : f->x >= f->limit;
+}
 
 void register_math_lib(struct VM *vm);
 void register_string_lib(struct VM *vm);
@@ -242,6 +311,11 @@ void register_table_lib(struct VM *vm);
 void register_utf8_lib(struct VM *vm);
 void register_os_lib(struct VM *vm);
 void register_io_lib(struct VM *vm);
+/* fd-level io for lib/async.c: handles are switched to O_NONBLOCK, and
+   the try functions return 0 where they would block */
+int   io_async_fd(Value fh);
+int   io_try_read(Value fh, Value fmt, Value *out);
+int   io_try_write(Value fh, const char *s, size_t len, size_t *done);
 void register_debug_lib(struct VM *vm);
 void register_random_lib(struct VM *vm);
 void register_date_lib(struct VM *vm);
@@ -255,17 +329,7 @@ void  tbl_set_public(struct Table *t, Value key, Value val);
 int   tbl_get_public(struct Table *t, Value key, Value *out);
 void  env_add_public(struct Env *e, const char *name, Value v, bool is_local);
 Value call_any_public(struct VM *vm, Value cal, int argc, Value *argv);
-void shim_collect(struct VM *vm);
-void shim_stop(struct VM *vm);
-void shim_restart(struct VM *vm);
-int  shim_isrunning(struct VM *vm);
-int  shim_step(struct VM *vm, int kb);
-int  shim_setpause(struct VM *vm, int pause);
-int  shim_setstepmul(struct VM *vm, int mul);
-void shim_set_generational(struct VM *vm, int minormul, int majormul);
-char* read_entire_file(const char *path, size_t *out_len);
 int to_int_val(Value v, int dflt);
-void shim_set_incremental(struct VM *vm, int pause, int stepmul, int stepsize_kb);
 void register_coroutine_lib(struct VM *vm);
 void register_async_lib(struct VM *vm);
 void register_class_lib(struct VM *vm);
@@ -273,7 +337,9 @@ void register_class_lib(struct VM *vm);
 typedef void (*TableIterCallback)(Value key, Value val, void *userdata);
 void tbl_foreach_public(struct Table *t, TableIterCallback callback, void *userdata);
 void load_packages();
-AST* compile_chunk_from_FILE(FILE *fp);
+AST* compile_chunk(const char *src, size_t len);   /* lex, parse and resolve */
+AST* compile_file(const char *path);                /* NULL if unreadable */
+Func *make_chunk_func(struct VM *vm, AST *program);
 Str *to_string_buf(Value v);
 void print_value(Value v);
 int is_callable(Value v);
@@ -281,22 +347,22 @@ void env_add_builtins(struct VM *vm);
 extern void *xmalloc(size_t n);
 extern char *xstrdup(const char *s);
 extern Value op_len(Value v);
-extern FILE *open_string_as_FILE(const char *code);
 extern Value V_nil(void);
 extern Value V_bool(bool b);
 extern Value V_int(long long x);
 extern Value V_num(double x);
 extern Str *Str_new_len(const char *s, int len);
+extern unsigned long long Str_hash(Str *s);
 extern Value V_str_from_c(const char *s);
 extern unsigned long long hash_mix(unsigned long long x);
-extern void vm_push(struct VM *vm, Value v);
-extern Value vm_pop(struct VM *vm);
 extern Table *tbl_new(void);
 extern char path_buf[2048];
 extern void env_add(Env *e, const char *name, Value v, bool is_local);
 extern int env_get(Env *e, const char *name, Value *out);
 extern Env* env_root(Env *e);
 extern Env* env_push(Env *parent);
+extern Env* env_push_slots(Env *parent, int n, const char **names);
+extern int env_global_slot(Env *root, Str *name);
 extern int env_set(Env *e, const char *name, Value v);
 extern int env_find(Env *e, const char *name, Env **owner, int *slot);
 #endif /* INTERPRETER_H */
@@ -64,46 +64,32 @@ typedef enum {
     TOK_EOF
 } TokenType;
 
+/* lexeme: NUL-terminated, owned by the Lexer that produced the token
+   (see below); NULL for TOK_EOF. */
 typedef struct {
     TokenType type;
-    char *lexeme;  
+    const char *lexeme;
     size_t len;
     size_t line;
 } Token;
 
-static int line_no = 1;
-
+/* Scans an in-memory buffer (no terminator needed; files are mmap'd, see
+   map_file). Operators and keywords point at static strings; identifiers,
+   numbers and decoded string literals are interned in the lexer's arena,
+   so each distinct spelling is stored once and lives until lexer_free. */
+typedef struct LexChunk LexChunk;
 typedef struct {
-    const char *word;
-    TokenType token;
-} Keyword;
+    const char *p, *end;
+    int line;
+    char *buf;             /* scratch for literals being decoded */
+    size_t bufcap;
+    LexChunk *chunks;      /* arena holding the interned lexemes */
+    const char **slots;    /* intern table, open addressing */
+    size_t nslots, nused;
+} Lexer;
 
-static const Keyword keywords[] = {
-    {"and",      TOK_KW_AND},
-    {"break",    TOK_KW_BREAK},
-    {"do",       TOK_KW_DO},
-    {"else",     TOK_KW_ELSE},
-    {"elseif",   TOK_KW_ELSEIF},
-    {"end",      TOK_KW_END},
-    {"false",    TOK_KW_FALSE},
-    {"for",      TOK_KW_FOR},
-    {"function", TOK_KW_FUNCTION},
-    {"goto",     TOK_KW_GOTO},
-    {"if",       TOK_KW_IF},
-    {"in",       TOK_KW_IN},
-    {"local",    TOK_KW_LOCAL},
-    {"nil",      TOK_KW_NIL},
-    {"not",      TOK_KW_NOT},
-    {"or",       TOK_KW_OR},
-    {"repeat",   TOK_KW_REPEAT},
-    {"return",   TOK_KW_RETURN},
-    {"then",     TOK_KW_THEN},
-    {"true",     TOK_KW_TRUE},
-    {"until",    TOK_KW_UNTIL},
-    {"while",    TOK_KW_WHILE},
-    {NULL, TOK_UNKNOWN}
-};
-extern Token *tokens;
-Token next(FILE *f);
+void  lexer_init(Lexer *lx, const char *src, size_t len);
+Token lexer_next(Lexer *lx);
+void  lexer_free(Lexer *lx);
 
 #endif
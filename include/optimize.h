@@ -0,0 +1,28 @@
+// optimize.h — constant folding and dead-branch removal (see src/optimize.c)
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <stdio.h>
+#include "parser.h"
+
+/* Tree simplification, run by parse_chunk on every chunk that parsed
+   cleanly (so the binary chunks of chunk.h store the folded tree too).
+   Works in the arena the constructors currently allocate from.
+
+     - arithmetic (+ - * / % ^), unary minus, `not`, comparisons and `..`
+       on number/string literals become a single literal, with exactly
+       the values vm_binop would produce at runtime;
+     - `and`/`or` with a literal left side keep the operand that would be
+       returned (unless that would turn a single value into a call's or
+       `...`'s full list);
+     - `if` with a literal condition becomes the taken branch (or
+       nothing), `while false` loops disappear.
+   Folded keys (t["a".."b"], { [2*8] = v }) then hit the constant-key
+   paths of both engines. Literals whose value depends on int/float
+   tagging (`//`, `#"s"`) are left to the VM. */
+void optimize_chunk(AST *program);
+
+/* luaX --dump-ast: the tree, one node per line, indented by depth */
+void ast_dump(FILE *out, AST *n);
+
+#endif /* OPTIMIZE_H */
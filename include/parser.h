@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "lexer.h"   /* Token, TokenType */
+#include "arena.h"   /* AstArena */
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,6 +15,10 @@ extern "C" {
  * ========================== */
 
 typedef struct AST AST;
+struct Str;
+struct Env;
+struct FieldIC;
+struct Str *Str_new_len(const char *s, int len);  /* util.c */
 
 typedef enum {
     AST_INVALID = 0,
@@ -74,10 +79,16 @@ typedef struct {
   AST *value;    /* rhs expression */
 } ASTCompoundAssign;
 typedef struct {
-    AST   **items;
-    size_t  count, cap;
+    AST     **items;
+    unsigned  count, cap;
 } ASTVec;
 
+/* ::name:: of a block and the index of its statement (resolver) */
+typedef struct {
+    const char *name;
+    unsigned    index;
+} BlockLabel;
+
 /* ==========================
  * AST Node Definition
  * ========================== */
@@ -85,13 +96,17 @@ typedef struct {
 struct AST {
     ASTKind kind;
     int     line;
+    bool    paren;   /* written as (expr): a call or `...` yields one value */
 
     union {
         /* Literals & identifiers */
         struct { bool        v; }              bval;
         struct { double      v; }              nval;
-        struct { const char *s; }              sval;
-        struct { const char *name; }           ident;
+        struct { const char *s; struct Str *str; } sval;  /* str: literal, built at parse time */
+        /* depth/slot: filled by the resolver; depth < 0 means global.
+           key/genv/gslot: interned name and a cached root-env slot for globals */
+        struct { const char *name; int depth; int slot;
+                 struct Str *key; struct Env *genv; int gslot; } ident;
 
         /* Unary / Binary */
         struct { OpKind op; AST *expr; }       unary;
@@ -101,12 +116,15 @@ struct AST {
         struct { AST *lhs_ident; AST *rhs; }   assign;
 
         /* Multi assignment */
-        struct { ASTVec lvals; ASTVec rvals; } massign;
+        struct { ASTVec lvals; ASTVec rvals; bool is_local; } massign;
 
         /* Calls & selectors */
-        struct { AST *callee; ASTVec args; }   call;
-        struct { AST *target; AST *index; }    index;   /* t[expr] */
-        struct { AST *target; const char *field; } field; /* t.name */
+        /* method: obj:m(...), callee is the field obj.m and args[0] is
+           the same obj node */
+        struct { AST *callee; ASTVec args; bool method; } call;
+        /* ic: inline cache of the site (include/icache.h), allocated on first use */
+        struct { AST *target; AST *index; struct FieldIC *ic; } index;   /* t[expr] */
+        struct { AST *target; const char *field; struct Str *key; struct FieldIC *ic; } field; /* t.name */
 
         /* Table constructor */
         struct { ASTVec keys; ASTVec values; } table;  /* key NULL => array-style */
@@ -114,32 +132,45 @@ struct AST {
         /* Function literal */
         struct {
             ASTVec params;   /* identifiers as AST* (AST_IDENT) */
-            bool   vararg;   /* has ... */
             AST   *body;     /* AST_BLOCK */
+            const char **slot_names; /* params scope layout (resolver) */
+            unsigned char *slot_captured; /* per param: used by a nested function */
+            bool   vararg;   /* has ... */
+            bool   heap_env; /* params env may outlive the call (resolver) */
         } fn;
 
         /* Function statements (named/local) */
         struct {
-            bool   is_local;
-            AST   *name;     /* name chain as FIELDs (e.g., a.b.c or a:b) or IDENT */
             ASTVec params;   /* AST_IDENT nodes */
-            bool   vararg;
             AST   *body;     /* AST_BLOCK */
+            const char **slot_names; /* params scope layout (resolver) */
+            unsigned char *slot_captured; /* per param: used by a nested function */
+            bool   vararg;
+            bool   heap_env; /* params env may outlive the call (resolver) */
+            bool   is_local;
+            AST   *name;     /* name chain as FIELDs (e.g., a.b.c or a:b) or IDENT */
         } fnstmt;
 
         /* Statements */
         struct { AST *expr; }                  stmt_expr;
 
         /* NOTE: added is_close for Lua 5.4 'to-be-closed' locals (local <close> x = ...) */
-        struct { bool is_local; bool is_close; const char *name; AST *init; } var;
-
-        struct { ASTVec stmts; }               block;
+        struct { bool is_local; bool is_close; const char *name; AST *init; int slot; } var;
+
+        /* nslots/slot_names: locals declared directly in this block (resolver);
+           a block without any gets no env at runtime and no scope hop;
+           heap_env: its env may outlive the block (closures, <close>);
+           labels: its ::labels::, name NULL-terminated (NULL if none);
+           arena: the chunk's arena, which function bodies pin */
+        struct { ASTVec stmts; const char **slot_names; unsigned char *slot_captured;
+                 BlockLabel *labels; AstArena *arena; int nslots; bool heap_env; } block;
         struct { AST *cond; AST *then_blk; AST *else_blk; } ifs;
         struct { AST *cond; AST *body; }       whiles;
         struct { AST *body; AST *cond; }       repeatstmt;
         struct { const char *var; AST *start; AST *end; AST *step; AST *body; } fornum;
         struct { ASTVec names; ASTVec iters; AST *body; } forin;
-        struct { ASTVec values; }              ret;
+        /* tail: a lone call the frame can hand over to (resolver) */
+        struct { ASTVec values; bool tail; }   ret;
         struct { const char *label; }          go;      /* goto */
         struct { const char *label; }          label;   /* ::label:: */
    struct {
@@ -157,22 +188,32 @@ struct AST {
  * ========================== */
 
 typedef struct {
-    Token *toks;
-    int    count;
-    int    pos;
+    Lexer *lx;          /* token source, pulled on demand */
+    Token *ring;        /* lookahead window; token i lives in ring[i & (cap-1)] */
+    int    cap;
+    int    lo, hi;      /* tokens [lo, hi) are buffered */
+    int    pos;         /* current token */
+    int    marks, keep; /* open backtrack points, position of the outermost */
+    bool   at_eof;      /* TOK_EOF is buffered */
     bool   had_error;
 
     /* robust error handling */
     int    err_count;   /* number of syntax errors seen */
     bool   panic;       /* in panic mode until we synchronize */
+    bool   aborted;     /* too many errors: every token reads as eof */
+    Token  eof;
+
+    AstArena *arena;    /* the chunk's nodes are allocated here */
+    AstArena *outer;    /* arena of an enclosing parse, restored on destroy */
 } Parser;
 
 /* ==========================
  * Public API (tiny)
  * ========================== */
 
-/* Construct/destroy a parser around an existing token array */
-Parser *parser_create(Token *tokens, int count);
+/* Construct/destroy a parser reading tokens from a lexer; the lexer must
+   outlive it */
+Parser *parser_create(Lexer *lx);
 void    parser_destroy(Parser *p);
 
 /* Parse one expression or one statement */
@@ -182,22 +223,11 @@ AST *statement(Parser *p);
 /* Your executor/VM entry (stubbed in parser.c) */
 int interpret(AST *root);
 
-/* ==========================
- * Optional inline helpers (handy in main.c tests)
- * ========================== */
-static inline Token parser_curr(Parser *p) {
-    return (p->pos < p->count) ? p->toks[p->pos]
-        : (Token){TOK_EOF, NULL, 0, p->count ? p->toks[p->count-1].line : 1};
-}
-static inline Token parser_peek(Parser *p, int la) {
-    int i = p->pos + la;
-    Token cur = parser_curr(p);
-    return (i < p->count) ? p->toks[i] : (Token){TOK_EOF, NULL, 0, cur.line};
-}
-static inline bool parser_match(Parser *p, TokenType t) {
-    if (parser_curr(p).type == t) { p->pos++; return true; }
-    return false;
-}
+/* Current token (TOK_EOF once the input is exhausted) */
+Token parser_curr(Parser *p);
+
+/* Parses statements up to the end of input into a chunk's root block */
+AST *parse_chunk(Parser *p);
 
 /* ==========================
  * Constructors & utils used by the parser
@@ -246,9 +276,16 @@ AST *ast_make_return_list(ASTVec values, int line);
 AST *ast_make_break(int line);
 AST *ast_make_goto(const char *label, int line);
 AST *ast_make_label(const char *label, int line);
+AST *ast_make_stmt_expr(AST *expr, int line);
+AST *ast_make_try_catch_finally(AST *try_blk, AST *catch_blk, AST *finally_blk, const char *catch_var, int line);
 
 /* Vector & memory helpers */
 void  astvec_push(ASTVec *v, AST *node);
+/* Points the constructors above at arena a (parsers do this
+   themselves); returns the one that was current. */
+AstArena *ast_arena_enter(AstArena *a);
+/* Drops a chunk's own reference to its arena (see arena.h); n is a root
+   returned by parse_chunk. Closures made from it keep the tree alive. */
 void  ast_free(AST *n);
 
 #ifdef __cplusplus
@@ -0,0 +1,23 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include "parser.h"
+
+/* Static scope resolution.
+   Walks a parsed chunk once and annotates every AST_IDENT with the
+   (depth, slot) of its binding: depth counts Env hops from the env that is
+   current when the identifier is evaluated, slot indexes Env->vals.
+   Unbound names keep depth < 0 and are looked up in the root (global) env.
+
+   The scope layout mirrors what the interpreter pushes at runtime:
+     - one Env per function call holding the parameters (and "..."),
+     - one Env per executed block holding that block's locals,
+       with for-loop control variables in the first slots of the body;
+       blocks declaring none get no Env and are not counted in depth.
+   Scopes no closure can capture and without <close> locals are left with
+   heap_env false: the interpreter keeps their slots on the value stack.
+   Each block also gets its label table (block.labels).
+   A chunk is resolved as a parameterless function. */
+void resolve_chunk(AST *program);
+
+#endif /* RESOLVER_H */
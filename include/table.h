@@ -9,6 +9,13 @@ int   tbl_get_public(Table *t, Value key, Value *out);
 Table *tbl_new(void);
 void tbl_set(Table *t, Value key, Value val);
 int tbl_get(Table *t, Value key, Value *out);
+int tbl_next(Table *t, int *iter, Value *key, Value *val);
+int tbl_next_key(Table *t, Value key, Value *nkey, Value *nval);
+int tbl_geti(Table *t, long long i, Value *out);
+void tbl_seti(Table *t, long long i, Value val);
+long long tbl_len(Table *t);
+Value *tbl_array_part(Table *t, long long n);
+int tbl_slot(Table *t, Value key);
 extern int value_equal(Value a, Value b);
 extern unsigned long long hash_value(Value v);
 #endif
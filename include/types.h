@@ -53,13 +53,17 @@ struct Value {
 typedef struct TableEntry {
   Value key;
   Value val;
-  struct TableEntry *next;
 } TableEntry;
 
 /* Table */
 typedef struct Table {
+  Value *arr;
+  int asize;
+  int alen;
   int cap;
-  TableEntry **buckets;
+  int count;
+  int used;
+  TableEntry *entries;
 } Table;
 
 /* Environment */
@@ -71,9 +75,10 @@ typedef struct CloseReg {
 typedef struct Env {
   struct Env *parent;
   int count, cap;
-  char **names;
+  const char **names;
   Value *vals;
   bool *is_local;
+  struct Table *index;
   CloseReg *closers;
   int ccount, ccap;
 } Env;
@@ -84,12 +89,17 @@ typedef struct Func {
   bool vararg;
   AST *body;      // AST comes from parser.h
   Env *env;
+  const char **pnames;
+  struct BcProto *proto;
+  struct BcCell **upvals;
 } Func;
 
 /* Coroutine resume point */
 typedef struct CoResumePoint {
   AST *blk;
   size_t pc;
+  Env *env;
+  void *bc;
 } CoResumePoint;
 
 /* Coroutine (forward declared) */
@@ -122,18 +132,4 @@ typedef enum {
   GC_MODE_GENERATIONAL = 1
 } GCMode;
 
-typedef struct GCShim {
-  int running;
-  GCMode mode;
-  int pause;
-  int stepmul;
-  int stepsize_kb;
-  int minormul;
-  int majormul;
-  unsigned tick;
-} GCShim;
-
-/* Global GC shim instance - declare extern here, define in one .c file */
-extern GCShim g_gc;
-
 #endif /* TYPES_H */
@@ -5,11 +5,13 @@
 void *xmalloc(size_t n);
 char *xstrdup(const char *s);
 Value op_len(Value v);
-FILE *open_string_as_FILE(const char *code);
+const char *map_file(const char *path, size_t *len);   /* NULL if unreadable */
+void unmap_file(const char *p, size_t len);
 Value V_nil(void);
 Value V_bool(bool b);
 Value V_int(long long x);
 Value V_num(double x);
 Str *Str_new_len(const char *s, int len);
+unsigned long long Str_hash(Str *s);
 Value V_str_from_c(const char *s);
 unsigned long long hash_mix(unsigned long long x);
@@ -3,13 +3,23 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #include "../include/interpreter.h"
+#include "../include/gc.h"
+#include "../include/err.h"
 
-/* ---- Async Task Queue ---- */
+/* ---- Async Task Queue ----
+   Only runnable tasks are queued. A task awaiting a pending promise is
+   parked on the promise's waiter list and queued again when it settles;
+   one waiting on a timer is reachable only from that timer's promise. */
 typedef struct TaskNode {
     Value coroutine;           /* The coroutine to resume */
-    Value pending_promise;     /* Promise it's waiting on (if any) */
-    int is_waiting;            /* 1 if waiting for promise, 0 if ready */
     struct TaskNode *next;
 } TaskNode;
 
@@ -19,8 +29,22 @@ typedef struct {
     int count;
 } TaskQueue;
 
+/* ---- Timers: a binary min-heap on the monotonic deadline ---- */
+typedef struct {
+    double deadline;           /* CLOCK_MONOTONIC seconds */
+    unsigned long seq;         /* FIFO among equal deadlines */
+    Value promise;             /* resolved when the deadline passes */
+} Timer;
+
+typedef struct {
+    Timer *items;
+    int count, cap;
+    unsigned long seq;
+} TimerHeap;
+
 /* Global event loop state */
 static TaskQueue g_task_queue = {NULL, NULL, 0};
+static TimerHeap g_timers = {NULL, 0, 0, 0};
 static int g_loop_running = 0;
 
 /* ---- Promise State ---- */
@@ -53,11 +77,10 @@ static void queue_init(TaskQueue *q) {
     q->count = 0;
 }
 
-static void queue_push(TaskQueue *q, Value coro, Value promise, int is_waiting) {
+static void queue_push(TaskQueue *q, Value coro) {
     TaskNode *node = (TaskNode*)malloc(sizeof(TaskNode));
+    if (!node) { fprintf(stderr, "OOM\n"); exit(1); }
     node->coroutine = coro;
-    node->pending_promise = promise;
-    node->is_waiting = is_waiting;
     node->next = NULL;
     
     if (q->tail) {
@@ -69,13 +92,11 @@ static void queue_push(TaskQueue *q, Value coro, Value promise, int is_waiting)
     q->count++;
 }
 
-static int queue_pop(TaskQueue *q, Value *coro_out, Value *promise_out, int *is_waiting_out) {
+static int queue_pop(TaskQueue *q, Value *coro_out) {
     if (!q->head) return 0;
     
     TaskNode *node = q->head;
     *coro_out = node->coroutine;
-    *promise_out = node->pending_promise;
-    *is_waiting_out = node->is_waiting;
     
     q->head = node->next;
     if (!q->head) q->tail = NULL;
@@ -95,72 +116,380 @@ static void queue_clear(TaskQueue *q) {
     q->count = 0;
 }
 
-/* ---- Promise Creation ---- */
+/* ---- Timer Heap Operations ---- */
+static double now_monotonic(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int timer_before(const Timer *a, const Timer *b) {
+    return a->deadline < b->deadline || (a->deadline == b->deadline && a->seq < b->seq);
+}
+
+static void timer_push(TimerHeap *h, double deadline, Value promise) {
+    if (h->count == h->cap) {
+        int ncap = h->cap ? h->cap * 2 : 16;
+        Timer *ni = realloc(h->items, sizeof(Timer) * (size_t)ncap);
+        if (!ni) { fprintf(stderr, "OOM\n"); exit(1); }
+        h->items = ni;
+        h->cap = ncap;
+    }
+    int i = h->count++;
+    Timer t = { deadline, h->seq++, promise };
+    while (i > 0) {
+        int up = (i - 1) / 2;
+        if (!timer_before(&t, &h->items[up])) break;
+        h->items[i] = h->items[up];
+        i = up;
+    }
+    h->items[i] = t;
+}
+
+static Timer timer_pop(TimerHeap *h) {
+    Timer top = h->items[0];
+    Timer last = h->items[--h->count];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= h->count) break;
+        if (c + 1 < h->count && timer_before(&h->items[c + 1], &h->items[c])) c++;
+        if (!timer_before(&h->items[c], &last)) break;
+        h->items[i] = h->items[c];
+        i = c;
+    }
+    if (h->count) h->items[i] = last;
+    return top;
+}
+
+/* ---- Promises ----
+   A promise is a VAL_PROMISE value: scripts see a userdata whose only
+   fields are the methods in promise_mt, and nothing of its state. Everything that depends on a
+   promise sits on its dependents list: parked tasks, then() callbacks,
+   adopting promises and the counters of all/any/race. Settling walks
+   that list once; nothing polls. then() callbacks run from a job queue
+   so long chains settle iteratively, not recursively. */
+typedef enum {
+    DEP_TASK,                  /* a: the parked coroutine */
+    DEP_THEN,                  /* a, b: on_ok, on_err; target: then()'s promise */
+    DEP_FORWARD,               /* target settles the same way */
+    DEP_ALL,                   /* target counts a value or fails */
+    DEP_ANY                    /* target takes a value or counts an error */
+} DepKind;
+
+typedef struct {
+    DepKind kind;
+    int index;                 /* DEP_ALL/DEP_ANY: slot in target's results */
+    Value a, b;
+    Value target;              /* a promise */
+} Dep;
+
+struct Promise {
+    PromiseState state;
+    Value value;               /* result or error once settled */
+    Dep *deps;
+    int ndeps, capdeps;
+    int remaining;             /* all/any: inputs still outstanding */
+    Value results;             /* all/any: values or errors by position */
+};
+
+typedef struct Job {
+    Dep dep;
+    PromiseState state;
+    Value value;
+    struct Job *next;
+} Job;
+
+static struct { Job *head, *tail; } g_jobs = {NULL, NULL};
+static int g_draining = 0;
+static Value g_await_tag;          /* first value a task yields from await */
+
+void promise_gc_traverse(Promise *p) {
+    gc_mark_value(p->value);
+    gc_mark_value(p->results);
+    for (int i = 0; i < p->ndeps; i++) {
+        gc_mark_value(p->deps[i].a);
+        gc_mark_value(p->deps[i].b);
+        gc_mark_value(p->deps[i].target);
+    }
+}
+
+void promise_gc_free(Promise *p) {
+    free(p->deps);
+}
+
+static Value V_promise(Promise *p) {
+    return (Value){.tag=VAL_PROMISE, .as.pr=p};
+}
+
 static Value create_promise(void) {
-    Value promise = new_table();
-    set_field(promise, "state", V_int(PROMISE_PENDING));
-    set_field(promise, "value", V_nil());
-    set_field(promise, "callbacks", new_table());  /* Array of callbacks */
-    return promise;
+    Promise *p = gc_alloc(GC_PROMISE, sizeof(Promise));
+    p->state = PROMISE_PENDING;
+    p->value = V_nil();
+    p->results = V_nil();
+    return V_promise(p);
+}
+
+static Promise *promise_of(Value v) {
+    return v.tag == VAL_PROMISE ? v.as.pr : NULL;
 }
 
 static int is_promise(Value v) {
-    if (v.tag != VAL_TABLE) return 0;
-    Value state;
-    return get_field(v, "state", &state);
+    return promise_of(v) != NULL;
 }
 
 static PromiseState get_promise_state(Value promise) {
-    Value state;
-    if (get_field(promise, "state", &state) && state.tag == VAL_INT) {
-        return (PromiseState)state.as.i;
+    Promise *p = promise_of(promise);
+    return p ? p->state : PROMISE_PENDING;
+}
+
+static void settle(struct VM *vm, Promise *p, PromiseState state, Value value);
+
+static void job_push(const Dep *d, PromiseState state, Value value) {
+    Job *j = malloc(sizeof(Job));
+    if (!j) { fprintf(stderr, "OOM\n"); exit(1); }
+    j->dep = *d;
+    j->state = state;
+    j->value = value;
+    j->next = NULL;
+    if (g_jobs.tail) g_jobs.tail->next = j;
+    else g_jobs.head = j;
+    g_jobs.tail = j;
+}
+
+/* Calls f(arg) and settles target with its result, or rejects it with
+   the error f raised. */
+static void run_callback(struct VM *vm, Value f, Value arg, Promise *target) {
+    ErrFrame frame;
+    vm_err_push(vm, &frame);
+    if (setjmp(frame.jb) == 0) {
+        Value ret = call_any_public(vm, f, 1, &arg);
+        vm_err_pop(vm);
+        settle(vm, target, PROMISE_RESOLVED, ret);
+    } else {
+        Value err = vm->err_obj.tag ? vm->err_obj : V_str_from_c("error");
+        vm_err_pop(vm);
+        settle(vm, target, PROMISE_REJECTED, err);
     }
-    return PROMISE_PENDING;
 }
 
-static void resolve_promise(struct VM *vm, Value promise, Value result) {
-    set_field(promise, "state", V_int(PROMISE_RESOLVED));
-    set_field(promise, "value", result);
-    
-    /* Run callbacks */
-    Value callbacks;
-    if (get_field(promise, "callbacks", &callbacks) && callbacks.tag == VAL_TABLE) {
-        /* Iterate through callbacks array */
-        for (int i = 1; i <= 100; i++) {  /* Max 100 callbacks */
-            Value cb;
-            if (tbl_get_public(callbacks.as.t, V_int(i), &cb) && 
-                (cb.tag == VAL_FUNC || cb.tag == VAL_CFUNC)) {
-                Value args[1] = {result};
-                call_any_public(vm, cb, 1, args);
-            } else {
-                break;
-            }
+static void drain_jobs(struct VM *vm) {
+    if (g_draining) return;
+    g_draining = 1;
+    while (g_jobs.head) {
+        Job *j = g_jobs.head;
+        g_jobs.head = j->next;
+        if (!g_jobs.head) g_jobs.tail = NULL;
+        Job job = *j;
+        free(j);
+        Value f = job.state == PROMISE_RESOLVED ? job.dep.a : job.dep.b;
+        Promise *target = promise_of(job.dep.target);
+        if (f.tag == VAL_FUNC || f.tag == VAL_CFUNC || f.tag == VAL_TABLE) run_callback(vm, f, job.value, target);
+        else settle(vm, target, job.state, job.value);
+    }
+    g_draining = 0;
+}
+
+/* Delivers a settled outcome to one dependent. */
+static void dispatch(struct VM *vm, const Dep *d, PromiseState state, Value value) {
+    Promise *t = d->kind == DEP_TASK ? NULL : promise_of(d->target);
+    switch (d->kind) {
+        case DEP_TASK:
+            queue_push(&g_task_queue, d->a);
+            break;
+        case DEP_THEN:
+            job_push(d, state, value);
+            break;
+        case DEP_FORWARD:
+            settle(vm, t, state, value);
+            break;
+        case DEP_ALL:
+        case DEP_ANY: {
+            PromiseState counted = d->kind == DEP_ALL ? PROMISE_RESOLVED : PROMISE_REJECTED;
+            if (state != counted) { settle(vm, t, state, value); break; }
+            if (t->state != PROMISE_PENDING) break;
+            tbl_set_public(t->results.as.t, V_int(d->index), value);
+            if (--t->remaining == 0) settle(vm, t, state, t->results);
+            break;
         }
     }
 }
 
+/* Adds a dependent; one added after settlement gets the outcome now. */
+static void add_dep(struct VM *vm, Promise *p, Dep d) {
+    if (p->state != PROMISE_PENDING) {
+        dispatch(vm, &d, p->state, p->value);
+        drain_jobs(vm);
+        return;
+    }
+    if (p->ndeps == p->capdeps) {
+        int ncap = p->capdeps ? p->capdeps * 2 : 2;
+        Dep *nd = realloc(p->deps, sizeof(Dep) * (size_t)ncap);
+        if (!nd) { fprintf(stderr, "OOM\n"); exit(1); }
+        p->deps = nd;
+        p->capdeps = ncap;
+    }
+    p->deps[p->ndeps++] = d;
+    gc_barrier(p);
+}
+
+static Dep make_dep(DepKind kind, Value a, Value b, Value target, int index) {
+    Dep d = { kind, index, a, b, target };
+    return d;
+}
+
+/* Settles p once: a promise value is adopted instead (p follows it). */
+static void settle(struct VM *vm, Promise *p, PromiseState state, Value value) {
+    if (!p || p->state != PROMISE_PENDING) return;
+    Promise *inner = state == PROMISE_RESOLVED ? promise_of(value) : NULL;
+    if (inner == p) {
+        state = PROMISE_REJECTED;
+        value = V_str_from_c("promise resolved with itself");
+    } else if (inner) {
+        add_dep(vm, inner, make_dep(DEP_FORWARD, V_nil(), V_nil(), V_promise(p), 0));
+        return;
+    }
+    p->state = state;
+    p->value = value;
+    gc_barrier(p);
+    Dep *deps = p->deps;
+    int n = p->ndeps;
+    p->deps = NULL;
+    p->ndeps = p->capdeps = 0;
+    for (int i = 0; i < n; i++) dispatch(vm, &deps[i], state, value);
+    free(deps);
+    drain_jobs(vm);
+}
+
+static void resolve_promise(struct VM *vm, Value promise, Value result) {
+    settle(vm, promise_of(promise), PROMISE_RESOLVED, result);
+}
+
 static void reject_promise(struct VM *vm, Value promise, Value error) {
-    set_field(promise, "state", V_int(PROMISE_REJECTED));
-    set_field(promise, "value", error);
-    
-    /* TODO: Run error callbacks */
+    settle(vm, promise_of(promise), PROMISE_REJECTED, error);
+}
+
+static void park_on(struct VM *vm, Value promise, Value coro) {
+    Promise *p = promise_of(promise);
+    if (p) add_dep(vm, p, make_dep(DEP_TASK, coro, V_nil(), V_nil(), 0));
+}
+
+/* ---- Reactor ----
+   The loop blocks in epoll_wait (poll elsewhere) whenever no task is
+   runnable, for as long as the earliest timer allows. A task waiting
+   for an fd awaits the promise of that fd's direction; readiness
+   resolves it. Regular files cannot be watched and count as ready. */
+typedef struct {
+    Value rd, wr;              /* pending promises, nil when nobody waits */
+    int armed;                 /* registered with epoll */
+} FdWatch;
+
+static FdWatch *g_watch = NULL;
+static int g_watch_cap = 0;
+static int g_nwatch = 0;       /* fds with a pending promise */
+#ifdef __linux__
+static int g_epfd = -1;
+#endif
+
+static int watch_events(const FdWatch *w) {
+    return (w->rd.tag != VAL_NIL ? POLLIN : 0) | (w->wr.tag != VAL_NIL ? POLLOUT : 0);
+}
+
+/* Resolves the promises of the directions in revents. */
+static void watch_fire(struct VM *vm, int fd, int revents) {
+    FdWatch *w = &g_watch[fd];
+    if (revents & (POLLERR | POLLHUP | POLLNVAL)) revents |= POLLIN | POLLOUT;
+    Value rd = V_nil(), wr = V_nil();
+    if (revents & POLLIN)  { rd = w->rd; w->rd = V_nil(); }
+    if (revents & POLLOUT) { wr = w->wr; w->wr = V_nil(); }
+    int ev = watch_events(w);
+#ifdef __linux__
+    if (w->armed) {
+        struct epoll_event e = { .events = (ev & POLLIN ? EPOLLIN : 0) | (ev & POLLOUT ? EPOLLOUT : 0), .data.fd = fd };
+        if (ev) epoll_ctl(g_epfd, EPOLL_CTL_MOD, fd, &e);
+        else { epoll_ctl(g_epfd, EPOLL_CTL_DEL, fd, NULL); w->armed = 0; }
+    }
+#endif
+    if (!ev) g_nwatch--;
+    if (rd.tag != VAL_NIL) resolve_promise(vm, rd, V_nil());
+    if (wr.tag != VAL_NIL) resolve_promise(vm, wr, V_nil());
+}
+
+/* The promise that settles once fd is ready for POLLIN or POLLOUT. */
+static Value watch_fd(struct VM *vm, int fd, int dir) {
+    if (fd >= g_watch_cap) {
+        int ncap = g_watch_cap ? g_watch_cap : 64;
+        while (ncap <= fd) ncap *= 2;
+        FdWatch *nw = realloc(g_watch, sizeof(FdWatch) * (size_t)ncap);
+        if (!nw) { fprintf(stderr, "OOM\n"); exit(1); }
+        for (int i = g_watch_cap; i < ncap; i++) nw[i] = (FdWatch){ V_nil(), V_nil(), 0 };
+        g_watch = nw;
+        g_watch_cap = ncap;
+    }
     (void)vm;
+    FdWatch *w = &g_watch[fd];
+    Value *slot = dir == POLLIN ? &w->rd : &w->wr;
+    if (slot->tag != VAL_NIL) return *slot;   /* join the task already waiting */
+    if (!watch_events(w)) g_nwatch++;
+    *slot = create_promise();
+    Value p = *slot;
+#ifdef __linux__
+    if (g_epfd < 0) g_epfd = epoll_create1(EPOLL_CLOEXEC);
+    int ev = watch_events(w);
+    struct epoll_event e = { .events = (ev & POLLIN ? EPOLLIN : 0) | (ev & POLLOUT ? EPOLLOUT : 0), .data.fd = fd };
+    if (epoll_ctl(g_epfd, w->armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &e) == 0) w->armed = 1;
+    else watch_fire(vm, fd, POLLIN | POLLOUT);   /* EPERM: a regular file */
+#endif
+    return p;
+}
+
+static void reactor_wait(struct VM *vm, double timeout) {
+    int ms = -1;
+    if (timeout >= 0) {
+        double t = timeout * 1000.0;
+        ms = t >= (double)INT_MAX ? INT_MAX : (int)t;
+        if ((double)ms < t) ms++;   /* round up: never wake before the deadline */
+    }
+#ifdef __linux__
+    if (g_epfd < 0) g_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_epfd >= 0) {
+        struct epoll_event ev[64];
+        int n = epoll_wait(g_epfd, ev, 64, ms);
+        for (int i = 0; i < n; i++) {
+            int re = ev[i].events;
+            watch_fire(vm, ev[i].data.fd, (re & EPOLLIN ? POLLIN : 0) | (re & EPOLLOUT ? POLLOUT : 0) |
+                                          (re & (EPOLLERR | EPOLLHUP) ? POLLHUP : 0));
+        }
+        return;
+    }
+#endif
+    struct pollfd *pfd = g_nwatch ? malloc(sizeof(struct pollfd) * (size_t)g_nwatch) : NULL;
+    int n = 0;
+    for (int fd = 0; pfd && fd < g_watch_cap && n < g_nwatch; fd++) {
+        int ev = watch_events(&g_watch[fd]);
+        if (ev) pfd[n++] = (struct pollfd){ .fd = fd, .events = (short)ev };
+    }
+    if (poll(pfd, (nfds_t)n, ms) > 0) {
+        for (int i = 0; i < n; i++)
+            if (pfd[i].revents) watch_fire(vm, pfd[i].fd, pfd[i].revents);
+    }
+    free(pfd);
+}
+
+/* Resolves the promises of every timer that is due. */
+static void fire_timers(struct VM *vm) {
+    double now = now_monotonic();
+    while (g_timers.count > 0 && g_timers.items[0].deadline <= now) {
+        Timer t = timer_pop(&g_timers);
+        resolve_promise(vm, t.promise, V_nil());
+    }
 }
 
 /* ---- Async Core Functions ---- */
 
 /* Helper to find global variable */
 static int get_global(struct VM *vm, const char *name, Value *out) {
-    /* Search through environment chain for the name */
-    for (Env *e = vm->env; e; e = e->parent) {
-        for (int i = 0; i < e->count; i++) {
-            if (e->names[i] && strcmp(e->names[i], name) == 0) {
-                *out = e->vals[i];
-                return 1;
-            }
-        }
-    }
-    return 0;
+    return env_get(env_root(vm->env), name, out);
 }
 
 /* async.spawn(func) - spawns a new async task */
@@ -187,7 +516,7 @@ static Value async_spawn(struct VM *vm, int argc, Value *argv) {
     Value coro = call_any_public(vm, create_func, 1, coro_args);
     
     /* Add to task queue */
-    queue_push(&g_task_queue, coro, V_nil(), 0);
+    if (coro.tag == VAL_COROUTINE) queue_push(&g_task_queue, coro);
     
     return coro;
 }
@@ -200,26 +529,7 @@ static Value async_await(struct VM *vm, int argc, Value *argv) {
     }
     
     Value promise = argv[0];
-    
-    /* If it's already resolved, return the value */
-    if (is_promise(promise)) {
-        PromiseState state = get_promise_state(promise);
-        if (state == PROMISE_RESOLVED) {
-            Value result;
-            get_field(promise, "value", &result);
-            return result;
-        } else if (state == PROMISE_REJECTED) {
-            Value err;
-            get_field(promise, "value", &err);
-            vm_raise(vm, err);
-            return V_nil();
-        }
-    }
-    
-    /* Otherwise, yield with a special marker */
-    Value marker = new_table();
-    set_field(marker, "_async_await", V_bool(1));
-    set_field(marker, "_promise", promise);
+    if (!is_promise(promise)) return promise;
     
     /* Get coroutine.yield */
     Value coro_table;
@@ -234,8 +544,73 @@ static Value async_await(struct VM *vm, int argc, Value *argv) {
         return V_nil();
     }
     
-    Value yield_args[1] = {marker};
-    return call_any_public(vm, yield_func, 1, yield_args);
+    /* Sleep until the promise settles; the loop parks us on it */
+    while (get_promise_state(promise) == PROMISE_PENDING) {
+        Value yield_args[2] = {g_await_tag, promise};
+        call_any_public(vm, yield_func, 2, yield_args);
+    }
+    
+    Promise *p = promise_of(promise);
+    if (p->state == PROMISE_REJECTED) vm_raise(vm, p->value);
+    return p->value;
+}
+
+/* Waits until fd is ready for dir (POLLIN/POLLOUT): inside a task by
+   awaiting the reactor, outside one by blocking in poll. */
+static void wait_fd(struct VM *vm, int fd, int dir) {
+    if (!vm->active_co) {
+        struct pollfd p = { .fd = fd, .events = (short)dir };
+        poll(&p, 1, -1);
+        return;
+    }
+    Value promise = watch_fd(vm, fd, dir);
+    async_await(vm, 1, &promise);
+}
+
+/* async.read(file [, fmt]) - file:read that suspends the task instead of
+   blocking; fmt is "*l" (default), "*L", "*a" or a byte count */
+static Value async_read(struct VM *vm, int argc, Value *argv) {
+    if (argc < 1) vm_raise(vm, V_str_from_c("async.read: expected file"));
+    Value fmt = argc > 1 ? argv[1] : V_str_from_c("*l");
+    for (;;) {
+        Value out;
+        int r = io_try_read(argv[0], fmt, &out);
+        if (r > 0) return out;
+        if (r < 0) return V_nil();
+        wait_fd(vm, io_async_fd(argv[0]), POLLIN);
+    }
+}
+
+/* async.write(file, ...) - writes every argument, suspending the task
+   while the fd is full; returns the file */
+static Value async_write(struct VM *vm, int argc, Value *argv) {
+    if (argc < 1) vm_raise(vm, V_str_from_c("async.write: expected file"));
+    for (int i = 1; i < argc; i++) {
+        Str *s = to_string_buf(argv[i]);
+        size_t done = 0;
+        int r;
+        while ((r = io_try_write(argv[0], s->data, (size_t)s->len, &done)) == 0)
+            wait_fd(vm, io_async_fd(argv[0]), POLLOUT);
+        if (r < 0) return V_nil();
+    }
+    return argv[0];
+}
+
+static Value async_lines_iter(struct VM *vm, int argc, Value *argv) {
+    if (argc < 1) return V_nil();
+    Value args[2];
+    if (!get_field(argv[0], "file", &args[0]) || !get_field(argv[0], "fmt", &args[1])) return V_nil();
+    return async_read(vm, 2, args);
+}
+
+/* async.lines(file [, fmt]) - generic-for iterator over async.read */
+static Value async_lines(struct VM *vm, int argc, Value *argv) {
+    if (argc < 1) return V_nil();
+    Value state = new_table();
+    set_field(state, "file", argv[0]);
+    set_field(state, "fmt", argc > 1 ? argv[1] : V_str_from_c("*l"));
+    Value out[3] = { (Value){.tag=VAL_CFUNC, .as.cfunc=async_lines_iter}, state, V_nil() };
+    return vm_return_values(vm, 3, out);
 }
 
 /* async.run() - runs the event loop until all tasks complete */
@@ -266,73 +641,42 @@ static Value async_run(struct VM *vm, int argc, Value *argv) {
         return V_nil();
     }
     
-    int max_iterations = 10000;  /* Prevent infinite loops */
-    int iteration = 0;
-    
-    while (g_task_queue.count > 0 && iteration++ < max_iterations) {
-        Value coro, promise;
-        int is_waiting;
+    for (;;) {
+        fire_timers(vm);
+        drain_jobs(vm);
         
-        if (!queue_pop(&g_task_queue, &coro, &promise, &is_waiting)) {
-            break;
+        Value coro;
+        if (!queue_pop(&g_task_queue, &coro)) {
+            /* Nothing runnable: sleep until the next timer or fd. Tasks
+               still parked on promises nothing can settle are abandoned. */
+            if (g_timers.count == 0 && g_nwatch == 0) break;
+            reactor_wait(vm, g_timers.count ? g_timers.items[0].deadline - now_monotonic() : -1);
+            continue;
         }
         
-        /* Check if task is waiting on a promise */
-        if (is_waiting && is_promise(promise)) {
-            PromiseState state = get_promise_state(promise);
-            if (state == PROMISE_PENDING) {
-                /* Still waiting, re-queue at the end */
-                queue_push(&g_task_queue, coro, promise, 1);
-                continue;
-            }
+        /* Resume the coroutine: ok, then what it yielded or returned */
+        Value resume_args[1] = {coro};
+        int base = vm->top;
+        int n = call_multi(vm, resume_func, 1, resume_args);
+        Value success = n > 0 ? vm->stack[base] : V_nil();
+        Value tag = n > 1 ? vm->stack[base + 1] : V_nil();
+        Value await_promise = n > 2 ? vm->stack[base + 2] : V_nil();
+        vm->top = base;
+        if (success.tag != VAL_BOOL || !success.as.b) {
+            continue;   /* errored: the task is done */
         }
+        Value status_args[1] = {coro};
+        Value status = call_any_public(vm, status_func, 1, status_args);
+        if (status.tag == VAL_STR && strcmp(status.as.s->data, "dead") == 0) continue;
         
-        /* Resume the coroutine */
-        Value resume_args[2] = {coro, V_nil()};
-        int resume_argc = 1;
-        
-        /* If promise is resolved, pass the value */
-        if (is_waiting && is_promise(promise) && get_promise_state(promise) == PROMISE_RESOLVED) {
-            Value result;
-            get_field(promise, "value", &result);
-            resume_args[1] = result;
-            resume_argc = 2;
-        }
-        
-        Value result = call_any_public(vm, resume_func, resume_argc, resume_args);
-        
-        /* Check result: {success, value} or {success, value, ...} */
-        if (result.tag == VAL_TABLE) {
-            Value success, ret_val;
-            if (tbl_get_public(result.as.t, V_int(1), &success) && success.tag == VAL_BOOL) {
-                if (success.as.b) {
-                    /* Coroutine yielded successfully */
-                    if (tbl_get_public(result.as.t, V_int(2), &ret_val)) {
-                        /* Check if it yielded an await marker */
-                        Value is_await;
-                        if (ret_val.tag == VAL_TABLE && 
-                            get_field(ret_val, "_async_await", &is_await) && 
-                            is_await.tag == VAL_BOOL && is_await.as.b) {
-                            /* It's waiting on a promise */
-                            Value await_promise;
-                            if (get_field(ret_val, "_promise", &await_promise)) {
-                                queue_push(&g_task_queue, coro, await_promise, 1);
-                            }
-                        } else {
-                            /* Regular yield, re-queue as ready */
-                            queue_push(&g_task_queue, coro, V_nil(), 0);
-                        }
-                    }
-                } else {
-                    /* Coroutine finished or errored */
-                    if (tbl_get_public(result.as.t, V_int(2), &ret_val)) {
-                        /* Check if it's an error */
-                        Value status_args[1] = {coro};
-                        Value status = call_any_public(vm, status_func, 1, status_args);
-                        /* Just continue, task is done */
-                    }
-                }
-            }
+        /* Check if it yielded an await marker */
+        if (tag.tag == VAL_TABLE && tag.as.t == g_await_tag.as.t &&
+            get_promise_state(await_promise) == PROMISE_PENDING) {
+            /* It's waiting on a promise */
+            park_on(vm, await_promise, coro);
+        } else {
+            /* Regular yield, re-queue as ready */
+            queue_push(&g_task_queue, coro);
         }
     }
     
@@ -352,20 +696,40 @@ static Value async_sleep(struct VM *vm, int argc, Value *argv) {
     
     Value promise = create_promise();
     
-    /* Store start time */
-    set_field(promise, "_sleep_start", V_num((double)clock() / CLOCKS_PER_SEC));
-    set_field(promise, "_sleep_duration", V_num(seconds));
-    
-    /* Spawn a task to resolve it after the delay */
-    /* Note: This is a simple busy-wait implementation */
-    /* In production, you'd use proper async I/O */
+    if (!(seconds > 0)) seconds = 0;
+    timer_push(&g_timers, now_monotonic() + seconds, promise);
     
     (void)vm;
     
     return promise;
 }
 
-/* async.promise(executor_func) - creates a new promise */
+/* The resolve/reject callables async.promise hands its executor: tables
+   whose __call settles "_target". */
+static Value resolver_call(struct VM *vm, int argc, Value *argv, PromiseState state) {
+    Value target;
+    if (argc < 1 || !get_field(argv[0], "_target", &target)) return V_nil();
+    settle(vm, promise_of(target), state, argc > 1 ? argv[1] : V_nil());
+    return V_nil();
+}
+static Value resolve_call(struct VM *vm, int argc, Value *argv) {
+    return resolver_call(vm, argc, argv, PROMISE_RESOLVED);
+}
+static Value reject_call(struct VM *vm, int argc, Value *argv) {
+    return resolver_call(vm, argc, argv, PROMISE_REJECTED);
+}
+
+static Value make_resolver(Value promise, CFunc call) {
+    Value r = new_table();
+    Value mt = new_table();
+    set_field(mt, "__call", (Value){.tag=VAL_CFUNC, .as.cfunc=call});
+    set_field(r, "_target", promise);
+    set_field(r, "_mt", mt);
+    return r;
+}
+
+/* async.promise(executor) - calls executor(resolve, reject) and returns
+   the promise they settle; an error in the executor rejects it */
 static Value async_promise(struct VM *vm, int argc, Value *argv) {
     if (argc < 1 || (argv[0].tag != VAL_FUNC && argv[0].tag != VAL_CFUNC)) {
         fprintf(stderr, "async.promise: expected function\n");
@@ -373,18 +737,36 @@ static Value async_promise(struct VM *vm, int argc, Value *argv) {
     }
     
     Value promise = create_promise();
-    Value executor = argv[0];
-    
-    /* Create resolve and reject functions */
-    /* These would need to be proper closures that capture the promise */
-    /* For now, we'll return the promise and let the executor handle it manually */
-    
-    (void)vm;
-    (void)executor;
-    
+    Value args[2] = { make_resolver(promise, resolve_call), make_resolver(promise, reject_call) };
+    ErrFrame frame;
+    vm_err_push(vm, &frame);
+    if (setjmp(frame.jb) == 0) {
+        call_any_public(vm, argv[0], 2, args);
+        vm_err_pop(vm);
+    } else {
+        Value err = vm->err_obj.tag ? vm->err_obj : V_str_from_c("error");
+        vm_err_pop(vm);
+        reject_promise(vm, promise, err);
+    }
     return promise;
 }
 
+/* promise:then(on_ok, on_err) (also promise:next) - the promise of
+   on_ok(value) or on_err(error); a missing handler passes the outcome on */
+static Value promise_then(struct VM *vm, int argc, Value *argv) {
+    Promise *p = argc > 0 ? promise_of(argv[0]) : NULL;
+    if (!p) vm_raise(vm, V_str_from_c("promise:then: expected promise"));
+    Value child = create_promise();
+    add_dep(vm, p, make_dep(DEP_THEN, argc > 1 ? argv[1] : V_nil(), argc > 2 ? argv[2] : V_nil(), child, 0));
+    return child;
+}
+
+/* promise:catch(on_err) */
+static Value promise_catch(struct VM *vm, int argc, Value *argv) {
+    Value args[3] = { argc > 0 ? argv[0] : V_nil(), V_nil(), argc > 1 ? argv[1] : V_nil() };
+    return promise_then(vm, 3, args);
+}
+
 /* async.resolve(value) - creates an immediately resolved promise */
 static Value async_resolve(struct VM *vm, int argc, Value *argv) {
     Value val = (argc > 0) ? argv[0] : V_nil();
@@ -401,36 +783,80 @@ static Value async_reject(struct VM *vm, int argc, Value *argv) {
     return promise;
 }
 
-/* Helper: Check if all promises are resolved */
-static int all_resolved(Value *promises, int count) {
-    for (int i = 0; i < count; i++) {
-        if (is_promise(promises[i]) && get_promise_state(promises[i]) == PROMISE_PENDING) {
-            return 0;
-        }
+/* all/any/race: one dependent per input on a fresh promise; all and
+   any count settlements down from #list in the promise itself. Plain
+   values in the list count as resolved. */
+static Value combine(struct VM *vm, int argc, Value *argv, DepKind kind, const char *name) {
+    if (argc < 1 || argv[0].tag != VAL_TABLE) {
+        fprintf(stderr, "async.%s: expected table of promises\n", name);
+        return V_nil();
     }
-    return 1;
+    Value out = create_promise();
+    Promise *r = promise_of(out);
+    int n = to_int_val(op_len(argv[0]), 0);
+    if (kind != DEP_FORWARD) {
+        r->results = new_table();
+        r->remaining = n;
+        gc_barrier(r);
+        if (n == 0) settle(vm, r, kind == DEP_ALL ? PROMISE_RESOLVED : PROMISE_REJECTED, r->results);
+    }
+    for (int i = 1; i <= n && r->state == PROMISE_PENDING; i++) {
+        Value item = V_nil();
+        tbl_get_public(argv[0].as.t, V_int(i), &item);
+        Dep d = make_dep(kind, V_nil(), V_nil(), out, i);
+        Promise *p = promise_of(item);
+        if (p) add_dep(vm, p, d);
+        else dispatch(vm, &d, PROMISE_RESOLVED, item);
+    }
+    return out;
 }
 
-/* async.all(promises_table) - waits for all promises */
+/* async.all(list) - resolves with every value in order, or rejects with the first error */
 static Value async_all(struct VM *vm, int argc, Value *argv) {
-    if (argc < 1 || argv[0].tag != VAL_TABLE) {
-        fprintf(stderr, "async.all: expected table of promises\n");
-        return V_nil();
+    return combine(vm, argc, argv, DEP_ALL, "all");
+}
+
+/* async.any(list) - resolves with the first value, or rejects with every error in order */
+static Value async_any(struct VM *vm, int argc, Value *argv) {
+    return combine(vm, argc, argv, DEP_ANY, "any");
+}
+
+/* async.race(list) - settles the way the first input to settle does */
+static Value async_race(struct VM *vm, int argc, Value *argv) {
+    return combine(vm, argc, argv, DEP_FORWARD, "race");
+}
+
+/* Queued tasks and timers live in malloc'd memory the collector cannot see. */
+static void mark_task_queue(void) {
+    for (TaskNode *n = g_task_queue.head; n; n = n->next) {
+        gc_mark_value(n->coroutine);
+    }
+    for (int i = 0; i < g_timers.count; i++) {
+        gc_mark_value(g_timers.items[i].promise);
+    }
+    for (int fd = 0; fd < g_watch_cap; fd++) {
+        gc_mark_value(g_watch[fd].rd);
+        gc_mark_value(g_watch[fd].wr);
+    }
+    for (Job *j = g_jobs.head; j; j = j->next) {
+        gc_mark_value(j->dep.a);
+        gc_mark_value(j->dep.b);
+        gc_mark_value(j->dep.target);
+        gc_mark_value(j->value);
     }
-    
-    /* Create a promise that resolves when all input promises resolve */
-    Value result_promise = create_promise();
-    
-    /* For simplicity, we'll just return the promise */
-    /* A full implementation would track all promises and resolve when they're all done */
-    
-    (void)vm;
-    
-    return result_promise;
 }
 
 /* ---- Registration ---- */
 void register_async_lib(struct VM *vm) {
+    gc_root(&promise_mt); gc_root(&g_await_tag);
+    g_await_tag = new_table();
+    Value methods = new_table();
+    set_field(methods, "then", (Value){.tag=VAL_CFUNC, .as.cfunc=promise_then});
+    set_field(methods, "next", (Value){.tag=VAL_CFUNC, .as.cfunc=promise_then});
+    set_field(methods, "catch", (Value){.tag=VAL_CFUNC, .as.cfunc=promise_catch});
+    promise_mt = new_table();
+    set_field(promise_mt, "__index", methods);
+    
     Value A = new_table();
     
     set_field(A, "spawn", (Value){.tag=VAL_CFUNC, .as.cfunc=async_spawn});
@@ -441,9 +867,15 @@ void register_async_lib(struct VM *vm) {
     set_field(A, "resolve", (Value){.tag=VAL_CFUNC, .as.cfunc=async_resolve});
     set_field(A, "reject", (Value){.tag=VAL_CFUNC, .as.cfunc=async_reject});
     set_field(A, "all", (Value){.tag=VAL_CFUNC, .as.cfunc=async_all});
+    set_field(A, "any", (Value){.tag=VAL_CFUNC, .as.cfunc=async_any});
+    set_field(A, "race", (Value){.tag=VAL_CFUNC, .as.cfunc=async_race});
+    set_field(A, "read", (Value){.tag=VAL_CFUNC, .as.cfunc=async_read});
+    set_field(A, "write", (Value){.tag=VAL_CFUNC, .as.cfunc=async_write});
+    set_field(A, "lines", (Value){.tag=VAL_CFUNC, .as.cfunc=async_lines});
     
     env_add_public(vm->env, "async", A, false);
     
     /* Initialize task queue */
     queue_init(&g_task_queue);
+    gc_root_fn(mark_task_queue);
 }
@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <string.h>
 #include "../include/interpreter.h"
+#include "../include/builtins.h"
+#include "../include/gc.h"
 
 /* ---- Helpers ---- */
 
@@ -108,16 +110,23 @@ static void setup_class_metatable(struct VM *vm, Value class_table) {
 
 /* Set up metatable for instance */
 static void setup_instance_metatable(struct VM *vm, Value instance, Value class_table) {
-    Value mt = new_table();
-    
-    /* __index metamethod - look up methods in class */
-    set_field(mt, "__index", class_table);
+    /* One metatable per class, shared by its instances: method calls then
+       resolve the same way for every instance and stay in the call
+       site's inline cache */
+    Value mt;
+    if (!get_field(class_table, "__instance_mt", &mt) || mt.tag != VAL_TABLE) {
+        mt = new_table();
+        /* __index metamethod - look up methods in class */
+        set_field(mt, "__index", class_table);
+        set_field(class_table, "__instance_mt", mt);
+    }
     
     /* Store class reference */
     set_field(instance, "__class", class_table);
     
     /* Set metatable */
     set_field(instance, "__metatable", mt);
+    set_field(instance, MT_STORE, mt);
     
     (void)vm;
 }
@@ -155,6 +164,7 @@ static Value class_create(struct VM *vm, int argc, Value *argv) {
         Value mt = new_table();
         set_field(mt, "__index", extends);
         set_field(class_table, "__metatable", mt);
+        set_field(class_table, MT_STORE, mt);
     }
     
     /* Copy ALL fields from definition to class */
@@ -222,14 +232,14 @@ static Value create_instance(struct VM *vm, Value class_table, int argc, Value *
     Value init;
     if (get_field(class_table, "init", &init) && is_callable(init)) {
         /* Prepend instance as first argument (self) */
-        Value *new_argv = (Value*)malloc(sizeof(Value) * (argc + 1));
+        Value *new_argv = gc_scratch((size_t)argc + 1);
         if (new_argv) {
             new_argv[0] = instance;
             for (int i = 0; i < argc; i++) {
                 new_argv[i + 1] = argv[i];
             }
             call_any_public(vm, init, argc + 1, new_argv);
-            free(new_argv);
+            gc_scratch_free(new_argv);
         }
     }
     
@@ -342,8 +352,7 @@ static Value class_super(struct VM *vm, int argc, Value *argv) {
     }
     
     /* Call parent method with object as first argument */
-    Value *new_argv = (Value*)malloc(sizeof(Value) * argc);
-    if (!new_argv) return V_nil();
+    Value *new_argv = gc_scratch((size_t)argc);
     
     new_argv[0] = obj;
     for (int i = 2; i < argc; i++) {
@@ -351,7 +360,7 @@ static Value class_super(struct VM *vm, int argc, Value *argv) {
     }
     
     Value result = call_any_public(vm, method, argc - 1, new_argv);
-    free(new_argv);
+    gc_scratch_free(new_argv);
     
     return result;
 }
@@ -72,9 +72,38 @@ static Value dbg_getmetatable(struct VM *vm, int argc, Value *argv) {
   return V_nil();
 }
 
+/* ---------- debug.sethook([thread,] f, mask [, count]) ---------- */
+/* Only count hooks exist (see vm_sethook): f is called as f("count")
+   every count steps. The mask's c/r/l events are accepted and ignored;
+   hooks are per VM, so a thread argument is skipped. */
+static void dbg_count_hook(struct VM *vm, void *ud) {
+  (void)ud;
+  Value ev = V_str_from_c("count");
+  call_any_public(vm, vm->hook_fn, 1, &ev);
+}
+
+static Value dbg_sethook(struct VM *vm, int argc, Value *argv) {
+  if (argc >= 1 && argv[0].tag == VAL_COROUTINE) { argc--; argv++; }
+  int count = argc >= 3 ? to_int_val(argv[2], 0) : 0;
+  if (argc < 1 || !is_callable(argv[0]) || count <= 0) {
+    vm->hook_fn = V_nil();
+    vm_sethook(vm, NULL, NULL, 0);
+    return V_nil();
+  }
+  vm->hook_fn = argv[0];
+  vm_sethook(vm, dbg_count_hook, NULL, count);
+  return V_nil();
+}
+
+/* ---------- debug.gethook() -> f, mask, count ---------- */
+static Value dbg_gethook(struct VM *vm, int argc, Value *argv) {
+  (void)argc; (void)argv;
+  if (vm->hook != dbg_count_hook) return V_nil();
+  Value out[3] = { vm->hook_fn, V_str_from_c(""), V_int(vm->hook_count) };
+  return vm_return_values(vm, 3, out);
+}
+
 /* placeholders to keep API surface */
-static Value dbg_sethook(struct VM *vm, int argc, Value *argv) { (void)vm;(void)argc;(void)argv; return V_nil(); }
-static Value dbg_gethook(struct VM *vm, int argc, Value *argv) { (void)vm;(void)argc;(void)argv; return V_nil(); }
 static Value dbg_upvalueid(struct VM *vm, int argc, Value *argv){ (void)vm;(void)argc;(void)argv; return V_nil(); }
 static Value dbg_getupvalue(struct VM *vm, int argc, Value *argv){ (void)vm;(void)argc;(void)argv; return V_nil(); }
 static Value dbg_setupvalue(struct VM *vm, int argc, Value *argv){ (void)vm;(void)argc;(void)argv; return V_nil(); }
@@ -88,9 +117,10 @@ void register_debug_lib(struct VM *vm) {
   tbl_set_public(debug.as.t, V_str_from_c("getinfo"),     (Value){.tag=VAL_CFUNC, .as.cfunc=dbg_getinfo});
   tbl_set_public(debug.as.t, V_str_from_c("getmetatable"),(Value){.tag=VAL_CFUNC, .as.cfunc=dbg_getmetatable});
 
-  /* stubs to complete surface */
   tbl_set_public(debug.as.t, V_str_from_c("sethook"),     (Value){.tag=VAL_CFUNC, .as.cfunc=dbg_sethook});
   tbl_set_public(debug.as.t, V_str_from_c("gethook"),     (Value){.tag=VAL_CFUNC, .as.cfunc=dbg_gethook});
+
+  /* stubs to complete surface */
   tbl_set_public(debug.as.t, V_str_from_c("upvalueid"),   (Value){.tag=VAL_CFUNC, .as.cfunc=dbg_upvalueid});
   tbl_set_public(debug.as.t, V_str_from_c("getupvalue"),  (Value){.tag=VAL_CFUNC, .as.cfunc=dbg_getupvalue});
   tbl_set_public(debug.as.t, V_str_from_c("setupvalue"),  (Value){.tag=VAL_CFUNC, .as.cfunc=dbg_setupvalue});
@@ -85,7 +85,7 @@ static Value exc_throw(struct VM *vm, int argc, Value *argv) {
     return V_nil(); // never reached
 }
 
-/* pcall(func, ...) -> { success, result } */
+/* pcall(func, ...) -> success, result */
 static Value exc_pcall(struct VM *vm, int argc, Value *argv) {
     if (argc < 1 || !is_callable(argv[0]))
         return exception_error("bad argument #1 to 'pcall' (function expected)");
@@ -93,13 +93,11 @@ static Value exc_pcall(struct VM *vm, int argc, Value *argv) {
     Value func = argv[0], ret;
     int success = protected_call(vm, func, argc - 1, argv + 1, &ret);
 
-    Value result = V_table();
-    tbl_set_public(result.as.t, V_int(1), V_bool(success));
-    tbl_set_public(result.as.t, V_int(2), ret);
-    return result;
+    Value out[2] = { V_bool(success), ret };
+    return vm_return_values(vm, 2, out);
 }
 
-/* xpcall(func, err_handler, ...) -> { success, result } */
+/* xpcall(func, err_handler, ...) -> success, result */
 static Value exc_xpcall(struct VM *vm, int argc, Value *argv) {
     if (argc < 2 || !is_callable(argv[0]) || !is_callable(argv[1]))
         return exception_error("bad arguments to 'xpcall' (function, function expected)");
@@ -114,10 +112,8 @@ static Value exc_xpcall(struct VM *vm, int argc, Value *argv) {
         ret = handler_ret;
     }
 
-    Value result = V_table();
-    tbl_set_public(result.as.t, V_int(1), V_bool(success));
-    tbl_set_public(result.as.t, V_int(2), ret);
-    return result;
+    Value out[2] = { V_bool(success), ret };
+    return vm_return_values(vm, 2, out);
 }
 
 /* exception.type(value) -> string */
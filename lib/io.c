@@ -3,7 +3,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "../include/interpreter.h"
+#include "../include/gc.h"
 
 /* ===========================================================
  *  File boxing & helpers
@@ -11,6 +18,17 @@
 
 static const char *FH_PTR = "_fh_ptr";   /* hidden FILE* (stored in CFunc slot) */
 static const char *FH_CLS = "_closed";   /* boolean flag: was closed */
+static const char *FH_NB  = "_nb_ptr";   /* NbBuf of a handle read through its fd */
+
+/* Read-ahead for the fd-level reads async.read makes: bytes read past
+   the end of the last line wait here. stdio's buffer is bypassed, so a
+   handle should be read either through its methods or through async.*,
+   not both. */
+typedef struct {
+  char *data;
+  size_t len, cap;
+  int eof;
+} NbBuf;
 
 static Value g_stdin_box;
 static Value g_stdout_box;
@@ -174,6 +192,13 @@ static Value f_close(struct VM *vm, int argc, Value *argv) {
     return V_nil();
   }
 
+  Value nb;
+  if (tbl_get_public(argv[0].as.t, V_str_from_c(FH_NB), &nb) && nb.tag == VAL_CFUNC) {
+    NbBuf *b = (NbBuf*)nb.as.cfunc;
+    free(b->data);
+    free(b);
+    tbl_set_public(argv[0].as.t, V_str_from_c(FH_NB), V_nil());
+  }
   int rc = fclose(fp);
   /* mark as closed */
   tbl_set_public(argv[0].as.t, V_str_from_c(FH_PTR), V_nil());
@@ -295,7 +320,6 @@ static Value lines_iter(struct VM *vm, int argc, Value *argv) {
 }
 
 static Value f_lines(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
   if (argc < 1 || !is_file_box(argv[0])) return V_nil();
   if (is_closed_box(argv[0])) return V_nil();
   FILE *fp = unbox_file(argv[0]); if (!fp) return V_nil();
@@ -326,11 +350,8 @@ static Value f_lines(struct VM *vm, int argc, Value *argv) {
 
   Value state = box_lines_state(ls);
   Value iter; iter.tag = VAL_CFUNC; iter.as.cfunc = lines_iter;
-  Value triple = V_table();
-  tbl_set_public(triple.as.t, V_int(1), iter);
-  tbl_set_public(triple.as.t, V_int(2), state);
-  tbl_set_public(triple.as.t, V_int(3), V_nil());
-  return triple;
+  Value out[3] = { iter, state, V_nil() };
+  return vm_return_values(vm, 3, out);
 }
 
 /* ===========================================================
@@ -351,11 +372,11 @@ static Value io_write(struct VM *vm, int argc, Value *argv) {
   Value out = is_file_box(g_out_box) ? g_out_box : g_stdout_box;
   Value args[64]; /* cheap stack; if more than 63 args, realloc */
   Value *pargs = args;
-  if (argc + 1 > 64) pargs = (Value*)malloc(sizeof(Value)*(argc+1));
+  if (argc + 1 > 64) pargs = gc_scratch((size_t)argc + 1);
   pargs[0] = out;
   for (int i=0;i<argc;i++) pargs[i+1] = argv[i];
   Value r = f_write(vm, argc+1, pargs);
-  if (pargs != args) free(pargs);
+  if (pargs != args) gc_scratch_free(pargs);
   return r;
 }
 
@@ -369,22 +390,64 @@ static Value io_flush(struct VM *vm, int argc, Value *argv) {
 static Value io_read(struct VM *vm, int argc, Value *argv) {
   Value in = is_file_box(g_in_box) ? g_in_box : g_stdin_box;
   /* build [in, ...fmts] */
-  Value *args = (Value*)malloc(sizeof(Value) * (argc + 1));
-  if (!args) return V_nil();
+  Value *args = gc_scratch((size_t)argc + 1);
   args[0] = in;
   for (int i = 0; i < argc; ++i) args[i+1] = argv[i];
   Value r = f_read(vm, argc + 1, args);
-  free(args);
+  gc_scratch_free(args);
   return r;
 }
 
+/* open(2) flags for an fopen mode string */
+static int mode_flags(const char *mode) {
+  int plus = strchr(mode, '+') != NULL;
+  switch (mode[0]) {
+    case 'w': return (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+    case 'a': return (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND;
+    default:  return plus ? O_RDWR : O_RDONLY;
+  }
+}
+
+/* A connected unix stream socket, for paths open(2) refuses with ENXIO. */
+static int connect_unix(const char *path) {
+  struct sockaddr_un sa;
+  if (strlen(path) >= sizeof(sa.sun_path)) { errno = ENAMETOOLONG; return -1; }
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  strcpy(sa.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0) { close(fd); return -1; }
+  return fd;
+}
+
+/* io.open(path [, mode [, {nonblocking=true}]]). A non-blocking open
+   never waits for a FIFO's other end and also connects to unix sockets;
+   its reads and writes are meant for async.read/async.write. */
 static Value io_open(struct VM *vm, int argc, Value *argv) {
   (void)vm;
   if (argc < 1 || argv[0].tag != VAL_STR) return V_nil();
   const char *path = argv[0].as.s->data;
   const char *mode = "r";
   if (argc >= 2 && argv[1].tag == VAL_STR) mode = argv[1].as.s->data;
-  FILE *fp = fopen(path, mode);
+  Value nbopt;
+  int nonblocking = argc >= 3 && argv[2].tag == VAL_TABLE &&
+                    tbl_get_public(argv[2].as.t, V_str_from_c("nonblocking"), &nbopt) &&
+                    as_truthy(nbopt);
+  FILE *fp;
+  if (nonblocking) {
+    int fd = open(path, mode_flags(mode) | O_NONBLOCK | O_CLOEXEC, 0666);
+    if (fd < 0 && errno == ENXIO) {
+      fd = connect_unix(path);
+      mode = "r+";
+      if (fd >= 0) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    if (fd < 0) return V_nil();
+    fp = fdopen(fd, mode);
+    if (!fp) { close(fd); return V_nil(); }
+  } else {
+    fp = fopen(path, mode);
+  }
   if (!fp) return V_nil(); /* would be (nil, err, code) */
   Value box = box_file(fp);      /* box_file also attaches methods */
   return box;
@@ -438,7 +501,6 @@ static Value io_output(struct VM *vm, int argc, Value *argv) {
 
 /* io.lines([filename] [, fmt...]) */
 static Value io_lines(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
 
   FILE *fp = NULL;
   int close_on_eof = 0;
@@ -478,11 +540,122 @@ static Value io_lines(struct VM *vm, int argc, Value *argv) {
 
   Value state = box_lines_state(ls);
   Value iter; iter.tag = VAL_CFUNC; iter.as.cfunc = lines_iter;
-  Value triple = V_table();
-  tbl_set_public(triple.as.t, V_int(1), iter);
-  tbl_set_public(triple.as.t, V_int(2), state);
-  tbl_set_public(triple.as.t, V_int(3), V_nil());
-  return triple;
+  Value out[3] = { iter, state, V_nil() };
+  return vm_return_values(vm, 3, out);
+}
+
+/* ===========================================================
+ *  fd-level access for async.read / async.write
+ * =========================================================== */
+
+int io_async_fd(Value fh) {
+  if (!is_file_box(fh) || is_closed_box(fh)) return -1;
+  FILE *fp = unbox_file(fh);
+  if (!fp) return -1;
+  int fd = fileno(fp);
+  int fl = fcntl(fd, F_GETFL);
+  if (fl >= 0 && !(fl & O_NONBLOCK)) fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+  return fd;
+}
+
+static NbBuf *nb_of(Value fh) {
+  Value nb;
+  if (tbl_get_public(fh.as.t, V_str_from_c(FH_NB), &nb) && nb.tag == VAL_CFUNC)
+    return (NbBuf*)nb.as.cfunc;
+  NbBuf *b = calloc(1, sizeof(NbBuf));
+  if (!b) return NULL;
+  nb = (Value){ .tag = VAL_CFUNC };
+  nb.as.cfunc = (CFunc)b;
+  tbl_set_public(fh.as.t, V_str_from_c(FH_NB), nb);
+  return b;
+}
+
+/* One read(2) into the buffer: 1 got data or EOF, 0 would block, -1 error. */
+static int nb_fill(NbBuf *b, int fd) {
+  if (b->len + 4096 > b->cap) {
+    size_t ncap = b->cap ? b->cap * 2 : 8192;
+    while (b->len + 4096 > ncap) ncap *= 2;
+    char *nd = realloc(b->data, ncap);
+    if (!nd) return -1;
+    b->data = nd; b->cap = ncap;
+  }
+  ssize_t n = read(fd, b->data + b->len, b->cap - b->len);
+  if (n > 0) { b->len += (size_t)n; return 1; }
+  if (n == 0) {
+    /* a FIFO reads as empty until its first writer opens it; only a
+       hangup (the last writer left) is its end of file */
+    struct stat st;
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+    if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) && poll(&p, 1, 0) == 0) return 0;
+    b->eof = 1;
+    return 1;
+  }
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+  return -1;
+}
+
+/* Moves the first n buffered bytes (dropping the last drop of them) into a string. */
+static Value nb_take(NbBuf *b, size_t n, size_t drop) {
+  Value v; v.tag = VAL_STR; v.as.s = Str_new_len(b->data, (int)(n - drop));
+  if (n) memmove(b->data, b->data + n, b->len - n);
+  b->len -= n;
+  return v;
+}
+
+/* Reads one fmt ("*l", "*L", "*a" or a byte count) without blocking:
+   1 with the result in *out (nil at end of file), 0 if the fd must
+   become readable first, -1 on error. */
+int io_try_read(Value fh, Value fmt, Value *out) {
+  int fd = io_async_fd(fh);
+  NbBuf *b = fd < 0 ? NULL : nb_of(fh);
+  if (!b) return -1;
+  long want = -1;
+  int keep_newline = 0, all = 0;
+  if (fmt.tag == VAL_INT || fmt.tag == VAL_NUM) {
+    want = fmt.tag == VAL_INT ? (long)fmt.as.i : (long)fmt.as.n;
+  } else if (fmt.tag == VAL_STR) {
+    const char *m = fmt.as.s->data;
+    if (*m == '*') m++;
+    keep_newline = *m == 'L';
+    all = *m == 'a';
+  }
+  for (;;) {
+    if (want >= 0) {
+      if ((size_t)want <= b->len || (b->eof && b->len > 0)) {
+        *out = nb_take(b, (size_t)want < b->len ? (size_t)want : b->len, 0);
+        return 1;
+      }
+    } else if (all) {
+      if (b->eof) { *out = nb_take(b, b->len, 0); return 1; }
+    } else {
+      char *nl = b->len ? memchr(b->data, '\n', b->len) : NULL;
+      if (nl) {
+        size_t n = (size_t)(nl - b->data) + 1;
+        *out = nb_take(b, n, keep_newline ? 0 : 1);
+        return 1;
+      }
+      if (b->eof && b->len > 0) { *out = nb_take(b, b->len, 0); return 1; }
+    }
+    if (b->eof) { *out = V_nil(); return 1; }
+    int r = nb_fill(b, fd);
+    if (r <= 0) return r;
+  }
+}
+
+/* Writes s[*done..len) without blocking: 1 once all of it is written,
+   0 if the fd must become writable first, -1 on error. */
+int io_try_write(Value fh, const char *s, size_t len, size_t *done) {
+  int fd = io_async_fd(fh);
+  if (fd < 0) return -1;
+  FILE *fp = unbox_file(fh);
+  if (fp) fflush(fp);
+  while (*done < len) {
+    ssize_t n = write(fd, s + *done, len - *done);
+    if (n >= 0) { *done += (size_t)n; continue; }
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+    return -1;
+  }
+  return 1;
 }
 
 /* ===========================================================
@@ -490,6 +663,9 @@ static Value io_lines(struct VM *vm, int argc, Value *argv) {
  * =========================================================== */
 
 void register_io_lib(struct VM *vm) {
+  gc_root(&g_stdin_box); gc_root(&g_stdout_box); gc_root(&g_stderr_box);
+  gc_root(&g_in_box); gc_root(&g_out_box);
+
   /* std streams */
   g_stdin_box  = box_file(stdin);
   g_stdout_box = box_file(stdout);
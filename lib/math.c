@@ -288,15 +288,13 @@ static Value m_rad(struct VM*vm,int argc,Value*argv){
   return V_num(to_double(argv[0]) * (M_PI/180.0));
 }
 
-/* ---- modf(x) -> {intpart, fracpart} ---- */
+/* ---- modf(x) -> intpart, fracpart ---- */
 static Value m_modf(struct VM*vm,int argc,Value*argv){
-  (void)vm; if(argc<1||!is_num(argv[0])) return V_nil();
+  if(argc<1||!is_num(argv[0])) return V_nil();
   double x = to_double(argv[0]);
   double ip; double fp = modf(x, &ip);
-  Value t = V_table();
-  tbl_set_public(t.as.t, V_int(1), ret_num_like(argv[0], ip));
-  tbl_set_public(t.as.t, V_int(2), V_num(fp));
-  return t;
+  Value out[2] = { ret_num_like(argv[0], ip), V_num(fp) };
+  return vm_return_values(vm, 2, out);
 }
 
 /* ---- random / randomseed ---- */
@@ -43,18 +43,13 @@ static int get_table_bool(Table *t, const char *key, int *out) {
   return 0;
 }
 
-static Value tuple3(Value a, Value b, Value c){
-  Value t = V_table();
-  tbl_set_public(t.as.t, V_int(1), a);
-  tbl_set_public(t.as.t, V_int(2), b);
-  tbl_set_public(t.as.t, V_int(3), c);
-  return t;
+static Value tuple3(struct VM *vm, Value a, Value b, Value c){
+  Value out[3] = { a, b, c };
+  return vm_return_values(vm, 3, out);
 }
-static Value tuple2(Value a, Value b){
-  Value t = V_table();
-  tbl_set_public(t.as.t, V_int(1), a);
-  tbl_set_public(t.as.t, V_int(2), b);
-  return t;
+static Value tuple2(struct VM *vm, Value a, Value b){
+  Value out[2] = { a, b };
+  return vm_return_values(vm, 2, out);
 }
 
 /* -------------------------------------------------------
@@ -142,46 +137,43 @@ static Value os_getenv(struct VM *vm, int argc, Value *argv) {
 /* -------------------------------------------------------
  * os.execute([cmd])
  * Lua 5.4 semantics (adapted to tuple-table):
- *  - no arg: returns {true} if a shell is available, else {false}
- *  - success (normal exit): {true, "exit", code}
- *  - signaled (POSIX): {nil, "signal", signo}
- *  - failure to run: {nil, "execute failed", errno}
+ *  - no arg: returns true if a shell is available, else false
+ *  - success (normal exit): true, "exit", code
+ *  - signaled (POSIX): nil, "signal", signo
+ *  - failure to run: nil, "execute failed", errno
  * ------------------------------------------------------- */
 static Value os_execute(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
 
   if (argc < 1 || argv[0].tag == VAL_NIL) {
     int ok = system(NULL);
-    Value t = V_table();
-    tbl_set_public(t.as.t, V_int(1), V_bool(ok ? 1 : 0));
-    return t;
+    return V_bool(ok ? 1 : 0);
   }
-  if (argv[0].tag != VAL_STR) return tuple2(V_nil(), V_str_from_c("invalid command"));
+  if (argv[0].tag != VAL_STR) return tuple2(vm, V_nil(), V_str_from_c("invalid command"));
 
   errno = 0;
   int st = system(argv[0].as.s->data);
 
 #if defined(_WIN32)
   if (st == -1) {
-    return tuple3(V_nil(), V_str_from_c("execute failed"), V_int(errno));
+    return tuple3(vm, V_nil(), V_str_from_c("execute failed"), V_int(errno));
   }
   /* On Windows, system returns exit code (implementation-defined).
      We treat >=0 as normal exit. */
-  return tuple3(V_bool(1), V_str_from_c("exit"), V_int((long long)st));
+  return tuple3(vm, V_bool(1), V_str_from_c("exit"), V_int((long long)st));
 #else
   if (st == -1) {
-    return tuple3(V_nil(), V_str_from_c("execute failed"), V_int(errno));
+    return tuple3(vm, V_nil(), V_str_from_c("execute failed"), V_int(errno));
   }
   if (WIFEXITED(st)) {
     int code = WEXITSTATUS(st);
-    return tuple3(V_bool(1), V_str_from_c("exit"), V_int(code));
+    return tuple3(vm, V_bool(1), V_str_from_c("exit"), V_int(code));
   }
   if (WIFSIGNALED(st)) {
     int sig = WTERMSIG(st);
-    return tuple3(V_nil(), V_str_from_c("signal"), V_int(sig));
+    return tuple3(vm, V_nil(), V_str_from_c("signal"), V_int(sig));
   }
   /* Fallback: unknown status */
-  return tuple3(V_nil(), V_str_from_c("unknown"), V_int(st));
+  return tuple3(vm, V_nil(), V_str_from_c("unknown"), V_int(st));
 #endif
 }
 
@@ -202,39 +194,29 @@ static Value os_exit(struct VM *vm, int argc, Value *argv) {
 
 /* -------------------------------------------------------
  * os.remove(path)
- * Success: {true}
- * Failure: {nil, errmsg, errno}
+ * Success: true
+ * Failure: nil, errmsg, errno
  * ------------------------------------------------------- */
 static Value os_remove(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
-  if (argc < 1 || argv[0].tag != VAL_STR) return tuple2(V_nil(), V_str_from_c("invalid path"));
+  if (argc < 1 || argv[0].tag != VAL_STR) return tuple2(vm, V_nil(), V_str_from_c("invalid path"));
   errno = 0;
   int rc = remove(argv[0].as.s->data);
-  if (rc == 0) {
-    Value t = V_table();
-    tbl_set_public(t.as.t, V_int(1), V_bool(1));
-    return t;
-  }
-  return tuple3(V_nil(), V_str_from_c(strerror(errno)), V_int(errno));
+  if (rc == 0) return V_bool(1);
+  return tuple3(vm, V_nil(), V_str_from_c(strerror(errno)), V_int(errno));
 }
 
 /* -------------------------------------------------------
  * os.rename(old, new)
- * Success: {true}
- * Failure: {nil, errmsg, errno}
+ * Success: true
+ * Failure: nil, errmsg, errno
  * ------------------------------------------------------- */
 static Value os_rename(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
   if (argc < 2 || argv[0].tag != VAL_STR || argv[1].tag != VAL_STR)
-    return tuple2(V_nil(), V_str_from_c("invalid arguments"));
+    return tuple2(vm, V_nil(), V_str_from_c("invalid arguments"));
   errno = 0;
   int rc = rename(argv[0].as.s->data, argv[1].as.s->data);
-  if (rc == 0) {
-    Value t = V_table();
-    tbl_set_public(t.as.t, V_int(1), V_bool(1));
-    return t;
-  }
-  return tuple3(V_nil(), V_str_from_c(strerror(errno)), V_int(errno));
+  if (rc == 0) return V_bool(1);
+  return tuple3(vm, V_nil(), V_str_from_c(strerror(errno)), V_int(errno));
 }
 
 /* -------------------------------------------------------
@@ -8,6 +8,7 @@
 #include <sys/stat.h>
 
 #include "../include/interpreter.h"   // brings interpreter.h / Value / CFunc etc.
+#include "../include/gc.h"
 
 /* If you have a real file loader, compile with -DHAVE_VM_LOAD_AND_RUN_FILE
    and provide: Value vm_load_and_run_file(VM*, const char*, const char*);
@@ -249,7 +250,7 @@ static Table *g_pkg = NULL;
 static void ensure_package_initialized(VM *vm);
 
 /* ===== Searchers =====
-   searcher(name) -> { loader_func, extra... }  OR  "error string"
+   searcher(name) -> loader_func, extra...  OR  "error string"
 */
 
 /* searcher 1: package.preload[name] */
@@ -265,10 +266,8 @@ static Value pkg_preload_searcher(VM *vm, int argc, Value *argv) {
 
   Value loader;
   if (tbl_get(preload.as.t, argv[0], &loader) && loader.tag == VAL_CFUNC) {
-    Value tup = V_table();               /* { loader, modname } */
-    tbl_set(tup.as.t, V_int(1), loader);
-    tbl_set(tup.as.t, V_int(2), argv[0]);
-    return tup;
+    Value out[2] = { loader, argv[0] };  /* loader, modname */
+    return vm_return_values(vm, 2, out);
   }
 
   return V_str_from_c("preload searcher: not found in package.preload");
@@ -321,13 +320,12 @@ static Value pkg_filesystem_searcher(VM *vm, int argc, Value *argv) {
     return V_str_from_c("filesystem searcher: not found in package.path");
   }
 
-  /* Return { loader_func, path } */
-  Value tup = V_table();
-  Value loader; loader.tag = VAL_CFUNC; loader.as.cfunc = lua_file_loader;
-  tbl_set(tup.as.t, V_int(1), loader);
-  tbl_set(tup.as.t, V_int(2), V_str_from_c(acc.found));
+  /* Return loader_func, path */
+  Value out[2];
+  out[0].tag = VAL_CFUNC; out[0].as.cfunc = lua_file_loader;
+  out[1] = V_str_from_c(acc.found);
   free(acc.found);
-  return tup;
+  return vm_return_values(vm, 2, out);
 }
 
 /* ---- C loader via loadlib ---- */
@@ -453,16 +451,15 @@ static Value pkg_clib_searcher(VM *vm, int argc, Value *argv) {
     return V_str_from_c("clib searcher: not found in package.cpath");
   }
 
-  /* Return { loader_func, path, initname } */
-  Value tup = V_table();
-  Value loader; loader.tag = VAL_CFUNC; loader.as.cfunc = c_module_loader;
-  tbl_set(tup.as.t, V_int(1), loader);
-  tbl_set(tup.as.t, V_int(2), V_str_from_c(acc.found));
-  tbl_set(tup.as.t, V_int(3), V_str_from_c(initname));
+  /* Return loader_func, path, initname */
+  Value out[3];
+  out[0].tag = VAL_CFUNC; out[0].as.cfunc = c_module_loader;
+  out[1] = V_str_from_c(acc.found);
+  out[2] = V_str_from_c(initname);
 
   free(acc.found);
   free(initname);
-  return tup;
+  return vm_return_values(vm, 3, out);
 }
 
 /* loader that calls package.loadlib(found, initname), then calls the cfunc.
@@ -540,30 +537,29 @@ Value builtin_require(VM *vm, int argc, Value *argv) {
     idx++;
     if (s.tag != VAL_CFUNC) continue;
 
-    Value res = call_any_public(vm, s, 1, &modname);
-
-    if (res.tag == VAL_TABLE) {
-      /* { loader, extra1, extra2? } */
-      Value loader, extra1, extra2;
-      (void)tbl_get(res.as.t, V_int(1), &loader);
-      (void)tbl_get(res.as.t, V_int(2), &extra1);
-      (void)tbl_get(res.as.t, V_int(3), &extra2);
-      if (loader.tag == VAL_CFUNC) {
-        Value args[3]; int cargc = 1;
-        args[0] = modname;
-        if (extra1.tag != VAL_NIL) args[cargc++] = extra1;
-        if (extra2.tag != VAL_NIL) args[cargc++] = extra2;
-
-        Value module_val = call_any_public(vm, loader, cargc, args);
-
-        /* If loader returns nil, store true */
-        if (module_val.tag == VAL_NIL) {
-          tbl_set(loaded.as.t, modname, V_bool(true));
-          return V_bool(true);
-        } else {
-          tbl_set(loaded.as.t, modname, module_val);
-          return module_val;
-        }
+    /* loader, extra1, extra2? -- or a message */
+    int base = vm->top;
+    int n = call_multi(vm, s, 1, &modname);
+    Value res = n > 0 ? vm->stack[base] : V_nil();
+    Value extra1 = n > 1 ? vm->stack[base + 1] : V_nil();
+    Value extra2 = n > 2 ? vm->stack[base + 2] : V_nil();
+    vm->top = base;
+
+    if (res.tag == VAL_CFUNC) {
+      Value args[3]; int cargc = 1;
+      args[0] = modname;
+      if (extra1.tag != VAL_NIL) args[cargc++] = extra1;
+      if (extra2.tag != VAL_NIL) args[cargc++] = extra2;
+
+      Value module_val = call_any_public(vm, res, cargc, args);
+
+      /* If loader returns nil, store true */
+      if (module_val.tag == VAL_NIL) {
+        tbl_set(loaded.as.t, modname, V_bool(true));
+        return V_bool(true);
+      } else {
+        tbl_set(loaded.as.t, modname, module_val);
+        return module_val;
       }
     } else if (res.tag == VAL_STR) {
       /* append message */
@@ -603,11 +599,14 @@ Value builtin_require(VM *vm, int argc, Value *argv) {
 
 /* ===== init & public API ===== */
 
+static void mark_package(void) { gc_mark(g_pkg); }
+
 static void ensure_package_initialized(VM *vm) {
   if (g_pkg) return;
 
   Value pkgV = V_table();
   g_pkg = pkgV.as.t;
+  gc_root_fn(mark_package);
 
   /* seed fields */
   tbl_set(g_pkg, V_str_from_c("loaded"),    V_table());
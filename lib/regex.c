@@ -11,14 +11,7 @@
 
 /* Helper to create string from buffer */
 static Value V_str_copy_n(const char *src, size_t n) {
-  Str *s = (Str*)malloc(sizeof(Str));
-  if (!s) { fprintf(stderr,"OOM\n"); exit(1); }
-  s->len = (int)n;
-  s->data = (char*)malloc(n + 1);
-  if (!s->data) { fprintf(stderr,"OOM\n"); exit(1); }
-  if (n) memcpy(s->data, src, n);
-  s->data[n] = '\0';
-  Value v; v.tag = VAL_STR; v.as.s = s; return v;
+  Value v; v.tag = VAL_STR; v.as.s = Str_new_len(src, (int)n); return v;
 }
 
 /* regex.compile(pattern [, flags]) -> regex object or nil */
@@ -126,31 +119,25 @@ static Value regex_match(struct VM *vm, int argc, Value *argv) {
   return result;
 }
 
-/* regex.find(regex_obj, string [, offset]) -> {start, end, captures...} or nil */
+/* regex.find(regex_obj, string [, offset]) -> start, end, captures... or nil */
 static Value regex_find(struct VM *vm, int argc, Value *argv) {
   Value match_result = regex_match(vm, argc, argv);
   if (match_result.tag == VAL_NIL) return V_nil();
   
-  /* Convert to find-style result */
-  Value result = V_table();
-  Value start_val, end_val;
+  /* Convert to find-style results */
+  Value out[MAX_MATCHES + 1];
+  int n = 2;
   
-  if (tbl_get_public(match_result.as.t, V_str_from_c("start"), &start_val))
-    tbl_set_public(result.as.t, V_int(1), start_val);
-  if (tbl_get_public(match_result.as.t, V_str_from_c("end"), &end_val))
-    tbl_set_public(result.as.t, V_int(2), end_val);
+  if (!tbl_get_public(match_result.as.t, V_str_from_c("start"), &out[0])) out[0] = V_nil();
+  if (!tbl_get_public(match_result.as.t, V_str_from_c("end"), &out[1])) out[1] = V_nil();
   
-  /* Copy captures starting at index 3 */
+  /* Then the captures */
   for (int i = 1; i < MAX_MATCHES; i++) {
-    Value cap;
-    if (tbl_get_public(match_result.as.t, V_int(i), &cap)) {
-      tbl_set_public(result.as.t, V_int(i + 2), cap);
-    } else {
-      break;
-    }
+    if (!tbl_get_public(match_result.as.t, V_int(i), &out[n])) break;
+    n++;
   }
   
-  return result;
+  return vm_return_values(vm, n, out);
 }
 
 /* regex.test(regex_obj, string) -> boolean */
@@ -167,7 +154,7 @@ static Value regex_test(struct VM *vm, int argc, Value *argv) {
   return V_bool(ret == 0);
 }
 
-/* regex.gsub(regex_obj, string, replacement [, limit]) -> {string, count} */
+/* regex.gsub(regex_obj, string, replacement [, limit]) -> string, count */
 static Value regex_gsub(struct VM *vm, int argc, Value *argv) {
   if (argc < 3 || argv[1].tag != VAL_STR) return V_nil();
   
@@ -298,19 +285,15 @@ static Value regex_gsub(struct VM *vm, int argc, Value *argv) {
     result_len = new_len;
   }
   
-  /* Return {string, count} */
-  Value ret = V_table();
+  /* Return string, count */
+  Value ret[2] = { argv[1], V_int(count) };
   if (result) {
     result[result_len] = '\0';
-    Value result_str = V_str_copy_n(result, result_len);
+    ret[0] = V_str_copy_n(result, result_len);
     free(result);
-    tbl_set_public(ret.as.t, V_int(1), result_str);
-  } else {
-    tbl_set_public(ret.as.t, V_int(1), argv[1]);
   }
-  tbl_set_public(ret.as.t, V_int(2), V_int(count));
   
-  return ret;
+  return vm_return_values(vm, 2, ret);
 }
 
 /* regex.free(regex_obj) */
@@ -7,6 +7,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "../include/interpreter.h"
+#include "../include/gc.h"
 #include "regex.h"
 
 /* Maximum number of captures */
@@ -14,14 +15,7 @@
 
 /* ---- safe string builder into VM Str ---- */
 static Value V_str_copy_n(const char *src, size_t n) {
-  Str *s = (Str*)malloc(sizeof(Str));
-  if (!s) { fprintf(stderr,"OOM\n"); exit(1); }
-  s->len = (int)n;
-  s->data = (char*)malloc(n + 1);
-  if (!s->data) { fprintf(stderr,"OOM\n"); exit(1); }
-  if (n) memcpy(s->data, src, n);
-  s->data[n] = '\0';
-  Value v; v.tag = VAL_STR; v.as.s = s; return v;
+  Value v; v.tag = VAL_STR; v.as.s = Str_new_len(src, (int)n); return v;
 }
 
 /* helpers */
@@ -448,7 +442,6 @@ static Value str_rep(struct VM *vm, int argc, Value *argv) {
 
 /* string.byte(s [, i [, j]]) */
 static Value str_byte(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
   if (argc < 1 || argv[0].tag != VAL_STR) return V_nil();
   Str *in = argv[0].as.s;
   int len = in->len;
@@ -470,15 +463,15 @@ static Value str_byte(struct VM *vm, int argc, Value *argv) {
   i = clamp(i, 1, len);
   j = clamp(j, 1, len);
   
-  if (j < i) return V_table();
+  if (j < i || len == 0) return vm_return_values(vm, 0, NULL);
   
-  Value t = V_table();
-  int k = 1;
+  int base = vm->top;
+  vm_stack_check(vm, j - i + 1);
   for (int pos = i; pos <= j; ++pos) {
     unsigned char b = (unsigned char)in->data[pos - 1];
-    tbl_set_public(t.as.t, V_int(k++), V_int((long long)b));
+    vm->stack[vm->top++] = V_int((long long)b);
   }
-  return t;
+  return V_multi(base, j - i + 1);
 }
 
 /* string.char(...) */
@@ -505,7 +498,6 @@ static Value str_char(struct VM *vm, int argc, Value *argv) {
 
 /* string.find(s, pattern [, init [, plain]]) */
 static Value str_find(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
   if (argc < 2 || argv[0].tag != VAL_STR || argv[1].tag != VAL_STR) 
     return V_nil();
   
@@ -535,10 +527,8 @@ static Value str_find(struct VM *vm, int argc, Value *argv) {
     if (found) {
       int start = (int)(found - s) + 1;
       int end = start + (int)pl - 1;
-      Value t = V_table();
-      tbl_set_public(t.as.t, V_int(1), V_int(start));
-      tbl_set_public(t.as.t, V_int(2), V_int(end));
-      return t;
+      Value out[2] = { V_int(start), V_int(end) };
+      return vm_return_values(vm, 2, out);
     }
     return V_nil();
   } else {
@@ -562,18 +552,17 @@ static Value str_find(struct VM *vm, int argc, Value *argv) {
       if (s2 != NULL) {
         int start = (int)(s1 - s) + 1;
         int end = (int)(s2 - s);
-        Value t = V_table();
-        tbl_set_public(t.as.t, V_int(1), V_int(start));
-        tbl_set_public(t.as.t, V_int(2), V_int(end));
+        Value out[LUA_MAXCAPTURES + 2];
+        out[0] = V_int(start);
+        out[1] = V_int(end);
         
         /* Add captures */
         for (int i = 0; i < ms.level; i++) {
-          if (ms.capture[i].len >= 0) {
-            Value cap = V_str_copy_n(ms.capture[i].init, (size_t)ms.capture[i].len);
-            tbl_set_public(t.as.t, V_int(i + 3), cap);
-          }
+          out[i + 2] = ms.capture[i].len >= 0
+            ? V_str_copy_n(ms.capture[i].init, (size_t)ms.capture[i].len)
+            : V_nil();
         }
-        return t;
+        return vm_return_values(vm, ms.level + 2, out);
       }
     } while (s1++ < ms.src_end && !anchor);
     
@@ -588,7 +577,6 @@ static Value str_find(struct VM *vm, int argc, Value *argv) {
  * If the VM doesn't support this, callers must explicitly index the table.
  */
 static Value str_match(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
   if (argc < 2 || argv[0].tag != VAL_STR || argv[1].tag != VAL_STR) 
     return V_nil();
   
@@ -634,25 +622,20 @@ static Value str_match(struct VM *vm, int argc, Value *argv) {
           /* Position capture */
           return V_int((long long)ms.capture[0].len);
         } else {
-          /* Multiple captures: return as array-like table */
-          /* The VM must support unpacking this for: local a, b = match(...) */
-          Value t = V_table();
+          /* Multiple captures: one value each */
+          Value out[LUA_MAXCAPTURES];
           
           for (int i = 0; i < ms.level; i++) {
             if (ms.capture[i].len >= 0) {
               /* String capture */
-              Value cap = V_str_copy_n(ms.capture[i].init, (size_t)ms.capture[i].len);
-              tbl_set_public(t.as.t, V_int(i + 1), cap);
+              out[i] = V_str_copy_n(ms.capture[i].init, (size_t)ms.capture[i].len);
             } else {
               /* Position capture - return as integer */
-              tbl_set_public(t.as.t, V_int(i + 1), V_int((long long)ms.capture[i].len));
+              out[i] = V_int((long long)ms.capture[i].len);
             }
           }
           
-          /* Store count for unpacking */
-          tbl_set_public(t.as.t, V_str_from_c("n"), V_int(ms.level));
-          
-          return t;
+          return vm_return_values(vm, ms.level, out);
         }
       } else {
         /* No captures: return whole match as string */
@@ -666,7 +649,6 @@ static Value str_match(struct VM *vm, int argc, Value *argv) {
 }
 /* Iterator state for gmatch (simple, global static pos) */
 static Value gmatch_next(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
   if (argc < 2 || argv[0].tag != VAL_STR || argv[1].tag != VAL_STR) 
     return V_nil();
     
@@ -701,14 +683,13 @@ static Value gmatch_next(struct VM *vm, int argc, Value *argv) {
             return V_str_copy_n(ms.capture[0].init, (size_t)ms.capture[0].len);
           }
         } else {
-          Value t = V_table();
+          Value out[LUA_MAXCAPTURES];
           for (int i = 0; i < ms.level; i++) {
-            if (ms.capture[i].len >= 0) {
-              Value cap = V_str_copy_n(ms.capture[i].init, (size_t)ms.capture[i].len);
-              tbl_set_public(t.as.t, V_int(i + 1), cap);
-            }
+            out[i] = ms.capture[i].len >= 0
+              ? V_str_copy_n(ms.capture[i].init, (size_t)ms.capture[i].len)
+              : V_nil();
           }
-          return t;
+          return vm_return_values(vm, ms.level, out);
         }
       } else {
         size_t match_len = (size_t)(s2 - s1);
@@ -817,8 +798,7 @@ static void gsub_expand_repl(VM *vm,
   if (repl.tag == VAL_FUNC || repl.tag == VAL_CFUNC) {
     /* call with captures if any; else whole match */
     int argc = (ms->level > 0) ? ms->level : 1;
-    Value *args = (Value*)malloc(sizeof(Value)*argc);
-    if (!args) { fprintf(stderr,"OOM\n"); exit(1); }
+    Value *args = gc_scratch((size_t)argc);
     if (ms->level > 0) {
       for (int i = 0; i < ms->level; i++) {
         if (ms->capture[i].len >= 0) {
@@ -829,7 +809,7 @@ static void gsub_expand_repl(VM *vm,
       args[0] = V_str_copy_n(match_start, (size_t)(match_end - match_start));
     }
     Value rv = call_any_public(vm, repl, argc, args);
-    free(args);
+    gc_scratch_free(args);
     if (rv.tag == VAL_STR) {
       gb_append_n(out, olen, ocap, rv.as.s->data, (size_t)rv.as.s->len);
     }
@@ -838,7 +818,7 @@ static void gsub_expand_repl(VM *vm,
   /* other types: append nothing */
 }
 
-/* string.gsub(s, pattern, repl [, n]) -> {string, count} */
+/* string.gsub(s, pattern, repl [, n]) -> string, count */
 static Value str_gsub(struct VM *vm, int argc, Value *argv) {
   if (argc < 3 || argv[0].tag != VAL_STR || argv[1].tag != VAL_STR) 
     return V_nil();
@@ -903,19 +883,13 @@ static Value str_gsub(struct VM *vm, int argc, Value *argv) {
 
   /* no changes? return original and 0 */
   if (!out) {
-    Value ret = V_table();
-    tbl_set_public(ret.as.t, V_int(1), argv[0]);
-    tbl_set_public(ret.as.t, V_int(2), V_int(0));
-    return ret;
+    Value ret[2] = { argv[0], V_int(0) };
+    return vm_return_values(vm, 2, ret);
   }
 
-  Value outstr = V_str_copy_n(out, olen);
+  Value ret[2] = { V_str_copy_n(out, olen), V_int(count) };
   free(out);
-
-  Value ret = V_table();
-  tbl_set_public(ret.as.t, V_int(1), outstr);
-  tbl_set_public(ret.as.t, V_int(2), V_int(count));
-  return ret;
+  return vm_return_values(vm, 2, ret);
 }
 
 /* ========= string.format ========= */
@@ -1205,9 +1179,8 @@ static regex_t* compile_regex_cached(const char *pattern, int cflags) {
     return preg;
 }
 
-/* string.refind(s, pattern [, init [, flags]]) -> {start, end, captures...} or nil */
+/* string.refind(s, pattern [, init [, flags]]) -> start, end, captures... or nil */
 static Value str_refind(struct VM *vm, int argc, Value *argv) {
-    (void)vm;
     if (argc < 2 || argv[0].tag != VAL_STR || argv[1].tag != VAL_STR) 
         return V_nil();
     
@@ -1252,30 +1225,21 @@ static Value str_refind(struct VM *vm, int argc, Value *argv) {
     if (ret == REG_NOMATCH) return V_nil();
     if (ret != 0) return V_nil();
     
-    /* Build result table {start, end, capture1, capture2, ...} */
-    Value t = V_table();
-    
-    if (matches[0].rm_so != -1) {
-        int start = (int)matches[0].rm_so + init;
-        int end = (int)matches[0].rm_eo + init - 1;
-        tbl_set_public(t.as.t, V_int(1), V_int(start));
-        tbl_set_public(t.as.t, V_int(2), V_int(end));
-        
-        /* Add captures starting at index 3 */
-        int idx = 3;
-        for (int i = 1; i < LUA_MAXCAPTURES && matches[i].rm_so != -1; i++) {
-            Value cap = V_str_copy_n(s + init - 1 + matches[i].rm_so,
-                                    (size_t)(matches[i].rm_eo - matches[i].rm_so));
-            tbl_set_public(t.as.t, V_int(idx++), cap);
-        }
+    /* Return start, end, capture1, capture2, ... */
+    if (matches[0].rm_so == -1) return V_nil();
+    Value out[LUA_MAXCAPTURES + 1];
+    int n = 0;
+    out[n++] = V_int((int)matches[0].rm_so + init);
+    out[n++] = V_int((int)matches[0].rm_eo + init - 1);
+    for (int i = 1; i < LUA_MAXCAPTURES && matches[i].rm_so != -1; i++) {
+        out[n++] = V_str_copy_n(s + init - 1 + matches[i].rm_so,
+                                (size_t)(matches[i].rm_eo - matches[i].rm_so));
     }
-    
-    return t;
+    return vm_return_values(vm, n, out);
 }
 
-/* string.rematch(s, pattern [, init [, flags]]) -> match or {captures...} or nil */
+/* string.rematch(s, pattern [, init [, flags]]) -> match or captures... or nil */
 static Value str_rematch(struct VM *vm, int argc, Value *argv) {
-    (void)vm;
     if (argc < 2 || argv[0].tag != VAL_STR || argv[1].tag != VAL_STR) 
         return V_nil();
     
@@ -1333,14 +1297,13 @@ static Value str_rematch(struct VM *vm, int argc, Value *argv) {
             return V_str_copy_n(s + init - 1 + matches[1].rm_so,
                               (size_t)(matches[1].rm_eo - matches[1].rm_so));
         } else {
-            /* Multiple captures: return as table */
-            Value t = V_table();
+            /* Multiple captures: one value each */
+            Value out[LUA_MAXCAPTURES];
             for (int i = 1; i <= capture_count; i++) {
-                Value cap = V_str_copy_n(s + init - 1 + matches[i].rm_so,
-                                        (size_t)(matches[i].rm_eo - matches[i].rm_so));
-                tbl_set_public(t.as.t, V_int(i), cap);
+                out[i - 1] = V_str_copy_n(s + init - 1 + matches[i].rm_so,
+                                          (size_t)(matches[i].rm_eo - matches[i].rm_so));
             }
-            return t;
+            return vm_return_values(vm, capture_count, out);
         }
     }
     
@@ -1353,7 +1316,7 @@ static Value str_rematch(struct VM *vm, int argc, Value *argv) {
     return V_nil();
 }
 
-/* string.regsub(s, pattern, repl [, n [, flags]]) -> {string, count} */
+/* string.regsub(s, pattern, repl [, n [, flags]]) -> string, count */
 static Value str_regsub(struct VM *vm, int argc, Value *argv) {
     if (argc < 3 || argv[0].tag != VAL_STR || argv[1].tag != VAL_STR) 
         return V_nil();
@@ -1494,18 +1457,14 @@ static Value str_regsub(struct VM *vm, int argc, Value *argv) {
     regfree(preg);
     free(preg);
     
-    /* Return {string, count} */
-    Value ret = V_table();
+    /* Return string, count */
+    Value ret[2] = { argv[0], V_int(count) };
     if (out) {
-        Value result_str = V_str_copy_n(out, olen);
+        ret[0] = V_str_copy_n(out, olen);
         free(out);
-        tbl_set_public(ret.as.t, V_int(1), result_str);
-    } else {
-        tbl_set_public(ret.as.t, V_int(1), argv[0]);
     }
-    tbl_set_public(ret.as.t, V_int(2), V_int(count));
     
-    return ret;
+    return vm_return_values(vm, 2, ret);
 }
 
 /* string.retest(s, pattern [, flags]) -> boolean */
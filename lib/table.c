@@ -5,6 +5,7 @@
 #include <math.h>
 #include <limits.h>
 #include "../include/interpreter.h"
+#include "../include/gc.h"
 
 /* Maximum values for Lua compatibility */
 #define MAX_INT   ((1LL << 53) - 1)  /* 2^53 - 1, max safe integer in double */
@@ -21,36 +22,11 @@ static char *sdup(const char *s) {
 }
 
 
-/* does t[i] exist and is non-nil? (1-indexed) */
-static int index_present(Table *t, int i) {
-  if (!t || i < 1) return 0;
-  Value tmp;
-  return tbl_get_public(t, V_int(i), &tmp) && tmp.tag != VAL_NIL;
-}
-
-/* Get the length of array part (1-indexed contiguous sequence).
-   Safe on empty/holey arrays, never probes index 0, never returns negative. */
+/* Length of the sequence part (a border, O(1) via the table's array part). */
 static int get_array_length(Table *t) {
   if (!t) return 0;
-
-  if (!index_present(t, 1)) return 0;   /* quick exit: empty array */
-
-  int lo = 1;
-  int hi = 2;
-
-  /* Find an upper bound where element is absent */
-  while (index_present(t, hi)) {
-    if (hi > INT_MAX / 2) { hi = INT_MAX; break; } /* clamp growth */
-    lo = hi;
-    hi *= 2;
-  }
-
-  /* Binary search between (lo, hi]; invariant: present(lo)=true, present(hi)=false */
-  while (lo + 1 < hi) {
-    int mid = lo + (hi - lo) / 2;
-    if (index_present(t, mid)) lo = mid; else hi = mid;
-  }
-  return lo;
+  long long n = tbl_len(t);
+  return n > INT_MAX ? INT_MAX : (int)n;
 }
 
 /* Check if value can be converted to integer */
@@ -104,9 +80,7 @@ static char *value_to_string(Value v) {
     case VAL_TABLE:  return sdup("table");
     case VAL_FUNC:   return sdup("function");
     case VAL_CFUNC:  return sdup("function");
-#ifdef VAL_COROUTINE
     case VAL_COROUTINE: return sdup("thread");
-#endif
     default:         return sdup("<unknown>");
   }
 }
@@ -149,10 +123,12 @@ static Value tbl_concat(struct VM *vm, int argc, Value *argv) {
   char **strings = (char**)malloc(sizeof(char*) * (size_t)count);
   if (!strings) return table_error("out of memory");
 
+  Value *arr = tbl_array_part(t, j);
   size_t total_len = 0;
   for (long long idx = 0; idx < count; idx++) {
     Value v;
-    if (!tbl_get_public(t, V_int((int)(i + idx)), &v)) v = V_nil();
+    if (arr) v = arr[i + idx - 1];
+    else if (!tbl_geti(t, i + idx, &v)) v = V_nil();
 
     if (v.tag != VAL_STR && v.tag != VAL_INT && v.tag != VAL_NUM) {
       for (long long k = 0; k < idx; k++) free(strings[k]);
@@ -218,11 +194,20 @@ static Value tbl_insert(struct VM *vm, int argc, Value *argv) {
   if (pos > (long long)n + 1) pos = (long long)n + 1;
   if (n >= MAXASIZE) return table_error("table overflow");
 
-  for (int i = n; i >= (int)pos; i--) {
-    Value v;
-    if (tbl_get_public(t, V_int(i), &v)) tbl_set_public(t, V_int(i + 1), v);
+  if (pos <= n) {
+    /* grow by the last element first, then shift the rest in place */
+    Value last; if (!tbl_geti(t, n, &last)) last = V_nil();
+    tbl_seti(t, (long long)n + 1, last);
+    Value *arr = tbl_array_part(t, (long long)n + 1);
+    if (arr) memmove(&arr[pos], &arr[pos - 1], sizeof(Value) * (size_t)(n - pos));
+    else {
+      for (int i = n - 1; i >= (int)pos; i--) {
+        Value v;
+        if (tbl_geti(t, i, &v)) tbl_seti(t, i + 1, v);
+      }
+    }
   }
-  tbl_set_public(t, V_int((int)pos), value);
+  tbl_seti(t, pos, value);
   return V_nil();
 }
 
@@ -290,14 +275,18 @@ static Value tbl_remove(struct VM *vm, int argc, Value *argv) {
   if (pos < 1 || pos > n) return V_nil();
 
   Value removed;
-  if (!tbl_get_public(t, V_int((int)pos), &removed)) removed = V_nil();
+  if (!tbl_geti(t, pos, &removed)) removed = V_nil();
 
-  for (long long i = pos; i < n; i++) {
-    Value v;
-    if (tbl_get_public(t, V_int((int)(i + 1)), &v)) tbl_set_public(t, V_int((int)i), v);
-    else tbl_set_public(t, V_int((int)i), V_nil());
+  Value *arr = tbl_array_part(t, n);
+  if (arr) memmove(&arr[pos - 1], &arr[pos], sizeof(Value) * (size_t)(n - pos));
+  else {
+    for (long long i = pos; i < n; i++) {
+      Value v;
+      if (!tbl_geti(t, i + 1, &v)) v = V_nil();
+      tbl_seti(t, i, v);
+    }
   }
-  tbl_set_public(t, V_int(n), V_nil());
+  tbl_seti(t, n, V_nil());
   return removed;
 }
 
@@ -315,6 +304,8 @@ static Value box_pairs_state(PairsState *ps) {
   Value p = { .tag = VAL_CFUNC };
   p.as.cfunc = (CFunc)ps;
   tbl_set_public(t.as.t, V_str_from_c(PAIRS_PTR), p);
+  /* the collector can't see into ps: keep the table reachable from the box */
+  tbl_set_public(t.as.t, V_str_from_c("_pairs_t"), ps->table);
   return t;
 }
 static PairsState* unbox_pairs_state(Value v) {
@@ -325,9 +316,8 @@ static PairsState* unbox_pairs_state(Value v) {
   return (PairsState*)p.as.cfunc;
 }
 
-/* iterator: returns {key, value} or nil */
+/* iterator: returns key, value or nil */
 static Value pairs_iter(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
   if (argc < 2) return V_nil();
   PairsState *st = unbox_pairs_state(argv[0]);
   if (!st || st->table.tag != VAL_TABLE) return V_nil();
@@ -340,19 +330,16 @@ static Value pairs_iter(struct VM *vm, int argc, Value *argv) {
     Value v;
     if (tbl_get_public(t, V_int(i), &v) && v.tag != VAL_NIL) {
       st->last = i;
-      Value pair = V_table();
-      tbl_set_public(pair.as.t, V_int(1), V_int(i));
-      tbl_set_public(pair.as.t, V_int(2), v);
-      return pair;
+      Value out[2] = { V_int(i), v };
+      return vm_return_values(vm, 2, out);
     }
     i++;
   }
   return V_nil();
 }
 
-/* table.pairs(t) -> iterator triple */
+/* table.pairs(t) -> iter, state, nil */
 static Value tbl_pairs(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
   if (argc < 1 || argv[0].tag != VAL_TABLE)
     return table_error("bad argument #1 to 'pairs' (table expected)");
 
@@ -364,11 +351,8 @@ static Value tbl_pairs(struct VM *vm, int argc, Value *argv) {
   Value state = box_pairs_state(st);
   Value iter; iter.tag = VAL_CFUNC; iter.as.cfunc = pairs_iter;
 
-  Value triple = V_table();
-  tbl_set_public(triple.as.t, V_int(1), iter);
-  tbl_set_public(triple.as.t, V_int(2), state);
-  tbl_set_public(triple.as.t, V_int(3), V_nil());
-  return triple;
+  Value out[3] = { iter, state, V_nil() };
+  return vm_return_values(vm, 3, out);
 }
 
 /* ---- sort ---- */
@@ -478,11 +462,14 @@ static Value tbl_sort(struct VM *vm, int argc, Value *argv) {
     else if (argv[1].tag != VAL_NIL) return table_error("bad argument #2 to 'sort' (function expected)");
   }
 
-  Value *arr = (Value*)malloc(sizeof(Value) * (size_t)n);
-  if (!arr) return table_error("out of memory");
+  Value *arr = gc_scratch((size_t)n);
 
-  for (int i = 0; i < n; i++) {
-    if (!tbl_get_public(t, V_int(i + 1), &arr[i])) arr[i] = V_nil();
+  Value *src = tbl_array_part(t, n);
+  if (src) memcpy(arr, src, sizeof(Value) * (size_t)n);
+  else {
+    for (int i = 0; i < n; i++) {
+      if (!tbl_geti(t, i + 1, &arr[i])) arr[i] = V_nil();
+    }
   }
 
   if (!has_comp) {
@@ -492,20 +479,17 @@ static Value tbl_sort(struct VM *vm, int argc, Value *argv) {
 
   quicksort(arr, 0, n - 1, vm, comp, has_comp);
 
-  for (int i = 0; i < n; i++) tbl_set_public(t, V_int(i + 1), arr[i]);
+  /* the comparator may have reshaped t, so look the array part up again */
+  Value *dst = tbl_array_part(t, n);
+  if (dst) { memcpy(dst, arr, sizeof(Value) * (size_t)n); gc_barrier(t); }
+  else for (int i = 0; i < n; i++) tbl_seti(t, i + 1, arr[i]);
 
-  free(arr);
+  gc_scratch_free(arr);
   return V_nil();
 }
 
-/* table.unpack(list [, i [, j]])
-   NOTE: Your VM currently supports only *single* return values.
-   Lua's unpack returns multiple values, which requires VM-level multi-return.
-   Until then, we return a table {1..(j-i+1)} so callers can do:
-     local tmp = table.unpack(t);  -- tmp is a packed array of values
-   When you add multi-return, replace this with actual multi returns. */
+/* table.unpack(list [, i [, j]]) -> list[i], ..., list[j] */
 static Value tbl_unpack(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
   if (argc < 1 || argv[0].tag != VAL_TABLE)
     return table_error("bad argument to 'unpack'");
 
@@ -516,16 +500,17 @@ static Value tbl_unpack(struct VM *vm, int argc, Value *argv) {
   if (argc >= 2 && !to_integer(argv[1], &i)) return table_error("bad argument #2 to 'unpack' (number expected)");
   if (argc >= 3 && !to_integer(argv[2], &j)) return table_error("bad argument #3 to 'unpack' (number expected)");
   if (i < 1) i = 1;
-  if (j < i) j = i - 1;
+  if (j < i) return vm_return_values(vm, 0, NULL);
+  if (j - i >= STACK_MAX) return table_error("too many results to unpack");
 
-  Value result = V_table();
-  long long k = 0;
-  for (long long idx = i; idx <= j; idx++) {
-    Value v; if (!tbl_get_public(t, V_int((int)idx), &v)) v = V_nil();
-    tbl_set_public(result.as.t, V_int((int)(++k)), v);
+  int n = (int)(j - i + 1), base = vm->top;
+  vm_stack_check(vm, n);
+  for (int k = 0; k < n; k++) {
+    Value v;
+    vm->stack[base + k] = tbl_get_public(t, V_int(i + k), &v) ? v : V_nil();
   }
-  tbl_set_public(result.as.t, V_str_from_c("n"), V_int((long long)k));
-  return result;
+  vm->top = base + n;
+  return V_multi(base, n);
 }
 
 /* ---- Lua 5.4 Compatibility Helpers (deprecated APIs) ---- */
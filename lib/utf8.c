@@ -211,7 +211,6 @@ static Value utf8_char(struct VM *vm, int argc, Value *argv) {
 
 /* ===== Iterator for utf8.codes(s) ===== */
 static Value utf8_codes_iter(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
   if (argc < 2) return V_nil();
   Value state = argv[0];
   Value ctrl  = argv[1];
@@ -239,14 +238,11 @@ static Value utf8_codes_iter(struct VM *vm, int argc, Value *argv) {
   int start_index = pos + 1;            // 1-based for Lua-side
   pos += adv;
 
-  Value pair = V_table();
-  tbl_set_public(pair.as.t, V_int(1), V_int((long long)start_index));
-  tbl_set_public(pair.as.t, V_int(2), V_int((long long)cp));
-  return pair;
+  Value out[2] = { V_int((long long)start_index), V_int((long long)cp) };
+  return vm_return_values(vm, 2, out);
 }
 
 static Value utf8_codes(struct VM *vm, int argc, Value *argv) {
-  (void)vm;
   if (argc < 1 || argv[0].tag != VAL_STR) return V_nil();
 
   Value state = V_table();
@@ -255,11 +251,8 @@ static Value utf8_codes(struct VM *vm, int argc, Value *argv) {
 
   Value iter; iter.tag = VAL_CFUNC; iter.as.cfunc = utf8_codes_iter;
 
-  Value triple = V_table();
-  tbl_set_public(triple.as.t, V_int(1), iter);
-  tbl_set_public(triple.as.t, V_int(2), state);
-  tbl_set_public(triple.as.t, V_int(3), V_int(0));  // ctrl = 0 (internal 0-based)
-  return triple;
+  Value out[3] = { iter, state, V_int(0) };  // ctrl = 0 (internal 0-based)
+  return vm_return_values(vm, 3, out);
 }
 
 /* ===== utf8.offset(s, n [, i]) -> integer|nil ===== */
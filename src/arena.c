@@ -0,0 +1,111 @@
+// arena.c — per-chunk AST arenas (see include/arena.h)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/arena.h"
+#include "../include/gc.h"
+#include "../include/util.h"
+
+#define ARENA_CHUNK 32768   /* bigger requests get a block of their own */
+
+typedef struct ArenaChunk {
+  struct ArenaChunk *next;
+  size_t used, cap;
+  _Alignas(16) char data[];
+} ArenaChunk;
+
+typedef struct ArenaHook {
+  struct ArenaHook *next;
+  void (*fn)(void *);
+  void *arg;
+} ArenaHook;
+
+struct AstArena {
+  AstArena *prev, *next;       /* live arenas, marked by the collector */
+  ArenaChunk *chunks;
+  int refs;
+  Str **strs;     int nstrs, capstrs;
+  struct FieldIC ***ics; int nics, capics;
+  ArenaHook *hooks;
+};
+
+static AstArena *live;
+
+#define GROW(arr, n, cap) do { if ((n) == (cap)) { \
+  (cap) = (cap) ? (cap) * 2 : 64; \
+  (arr) = realloc((arr), sizeof(*(arr)) * (size_t)(cap)); \
+  if (!(arr)) { fprintf(stderr, "OOM\n"); exit(1); } } } while (0)
+
+static void mark_arenas(void){
+  for (AstArena *a = live; a; a = a->next)
+    for (int i = 0; i < a->nstrs; i++) gc_mark(a->strs[i]);
+}
+
+AstArena *ast_arena_new(void){
+  static int registered;
+  if (!registered) { gc_root_fn(mark_arenas); registered = 1; }
+  AstArena *a = xmalloc(sizeof(*a));
+  memset(a, 0, sizeof(*a));
+  a->refs = 1;
+  a->next = live;
+  if (live) live->prev = a;
+  live = a;
+  return a;
+}
+
+void ast_arena_retain(AstArena *a){ if (a) a->refs++; }
+
+void ast_arena_release(AstArena *a){
+  if (!a || --a->refs > 0) return;
+  if (a->prev) a->prev->next = a->next; else live = a->next;
+  if (a->next) a->next->prev = a->prev;
+  for (ArenaHook *h = a->hooks; h; h = h->next) h->fn(h->arg);
+  for (int i = 0; i < a->nics; i++) free(*a->ics[i]);
+  for (ArenaChunk *c = a->chunks, *nx; c; c = nx) { nx = c->next; free(c); }
+  free(a->strs);
+  free(a->ics);
+  free(a);
+}
+
+void *ast_arena_alloc(AstArena *a, size_t n){
+  n = (n + 15) & ~(size_t)15;
+  ArenaChunk *c = a->chunks;
+  if (!c || c->cap - c->used < n) {
+    size_t cap = n > ARENA_CHUNK / 4 ? n : ARENA_CHUNK;
+    ArenaChunk *nc = xmalloc(sizeof(*nc) + cap);
+    nc->used = 0; nc->cap = cap;
+    if (c && cap == n) { nc->next = c->next; c->next = nc; c = nc; }   /* keep filling the current one */
+    else { nc->next = c; a->chunks = c = nc; }
+  }
+  void *p = c->data + c->used;
+  c->used += n;
+  memset(p, 0, n);
+  return p;
+}
+
+char *ast_arena_strdup(AstArena *a, const char *s){
+  if (!s) s = "";
+  size_t n = strlen(s) + 1;
+  char *p = ast_arena_alloc(a, n);
+  memcpy(p, s, n);
+  return p;
+}
+
+Str *ast_arena_str(AstArena *a, const char *s){
+  Str *r = Str_new_len(s, (int)strlen(s));
+  GROW(a->strs, a->nstrs, a->capstrs);
+  a->strs[a->nstrs++] = r;
+  return r;
+}
+
+void ast_arena_track_ic(AstArena *a, struct FieldIC **ic){
+  GROW(a->ics, a->nics, a->capics);
+  a->ics[a->nics++] = ic;
+}
+
+void ast_arena_on_free(AstArena *a, void (*fn)(void *), void *arg){
+  ArenaHook *h = ast_arena_alloc(a, sizeof(*h));
+  h->fn = fn; h->arg = arg;
+  h->next = a->hooks;
+  a->hooks = h;
+}
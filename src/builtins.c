@@ -3,23 +3,16 @@
 
 Value builtin_load(struct VM *vm, int argc, Value *argv){
   if (argc<1 || argv[0].tag!=VAL_STR) return V_nil();
-  FILE *fp = open_string_as_FILE(argv[0].as.s->data);
-  if (!fp) return V_nil();
-  AST *program = compile_chunk_from_FILE(fp);
-  fclose(fp);
-  Func *fn = xmalloc(sizeof(*fn)); memset(fn,0,sizeof(*fn));
-  fn->params=(ASTVec){0}; fn->vararg=false; fn->body=program; fn->env=vm->env;
+  AST *program = compile_chunk(argv[0].as.s->data, (size_t)argv[0].as.s->len);
+  Func *fn = make_chunk_func(vm, program);
+  ast_free(program);
   Value v; v.tag=VAL_FUNC; v.as.fn=fn; return v;
 }
 Value builtin_ipairs(struct VM *vm, int argc, Value *argv){
-  (void)argc;
   if (argc < 1 || argv[0].tag != VAL_TABLE) return V_nil();
-  Value triple = V_table();
   Value iter; iter.tag = VAL_CFUNC; iter.as.cfunc = ipairs_iter;
-  tbl_set(triple.as.t, V_int(1), iter);
-  tbl_set(triple.as.t, V_int(2), argv[0]);
-  tbl_set(triple.as.t, V_int(3), V_int(0));
-  return triple;
+  Value out[3] = { iter, argv[0], V_int(0) };
+  return vm_return_values(vm, 3, out);
 }
 Value builtin_tonumber(struct VM* vm, int argc, Value* argv) {
   (void)vm;
@@ -61,85 +54,68 @@ Value builtin_tonumber(struct VM* vm, int argc, Value* argv) {
 
 Value builtin_loadfile(struct VM *vm, int argc, Value *argv){
   if (argc<1 || argv[0].tag!=VAL_STR) return V_nil();
-  size_t n=0; char *src = read_entire_file(argv[0].as.s->data, &n);
-  if (!src) { fprintf(stderr,"[LuaX]: loadfile: cannot open '%s'\n", argv[0].as.s->data); return V_nil(); }
-  FILE *fp = open_string_as_FILE(src);
-  free(src);
-  if (!fp) return V_nil();
-  AST *program = compile_chunk_from_FILE(fp);
-  fclose(fp);
-  Func *fn = xmalloc(sizeof(*fn)); memset(fn,0,sizeof(*fn));
-  fn->params=(ASTVec){0}; fn->vararg=false; fn->body=program; fn->env=vm->env;
+  AST *program = compile_file(argv[0].as.s->data);
+  if (!program) { fprintf(stderr,"[LuaX]: loadfile: cannot open '%s'\n", argv[0].as.s->data); return V_nil(); }
+  Func *fn = make_chunk_func(vm, program);
+  ast_free(program);
   Value v; v.tag=VAL_FUNC; v.as.fn=fn; return v;
 }
+/* pcall and xpcall return true and every result of the call, or false
+   and the error. */
+static Value pcall_fail(struct VM *vm, Value err){
+  Value out[2] = { V_bool(0), err };
+  return vm_return_values(vm, 2, out);
+}
 Value builtin_pcall(struct VM *vm, int argc, Value *argv){
-  if (argc < 1 || !is_callable(argv[0])) {
-    Value tup = V_table();
-    tbl_set(tup.as.t, V_int(1), V_bool(0));
-    tbl_set(tup.as.t, V_int(2), V_str_from_c("attempt to call a non-function"));
-    return tup;
-  }
+  if (argc < 1 || !is_callable(argv[0]))
+    return pcall_fail(vm, V_str_from_c("attempt to call a non-function"));
+  int base = vm->top;
+  vm_push(vm, V_bool(1));
   ErrFrame frame;
   vm_err_push(vm, &frame);
   if (setjmp(frame.jb) == 0) {
-    Value ret = call_any(vm, argv[0], argc - 1, argv + 1);
+    int n = call_multi(vm, argv[0], argc - 1, argv + 1);
     vm_err_pop(vm);
-    Value tup = V_table();
-    tbl_set(tup.as.t, V_int(1), V_bool(1));
-    tbl_set(tup.as.t, V_int(2), ret);
-    return tup;
+    return V_multi(base, n + 1);
   } else {
     Value err = vm->err_obj.tag ? vm->err_obj : V_str_from_c("error");
     vm_err_pop(vm);
-    Value tup = V_table();
-    tbl_set(tup.as.t, V_int(1), V_bool(0));
-    tbl_set(tup.as.t, V_int(2), err);
-    return tup;
+    vm->top = base;
+    return pcall_fail(vm, err);
   }
 }
 Value builtin_xpcall(struct VM *vm, int argc, Value *argv){
-  if (argc < 2 || !is_callable(argv[0]) || !is_callable(argv[1])) {
-    Value tup = V_table();
-    tbl_set(tup.as.t, V_int(1), V_bool(0));
-    tbl_set(tup.as.t, V_int(2), V_str_from_c("bad arguments to xpcall"));
-    return tup;
-  }
+  if (argc < 2 || !is_callable(argv[0]) || !is_callable(argv[1]))
+    return pcall_fail(vm, V_str_from_c("bad arguments to xpcall"));
   Value f = argv[0];
   Value msgh = argv[1];
+  int base = vm->top;
+  vm_push(vm, V_bool(1));
   ErrFrame frame;
   vm_err_push(vm, &frame);
   if (setjmp(frame.jb) == 0) {
-    Value ret = call_any(vm, f, argc - 2, argv + 2);
+    int n = call_multi(vm, f, argc - 2, argv + 2);
     vm_err_pop(vm);
-    Value tup = V_table();
-    tbl_set(tup.as.t, V_int(1), V_bool(1));
-    tbl_set(tup.as.t, V_int(2), ret);
-    return tup;
+    return V_multi(base, n + 1);
   } else {
     Value err_in = vm->err_obj.tag ? vm->err_obj : V_str_from_c("error");
     vm_err_pop(vm);
+    vm->top = base;
     ErrFrame mh;
     vm_err_push(vm, &mh);
     if (setjmp(mh.jb) == 0) {
       Value msgret = call_any(vm, msgh, 1, &err_in);
       vm_err_pop(vm);
-      Value tup = V_table();
-      tbl_set(tup.as.t, V_int(1), V_bool(0));
-      tbl_set(tup.as.t, V_int(2), msgret);
-      return tup;
+      return pcall_fail(vm, msgret);
     } else {
       Value handler_err = vm->err_obj.tag ? vm->err_obj : V_str_from_c("error in error handler");
       vm_err_pop(vm);
-      Value tup = V_table();
-      tbl_set(tup.as.t, V_int(1), V_bool(0));
-      tbl_set(tup.as.t, V_int(2), handler_err);
-      return tup;
+      return pcall_fail(vm, handler_err);
     }
   }
 }
 
 Value builtin_select(struct VM *vm, int argc, Value *argv){
-  (void)vm;
   if (argc < 1) return V_nil();
   if (argv[0].tag == VAL_STR && argv[0].as.s->len > 0 &&
       argv[0].as.s->data[0] == '#') {
@@ -149,8 +125,9 @@ Value builtin_select(struct VM *vm, int argc, Value *argv){
   if (argv[0].tag == VAL_INT) i = argv[0].as.i;
   else if (argv[0].tag == VAL_NUM) i = (long long)argv[0].as.n;
   else i = 0;
+  if (i < 0) i += argc;   /* select(-1, ...) is the last one */
   if (i < 1 || i > argc - 1) return V_nil();
-  return argv[i];
+  return vm_return_values(vm, argc - (int)i, argv + i);
 }
 
 Value builtin__G(struct VM *vm, int argc, Value *argv){
@@ -181,40 +158,24 @@ Value builtin_rawset(struct VM *vm, int argc, Value *argv){
   return argv[0];
 }
 Value builtin_next(struct VM *vm, int argc, Value *argv){
-  (void)vm;
   if (argc<1 || argv[0].tag!=VAL_TABLE) return V_nil();
   Table *t = argv[0].as.t;
-  int has_key = (argc>=2) && (argv[1].tag!=VAL_NIL);
-  int found = !has_key;
-  for (int bi=0; bi<t->cap; ++bi){
-    for (TableEntry *e = t->buckets[bi]; e; e=e->next){
-      if (!found){
-        if (value_equal(e->key, argv[1])) { found = 1; }
-        continue;
-      } else {
-        Value tup = V_table();
-        tbl_set(tup.as.t, V_int(1), e->key);
-        tbl_set(tup.as.t, V_int(2), e->val);
-        return tup;
-      }
-    }
-  }
-  return V_nil();
+  Value out[2];
+  if (!tbl_next_key(t, argc>=2 ? argv[1] : V_nil(), &out[0], &out[1])) return V_nil();
+  return vm_return_values(vm, 2, out);
 }
 Value builtin_pairs(struct VM *vm, int argc, Value *argv){
-  (void)vm;
   if (argc < 1 || argv[0].tag != VAL_TABLE) return V_nil();
   Value mm = mm_of(argv[0], "__pairs");
   if (mm.tag != VAL_NIL) {
-    Value res = call_any(vm, mm, 1, &argv[0]);
-    if (res.tag == VAL_TABLE) return res;
+    int base = vm->top;
+    int n = call_multi(vm, mm, 1, &argv[0]);
+    if (n > 3) n = 3;
+    return V_multi(base, n);
   }
-  Value triple = V_table();
   Value iter; iter.tag = VAL_CFUNC; iter.as.cfunc = builtin_next;
-  tbl_set(triple.as.t, V_int(1), iter);
-  tbl_set(triple.as.t, V_int(2), argv[0]);
-  tbl_set(triple.as.t, V_int(3), V_nil());
-  return triple;
+  Value out[3] = { iter, argv[0], V_nil() };
+  return vm_return_values(vm, 3, out);
 }
 
 /* getmetatable with protection: return mt.__metatable if present */
@@ -272,7 +233,7 @@ Value builtin_collectgarbage(struct VM *vm, int argc, Value *argv){
     mode = argv[0].as.s->data;
 
   if (strcmp(mode, "collect") == 0) {
-    shim_collect(vm);
+    vm_gc_collect(vm);
     return V_nil();
   }
   if (strcmp(mode, "count") == 0) {
@@ -280,41 +241,42 @@ Value builtin_collectgarbage(struct VM *vm, int argc, Value *argv){
     return V_num((double)bytes / 1024.0);
   }
   if (strcmp(mode, "stop") == 0) {
-    shim_stop(vm);
+    vm_gc_stop(vm);
     return V_nil();
   }
   if (strcmp(mode, "restart") == 0) {
-    shim_restart(vm);
+    vm_gc_restart(vm);
     return V_nil();
   }
   if (strcmp(mode, "step") == 0) {
     int kb = (argc >= 2) ? to_int_val(argv[1], 0) : 0;
-    int done = shim_step(vm, kb);
+    int done = vm_gc_step(vm, kb);
     return V_bool(done ? 1 : 0);
   }
   if (strcmp(mode, "isrunning") == 0) {
-    return V_bool(shim_isrunning(vm) ? 1 : 0);
+    return V_bool(vm_gc_isrunning(vm) ? 1 : 0);
   }
   if (strcmp(mode, "setpause") == 0) {
-    int pause = (argc >= 2) ? to_int_val(argv[1], g_gc.pause) : g_gc.pause;
-    return V_int(shim_setpause(vm, pause));
+    int pause = (argc >= 2) ? to_int_val(argv[1], -1) : -1;
+    return V_int(vm_gc_setpause(vm, pause));
   }
   if (strcmp(mode, "setstepmul") == 0) {
-    int mul = (argc >= 2) ? to_int_val(argv[1], g_gc.stepmul) : g_gc.stepmul;
-    return V_int(shim_setstepmul(vm, mul));
+    int mul = (argc >= 2) ? to_int_val(argv[1], -1) : -1;
+    return V_int(vm_gc_setstepmul(vm, mul));
   }
   if (strcmp(mode, "incremental") == 0) {
-    int pause    = (argc >= 2) ? to_int_val(argv[1], g_gc.pause)     : g_gc.pause;
-    int stepmul  = (argc >= 3) ? to_int_val(argv[2], g_gc.stepmul)   : g_gc.stepmul;
-    int stepsize = (argc >= 4) ? to_int_val(argv[3], g_gc.stepsize_kb) : g_gc.stepsize_kb;
-    shim_set_incremental(vm, pause, stepmul, stepsize);
-    return V_nil();
+    /* 0 keeps the current setting */
+    int pause    = (argc >= 2) ? to_int_val(argv[1], 0) : 0;
+    int stepmul  = (argc >= 3) ? to_int_val(argv[2], 0) : 0;
+    int stepsize = (argc >= 4) ? to_int_val(argv[3], 0) : 0;
+    int old = vm_gc_set_incremental(vm, pause, stepmul, stepsize);
+    return V_str_from_c(old == GC_MODE_GENERATIONAL ? "generational" : "incremental");
   }
   if (strcmp(mode, "generational") == 0) {
-    int minormul = (argc >= 2) ? to_int_val(argv[1], g_gc.minormul) : g_gc.minormul;
-    int majormul = (argc >= 3) ? to_int_val(argv[2], g_gc.majormul) : g_gc.majormul;
-    shim_set_generational(vm, minormul, majormul);
-    return V_nil();
+    int minormul = (argc >= 2) ? to_int_val(argv[1], 0) : 0;
+    int majormul = (argc >= 3) ? to_int_val(argv[2], 0) : 0;
+    int old = vm_gc_set_generational(vm, minormul, majormul);
+    return V_str_from_c(old == GC_MODE_GENERATIONAL ? "generational" : "incremental");
   }
 
   /* unknown mode -> nil (Lua returns nil + error; single-return VM => nil) */
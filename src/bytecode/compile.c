@@ -0,0 +1,893 @@
+// compile.c — resolved AST -> register bytecode (see include/bytecode.h)
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include "../../include/bytecode.h"
+
+/* The compiler walks the same scope structure the resolver built: one
+   BcScope per resolver Scope, so an identifier's (depth, slot) picks its
+   variable directly. Locals live in registers allocated stack-like per
+   block; locals a nested function refers to live in cells instead. */
+
+typedef struct BcVar {
+  int reg;
+  int cell;   /* >= 0: captured, the value lives in C[cell] */
+} BcVar;
+
+typedef struct BcLabel {
+  const char *name;
+  int pc;
+} BcLabel;
+
+typedef struct BcScope {
+  struct BcScope *parent;
+  struct FuncState *fs;
+  bool is_func;
+  bool noenv;                      /* block without locals: not a resolver hop */
+  const unsigned char *captured;   /* resolver: slot -> captured */
+  BcVar *vars; int nvars, capvars;
+  int reg_base, cell_base;
+  BcLabel *labels; int nlabels, caplabels;
+  BcLabel *gotos;  int ngotos, capgotos;   /* unresolved: pc of the JMP */
+} BcScope;
+
+typedef struct BcLoop {
+  struct BcLoop *prev;
+  int *breaks; int nbreaks, capbreaks;
+} BcLoop;
+
+typedef struct BcUpKey {
+  BcScope *scope;
+  int slot;
+} BcUpKey;
+
+typedef struct FuncState {
+  struct FuncState *parent;
+  BcProto *p;
+  BcScope *scope;
+  int freereg;   /* first free register */
+  int nactive;   /* registers below are locals; temps live above */
+  int ncells;
+  int line;
+  BcUpKey *upkeys;
+  BcLoop *loop;
+  int *endjumps; int nend, capend;   /* break/goto with no target: leave the function */
+  jmp_buf *fail;
+} FuncState;
+
+#define GROW(arr, n, cap) do { if ((n) == (cap)) { (cap) = (cap) ? (cap) * 2 : 8; \
+  (arr) = realloc((arr), sizeof(*(arr)) * (size_t)(cap)); } } while (0)
+
+static void expr_to(FuncState *fs, AST *n, int dst);
+static int  expr_any(FuncState *fs, AST *n);
+static void stmt(FuncState *fs, AST *n);
+static void block(FuncState *fs, AST *blk);
+
+static void fail(FuncState *fs){ longjmp(*fs->fail, 1); }
+
+/* ---------- emission ---------- */
+
+static int emit(FuncState *fs, BcInst i){
+  BcProto *p = fs->p;
+  if (p->ncode == p->capcode) {
+    p->capcode = p->capcode ? p->capcode * 2 : 64;
+    p->code  = realloc(p->code,  sizeof(BcInst) * (size_t)p->capcode);
+    p->lines = realloc(p->lines, sizeof(int) * (size_t)p->capcode);
+  }
+  p->code[p->ncode] = i;
+  p->lines[p->ncode] = fs->line;
+  return p->ncode++;
+}
+static int emit_abc(FuncState *fs, BcOp op, int a, int b, int c){
+  if (a > BC_MAXARG || b > BC_MAXARG || c > BC_MAXARG) fail(fs);
+  return emit(fs, BC_ABC(op, a, b, c));
+}
+static int emit_abx(FuncState *fs, BcOp op, int a, int bx){
+  if (a > BC_MAXARG || bx > BC_MAXBX) fail(fs);
+  return emit(fs, BC_ABx(op, a, bx));
+}
+static int here(FuncState *fs){ return fs->p->ncode; }
+
+/* Jumps are emitted with a zero offset and patched once the target is known. */
+static int emit_jump(FuncState *fs, BcOp op, int a){ return emit(fs, BC_ABx(op, a, BC_MAXSBX)); }
+static void patch(FuncState *fs, int at, int target){
+  int off = target - (at + 1);
+  if (off < -BC_MAXSBX || off > BC_MAXBX - BC_MAXSBX) fail(fs);
+  BcInst i = fs->p->code[at];
+  fs->p->code[at] = BC_ABx(BC_OP(i), BC_A(i), off + BC_MAXSBX);
+}
+
+static int reserve(FuncState *fs, int n){
+  int r = fs->freereg;
+  fs->freereg += n;
+  if (fs->freereg > BC_MAXARG) fail(fs);
+  if (fs->freereg > fs->p->maxregs) fs->p->maxregs = fs->freereg;
+  return r;
+}
+static bool is_temp(FuncState *fs, int r){ return r >= fs->nactive; }
+
+/* ---------- constants ---------- */
+
+static int add_const(FuncState *fs, Value v){
+  BcProto *p = fs->p;
+  for (int i = 0; i < p->nk; i++) {
+    Value k = p->k[i];
+    if (k.tag != v.tag) continue;
+    if (v.tag == VAL_NUM && k.as.n == v.as.n) return i;
+    if (v.tag == VAL_INT && k.as.i == v.as.i) return i;
+    if (v.tag == VAL_STR && (k.as.s == v.as.s ||
+        (k.as.s->len == v.as.s->len && memcmp(k.as.s->data, v.as.s->data, (size_t)v.as.s->len) == 0)))
+      return i;
+  }
+  if (p->nk > BC_MAXBX) fail(fs);
+  GROW(p->k, p->nk, p->capk);
+  p->k[p->nk] = v;
+  return p->nk++;
+}
+static int str_const(FuncState *fs, Str *s){ return add_const(fs, (Value){.tag=VAL_STR,.as.s=s}); }
+
+/* Constant index usable as a table key operand, or -1. */
+static int key_const(FuncState *fs, AST *k){
+  int idx = -1;
+  if (k->kind == AST_STRING) idx = str_const(fs, k->as.sval.str);
+  else if (k->kind == AST_NUMBER) idx = add_const(fs, V_num(k->as.nval.v));
+  return idx <= BC_MAXARG ? idx : -1;
+}
+
+static void load_const(FuncState *fs, int dst, Value v){
+  emit_abx(fs, BC_LOADK, dst, add_const(fs, v));
+}
+
+/* ---------- scopes & variables ---------- */
+
+static void open_scope(FuncState *fs, BcScope *s, BcScope *parent, bool is_func, const unsigned char *captured){
+  memset(s, 0, sizeof(*s));
+  s->parent = parent;
+  s->fs = fs;
+  s->is_func = is_func;
+  s->captured = captured;
+  s->reg_base = fs->nactive;
+  s->cell_base = fs->ncells;
+  fs->scope = s;
+}
+
+static void add_endjump(FuncState *fs, int pc){
+  GROW(fs->endjumps, fs->nend, fs->capend);
+  fs->endjumps[fs->nend++] = pc;
+}
+
+/* Gotos resolve against any label of the block they are pending in;
+   the rest move outwards, and past the function they leave it. */
+static void close_scope(FuncState *fs, BcScope *s){
+  for (int i = 0; i < s->ngotos; i++) {
+    int target = -1;
+    for (int j = 0; j < s->nlabels; j++)
+      if (strcmp(s->labels[j].name, s->gotos[i].name) == 0) { target = s->labels[j].pc; break; }
+    if (target >= 0) patch(fs, s->gotos[i].pc, target);
+    else if (!s->is_func && s->parent && s->parent->fs == fs) {
+      BcScope *ps = s->parent;
+      GROW(ps->gotos, ps->ngotos, ps->capgotos);
+      ps->gotos[ps->ngotos++] = s->gotos[i];
+    } else add_endjump(fs, s->gotos[i].pc);
+  }
+  free(s->gotos);
+  free(s->labels);
+  free(s->vars);
+  fs->scope = s->parent;
+  fs->nactive = fs->freereg = s->reg_base;
+  fs->ncells = s->cell_base;
+}
+
+/* Declares the scope's next slot in register reg. set: copy the register
+   into the fresh cell (no-op for locals that stay in registers). */
+static void declare_local(FuncState *fs, int reg, bool set){
+  BcScope *s = fs->scope;
+  BcVar v = { reg, -1 };
+  if (s->captured && s->captured[s->nvars]) {
+    v.cell = fs->ncells++;
+    if (fs->ncells > BC_MAXARG) fail(fs);
+    if (fs->ncells > fs->p->ncells) fs->p->ncells = fs->ncells;
+    emit_abc(fs, BC_NEWCELL, v.cell, 0, 0);
+    if (set) emit_abc(fs, BC_SETCELL, v.cell, reg, 0);
+  }
+  GROW(s->vars, s->nvars, s->capvars);
+  s->vars[s->nvars++] = v;
+}
+
+static int upval_index(FuncState *fs, BcScope *s, int slot){
+  BcProto *p = fs->p;
+  for (int i = 0; i < p->nupvals; i++)
+    if (fs->upkeys[i].scope == s && fs->upkeys[i].slot == slot) return i;
+  BcUpvalDesc d;
+  if (s->fs == fs->parent) {
+    d.from_cell = true;
+    d.index = s->vars[slot].cell;
+    if (d.index < 0) fail(fs);
+  } else {
+    d.from_cell = false;
+    d.index = upval_index(fs->parent, s, slot);
+  }
+  if (p->nupvals >= BC_MAXARG) fail(fs);
+  int cap = p->capupvals;
+  GROW(p->upvals, p->nupvals, p->capupvals);
+  if (cap != p->capupvals) fs->upkeys = realloc(fs->upkeys, sizeof(BcUpKey) * (size_t)p->capupvals);
+  fs->upkeys[p->nupvals] = (BcUpKey){ s, slot };
+  p->upvals[p->nupvals] = d;
+  return p->nupvals++;
+}
+
+typedef enum { VK_REG, VK_CELL, VK_UPVAL, VK_GLOBAL } VarKind;
+
+static VarKind lookup(FuncState *fs, AST *id, int *idx){
+  int depth = id->as.ident.depth;
+  if (depth < 0) { *idx = str_const(fs, id->as.ident.key); return VK_GLOBAL; }
+  BcScope *s = fs->scope;
+  while (s && s->noenv) s = s->parent;
+  for (; depth > 0 && s; depth--) {
+    s = s->parent;
+    while (s && s->noenv) s = s->parent;
+  }
+  int slot = id->as.ident.slot;
+  if (!s || slot >= s->nvars) fail(fs);
+  if (s->fs != fs) { *idx = upval_index(fs, s, slot); return VK_UPVAL; }
+  BcVar *v = &s->vars[slot];
+  if (v->cell >= 0) { *idx = v->cell; return VK_CELL; }
+  *idx = v->reg;
+  return VK_REG;
+}
+
+static void store_var(FuncState *fs, AST *id, int src){
+  int idx;
+  switch (lookup(fs, id, &idx)) {
+    case VK_REG:    if (idx != src) emit_abc(fs, BC_MOVE, idx, src, 0); break;
+    case VK_CELL:   emit_abc(fs, BC_SETCELL, idx, src, 0); break;
+    case VK_UPVAL:  emit_abc(fs, BC_SETUPVAL, src, idx, 0); break;
+    case VK_GLOBAL: emit_abx(fs, BC_SETGLOBAL, src, idx); break;
+  }
+}
+
+static bool is_dots(AST *n){
+  return n && n->kind == AST_IDENT && n->as.ident.name && strcmp(n->as.ident.name, "...") == 0;
+}
+
+/* ---------- superinstructions ---------- */
+
+/* Rewrites the first instruction of common pairs into a fused opcode.
+   The second instruction is left as is, so jumps landing on it and the
+   line table stay valid; the fused op executes it and steps over it. */
+static void fuse(BcProto *p){
+  if (!BC_SUPERINSTRUCTIONS) return;
+  for (int k = 0; k + 1 < p->ncode; k++) {
+    BcInst i = p->code[k], j = p->code[k + 1];
+    int op = BC_OP(i), next = BC_OP(j);
+    BcOp f = BC_MOVE;
+    if ((next == BC_JMPIF || next == BC_JMPIFNOT) && BC_A(j) == BC_A(i)) {
+      switch (op) {
+        case BC_EQ: f = BC_EQJ; break;
+        case BC_NE: f = BC_NEJ; break;
+        case BC_LT: f = BC_LTJ; break;
+        case BC_LE: f = BC_LEJ; break;
+        case BC_GT: f = BC_GTJ; break;
+        case BC_GE: f = BC_GEJ; break;
+        default: break;
+      }
+    } else if (next == BC_GETFIELD && BC_B(j) == BC_A(i)) {
+      if (op == BC_GETUPVAL) f = BC_GETUPFIELD;
+      else if (op == BC_GETGLOBAL) f = BC_GETGLOBFIELD;
+    }
+    if (f != BC_MOVE) p->code[k] = (i & ~(BcInst)0xff) | (BcInst)f;
+  }
+}
+
+/* ---------- functions ---------- */
+
+static BcProto *proto_new(AST *fn){
+  BcProto *p = calloc(1, sizeof(*p));
+  p->fn = fn;
+  return p;
+}
+
+void bc_proto_free(BcProto *p){
+  for (int i = 0; i < p->nprotos; i++) bc_proto_free(p->protos[i]);
+  if (p->fic) for (int i = 0; i < p->ncode; i++) free(p->fic[i]);
+  free(p->code); free(p->lines); free(p->k); free(p->protos);
+  free(p->upvals); free(p->gcache); free(p->fic);
+  free(p);
+}
+
+static int function(FuncState *fs, AST *node, ASTVec *params, bool vararg, AST *body, const unsigned char *captured){
+  BcProto *p = proto_new(node);
+  p->nparams = (int)params->count;
+  p->vararg = vararg;
+  FuncState cfs = { .parent = fs, .p = p, .line = node->line, .fail = fs->fail };
+  BcScope ps;
+  open_scope(&cfs, &ps, fs->scope, true, captured);
+  int nslots = p->nparams + (vararg ? 1 : 0);
+  reserve(&cfs, nslots);
+  for (int i = 0; i < nslots; i++) declare_local(&cfs, i, true);
+  cfs.nactive = cfs.freereg;
+  block(&cfs, body);
+  close_scope(&cfs, &ps);
+  int ret = emit_abc(&cfs, BC_RETURN, 0, 0, 0);
+  for (int i = 0; i < cfs.nend; i++) patch(&cfs, cfs.endjumps[i], ret);
+  free(cfs.endjumps);
+  fuse(p);
+  free(cfs.upkeys);
+  p->gcache = calloc((size_t)p->ncode, sizeof(int));
+  p->fic = calloc((size_t)p->ncode, sizeof(*p->fic));
+
+  BcProto *fp = fs->p;
+  if (fp->nprotos > BC_MAXBX) fail(fs);
+  GROW(fp->protos, fp->nprotos, fp->capprotos);
+  fp->protos[fp->nprotos] = p;
+  return fp->nprotos++;
+}
+
+/* ---------- expressions ---------- */
+
+/* Evaluates n into a register: a local's own register when possible. */
+static int expr_any(FuncState *fs, AST *n){
+  if (n && n->kind == AST_IDENT && !is_dots(n)) {
+    int idx;
+    if (lookup(fs, n, &idx) == VK_REG) return idx;
+  }
+  int r = reserve(fs, 1);
+  expr_to(fs, n, r);
+  return r;
+}
+
+/* calls and `...` produce every value when last in a list, unless
+   parenthesized */
+static bool is_multi(AST *n){
+  return n && !n->paren && (n->kind == AST_CALL || is_dots(n));
+}
+
+/* `...` into cnt registers from dst, or open with cnt = 0. Only the
+   vararg function's own `...` is supported. */
+static void vararg(FuncState *fs, AST *n, int dst, int cnt){
+  int idx;
+  if (!fs->p->vararg || lookup(fs, n, &idx) != VK_REG || idx != fs->p->nparams) fail(fs);
+  if (cnt > BC_MAXARG) fail(fs);
+  emit_abc(fs, BC_VARARG, dst, cnt, 0);
+}
+
+static void call(FuncState *fs, AST *n, int dst, int nres);
+
+/* Leaves all values of a call or `...` open on the value stack. */
+static void multi(FuncState *fs, AST *n){
+  int save = fs->freereg;
+  if (n->kind == AST_CALL) call(fs, n, reserve(fs, 1), 0);
+  else vararg(fs, n, 0, 0);
+  fs->freereg = save;
+}
+
+/* Calls n with nres results in dst..dst+nres-1 (dst must be the top
+   temporary when nres > 1), open when nres = 0, or as the function's
+   tail call (returning every result) when nres < 0. */
+static void call(FuncState *fs, AST *n, int dst, int nres){
+  int save = fs->freereg;
+  int base = (is_temp(fs, dst) && dst == fs->freereg - 1) ? dst : reserve(fs, 1);
+  if (nres > 1 && base != dst) fail(fs);
+  if (nres > BC_MAXARG) fail(fs);
+  AST *callee = n->as.call.callee;
+  ASTVec *args = &n->as.call.args;
+  /* obj:m(...) — the parser passes the receiver node itself as argument 1 */
+  size_t from = 0;
+  int nfix = 0;
+  if (n->as.call.method) {
+    int obj = expr_any(fs, callee->as.field.target);
+    int k = str_const(fs, callee->as.field.key);
+    fs->line = n->line;
+    fs->freereg = base + 1;
+    reserve(fs, 1);
+    if (k <= BC_MAXARG) emit_abc(fs, BC_SELF, base, obj, k);
+    else {
+      emit_abc(fs, BC_MOVE, base + 1, obj, 0);
+      int kr = reserve(fs, 1);
+      emit_abx(fs, BC_LOADK, kr, k);
+      emit_abc(fs, BC_GETTABLE, base, base + 1, kr);
+      fs->freereg = base + 2;
+    }
+    from = 1;
+    nfix = 1;
+  } else {
+    expr_to(fs, callee, base);
+    fs->freereg = base + 1;
+  }
+  bool open = args->count > from && is_multi(args->items[args->count - 1]);
+  for (size_t i = from; i < args->count; i++) {
+    if (open && i == args->count - 1) { multi(fs, args->items[i]); break; }
+    int r = reserve(fs, 1);
+    expr_to(fs, args->items[i], r);
+    fs->freereg = r + 1;
+    nfix++;
+  }
+  if (nfix > BC_MAXARG) fail(fs);
+  fs->line = n->line;
+  if (nres < 0) { emit_abc(fs, BC_TAILCALL, base, nfix, open); fs->freereg = save; return; }
+  emit_abc(fs, open ? BC_CALLV : BC_CALL, base, nfix, nres);
+  if (nres == 1 && dst != base) emit_abc(fs, BC_MOVE, dst, base, 0);
+  fs->freereg = save;
+}
+
+static void table(FuncState *fs, AST *n, int dst){
+  emit_abc(fs, BC_NEWTABLE, dst, 0, 0);
+  int nexti = 1;
+  size_t nv = n->as.table.values.count;
+  for (size_t i = 0; i < nv; i++) {
+    int save = fs->freereg;
+    AST *k = n->as.table.keys.items[i];
+    AST *v = n->as.table.values.items[i];
+    if (!k && i == nv - 1 && is_multi(v)) {
+      int c = reserve(fs, 1);
+      load_const(fs, c, V_int(nexti));
+      multi(fs, v);
+      emit_abc(fs, BC_APPENDV, dst, c, 0);
+    } else {
+      int kc = k ? key_const(fs, k) : add_const(fs, V_int(nexti++));
+      int kr = -1;
+      if (kc > BC_MAXARG) kc = -1;
+      if (kc < 0) {
+        if (k) kr = expr_any(fs, k);
+        else { kr = reserve(fs, 1); load_const(fs, kr, V_int(nexti - 1)); }
+      }
+      int vr = expr_any(fs, v);
+      if (kc >= 0) emit_abc(fs, BC_SETFIELD, dst, kc, vr);
+      else emit_abc(fs, BC_SETTABLE, dst, kr, vr);
+    }
+    fs->freereg = save;
+  }
+}
+
+static const BcOp binops[] = {
+  [OP_ADD] = BC_ADD, [OP_SUB] = BC_SUB, [OP_MUL] = BC_MUL, [OP_DIV] = BC_DIV,
+  [OP_MOD] = BC_MOD, [OP_POW] = BC_POW, [OP_IDIV] = BC_IDIV, [OP_CONCAT] = BC_CONCAT,
+  [OP_EQ] = BC_EQ, [OP_NE] = BC_NE, [OP_LT] = BC_LT, [OP_LE] = BC_LE,
+  [OP_GT] = BC_GT, [OP_GE] = BC_GE,
+};
+
+/* A number literal that fits ADDI/SUBI's immediate operand. */
+static bool small_int(AST *n, int *imm){
+  if (!BC_SUPERINSTRUCTIONS || !n || n->kind != AST_NUMBER) return false;
+  double v = n->as.nval.v;
+  if (!(v >= -BC_IMM_BIAS && v <= BC_MAXARG - BC_IMM_BIAS) || v != (int)v) return false;
+  *imm = (int)v;
+  return true;
+}
+
+/* Evaluates n into dst. dst may be a live local: it is then only written
+   once every operand has been read. */
+static void expr_to(FuncState *fs, AST *n, int dst){
+  int save = fs->freereg;
+  if (!n) { emit_abc(fs, BC_LOADNIL, dst, 0, 0); return; }
+  fs->line = n->line;
+  switch (n->kind) {
+    case AST_NIL:    emit_abc(fs, BC_LOADNIL, dst, 0, 0); break;
+    case AST_BOOL:   emit_abc(fs, BC_LOADBOOL, dst, n->as.bval.v ? 1 : 0, 0); break;
+    case AST_NUMBER: load_const(fs, dst, V_num(n->as.nval.v)); break;
+    case AST_STRING: emit_abx(fs, BC_LOADK, dst, str_const(fs, n->as.sval.str)); break;
+    case AST_IDENT: {
+      int idx;
+      if (is_dots(n)) { vararg(fs, n, dst, 1); break; }
+      switch (lookup(fs, n, &idx)) {
+        case VK_REG:    if (idx != dst) emit_abc(fs, BC_MOVE, dst, idx, 0); break;
+        case VK_CELL:   emit_abc(fs, BC_GETCELL, dst, idx, 0); break;
+        case VK_UPVAL:  emit_abc(fs, BC_GETUPVAL, dst, idx, 0); break;
+        case VK_GLOBAL: emit_abx(fs, BC_GETGLOBAL, dst, idx); break;
+      }
+      break;
+    }
+    case AST_UNARY: {
+      int r = expr_any(fs, n->as.unary.expr);
+      BcOp op = n->as.unary.op == OP_NEG ? BC_UNM : n->as.unary.op == OP_NOT ? BC_NOT : BC_LEN;
+      fs->line = n->line;
+      emit_abc(fs, op, dst, r, 0);
+      break;
+    }
+    case AST_BINARY: {
+      OpKind op = n->as.binary.op;
+      if (op == OP_AND || op == OP_OR) {
+        /* dst holds the lhs while the rhs is pending, so never a live local */
+        int t = is_temp(fs, dst) ? dst : reserve(fs, 1);
+        expr_to(fs, n->as.binary.lhs, t);
+        int j = emit_jump(fs, op == OP_AND ? BC_JMPIFNOT : BC_JMPIF, t);
+        expr_to(fs, n->as.binary.rhs, t);
+        patch(fs, j, here(fs));
+        if (t != dst) emit_abc(fs, BC_MOVE, dst, t, 0);
+        break;
+      }
+      if ((size_t)op >= sizeof(binops) / sizeof(binops[0]) || binops[op] == BC_MOVE) {
+        emit_abc(fs, BC_LOADNIL, dst, 0, 0);
+        break;
+      }
+      int l = expr_any(fs, n->as.binary.lhs);
+      int imm;
+      if ((op == OP_ADD || op == OP_SUB) && small_int(n->as.binary.rhs, &imm)) {
+        fs->line = n->line;
+        emit_abc(fs, op == OP_ADD ? BC_ADDI : BC_SUBI, dst, l, imm + BC_IMM_BIAS);
+        break;
+      }
+      int r = expr_any(fs, n->as.binary.rhs);
+      fs->line = n->line;
+      emit_abc(fs, binops[op], dst, l, r);
+      break;
+    }
+    case AST_INDEX: {
+      int t = expr_any(fs, n->as.index.target);
+      int kc = key_const(fs, n->as.index.index);
+      fs->line = n->line;
+      if (kc >= 0) emit_abc(fs, BC_GETFIELD, dst, t, kc);
+      else {
+        int k = expr_any(fs, n->as.index.index);
+        fs->line = n->line;
+        emit_abc(fs, BC_GETTABLE, dst, t, k);
+      }
+      break;
+    }
+    case AST_FIELD: {
+      int t = expr_any(fs, n->as.field.target);
+      int kc = str_const(fs, n->as.field.key);
+      fs->line = n->line;
+      if (kc <= BC_MAXARG) emit_abc(fs, BC_GETFIELD, dst, t, kc);
+      else {
+        int k = reserve(fs, 1);
+        emit_abx(fs, BC_LOADK, k, kc);
+        emit_abc(fs, BC_GETTABLE, dst, t, k);
+      }
+      break;
+    }
+    case AST_TABLE: {
+      int t = is_temp(fs, dst) ? dst : reserve(fs, 1);
+      table(fs, n, t);
+      if (t != dst) emit_abc(fs, BC_MOVE, dst, t, 0);
+      break;
+    }
+    case AST_FUNCTION: {
+      int idx = function(fs, n, &n->as.fn.params, n->as.fn.vararg, n->as.fn.body, n->as.fn.slot_captured);
+      fs->line = n->line;
+      emit_abx(fs, BC_CLOSURE, dst, idx);
+      break;
+    }
+    case AST_CALL: call(fs, n, dst, 1); break;
+    default:
+      /* assignments in expression position evaluate to nil, as in the walker */
+      emit_abc(fs, BC_LOADNIL, dst, 0, 0);
+      break;
+  }
+  fs->freereg = save;
+}
+
+/* ---------- statements ---------- */
+
+static void store_target(FuncState *fs, AST *lhs, int src){
+  int save = fs->freereg;
+  if (lhs->kind == AST_IDENT) store_var(fs, lhs, src);
+  else if (lhs->kind == AST_INDEX) {
+    int t = expr_any(fs, lhs->as.index.target);
+    int kc = key_const(fs, lhs->as.index.index);
+    fs->line = lhs->line;
+    if (kc >= 0) emit_abc(fs, BC_SETFIELD, t, kc, src);
+    else emit_abc(fs, BC_SETTABLE, t, expr_any(fs, lhs->as.index.index), src);
+  } else if (lhs->kind == AST_FIELD) {
+    int t = expr_any(fs, lhs->as.field.target);
+    int kc = str_const(fs, lhs->as.field.key);
+    fs->line = lhs->line;
+    if (kc <= BC_MAXARG) emit_abc(fs, BC_SETFIELD, t, kc, src);
+    else {
+      int k = reserve(fs, 1);
+      emit_abx(fs, BC_LOADK, k, kc);
+      emit_abc(fs, BC_SETTABLE, t, k, src);
+    }
+  }
+  fs->freereg = save;
+}
+
+/* Evaluates rvals into nl consecutive fresh registers; a trailing call
+   or `...` supplies as many values as are still missing. */
+static void explist(FuncState *fs, ASTVec *rvals, int nl){
+  int rn = (int)rvals->count;
+  for (int i = 0; i < rn; i++) {
+    AST *e = rvals->items[i];
+    int r = reserve(fs, 1);
+    if (i == rn - 1 && nl > rn && is_multi(e)) {
+      int want = nl - rn + 1;
+      if (e->kind == AST_CALL) call(fs, e, r, want);
+      else vararg(fs, e, r, want);
+      reserve(fs, want - 1);
+      return;
+    }
+    expr_to(fs, e, r);
+  }
+  if (nl > rn) {
+    int r = reserve(fs, nl - rn);
+    emit_abc(fs, BC_LOADNIL, r, nl - rn - 1, 0);
+  }
+}
+
+static void assign_list(FuncState *fs, AST *st){
+  ASTVec *lv = &st->as.massign.lvals;
+  int nl = (int)lv->count;
+  int base = fs->freereg;
+  if (!st->as.massign.is_local && nl == 1 && st->as.massign.rvals.count == 1) {
+    /* x = e on a register local: evaluate straight into it */
+    AST *id = lv->items[0], *e = st->as.massign.rvals.items[0];
+    int idx;
+    if (id->kind == AST_IDENT && e && e->kind != AST_CALL && !is_dots(e) && lookup(fs, id, &idx) == VK_REG) {
+      expr_to(fs, e, idx);
+      return;
+    }
+  }
+  explist(fs, &st->as.massign.rvals, nl);
+  if (st->as.massign.is_local) {
+    fs->freereg = base + nl;
+    if (fs->freereg > fs->p->maxregs) fs->p->maxregs = fs->freereg;
+    for (int i = 0; i < nl; i++) {
+      AST *id = lv->items[i];
+      if (id->as.ident.slot != fs->scope->nvars) fail(fs);
+      declare_local(fs, base + i, true);
+    }
+    fs->nactive = fs->freereg;
+    return;
+  }
+  for (int i = 0; i < nl; i++) store_target(fs, lv->items[i], base + i);
+  fs->freereg = base;
+}
+
+static void push_loop(FuncState *fs, BcLoop *l){
+  memset(l, 0, sizeof(*l));
+  l->prev = fs->loop;
+  fs->loop = l;
+}
+static void pop_loop(FuncState *fs, BcLoop *l, int exit){
+  for (int i = 0; i < l->nbreaks; i++) patch(fs, l->breaks[i], exit);
+  free(l->breaks);
+  fs->loop = l->prev;
+}
+
+/* Opens body's scope with its first slots bound to registers from first. */
+static void open_body(FuncState *fs, BcScope *s, AST *body){
+  bool blk = body && body->kind == AST_BLOCK;
+  open_scope(fs, s, fs->scope, false, blk ? body->as.block.slot_captured : NULL);
+  s->noenv = blk && body->as.block.nslots == 0;
+}
+static void body_stmts(FuncState *fs, AST *body){
+  if (!body) return;
+  if (body->kind != AST_BLOCK) { stmt(fs, body); return; }
+  ASTVec *S = &body->as.block.stmts;
+  for (size_t i = 0; i < S->count; i++) stmt(fs, S->items[i]);
+}
+
+static void block(FuncState *fs, AST *blk){
+  if (!blk) return;
+  if (blk->kind != AST_BLOCK) { stmt(fs, blk); return; }
+  BcScope s;
+  open_body(fs, &s, blk);
+  body_stmts(fs, blk);
+  close_scope(fs, &s);
+}
+
+static void if_stmt(FuncState *fs, AST *st){
+  int save = fs->freereg;
+  int c = expr_any(fs, st->as.ifs.cond);
+  fs->freereg = save;
+  int jf = emit_jump(fs, BC_JMPIFNOT, c);
+  block(fs, st->as.ifs.then_blk);
+  AST *eb = st->as.ifs.else_blk;
+  if (!eb) { patch(fs, jf, here(fs)); return; }
+  int je = emit_jump(fs, BC_JMP, 0);
+  patch(fs, jf, here(fs));
+  if (eb->kind == AST_IF) if_stmt(fs, eb);
+  else block(fs, eb);
+  patch(fs, je, here(fs));
+}
+
+static void fornum(FuncState *fs, AST *st){
+  int a = reserve(fs, 4);
+  expr_to(fs, st->as.fornum.start, a);
+  expr_to(fs, st->as.fornum.end, a + 1);
+  if (st->as.fornum.step) expr_to(fs, st->as.fornum.step, a + 2);
+  else load_const(fs, a + 2, V_int(1));
+  fs->line = st->line;
+  int prep = emit_jump(fs, BC_FORPREP, a);
+  fs->nactive = a + 3;
+  BcLoop loop; push_loop(fs, &loop);
+  int body = here(fs);
+  BcScope s;
+  open_body(fs, &s, st->as.fornum.body);
+  declare_local(fs, a + 3, true);
+  fs->nactive = fs->freereg = a + 4;
+  body_stmts(fs, st->as.fornum.body);
+  close_scope(fs, &s);
+  fs->line = st->line;
+  int fl = emit_jump(fs, BC_FORLOOP, a);
+  patch(fs, fl, body);
+  patch(fs, prep, here(fs));
+  pop_loop(fs, &loop, here(fs));
+  fs->nactive = fs->freereg = a;
+}
+
+static void forin(FuncState *fs, AST *st){
+  int a = reserve(fs, 4);
+  ASTVec *it = &st->as.forin.iters;
+  int niters = it->count > 3 ? 3 : (int)it->count;
+  if (it->count == 1 && it->items[0]->kind == AST_CALL) {
+    multi(fs, it->items[0]);
+    niters = 0;   /* TFORPREP takes up to three of its results */
+  } else {
+    for (int i = 0; i < niters; i++) expr_to(fs, it->items[i], a + i);
+  }
+  fs->line = st->line;
+  emit_abc(fs, BC_TFORPREP, a, niters, 0);
+  int jcall = emit_jump(fs, BC_JMP, 0);
+  fs->nactive = a + 4;
+  BcLoop loop; push_loop(fs, &loop);
+  int body = here(fs);
+  int nvars = (int)st->as.forin.names.count;
+  int nv = nvars < 2 ? 2 : nvars;
+  BcScope s;
+  open_body(fs, &s, st->as.forin.body);
+  reserve(fs, nv);
+  if (nvars > 2) emit_abc(fs, BC_LOADNIL, a + 6, nvars - 3, 0);
+  for (int i = 0; i < nvars; i++) declare_local(fs, a + 4 + i, true);
+  fs->nactive = fs->freereg = a + 4 + nv;
+  body_stmts(fs, st->as.forin.body);
+  close_scope(fs, &s);
+  patch(fs, jcall, here(fs));
+  fs->line = st->line;
+  emit_abc(fs, BC_TFORCALL, a, nvars, 0);
+  int back = emit_jump(fs, BC_JMP, 0);
+  patch(fs, back, body);
+  pop_loop(fs, &loop, here(fs));
+  fs->nactive = fs->freereg = a;
+}
+
+static void add_goto(FuncState *fs, const char *label){
+  BcScope *s = fs->scope;
+  GROW(s->gotos, s->ngotos, s->capgotos);
+  s->gotos[s->ngotos++] = (BcLabel){ label, emit_jump(fs, BC_JMP, 0) };
+}
+
+static void stmt(FuncState *fs, AST *st){
+  if (!st) return;
+  fs->line = st->line;
+  int save = fs->freereg;
+  switch (st->kind) {
+    case AST_STMT_EXPR: {
+      AST *e = st->as.stmt_expr.expr;
+      if (e && e->kind == AST_CALL) call(fs, e, reserve(fs, 1), 1);
+      else if (e) expr_to(fs, e, reserve(fs, 1));
+      break;
+    }
+    case AST_ASSIGN: {
+      AST *lhs = st->as.assign.lhs_ident;
+      int idx;
+      if (lhs->kind == AST_IDENT && lookup(fs, lhs, &idx) == VK_REG) {
+        expr_to(fs, st->as.assign.rhs, idx);
+      } else {
+        int r = expr_any(fs, st->as.assign.rhs);
+        store_target(fs, lhs, r);
+      }
+      break;
+    }
+    case AST_ASSIGN_LIST:
+      assign_list(fs, st);
+      return;   /* local declarations keep their registers */
+    case AST_VAR: {
+      if (st->as.var.is_close) fail(fs);   /* <close> stays on the walker */
+      int r = reserve(fs, 1);
+      expr_to(fs, st->as.var.init, r);
+      if (st->as.var.slot != fs->scope->nvars) fail(fs);
+      declare_local(fs, r, true);
+      fs->nactive = fs->freereg;
+      return;
+    }
+    case AST_BLOCK: block(fs, st); break;
+    case AST_IF: if_stmt(fs, st); break;
+    case AST_WHILE: {
+      int top = here(fs);
+      int c = expr_any(fs, st->as.whiles.cond);
+      fs->freereg = save;
+      int jx = emit_jump(fs, BC_JMPIFNOT, c);
+      BcLoop loop; push_loop(fs, &loop);
+      block(fs, st->as.whiles.body);
+      patch(fs, emit_jump(fs, BC_JMP, 0), top);
+      patch(fs, jx, here(fs));
+      pop_loop(fs, &loop, here(fs));
+      break;
+    }
+    case AST_REPEAT: {
+      BcLoop loop; push_loop(fs, &loop);
+      int top = here(fs);
+      AST *body = st->as.repeatstmt.body;
+      BcScope s;
+      open_body(fs, &s, body);
+      body_stmts(fs, body);
+      int c = expr_any(fs, st->as.repeatstmt.cond);
+      patch(fs, emit_jump(fs, BC_JMPIFNOT, c), top);
+      close_scope(fs, &s);
+      pop_loop(fs, &loop, here(fs));
+      break;
+    }
+    case AST_FOR_NUM: fornum(fs, st); break;
+    case AST_FOR_IN:  forin(fs, st); break;
+    case AST_RETURN: {
+      ASTVec *v = &st->as.ret.values;
+      int nv = (int)v->count;
+      bool open = nv > 0 && is_multi(v->items[nv - 1]);
+      if (st->as.ret.tail) { call(fs, v->items[0], reserve(fs, 1), -1); break; }
+      if (nv == 0) emit_abc(fs, BC_RETURN, 0, 0, 0);
+      else if (nv == 1 && !open) emit_abc(fs, BC_RETURN, expr_any(fs, v->items[0]), 1, 0);
+      else {
+        int base = fs->freereg;
+        int nfix = open ? nv - 1 : nv;
+        if (nfix > BC_MAXARG) fail(fs);
+        for (int i = 0; i < nfix; i++) expr_to(fs, v->items[i], reserve(fs, 1));
+        if (open) multi(fs, v->items[nv - 1]);
+        fs->line = st->line;
+        emit_abc(fs, open ? BC_RETURNV : BC_RETURN, base, nfix, 0);
+      }
+      break;
+    }
+    case AST_BREAK: {
+      int j = emit_jump(fs, BC_JMP, 0);
+      BcLoop *l = fs->loop;
+      if (l) { GROW(l->breaks, l->nbreaks, l->capbreaks); l->breaks[l->nbreaks++] = j; }
+      else add_endjump(fs, j);   /* break outside a loop leaves the function */
+      break;
+    }
+    case AST_GOTO: add_goto(fs, st->as.go.label); break;
+    case AST_LABEL: {
+      BcScope *s = fs->scope;
+      GROW(s->labels, s->nlabels, s->caplabels);
+      s->labels[s->nlabels++] = (BcLabel){ st->as.label.label, here(fs) };
+      break;
+    }
+    case AST_FUNC_STMT: {
+      AST *name = st->as.fnstmt.name;
+      if (st->as.fnstmt.is_local && name->kind == AST_IDENT) {
+        /* declared first so the body can see itself */
+        int r = reserve(fs, 1);
+        if (name->as.ident.slot != fs->scope->nvars) fail(fs);
+        declare_local(fs, r, false);
+        fs->nactive = fs->freereg;
+        int idx = function(fs, st, &st->as.fnstmt.params, st->as.fnstmt.vararg, st->as.fnstmt.body,
+                           st->as.fnstmt.slot_captured);
+        fs->line = st->line;
+        emit_abx(fs, BC_CLOSURE, r, idx);
+        BcVar *v = &fs->scope->vars[fs->scope->nvars - 1];
+        if (v->cell >= 0) emit_abc(fs, BC_SETCELL, v->cell, r, 0);
+        return;
+      }
+      int r = reserve(fs, 1);
+      int idx = function(fs, st, &st->as.fnstmt.params, st->as.fnstmt.vararg, st->as.fnstmt.body,
+                         st->as.fnstmt.slot_captured);
+      fs->line = st->line;
+      emit_abx(fs, BC_CLOSURE, r, idx);
+      store_target(fs, name, r);
+      break;
+    }
+    default:
+      /* try/catch and compound assignment are no-ops in the walker too */
+      break;
+  }
+  fs->freereg = save;
+}
+
+BcProto *bc_compile_chunk(AST *program){
+  if (!program) return NULL;
+  jmp_buf jb;
+  BcProto *volatile p = proto_new(program);
+  FuncState fs = { .p = p, .line = program->line, .fail = &jb };
+  if (setjmp(jb)) { bc_proto_free(p); return NULL; }   /* unsupported: the caller keeps the AST */
+  BcScope cs;
+  open_scope(&fs, &cs, NULL, true, NULL);
+  block(&fs, program);
+  close_scope(&fs, &cs);
+  int ret = emit_abc(&fs, BC_RETURN, 0, 0, 0);
+  for (int i = 0; i < fs.nend; i++) patch(&fs, fs.endjumps[i], ret);
+  free(fs.endjumps);
+  fuse(p);
+  p->gcache = calloc((size_t)p->ncode, sizeof(int));
+  p->fic = calloc((size_t)p->ncode, sizeof(*p->fic));
+  return p;
+}
@@ -0,0 +1,518 @@
+// vm.c — register VM for the bytecode engine (see include/bytecode.h)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../include/bytecode.h"
+#include "../../include/icache.h"
+#include "../../include/gc.h"
+
+int bc_engine = 0;
+
+/* generic-for modes kept in R[A+3], mirroring the walker's for-in */
+enum { TF_SKIP, TF_ARRAY, TF_HASH, TF_CALL0, TF_ARGS };
+
+static inline int invoke(VM *vm, Value f, int argc, Value *argv){
+  if (f.tag == VAL_FUNC && f.as.fn->proto) return bc_call(vm, f.as.fn, argc, argv);
+  return call_multi(vm, f, argc, argv);
+}
+
+/* FORPREP: ra holds the control value, the iterations left (integer loop)
+   or the limit (float loop), the step, and the visible loop variable */
+static bool for_prep(VM *vm, Value *ra){
+  ForNum f;
+  if (!vm_forprep(vm, ra[0], ra[1], ra[2], &f)) return false;
+  if (f.isint) { ra[0] = V_int(f.i); ra[1] = V_int((long long)f.count); ra[2] = V_int(f.step); }
+  else { ra[0] = V_num(f.x); ra[1] = V_num(f.limit); ra[2] = V_num(f.fstep); }
+  ra[3] = ra[0];
+  return true;
+}
+
+static Func *closure_new(BcProto *p, BcCell **cells, BcCell **up, Env *root){
+  Func *fn = gc_alloc(GC_FUNC, sizeof(*fn));
+  AST *n = p->fn;
+  if (n->kind == AST_FUNCTION) {
+    fn->params = n->as.fn.params; fn->body = n->as.fn.body; fn->pnames = n->as.fn.slot_names;
+    fn->heap_env = n->as.fn.heap_env;
+  } else {
+    fn->params = n->as.fnstmt.params; fn->body = n->as.fnstmt.body; fn->pnames = n->as.fnstmt.slot_names;
+    fn->heap_env = n->as.fnstmt.heap_env;
+  }
+  fn->vararg = p->vararg;
+  fn->env = root;
+  fn->proto = p;
+  fn->arena = fn->body->as.block.arena;
+  ast_arena_retain(fn->arena);
+  if (p->nupvals) {
+    fn->upvals = xmalloc(sizeof(BcCell*) * (size_t)p->nupvals);
+    gc_account((long long)(sizeof(BcCell*) * (size_t)p->nupvals));
+    for (int i = 0; i < p->nupvals; i++)
+      fn->upvals[i] = p->upvals[i].from_cell ? cells[p->upvals[i].index] : up[p->upvals[i].index];
+  }
+  return fn;
+}
+
+/* Moves a call's n results at stack[base] into want registers and pops
+   them. */
+static inline void take_results(VM *vm, Value *ra, int want, int base, int n){
+  Value *res = vm->stack + base;
+  for (int k = 0; k < want; k++) ra[k] = k < n ? res[k] : V_nil();
+  vm->top = base;
+}
+
+static void tfor_prep(Value *ra, int niters){
+  Value v = ra[0];
+  int mode = TF_SKIP;
+  if (niters == 1) {
+    if (v.tag == VAL_TABLE) {
+      Value tmp;
+      ra[1] = v;
+      ra[2] = V_int(0);
+      mode = tbl_geti(v.as.t, 1, &tmp) ? TF_ARRAY : TF_HASH;
+    } else if (is_callable(v)) mode = TF_CALL0;
+  } else if (is_callable(v)) {
+    if (niters < 3) ra[2] = V_nil();
+    mode = TF_ARGS;
+  }
+  ra[3] = V_int(mode);
+}
+
+/* One step of a generic for; returns 0 once the loop is exhausted. */
+static int tfor_call(VM *vm, Value *ra, int nvars){
+  switch ((int)ra[3].as.i) {
+    case TF_ARRAY: {
+      long long i = ra[2].as.i + 1;
+      Value val;
+      if (!tbl_geti(ra[1].as.t, i, &val)) return 0;
+      ra[2] = V_int(i);
+      if (nvars <= 1) ra[4] = val;
+      else { ra[4] = V_int(i); ra[5] = val; }
+      return 1;
+    }
+    case TF_HASH: {
+      int it = (int)ra[2].as.i;
+      Value k, v;
+      if (!tbl_next(ra[1].as.t, &it, &k, &v)) return 0;
+      ra[2] = V_int(it);
+      if (nvars <= 1) ra[4] = v;
+      else { ra[4] = k; ra[5] = v; }
+      return 1;
+    }
+    case TF_ARGS:
+    case TF_CALL0: {
+      int mode = (int)ra[3].as.i;
+      int argc = mode == TF_CALL0 ? 0 : 2;
+      Value argv[2] = { ra[1], ra[2] };
+      Value a, b;
+      if (!call_iter(vm, ra[0], argc, argv, &a, &b)) return 0;
+      if (mode != TF_CALL0) ra[2] = a;
+      ra[4] = a; ra[5] = b;
+      return 1;
+    }
+    default: return 0;
+  }
+}
+
+/* GETFIELD's key is a string or number constant; strings go through the
+   instruction's inline cache. */
+static inline Value get_field(VM *vm, FieldIC **ic, Value t, Value k){
+  return k.tag == VAL_STR ? ic_index(vm, ic, t, k.as.s) : vm_index(vm, t, k);
+}
+
+/* Global read through the per-instruction slot cache; slots never move. */
+static inline Value get_global(BcProto *p, Env *root, int at, Value name){
+  int slot = p->gcache[at] - 1;
+  if (slot < 0) {
+    slot = env_global_slot(root, name.as.s);
+    if (slot < 0) return V_nil();
+    p->gcache[at] = slot + 1;
+  }
+  return root->vals[slot];
+}
+
+#define RA      (R[BC_A(i)])
+#define RB      (R[BC_B(i)])
+#define RC      (R[BC_C(i)])
+#define KB      (K[BC_B(i)])
+#define KC      (K[BC_C(i)])
+#define SAVEPC  (vm->current_line = p->lines[pc - 1 - p->code])
+#define FIC     (&p->fic[pc - 1 - p->code])
+#define IS_NUM(v) ((v).tag == VAL_INT || (v).tag == VAL_NUM)
+#define NUM(v)    ((v).tag == VAL_INT ? (double)(v).as.i : (v).as.n)
+
+#define ARITH(op, opk, intok) do { \
+  Value l = RB, r = RC; \
+  if (intok && l.tag == VAL_INT && r.tag == VAL_INT) RA = V_int(l.as.i op r.as.i); \
+  else if (IS_NUM(l) && IS_NUM(r)) RA = V_num(NUM(l) op NUM(r)); \
+  else { SAVEPC; RA = vm_binop(vm, opk, l, r); } \
+} while (0)
+
+#define COMPARE(op, opk) do { \
+  Value l = RB, r = RC; \
+  if (IS_NUM(l) && IS_NUM(r)) RA = V_bool(NUM(l) op NUM(r)); \
+  else { SAVEPC; RA = vm_binop(vm, opk, l, r); } \
+} while (0)
+
+#define ARITHI(op, opk) do { \
+  Value l = RB; \
+  double imm = (double)(BC_C(i) - BC_IMM_BIAS); \
+  if (IS_NUM(l)) RA = V_num(NUM(l) op imm); \
+  else { SAVEPC; RA = vm_binop(vm, opk, l, V_num(imm)); } \
+} while (0)
+
+/* Compare, then run the JMPIF/JMPIFNOT that follows on the result. */
+/* Backward jumps are the loops: each one is a step of the count hook */
+#define STEP do { if (--vm->hook_left < 0) { SAVEPC; vm_hook_fire(vm); } } while (0)
+#define JUMP(o) do { int o_ = (o); if (o_ < 0) STEP; pc += o_; } while (0)
+
+#define COMPAREJ(op, opk, intok) do { \
+  Value l = RB, r = RC; \
+  bool c; \
+  if (intok && l.tag == VAL_INT && r.tag == VAL_INT) c = l.as.i op r.as.i; \
+  else if (IS_NUM(l) && IS_NUM(r)) c = NUM(l) op NUM(r); \
+  else { SAVEPC; c = as_truthy(vm_binop(vm, opk, l, r)); } \
+  RA = V_bool(c); \
+  BcInst j = *pc++; \
+  if (c == (BC_OP(j) == BC_JMPIF)) JUMP(BC_sBx(j)); \
+} while (0)
+
+/* Direct threading through a table of label addresses where the compiler
+   supports it (GCC, Clang): every handler ends in its own indirect jump,
+   which predicts far better than one shared switch. -DBC_SWITCH_DISPATCH
+   forces the portable switch. */
+#if defined(__GNUC__) && !defined(BC_SWITCH_DISPATCH)
+#define BC_THREADED 1
+#define vmdispatch(o)  goto *disptab[o];
+#define vmcase(op)     L_##op:
+#define vmbreak        do { i = *pc++; goto *disptab[BC_OP(i)]; } while (0)
+#else
+#define vmdispatch(o)  switch (o)
+#define vmcase(op)     case BC_##op:
+#define vmbreak        break
+#endif
+
+/* Runs fn's body; returns its result count, or BC_TAIL after a TAILCALL
+   left the callee and its args at the entry stack top for bc_call. */
+#define BC_TAIL (-1)
+static int bc_exec(VM *vm, Func *fn, int argc, Value *argv){
+  BcProto *p = fn->proto;
+  int fbase = vm->top;   /* results go here */
+  int nopen = 0;         /* values the previous instruction left open */
+  Value *R;              /* registers: on the value stack, above the varargs */
+  BcCell *C[p->ncells + 1];
+  BcCell **U = fn->upvals;
+  const Value *K = p->k;
+  const BcInst *pc = p->code;
+  Env *root = fn->env;
+  if (p->groot != root) {
+    memset(p->gcache, 0, sizeof(int) * (size_t)p->ncode);
+    p->groot = root;
+  }
+
+  int np = p->nparams;
+  int nv = p->vararg && argc > np ? argc - np : 0;
+  vm_stack_check(vm, nv + p->maxregs);
+  for (int k = 0; k < nv; k++) vm->stack[fbase + k] = argv[np + k];
+  R = vm->stack + fbase + nv;
+  vm->top = fbase + nv + p->maxregs;
+  for (int k = 0; k < p->maxregs; k++) R[k] = V_nil();
+  for (int k = 0; k < np && k < argc; k++) R[k] = argv[k];
+  if (p->vararg) R[np] = V_multi(fbase, nv);
+  vm_step(vm);
+
+#ifdef BC_THREADED
+  static const void *const disptab[BC_NUM_OPCODES] = {
+#define BC_LABEL(n) &&L_##n,
+    BC_OPCODES(BC_LABEL)
+#undef BC_LABEL
+  };
+#endif
+  BcInst i;
+  for (;;) {
+    i = *pc++;
+    vmdispatch(BC_OP(i)) {
+      vmcase(MOVE)     RA = RB; vmbreak;
+      vmcase(LOADK)    RA = K[BC_Bx(i)]; vmbreak;
+      vmcase(LOADNIL)  for (int k = 0; k <= BC_B(i); k++) R[BC_A(i) + k] = V_nil(); vmbreak;
+      vmcase(LOADBOOL) RA = V_bool(BC_B(i)); vmbreak;
+      vmcase(GETGLOBAL) RA = get_global(p, root, (int)(pc - 1 - p->code), K[BC_Bx(i)]); vmbreak;
+      vmcase(SETGLOBAL) {
+        int at = (int)(pc - 1 - p->code);
+        int slot = p->gcache[at] - 1;
+        if (slot < 0) {
+          slot = env_global_slot(root, K[BC_Bx(i)].as.s);
+          if (slot < 0) { env_add(root, K[BC_Bx(i)].as.s->data, RA, false); vmbreak; }
+          p->gcache[at] = slot + 1;
+        }
+        root->vals[slot] = RA;
+        gc_barrier(root);
+        vmbreak;
+      }
+      vmcase(GETUPVAL) RA = U[BC_B(i)]->v; vmbreak;
+      vmcase(SETUPVAL) U[BC_B(i)]->v = RA; gc_barrier(U[BC_B(i)]); vmbreak;
+      vmcase(NEWCELL) {
+        BcCell *c = gc_alloc(GC_CELL, sizeof(*c));
+        C[BC_A(i)] = c;
+        vmbreak;
+      }
+      vmcase(GETCELL)  RA = C[BC_B(i)]->v; vmbreak;
+      vmcase(SETCELL)  C[BC_A(i)]->v = RB; gc_barrier(C[BC_A(i)]); vmbreak;
+      vmcase(GETTABLE) SAVEPC; RA = vm_index(vm, RB, RC); vmbreak;
+      vmcase(GETFIELD) SAVEPC; RA = get_field(vm, FIC, RB, KC); vmbreak;
+      vmcase(SETTABLE) SAVEPC; vm_setindex(vm, RA, RB, RC); vmbreak;
+      vmcase(SETFIELD) {
+        Value k = KB;
+        SAVEPC;
+        if (k.tag == VAL_STR) ic_setindex(vm, FIC, RA, k.as.s, RC);
+        else vm_setindex(vm, RA, k, RC);
+        vmbreak;
+      }
+      vmcase(SELF) {
+        Value obj = RB;
+        SAVEPC;
+        R[BC_A(i) + 1] = obj;
+        RA = get_field(vm, FIC, obj, KC);
+        vmbreak;
+      }
+      vmcase(NEWTABLE) RA = V_table(); vmbreak;
+      vmcase(APPENDV) {
+        int base = vm->top - nopen;
+        long long at = RB.as.i;
+        if (RA.tag == VAL_TABLE)
+          for (int k = 0; k < nopen; k++) tbl_seti(RA.as.t, at + k, vm->stack[base + k]);
+        vm->top = base;
+        vmbreak;
+      }
+      vmcase(ADD)  ARITH(+, OP_ADD, 1); vmbreak;
+      vmcase(SUB)  ARITH(-, OP_SUB, 1); vmbreak;
+      vmcase(MUL)  ARITH(*, OP_MUL, 1); vmbreak;
+      vmcase(DIV)  ARITH(/, OP_DIV, 0); vmbreak;
+      vmcase(MOD)  SAVEPC; RA = vm_binop(vm, OP_MOD, RB, RC); vmbreak;
+      vmcase(POW)  SAVEPC; RA = vm_binop(vm, OP_POW, RB, RC); vmbreak;
+      vmcase(IDIV) SAVEPC; RA = vm_binop(vm, OP_IDIV, RB, RC); vmbreak;
+      vmcase(CONCAT) SAVEPC; RA = vm_binop(vm, OP_CONCAT, RB, RC); vmbreak;
+      vmcase(ADDI) ARITHI(+, OP_ADD); vmbreak;
+      vmcase(SUBI) ARITHI(-, OP_SUB); vmbreak;
+      vmcase(EQ) {
+        Value l = RB, r = RC;
+        if (l.tag == r.tag && l.tag == VAL_INT) RA = V_bool(l.as.i == r.as.i);
+        else if (IS_NUM(l) && IS_NUM(r)) RA = V_bool(NUM(l) == NUM(r));
+        else { SAVEPC; RA = vm_binop(vm, OP_EQ, l, r); }
+        vmbreak;
+      }
+      vmcase(NE) {
+        Value l = RB, r = RC;
+        if (l.tag == r.tag && l.tag == VAL_INT) RA = V_bool(l.as.i != r.as.i);
+        else if (IS_NUM(l) && IS_NUM(r)) RA = V_bool(NUM(l) != NUM(r));
+        else { SAVEPC; RA = vm_binop(vm, OP_NE, l, r); }
+        vmbreak;
+      }
+      vmcase(LT) COMPARE(<,  OP_LT); vmbreak;
+      vmcase(LE) COMPARE(<=, OP_LE); vmbreak;
+      vmcase(GT) COMPARE(>,  OP_GT); vmbreak;
+      vmcase(GE) COMPARE(>=, OP_GE); vmbreak;
+      vmcase(UNM) SAVEPC; RA = vm_unop(vm, OP_NEG, RB); vmbreak;
+      vmcase(NOT) RA = V_bool(!as_truthy(RB)); vmbreak;
+      vmcase(LEN) SAVEPC; RA = vm_unop(vm, OP_LEN, RB); vmbreak;
+      vmcase(JMP) JUMP(BC_sBx(i)); vmbreak;
+      vmcase(JMPIF)    if (as_truthy(RA)) JUMP(BC_sBx(i)); vmbreak;
+      vmcase(JMPIFNOT) if (!as_truthy(RA)) JUMP(BC_sBx(i)); vmbreak;
+      vmcase(CALL) {
+        Value *ra = &RA;
+        int base = vm->top;
+        SAVEPC;
+        int n = invoke(vm, *ra, BC_B(i), ra + 1);
+        if (BC_C(i)) take_results(vm, ra, BC_C(i), base, n);
+        else nopen = n;
+        vmbreak;
+      }
+      vmcase(CALLV) {
+        Value *ra = &RA;
+        int nfix = BC_B(i), base = vm->top - nopen;
+        vm_stack_check(vm, nfix);
+        Value *args = vm->stack + base;
+        memmove(args + nfix, args, sizeof(Value) * (size_t)nopen);
+        for (int k = 0; k < nfix; k++) args[k] = ra[k + 1];
+        int argc = nfix + nopen;
+        vm->top = base + argc;
+        SAVEPC;
+        int n = invoke(vm, *ra, argc, args);
+        memmove(args, args + argc, sizeof(Value) * (size_t)n);
+        vm->top = base + n;
+        if (BC_C(i)) take_results(vm, ra, BC_C(i), base, n);
+        else nopen = n;
+        vmbreak;
+      }
+      vmcase(VARARG) {
+        Value va = R[p->nparams];
+        if (BC_B(i) == 0) nopen = vm_push_varargs(vm, va);
+        else for (int k = 0; k < BC_B(i); k++) R[BC_A(i) + k] = vm_vararg(vm, va, k);
+        vmbreak;
+      }
+      vmcase(RETURN) {
+        /* the results move down over the frame: R lies above fbase */
+        int n = BC_B(i);
+        memmove(vm->stack + fbase, R + BC_A(i), sizeof(Value) * (size_t)n);
+        vm->top = fbase + n;
+        return n;
+      }
+      vmcase(RETURNV) {
+        int nfix = BC_B(i), base = vm->top - nopen;
+        Value *res = vm->stack + fbase;
+        memmove(res, R + BC_A(i), sizeof(Value) * (size_t)nfix);
+        memmove(res + nfix, vm->stack + base, sizeof(Value) * (size_t)nopen);
+        vm->top = fbase + nfix + nopen;
+        return nfix + nopen;
+      }
+      vmcase(TAILCALL) {
+        Value *ra = &RA;
+        int nfix = BC_B(i), nop = BC_C(i) ? nopen : 0, base = vm->top - nop;
+        SAVEPC;
+        Value *res = vm->stack + fbase;
+        memmove(res, ra, sizeof(Value) * (size_t)(nfix + 1));
+        memmove(res + nfix + 1, vm->stack + base, sizeof(Value) * (size_t)nop);
+        vm->top = fbase + nfix + 1 + nop;
+        return BC_TAIL;
+      }
+      vmcase(CLOSURE) {
+        Value v; v.tag = VAL_FUNC;
+        v.as.fn = closure_new(p->protos[BC_Bx(i)], C, U, root);
+        RA = v;
+        vmbreak;
+      }
+      vmcase(FORPREP) {
+        /* ra: control value, count left (int) or limit (float), step, the loop variable */
+        SAVEPC;
+        if (!for_prep(vm, &RA)) pc += BC_sBx(i);
+        vmbreak;
+      }
+      vmcase(FORLOOP) {
+        Value *ra = &RA;
+        if (ra[2].tag == VAL_INT) {
+          unsigned long long left = (unsigned long long)ra[1].as.i;
+          if (left) {
+            long long idx = (long long)((unsigned long long)ra[0].as.i + (unsigned long long)ra[2].as.i);
+            ra[1].as.i = (long long)(left - 1);
+            ra[0].as.i = idx;
+            ra[3] = V_int(idx);
+            JUMP(BC_sBx(i));
+          }
+        } else {
+          double x = ra[0].as.n + ra[2].as.n;
+          if (ra[2].as.n > 0 ? x <= ra[1].as.n : x >= ra[1].as.n) {
+            ra[0].as.n = x;
+            ra[3] = ra[0];
+            JUMP(BC_sBx(i));
+          }
+        }
+        vmbreak;
+      }
+      vmcase(TFORPREP) {
+        Value *ra = &RA;
+        int niters = BC_B(i);
+        if (niters == 0) {
+          int base = vm->top - nopen;
+          for (int k = 0; k < 3; k++) ra[k] = k < nopen ? vm->stack[base + k] : V_nil();
+          niters = nopen < 1 ? 1 : nopen > 3 ? 3 : nopen;
+          vm->top = base;
+        }
+        tfor_prep(ra, niters);
+        vmbreak;
+      }
+      vmcase(TFORCALL) {
+        SAVEPC;
+        int more = tfor_call(vm, &RA, BC_B(i));
+        if (!more) pc++;   /* skip the jump back into the body */
+        vmbreak;
+      }
+      vmcase(EQJ) COMPAREJ(==, OP_EQ, 1); vmbreak;
+      vmcase(NEJ) COMPAREJ(!=, OP_NE, 1); vmbreak;
+      vmcase(LTJ) COMPAREJ(<,  OP_LT, 0); vmbreak;
+      vmcase(LEJ) COMPAREJ(<=, OP_LE, 0); vmbreak;
+      vmcase(GTJ) COMPAREJ(>,  OP_GT, 0); vmbreak;
+      vmcase(GEJ) COMPAREJ(>=, OP_GE, 0); vmbreak;
+      vmcase(GETUPFIELD) {
+        BcInst j = *pc++;
+        Value t = U[BC_B(i)]->v;
+        RA = t;
+        SAVEPC;
+        R[BC_A(j)] = get_field(vm, FIC, t, K[BC_C(j)]);
+        vmbreak;
+      }
+      vmcase(GETGLOBFIELD) {
+        Value t = get_global(p, root, (int)(pc - 1 - p->code), K[BC_Bx(i)]);
+        BcInst j = *pc++;
+        RA = t;
+        SAVEPC;
+        R[BC_A(j)] = get_field(vm, FIC, t, K[BC_C(j)]);
+        vmbreak;
+      }
+#ifndef BC_THREADED
+      default:
+        vm_raise(vm, V_str_from_c("bad bytecode"));
+        return 0;
+#endif
+    }
+  }
+}
+
+/* Tail calls run here, one after another, at the same stack base: each
+   callee's values (its results, or the next callee and its args) move
+   down from where it ran. */
+int bc_call(VM *vm, Func *fn, int argc, Value *argv){
+  vm_cstack_check(vm);
+  int base = vm->top, at = base;
+  int n = bc_exec(vm, fn, argc, argv);
+  for (;;) {
+    int cnt = vm->top - at;
+    if (at != base) {
+      memmove(vm->stack + base, vm->stack + at, sizeof(Value) * (size_t)cnt);
+      vm->top = base + cnt;
+    }
+    if (n != BC_TAIL) return n;
+    Value cal = vm->stack[base];
+    argc = cnt - 1;
+    argv = vm->stack + base + 1;
+    at = vm->top;
+    if (cal.tag == VAL_FUNC && cal.as.fn->proto) n = bc_exec(vm, cal.as.fn, argc, argv);
+    else { n = call_multi(vm, cal, argc, argv); at = vm->top - n; }
+  }
+}
+
+int bc_attach_chunk(Func *fn, AST *program){
+  if (!bc_engine) return 0;
+  BcProto *p = bc_compile_chunk(program);
+  if (!p) return 0;
+  ast_arena_on_free(program->as.block.arena, (void (*)(void *))bc_proto_free, p);
+  fn->proto = p;
+  fn->upvals = NULL;
+  return 1;
+}
+
+static const char *op_names[] = {
+#define BC_NAME(n) #n,
+  BC_OPCODES(BC_NAME)
+#undef BC_NAME
+};
+
+void bc_dump(FILE *out, BcProto *p){
+  fprintf(out, "function <line %d>: %d params%s, %d regs, %d cells, %d upvals, %d consts\n",
+          p->fn ? p->fn->line : 0, p->nparams, p->vararg ? "+..." : "", p->maxregs, p->ncells,
+          p->nupvals, p->nk);
+  for (int k = 0; k < p->ncode; k++) {
+    BcInst i = p->code[k];
+    int op = BC_OP(i);
+    fprintf(out, "  %4d [%4d] %-12s", k, p->lines[k], op < BC_NUM_OPCODES ? op_names[op] : "?");
+    switch (op) {
+      case BC_LOADK: case BC_GETGLOBAL: case BC_SETGLOBAL: case BC_CLOSURE: case BC_GETGLOBFIELD:
+        fprintf(out, "%d %d", BC_A(i), BC_Bx(i)); break;
+      case BC_JMP: case BC_JMPIF: case BC_JMPIFNOT: case BC_FORPREP: case BC_FORLOOP:
+        fprintf(out, "%d -> %d", BC_A(i), k + 1 + BC_sBx(i)); break;
+      case BC_ADDI: case BC_SUBI:
+        fprintf(out, "%d %d %d", BC_A(i), BC_B(i), BC_C(i) - BC_IMM_BIAS); break;
+      default:
+        fprintf(out, "%d %d %d", BC_A(i), BC_B(i), BC_C(i)); break;
+    }
+    fputc('\n', out);
+  }
+  for (int k = 0; k < p->nprotos; k++) bc_dump(out, p->protos[k]);
+}
@@ -0,0 +1,467 @@
+// chunk.c — binary chunks and the require cache (see include/chunk.h)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../include/chunk.h"
+#include "../include/interpreter.h"
+#include "../include/resolver.h"
+#include "../include/util.h"
+
+#define CHUNK_MAGIC   "\x1bLXC"
+#define CHUNK_VERSION 3
+#define CHUNK_HDR     40   /* magic, version, 3 reserved, then the key */
+#define NODE_PAREN    0x80 /* or'ed into a node's kind byte: written as (expr) */
+
+typedef struct {
+  uint64_t mtime_s, mtime_ns, size, hash;
+} ChunkKey;
+
+static uint64_t fnv64(const char *s, size_t n){
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < n; i++) { h ^= (unsigned char)s[i]; h *= 1099511628211ull; }
+  return h;
+}
+
+static bool source_key(const char *path, ChunkKey *k){
+  struct stat st;
+  if (stat(path, &st) != 0) return false;
+  k->mtime_s = (uint64_t)st.st_mtime;
+#if defined(__APPLE__)
+  k->mtime_ns = (uint64_t)st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  k->mtime_ns = 0;
+#else
+  k->mtime_ns = (uint64_t)st.st_mtim.tv_nsec;
+#endif
+  k->size = (uint64_t)st.st_size;
+  k->hash = 0;
+  return true;
+}
+
+/* ===== writing ===== */
+
+typedef struct {
+  char *b; size_t n, cap;
+  const char **strs; unsigned *ids; size_t nslots, nstrs;   /* string table, open addressing */
+  bool bad;
+} Writer;
+
+static void put(Writer *w, const void *p, size_t n){
+  if (w->n + n > w->cap) {
+    w->cap = (w->n + n) * 2;
+    w->b = realloc(w->b, w->cap);
+    if (!w->b) { fprintf(stderr, "OOM\n"); exit(1); }
+  }
+  memcpy(w->b + w->n, p, n);
+  w->n += n;
+}
+
+static void put_u8(Writer *w, unsigned v){ unsigned char c = (unsigned char)v; put(w, &c, 1); }
+
+static void put_uv(Writer *w, uint64_t v){
+  do { unsigned char c = v & 0x7f; v >>= 7; if (v) c |= 0x80; put(w, &c, 1); } while (v);
+}
+
+static void put_u64(Writer *w, uint64_t v){
+  unsigned char b[8];
+  for (int i = 0; i < 8; i++) b[i] = (unsigned char)(v >> (8 * i));
+  put(w, b, 8);
+}
+
+static void put_f64(Writer *w, double d){ uint64_t u; memcpy(&u, &d, 8); put_u64(w, u); }
+
+/* 0 = NULL, i = i-th string seen; a string's first use is followed by its
+   bytes and terminator. */
+static void put_str(Writer *w, const char *s){
+  if (!s) { put_uv(w, 0); return; }
+  if (2 * (w->nstrs + 1) > w->nslots) {
+    size_t n = w->nslots ? w->nslots * 2 : 256;
+    const char **strs = calloc(n, sizeof(*strs));
+    unsigned *ids = calloc(n, sizeof(*ids));
+    if (!strs || !ids) { fprintf(stderr, "OOM\n"); exit(1); }
+    for (size_t i = 0; i < w->nslots; i++) {
+      if (!w->strs[i]) continue;
+      size_t j = fnv64(w->strs[i], strlen(w->strs[i])) & (n - 1);
+      while (strs[j]) j = (j + 1) & (n - 1);
+      strs[j] = w->strs[i]; ids[j] = w->ids[i];
+    }
+    free(w->strs); free(w->ids);
+    w->strs = strs; w->ids = ids; w->nslots = n;
+  }
+  size_t len = strlen(s);
+  size_t j = fnv64(s, len) & (w->nslots - 1);
+  for (; w->strs[j]; j = (j + 1) & (w->nslots - 1))
+    if (strcmp(w->strs[j], s) == 0) { put_uv(w, w->ids[j]); return; }
+  w->strs[j] = s;
+  w->ids[j] = (unsigned)++w->nstrs;
+  put_uv(w, w->nstrs);
+  put_uv(w, len);
+  put(w, s, len + 1);
+}
+
+static void put_node(Writer *w, AST *n);
+
+static void put_vec(Writer *w, ASTVec *v){
+  put_uv(w, v->count);
+  for (unsigned i = 0; i < v->count; i++) put_node(w, v->items[i]);
+}
+
+static void put_node(Writer *w, AST *n){
+  if (!n) { put_u8(w, 0); return; }
+  put_u8(w, n->kind | (n->paren ? NODE_PAREN : 0));
+  put_uv(w, (uint64_t)(n->line < 0 ? 0 : n->line));
+  switch (n->kind) {
+    case AST_NIL: case AST_BREAK: break;
+    case AST_BOOL:   put_u8(w, n->as.bval.v); break;
+    case AST_NUMBER: put_f64(w, n->as.nval.v); break;
+    case AST_STRING: put_str(w, n->as.sval.s); break;
+    case AST_IDENT:  put_str(w, n->as.ident.name); break;
+    case AST_UNARY:  put_u8(w, n->as.unary.op); put_node(w, n->as.unary.expr); break;
+    case AST_BINARY:
+      put_u8(w, n->as.binary.op);
+      put_node(w, n->as.binary.lhs); put_node(w, n->as.binary.rhs);
+      break;
+    case AST_ASSIGN: put_node(w, n->as.assign.lhs_ident); put_node(w, n->as.assign.rhs); break;
+    case AST_ASSIGN_LIST:
+      put_vec(w, &n->as.massign.lvals); put_vec(w, &n->as.massign.rvals);
+      put_u8(w, n->as.massign.is_local);
+      break;
+    case AST_CALL:
+      /* a method call's self is its callee's target: written once */
+      put_node(w, n->as.call.callee); put_u8(w, n->as.call.method);
+      put_uv(w, n->as.call.args.count - n->as.call.method);
+      for (unsigned i = n->as.call.method; i < n->as.call.args.count; i++) put_node(w, n->as.call.args.items[i]);
+      break;
+    case AST_INDEX: put_node(w, n->as.index.target); put_node(w, n->as.index.index); break;
+    case AST_FIELD: put_node(w, n->as.field.target); put_str(w, n->as.field.field); break;
+    case AST_TABLE: put_vec(w, &n->as.table.keys); put_vec(w, &n->as.table.values); break;
+    case AST_FUNCTION:
+      put_vec(w, &n->as.fn.params); put_u8(w, n->as.fn.vararg); put_node(w, n->as.fn.body);
+      break;
+    case AST_STMT_EXPR: put_node(w, n->as.stmt_expr.expr); break;
+    case AST_VAR:
+      put_u8(w, n->as.var.is_local); put_u8(w, n->as.var.is_close);
+      put_str(w, n->as.var.name); put_node(w, n->as.var.init);
+      break;
+    case AST_BLOCK: put_vec(w, &n->as.block.stmts); break;
+    case AST_IF:
+      put_node(w, n->as.ifs.cond); put_node(w, n->as.ifs.then_blk); put_node(w, n->as.ifs.else_blk);
+      break;
+    case AST_WHILE:  put_node(w, n->as.whiles.cond); put_node(w, n->as.whiles.body); break;
+    case AST_REPEAT: put_node(w, n->as.repeatstmt.body); put_node(w, n->as.repeatstmt.cond); break;
+    case AST_FOR_NUM:
+      put_str(w, n->as.fornum.var);
+      put_node(w, n->as.fornum.start); put_node(w, n->as.fornum.end);
+      put_node(w, n->as.fornum.step); put_node(w, n->as.fornum.body);
+      break;
+    case AST_FOR_IN:
+      put_vec(w, &n->as.forin.names); put_vec(w, &n->as.forin.iters); put_node(w, n->as.forin.body);
+      break;
+    case AST_RETURN: put_vec(w, &n->as.ret.values); break;
+    case AST_GOTO:   put_str(w, n->as.go.label); break;
+    case AST_LABEL:  put_str(w, n->as.label.label); break;
+    case AST_FUNC_STMT:
+      put_u8(w, n->as.fnstmt.is_local); put_node(w, n->as.fnstmt.name);
+      put_vec(w, &n->as.fnstmt.params); put_u8(w, n->as.fnstmt.vararg); put_node(w, n->as.fnstmt.body);
+      break;
+    case AST_TRY:
+      put_node(w, n->as.trycatch.try_block); put_node(w, n->as.trycatch.catch_block);
+      put_node(w, n->as.trycatch.finally_block); put_str(w, n->as.trycatch.catch_var);
+      break;
+    default: w->bad = true; break;   /* not produced by the parser */
+  }
+}
+
+static int write_chunk(AST *program, const ChunkKey *k, const char *out){
+  Writer w = {0};
+  put(&w, CHUNK_MAGIC, 4);
+  put_u8(&w, CHUNK_VERSION); put_u8(&w, 0); put_u8(&w, 0); put_u8(&w, 0);
+  put_u64(&w, k->mtime_s); put_u64(&w, k->mtime_ns); put_u64(&w, k->size); put_u64(&w, k->hash);
+  put_node(&w, program);
+  free(w.strs); free(w.ids);
+  if (w.bad) { free(w.b); return 1; }
+  /* write beside the target and rename, so readers never see half a file */
+  size_t n = strlen(out) + 32;
+  char *tmp = xmalloc(n);
+  snprintf(tmp, n, "%s.%ld.tmp", out, (long)getpid());
+  FILE *f = fopen(tmp, "wb");
+  int rc = 1;
+  if (f) {
+    bool ok = fwrite(w.b, 1, w.n, f) == w.n;
+    ok = fclose(f) == 0 && ok;
+    if (ok && rename(tmp, out) == 0) rc = 0;
+    else remove(tmp);
+  }
+  free(tmp);
+  free(w.b);
+  return rc;
+}
+
+/* ===== reading ===== */
+
+typedef struct {
+  const unsigned char *p, *end;
+  const char **strs; size_t nstrs, capstrs;
+  jmp_buf fail;
+} Reader;
+
+static unsigned get_u8(Reader *r){
+  if (r->p >= r->end) longjmp(r->fail, 1);
+  return *r->p++;
+}
+
+static uint64_t get_uv(Reader *r){
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    unsigned c = get_u8(r);
+    v |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) return v;
+  }
+  longjmp(r->fail, 1);
+}
+
+static uint64_t get_u64(Reader *r){
+  if (r->end - r->p < 8) longjmp(r->fail, 1);
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) v |= (uint64_t)r->p[i] << (8 * i);
+  r->p += 8;
+  return v;
+}
+
+static double get_f64(Reader *r){ uint64_t u = get_u64(r); double d; memcpy(&d, &u, 8); return d; }
+
+static const char *get_str(Reader *r){
+  uint64_t id = get_uv(r);
+  if (id == 0) return NULL;
+  if (id <= r->nstrs) return r->strs[id - 1];
+  if (id != r->nstrs + 1) longjmp(r->fail, 1);
+  uint64_t len = get_uv(r);
+  if ((uint64_t)(r->end - r->p) <= len || r->p[len] != '\0') longjmp(r->fail, 1);
+  const char *s = (const char *)r->p;
+  r->p += len + 1;
+  if (r->nstrs == r->capstrs) {
+    r->capstrs = r->capstrs ? r->capstrs * 2 : 256;
+    r->strs = realloc(r->strs, sizeof(*r->strs) * r->capstrs);
+    if (!r->strs) { fprintf(stderr, "OOM\n"); exit(1); }
+  }
+  r->strs[r->nstrs++] = s;
+  return s;
+}
+
+static AST *get_node(Reader *r);
+
+static ASTVec get_vec(Reader *r){
+  ASTVec v = {0};
+  uint64_t n = get_uv(r);
+  if (n > (uint64_t)(r->end - r->p)) longjmp(r->fail, 1);   /* at least a byte per node */
+  for (uint64_t i = 0; i < n; i++) astvec_push(&v, get_node(r));
+  return v;
+}
+
+static AST *need(Reader *r, AST *n){ if (!n) longjmp(r->fail, 1); return n; }
+
+static AST *get_node_of(Reader *r, unsigned kind){
+  int l = (int)get_uv(r);
+  AST *n, *a, *b, *c;
+  ASTVec v1, v2;
+  const char *s;
+  unsigned op;
+  switch (kind) {
+    case AST_NIL:    return ast_make_nil(l);
+    case AST_BREAK:  return ast_make_break(l);
+    case AST_BOOL:   return ast_make_bool(get_u8(r) != 0, l);
+    case AST_NUMBER: return ast_make_number(get_f64(r), l);
+    case AST_STRING: return ast_make_string(get_str(r), l);
+    case AST_IDENT:  return ast_make_ident(get_str(r), l);
+    case AST_UNARY:  op = get_u8(r); return ast_make_unary((OpKind)op, get_node(r), l);
+    case AST_BINARY:
+      op = get_u8(r); a = get_node(r); b = get_node(r);
+      return ast_make_binary((OpKind)op, a, b, l);
+    case AST_ASSIGN: a = get_node(r); b = get_node(r); return ast_make_assign(a, b, l);
+    case AST_ASSIGN_LIST:
+      v1 = get_vec(r); v2 = get_vec(r);
+      n = ast_make_assign_list(v1, v2, l);
+      n->as.massign.is_local = get_u8(r) != 0;
+      return n;
+    case AST_CALL: {
+      a = need(r, get_node(r));
+      bool method = get_u8(r) != 0;
+      if (method && a->kind != AST_FIELD) longjmp(r->fail, 1);
+      v1 = (ASTVec){0};
+      if (method) astvec_push(&v1, a->as.field.target);
+      uint64_t na = get_uv(r);
+      if (na > (uint64_t)(r->end - r->p)) longjmp(r->fail, 1);
+      for (uint64_t i = 0; i < na; i++) astvec_push(&v1, get_node(r));
+      n = ast_make_call(a, v1, l);
+      n->as.call.method = method;
+      return n;
+    }
+    case AST_INDEX: a = need(r, get_node(r)); b = get_node(r); return ast_make_index(a, b, l);
+    case AST_FIELD: a = need(r, get_node(r)); return ast_make_field(a, get_str(r), l);
+    case AST_TABLE:
+      v1 = get_vec(r); v2 = get_vec(r);
+      if (v1.count != v2.count) longjmp(r->fail, 1);
+      return ast_make_table(v1, v2, l);
+    case AST_FUNCTION: {
+      v1 = get_vec(r); bool va = get_u8(r) != 0; a = need(r, get_node(r));
+      if (a->kind != AST_BLOCK) longjmp(r->fail, 1);
+      return ast_make_function(v1, va, a, l);
+    }
+    case AST_STMT_EXPR: return ast_make_stmt_expr(get_node(r), l);
+    case AST_VAR: {
+      bool loc = get_u8(r) != 0, close = get_u8(r) != 0;
+      s = get_str(r);
+      n = ast_make_var(loc, s, get_node(r), l);
+      n->as.var.is_close = close;
+      return n;
+    }
+    case AST_BLOCK:  return ast_make_block(get_vec(r), l);
+    case AST_IF:
+      a = get_node(r); b = get_node(r); c = get_node(r);
+      return ast_make_if(a, b, c, l);
+    case AST_WHILE:  a = get_node(r); b = get_node(r); return ast_make_while(a, b, l);
+    case AST_REPEAT: a = get_node(r); b = get_node(r); return ast_make_repeat(a, b, l);
+    case AST_FOR_NUM: {
+      s = get_str(r);
+      a = get_node(r); b = get_node(r); c = get_node(r);
+      AST *body = get_node(r);
+      return ast_make_for_num(s, a, b, c, body, l);
+    }
+    case AST_FOR_IN:
+      v1 = get_vec(r); v2 = get_vec(r);
+      return ast_make_for_in(v1, v2, get_node(r), l);
+    case AST_RETURN: return ast_make_return_list(get_vec(r), l);
+    case AST_GOTO:   return ast_make_goto(get_str(r), l);
+    case AST_LABEL:  return ast_make_label(get_str(r), l);
+    case AST_FUNC_STMT: {
+      bool loc = get_u8(r) != 0;
+      a = need(r, get_node(r)); v1 = get_vec(r);
+      bool va = get_u8(r) != 0;
+      b = need(r, get_node(r));
+      if (b->kind != AST_BLOCK) longjmp(r->fail, 1);
+      return ast_make_func_stmt(loc, a, v1, va, b, l);
+    }
+    case AST_TRY:
+      a = get_node(r); b = get_node(r); c = get_node(r);
+      return ast_make_try_catch_finally(a, b, c, get_str(r), l);
+    default: longjmp(r->fail, 1);
+  }
+}
+
+static AST *get_node(Reader *r){
+  unsigned kind = get_u8(r);
+  if (kind == 0) return NULL;
+  AST *n = get_node_of(r, kind & ~NODE_PAREN);
+  n->paren = (kind & NODE_PAREN) != 0;
+  return n;
+}
+
+bool chunk_is_binary(const char *data, size_t len){
+  return len >= CHUNK_HDR && memcmp(data, CHUNK_MAGIC, 4) == 0;
+}
+
+static bool read_key(const char *data, size_t len, ChunkKey *k){
+  if (!chunk_is_binary(data, len) || (unsigned char)data[4] != CHUNK_VERSION) return false;
+  Reader r = { .p = (const unsigned char *)data + 8, .end = (const unsigned char *)data + len };
+  if (setjmp(r.fail)) return false;
+  k->mtime_s = get_u64(&r); k->mtime_ns = get_u64(&r);
+  k->size = get_u64(&r); k->hash = get_u64(&r);
+  return true;
+}
+
+AST *chunk_undump(const char *data, size_t len){
+  ChunkKey k;
+  if (!read_key(data, len, &k)) return NULL;
+  AstArena *volatile a = ast_arena_new();
+  AstArena *volatile outer = ast_arena_enter(a);
+  Reader r = { .p = (const unsigned char *)data + CHUNK_HDR, .end = (const unsigned char *)data + len };
+  if (setjmp(r.fail)) {
+    ast_arena_enter(outer);
+    ast_arena_release(a);
+    free(r.strs);
+    return NULL;
+  }
+  AST *root = need(&r, get_node(&r));
+  if (root->kind != AST_BLOCK || r.p != r.end) longjmp(r.fail, 1);
+  ast_arena_enter(outer);   /* the root keeps the arena's only reference */
+  free(r.strs);
+  return root;
+}
+
+/* ===== compiling ===== */
+
+/* Unresolved tree of src; *ok is false if it had syntax errors (reported) */
+static AST *parse_source(const char *src, size_t len, bool *ok){
+  Lexer lx;
+  lexer_init(&lx, src, len);
+  Parser *p = parser_create(&lx);
+  AST *program = parse_chunk(p);
+  *ok = !p->had_error;
+  parser_destroy(p);
+  lexer_free(&lx);
+  return program;
+}
+
+int chunk_compile_file(const char *src, const char *out){
+  ChunkKey k;
+  size_t len;
+  const char *text = source_key(src, &k) ? map_file(src, &len) : NULL;
+  if (!text) { fprintf(stderr, "[LuaX]: cannot open '%s'\n", src); return 1; }
+  k.hash = fnv64(text, len);
+  bool ok;
+  AST *program = parse_source(text, len, &ok);
+  unmap_file(text, len);
+  if (!ok) { ast_free(program); return 1; }
+  int rc = write_chunk(program, &k, out);
+  if (rc) fprintf(stderr, "[LuaX]: cannot write '%s'\n", out);
+  ast_free(program);
+  return rc;
+}
+
+static char *cache_path(const char *path){
+  const char *slash = strrchr(path, '/');
+  const char *dot = strrchr(path, '.');
+  size_t stem = (dot && (!slash || dot > slash)) ? (size_t)(dot - path) : strlen(path);
+  char *c = xmalloc(stem + sizeof(CHUNK_EXT));
+  memcpy(c, path, stem);
+  memcpy(c + stem, CHUNK_EXT, sizeof(CHUNK_EXT));
+  return c;
+}
+
+AST *compile_module(const char *path){
+  ChunkKey sk;
+  if (getenv("LUAX_NOCACHE") || !source_key(path, &sk)) return compile_file(path);
+  char *cpath = cache_path(path);
+  size_t clen = 0, len = 0;
+  const char *cached = map_file(cpath, &clen);
+  ChunkKey ck;
+  bool have = cached && read_key(cached, clen, &ck);
+  AST *program = NULL;
+  if (have && ck.size == sk.size && ck.mtime_s == sk.mtime_s && ck.mtime_ns == sk.mtime_ns)
+    program = chunk_undump(cached, clen);
+  if (!program) {
+    const char *text = map_file(path, &len);
+    if (text) {
+      sk.hash = fnv64(text, len);
+      if (have && ck.size == len && ck.hash == sk.hash) {
+        /* same bytes, new mtime (checkout, touch): keep the tree, restamp it */
+        program = chunk_undump(cached, clen);
+        if (program) write_chunk(program, &sk, cpath);
+      }
+      if (!program) {
+        bool ok;
+        program = parse_source(text, len, &ok);
+        if (ok) write_chunk(program, &sk, cpath);   /* broken sources run as before, uncached */
+      }
+      unmap_file(text, len);
+    }
+  }
+  if (cached) unmap_file(cached, clen);
+  free(cpath);
+  if (program) resolve_chunk(program);
+  return program;
+}
@@ -0,0 +1,290 @@
+// coctx.c — context switching and C stacks for coroutines
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../include/coctx.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#define COCTX_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define COCTX_ASAN 1
+#endif
+#endif
+#ifdef COCTX_ASAN
+void __sanitizer_start_switch_fiber(void **fake_stack_save, const void *bottom, size_t size);
+void __sanitizer_finish_switch_fiber(void *fake_stack_save, const void **bottom_old, size_t *size_old);
+#endif
+
+/* the context the running one was entered from, so it can learn its
+   own stack bounds (only the sanitizer needs them) */
+static CoCtx *switched_from;
+
+static void arrived(void *fake){
+#ifdef COCTX_ASAN
+  __sanitizer_finish_switch_fiber(fake, &switched_from->stk_lo, &switched_from->stk_size);
+#else
+  (void)fake;
+#endif
+}
+
+static void (*boot_entry)(void *);
+static void *boot_arg;
+
+/* First code on a new stack. entry/arg are picked up from the statics
+   before anything else can switch. */
+static void coctx_enter(void){
+  void (*entry)(void *) = boot_entry;
+  void *arg = boot_arg;
+  arrived(NULL);
+  entry(arg);
+  abort();   /* entry ends with a final switch */
+}
+
+#ifndef COCTX_UCONTEXT
+
+#ifdef __APPLE__
+#define SYM(x) "_" #x
+#else
+#define SYM(x) #x
+#endif
+
+/* coctx_jump(&from->sp, &to->sp): push the callee-saved registers, swap
+   stack pointers, pop the other side's. A fresh stack is laid out so the
+   pops land in coctx_boot, which calls coctx_enter. */
+void coctx_jump(void **from_sp, void **to_sp);
+void coctx_boot(void);
+
+#if defined(__x86_64__)
+__asm__(
+  ".text\n"
+  ".globl " SYM(coctx_jump) "\n"
+  ".p2align 4\n"
+  SYM(coctx_jump) ":\n"
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  subq $8, %rsp\n"
+  "  stmxcsr (%rsp)\n"
+  "  fnstcw 4(%rsp)\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq (%rsi), %rsp\n"
+  "  ldmxcsr (%rsp)\n"
+  "  fldcw 4(%rsp)\n"
+  "  addq $8, %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  ret\n"
+  ".globl " SYM(coctx_boot) "\n"
+  ".p2align 4\n"
+  SYM(coctx_boot) ":\n"
+  "  callq *%r12\n"
+  "  ud2\n"
+);
+
+void coctx_make(CoCtx *ctx, void *stack, size_t size, void (*entry)(void *), void *arg){
+  uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+  void **sp = (void **)top - 8;
+  sp[0] = (void *)(uintptr_t)0x0000037F00001F80ull;   /* default mxcsr, x87 control word */
+  sp[1] = sp[2] = sp[3] = NULL;                       /* r15 r14 r13 */
+  sp[4] = (void *)coctx_enter;                        /* r12 */
+  sp[5] = sp[6] = NULL;                               /* rbx rbp */
+  sp[7] = (void *)coctx_boot;                         /* return address */
+  ctx->sp = sp;
+  ctx->stk_lo = stack;
+  ctx->stk_size = size;
+  ctx->entry = entry;
+  ctx->arg = arg;
+}
+
+#elif defined(__aarch64__)
+__asm__(
+  ".text\n"
+  ".globl " SYM(coctx_jump) "\n"
+  ".p2align 4\n"
+  SYM(coctx_jump) ":\n"
+  "  sub sp, sp, #160\n"
+  "  stp x19, x20, [sp, #0]\n"
+  "  stp x21, x22, [sp, #16]\n"
+  "  stp x23, x24, [sp, #32]\n"
+  "  stp x25, x26, [sp, #48]\n"
+  "  stp x27, x28, [sp, #64]\n"
+  "  stp x29, x30, [sp, #80]\n"
+  "  stp d8, d9, [sp, #96]\n"
+  "  stp d10, d11, [sp, #112]\n"
+  "  stp d12, d13, [sp, #128]\n"
+  "  stp d14, d15, [sp, #144]\n"
+  "  mov x9, sp\n"
+  "  str x9, [x0]\n"
+  "  ldr x9, [x1]\n"
+  "  mov sp, x9\n"
+  "  ldp x19, x20, [sp, #0]\n"
+  "  ldp x21, x22, [sp, #16]\n"
+  "  ldp x23, x24, [sp, #32]\n"
+  "  ldp x25, x26, [sp, #48]\n"
+  "  ldp x27, x28, [sp, #64]\n"
+  "  ldp x29, x30, [sp, #80]\n"
+  "  ldp d8, d9, [sp, #96]\n"
+  "  ldp d10, d11, [sp, #112]\n"
+  "  ldp d12, d13, [sp, #128]\n"
+  "  ldp d14, d15, [sp, #144]\n"
+  "  add sp, sp, #160\n"
+  "  ret\n"
+  ".globl " SYM(coctx_boot) "\n"
+  ".p2align 4\n"
+  SYM(coctx_boot) ":\n"
+  "  blr x19\n"
+  "  brk #0\n"
+);
+
+void coctx_make(CoCtx *ctx, void *stack, size_t size, void (*entry)(void *), void *arg){
+  uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+  void **sp = (void **)top - 20;
+  for (int k = 0; k < 20; k++) sp[k] = NULL;
+  sp[0] = (void *)coctx_enter;    /* x19 */
+  sp[11] = (void *)coctx_boot;    /* x30 */
+  ctx->sp = sp;
+  ctx->stk_lo = stack;
+  ctx->stk_size = size;
+  ctx->entry = entry;
+  ctx->arg = arg;
+}
+#endif
+
+void coctx_switch(CoCtx *from, CoCtx *to, int final){
+  void *fake = NULL;
+#ifdef COCTX_ASAN
+  __sanitizer_start_switch_fiber(final ? NULL : &fake, to->stk_lo, to->stk_size);
+#else
+  (void)final;
+#endif
+  switched_from = from;
+  if (to->entry) { boot_entry = to->entry; boot_arg = to->arg; to->entry = NULL; }
+  coctx_jump(&from->sp, &to->sp);
+  arrived(fake);
+}
+
+#else /* COCTX_UCONTEXT */
+
+void coctx_make(CoCtx *ctx, void *stack, size_t size, void (*entry)(void *), void *arg){
+  getcontext(&ctx->uc);
+  ctx->uc.uc_stack.ss_sp = stack;
+  ctx->uc.uc_stack.ss_size = size;
+  ctx->uc.uc_link = NULL;
+  makecontext(&ctx->uc, coctx_enter, 0);
+  ctx->sp = (char *)stack + size;
+  ctx->stk_lo = stack;
+  ctx->stk_size = size;
+  ctx->entry = entry;
+  ctx->arg = arg;
+}
+
+void coctx_switch(CoCtx *from, CoCtx *to, int final){
+  void *fake = NULL;
+  volatile char here;
+#ifdef COCTX_ASAN
+  __sanitizer_start_switch_fiber(final ? NULL : &fake, to->stk_lo, to->stk_size);
+#else
+  (void)final;
+#endif
+  from->sp = (void *)&here;   /* registers are in from->uc */
+  switched_from = from;
+  if (to->entry) { boot_entry = to->entry; boot_arg = to->arg; to->entry = NULL; }
+  swapcontext(&from->uc, &to->uc);
+  arrived(fake);
+}
+
+#endif /* COCTX_UCONTEXT */
+
+static size_t page_size(void){
+  static size_t ps;
+  if (!ps) ps = (size_t)sysconf(_SC_PAGESIZE);
+  return ps;
+}
+
+/* Released stacks wait on a free list per size class (powers of two from
+   COCTX_MIN_STACK) and are handed out again before anything is mapped.
+   The first COCTX_POOL_WARM in a class keep their pages; later ones give
+   them back to the kernel and keep only the address range; past
+   COCTX_POOL_MAX a stack is unmapped. */
+#ifndef COCTX_MIN_STACK
+#define COCTX_MIN_STACK (64u << 10)
+#endif
+#ifndef COCTX_POOL_WARM
+#define COCTX_POOL_WARM 32
+#endif
+#ifndef COCTX_POOL_MAX
+#define COCTX_POOL_MAX 512
+#endif
+#define COCTX_CLASSES 16
+
+typedef struct PoolStack { struct PoolStack *next; } PoolStack;
+
+static struct {
+  PoolStack *head;
+  int n;
+} pool[COCTX_CLASSES];
+
+static int size_class(size_t *size){
+  size_t sz = COCTX_MIN_STACK;
+  int c = 0;
+  while (sz < *size && c < COCTX_CLASSES - 1) { sz <<= 1; c++; }
+  if (sz < *size) return -1;   /* too big to pool */
+  *size = sz;
+  return c;
+}
+
+static void *stack_map(size_t size){
+  size_t guard = page_size();
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+#endif
+#ifdef MAP_STACK
+  flags |= MAP_STACK;
+#endif
+  char *p = mmap(NULL, size + guard, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (p == MAP_FAILED) return NULL;
+  if (mprotect(p, guard, PROT_NONE) != 0) { munmap(p, size + guard); return NULL; }
+  return p + guard;
+}
+
+static void stack_unmap(void *stack, size_t size){
+  size_t guard = page_size();
+  munmap((char *)stack - guard, size + guard);
+}
+
+void *coctx_stack_alloc(size_t size){
+  int c = size_class(&size);
+  if (c >= 0 && pool[c].head) {
+    PoolStack *s = pool[c].head;
+    pool[c].head = s->next;
+    pool[c].n--;
+    s->next = NULL;
+    return s;
+  }
+  return stack_map(size);
+}
+
+void coctx_stack_free(void *stack, size_t size){
+  if (!stack) return;
+  int c = size_class(&size);
+  if (c < 0 || pool[c].n >= COCTX_POOL_MAX) { stack_unmap(stack, size); return; }
+  if (pool[c].n >= COCTX_POOL_WARM) {
+#ifdef MADV_DONTNEED
+    madvise(stack, size, MADV_DONTNEED);
+#endif
+  }
+  PoolStack *s = stack;
+  s->next = pool[c].head;
+  pool[c].head = s;
+  pool[c].n++;
+}
@@ -5,6 +5,22 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include "../include/interpreter.h"
+#include "../include/gc.h"
+#include "../include/err.h"
+#include "../include/coctx.h"
+
+/* Each coroutine runs on its own C stack, with its own value stack
+   above it in the same mapping; resume and yield swap the VM's
+   per-thread fields and switch machine contexts, so a yield can happen
+   anywhere (inside loops, nested calls, pcall, metamethods) and costs
+   the same however deep it is. Pages are committed as they are touched,
+   and the mapping goes back to coctx's pool when the coroutine dies. */
+#ifndef CO_CSTACK_SIZE
+#define CO_CSTACK_SIZE (15u << 20)   /* with the value stack, a 16 MiB mapping */
+#endif
+#ifndef CO_VSTACK_SLOTS
+#define CO_VSTACK_SLOTS (1 << 16)
+#endif
 
 /* ---------------------------
  * Enhanced coroutine record with full Lua compatibility
@@ -17,31 +33,30 @@ typedef enum {
     CO_NORMAL = 3     /* When coroutine calls another coroutine */
 } CoStatus;
 
-typedef struct CoStackFrame {
-    char **names;            /* Variable names snapshot */
-    Value *vals;             /* Variable values snapshot */
-    bool *is_local;          /* Local flags snapshot */
-    int var_count;           /* Number of variables */
-    CoResumePoint point;     /* Resume point (blk, pc) */
-    struct CoStackFrame *next;
-} CoStackFrame;
+/* The VM fields that belong to one thread of execution */
+typedef struct CoThread {
+    Env *env;
+    CallFrame *frame;
+    void *err_frame;
+    Value *stack;            /* NULL: nothing saved */
+    int top, stack_max, nret, current_line;
+    bool has_ret, break_flag, pending_goto, tailcall, in_hook;
+    Value ret_val;
+    const char *goto_label;
+    void *scratch;           /* its gc_scratch list */
+} CoThread;
 
 typedef struct Coroutine {
     Value fn;                /* the coroutine function (VAL_FUNC/VAL_CFUNC) */
     CoStatus status;
-
-    /* Enhanced resume point with full stack context */
-    CoResumePoint point;
-    Env *env_on_yield;       /* Environment chain snapshot */
-    CoStackFrame *call_stack; /* Full call stack preservation */
+    struct VM *vm;
 
     /* Execution state */
     int started;             /* 0=new, 1=started */
     Value *yield_values;     /* Values passed to yield (to the resumer) */
-    int yield_count;
+    int yield_count, yield_cap;
     Value *resume_values;    /* Values passed to resume (to yield’s caller) */
-    int resume_count;
-    bool pending_yield_return; /* next yield() should return resume_values */
+    int resume_count, resume_cap;
 
     /* Error handling */
     Value error_value;       /* If coroutine died with error */
@@ -51,19 +66,25 @@ typedef struct Coroutine {
     struct Coroutine *caller; /* Which coroutine resumed this one */
     struct Coroutine *callee;  /* Which coroutine this one is running */
 
-    /* Memory management */
-    int ref_count;           /* Reference counting for GC */
-    bool marked;             /* GC mark bit */
+    /* Machine state: the main thread has no mem and runs on main's stack */
+    CoCtx ctx;
+    char *mem;               /* C stack, then the value stack */
+    void *stack_hi;          /* outer end of the C stack */
+    char *cstack_limit;      /* its vm->cstack_limit */
+    CoThread th;             /* VM fields while another thread runs */
 } Coroutine;
 
+#define CO_MEM_SIZE ((size_t)CO_CSTACK_SIZE + sizeof(Value) * (size_t)CO_VSTACK_SLOTS)
+
+/* What a started coroutine's stacks are charged to the collector: about
+   what a shallow one touches, so heaps of idle coroutines get collected
+   and their stacks go back to the pool. */
+#define CO_STACK_CHARGE ((long long)16 << 10)
+
 /* Global coroutine management */
 static Coroutine *g_main_coroutine = NULL;  /* The main thread */
 static Coroutine *g_current_coroutine = NULL;
 
-/* We represent coroutine values as tables with a hidden pointer field. */
-static const char *CO_PTR = "_co_ptr";
-static const char *CO_TYPE = "_co_type";
-
 /* Forwarded helpers from your VM */
 extern void  tbl_set_public(struct Table *t, Value key, Value val);
 extern int   tbl_get_public(struct Table *t, Value key, Value *out);
@@ -78,202 +99,199 @@ static Value vm_error_simple(struct VM *vm, const char *msg) {
 }
 
 /* ---------------------------
- * Stack frame management
+ * Coroutine values
  * --------------------------- */
 
-static CoStackFrame* co_frame_create(void) {
-    CoStackFrame *frame = (CoStackFrame*)calloc(1, sizeof(CoStackFrame));
-    if (!frame) {
-        fprintf(stderr, "Coroutine: Out of memory creating stack frame\n");
-        exit(1);
-    }
-    return frame;
+static Value V_coroutine(Coroutine *co) {
+    return (Value){ .tag = VAL_COROUTINE, .as.co = co };
 }
 
-static void co_frame_destroy(CoStackFrame *frame) {
-    if (!frame) return;
-
-    if (frame->names) {
-        for (int i = 0; i < frame->var_count; i++) {
-            if (frame->names[i]) free(frame->names[i]);
-        }
-        free(frame->names);
-    }
-    if (frame->vals)     free(frame->vals);
-    if (frame->is_local) free(frame->is_local);
-
-    CoStackFrame *next = frame->next;
-    free(frame);
-    if (next) co_frame_destroy(next);
+static Coroutine* co_from_value(Value v) {
+    return v.tag == VAL_COROUTINE ? v.as.co : NULL;
 }
 
-static void co_save_stack_frame(Coroutine *co, struct VM *vm) {
-    if (!co || !vm) return;
-
-    CoStackFrame *frame = co_frame_create();
-
-    /* Save current resume point */
-    frame->point = vm->co_point;
-
-    /* Save environment variables */
-    if (vm->env && vm->env->count > 0) {
-        frame->var_count = vm->env->count;
-
-        /* Deep copy names */
-        frame->names = (char**)calloc((size_t)frame->var_count, sizeof(char*));
-        for (int i = 0; i < frame->var_count; i++) {
-            if (vm->env->names[i]) {
-                size_t len = strlen(vm->env->names[i]) + 1;
-                frame->names[i] = (char*)malloc(len);
-                if (frame->names[i]) memcpy(frame->names[i], vm->env->names[i], len);
-            }
-        }
-
-        /* Deep copy values */
-        frame->vals = (Value*)malloc(sizeof(Value) * (size_t)frame->var_count);
-        if (frame->vals) memcpy(frame->vals, vm->env->vals, sizeof(Value) * (size_t)frame->var_count);
-
-        /* Deep copy local flags */
-        frame->is_local = (bool*)malloc(sizeof(bool) * (size_t)frame->var_count);
-        if (frame->is_local) memcpy(frame->is_local, vm->env->is_local, sizeof(bool) * (size_t)frame->var_count);
-    }
-
-    /* Link into coroutine's stack chain */
-    frame->next = co->call_stack;
-    co->call_stack = frame;
+static int co_is_callable(Value v) {
+    return (v.tag == VAL_FUNC) || (v.tag == VAL_CFUNC);
 }
 
-static void co_restore_stack_frame(Coroutine *co, struct VM *vm) {
-    if (!co || !vm || !co->call_stack) return;
-
-    CoStackFrame *frame = co->call_stack;
-
-    /* Restore resume point */
-    vm->co_point = frame->point;
-
-    /* Restore environment variables */
-    if (frame->var_count > 0 && vm->env) {
-        /* Ensure environment has enough capacity */
-        if (vm->env->cap < frame->var_count) {
-            int new_cap = frame->var_count * 2;
-
-            vm->env->names    = (char**)realloc(vm->env->names,    sizeof(char*) * (size_t)new_cap);
-            vm->env->vals     = (Value*)realloc(vm->env->vals,     sizeof(Value) * (size_t)new_cap);
-            vm->env->is_local = (bool*)realloc(vm->env->is_local,  sizeof(bool) * (size_t)new_cap);
-
-            vm->env->cap = new_cap;
-        }
-
-        /* Clear existing names to avoid leaks */
-        for (int i = 0; i < vm->env->count; i++) {
-            if (vm->env->names[i]) {
-                free(vm->env->names[i]);
-                vm->env->names[i] = NULL;
-            }
-        }
-
-        /* Copy names */
-        for (int i = 0; i < frame->var_count; i++) {
-            if (frame->names[i]) {
-                size_t len = strlen(frame->names[i]) + 1;
-                vm->env->names[i] = (char*)malloc(len);
-                if (vm->env->names[i]) memcpy(vm->env->names[i], frame->names[i], len);
-            } else {
-                vm->env->names[i] = NULL;
-            }
-        }
-
-        /* Copy values and flags */
-        memcpy(vm->env->vals,     frame->vals,     sizeof(Value) * (size_t)frame->var_count);
-        memcpy(vm->env->is_local, frame->is_local, sizeof(bool)  * (size_t)frame->var_count);
-
-        vm->env->count = frame->var_count;
+/* Copies n values into a transfer buffer that only ever grows. */
+static void set_values(Value **buf, int *count, int *cap, const Value *v, int n) {
+    if (n > *cap) {
+        Value *nb = realloc(*buf, sizeof(Value) * (size_t)n);
+        if (!nb) { fprintf(stderr, "OOM\n"); exit(1); }
+        *buf = nb;
+        *cap = n;
     }
-
-    /* Pop the frame */
-    co->call_stack = frame->next;
-    frame->next = NULL;
-    co_frame_destroy(frame);
+    if (n > 0) memcpy(*buf, v, sizeof(Value) * (size_t)n);
+    *count = n;
 }
 
 /* ---------------------------
- * Coroutine boxing/unboxing with type safety
+ * Memory management
  * --------------------------- */
 
-static Value V_coroutine_box(Coroutine *co) {
-    Value t = V_table();
-
-    /* Box pointer via CFunc slot (reusing existing mechanism) */
-    Value ptr;
-    ptr.tag = VAL_CFUNC;
-    ptr.as.cfunc = (CFunc)co;
-    tbl_set_public(t.as.t, V_str_from_c(CO_PTR), ptr);
-
-    /* Add type marker for safety */
-    tbl_set_public(t.as.t, V_str_from_c(CO_TYPE), V_str_from_c("coroutine"));
-
-    /* Add reference */
-    co->ref_count++;
+/* Collector hooks: a coroutine owns its value arrays and, while another
+   thread runs, its saved VM fields, value stack and C stack. */
+void co_gc_traverse(Coroutine *co) {
+    gc_mark_value(co->fn);
+    for (int i = 0; i < co->yield_count; i++)  gc_mark_value(co->yield_values[i]);
+    for (int i = 0; i < co->resume_count; i++) gc_mark_value(co->resume_values[i]);
+    gc_mark_value(co->error_value);
+    gc_mark(co->caller);
+    gc_mark(co->callee);
+    if (co == g_current_coroutine || !co->th.stack) return;
+    gc_mark(co->th.env);
+    gc_mark_value(co->th.ret_val);
+    for (int i = 0; i < co->th.top; i++) gc_mark_value(co->th.stack[i]);
+    gc_scratch_mark_list(co->th.scratch);
+    gc_mark_stack_range(co->ctx.sp, co->stack_hi);
+    gc_mark_stack_range(&co->ctx, &co->ctx + 1);   /* registers, in a ucontext */
+}
 
-    return t;
+static void co_release(Coroutine *co) {
+    if (co->mem) gc_account(-CO_STACK_CHARGE);
+    coctx_stack_free(co->mem, CO_MEM_SIZE);
+    co->mem = NULL;
+    gc_scratch_release(co->th.scratch);
+    co->th = (CoThread){0};
 }
 
-static Coroutine* co_from_value(Value v) {
-    if (v.tag != VAL_TABLE) return NULL;
+void co_gc_free(Coroutine *co) {
+    free(co->yield_values);
+    free(co->resume_values);
+    co_release(co);
+}
 
-    /* Check type marker */
-    Value type_val;
-    if (!tbl_get_public(v.as.t, V_str_from_c(CO_TYPE), &type_val)) return NULL;
-    if (type_val.tag != VAL_STR || strcmp(type_val.as.s->data, "coroutine") != 0) return NULL;
+static void co_mark_globals(void) {
+    gc_mark(g_main_coroutine);
+    gc_mark(g_current_coroutine);
+}
 
-    Value ptr;
-    if (!tbl_get_public(v.as.t, V_str_from_c(CO_PTR), &ptr)) return NULL;
-    if (ptr.tag != VAL_CFUNC) return NULL;
+/* ---------------------------
+ * Context switching
+ * --------------------------- */
 
-    return (Coroutine*)(void*)ptr.as.cfunc;
+static void th_save(struct VM *vm, CoThread *t) {
+    t->env = vm->env;
+    t->frame = vm->frame;
+    t->err_frame = vm->err_frame;
+    t->stack = vm->stack;
+    t->top = vm->top;
+    t->stack_max = vm->stack_max;
+    t->nret = vm->nret;
+    t->current_line = vm->current_line;
+    t->has_ret = vm->has_ret;
+    t->break_flag = vm->break_flag;
+    t->pending_goto = vm->pending_goto;
+    t->tailcall = vm->tailcall;
+    t->in_hook = vm->in_hook;
+    t->ret_val = vm->ret_val;
+    t->goto_label = vm->goto_label;
 }
 
-static int co_is_callable(Value v) {
-    return (v.tag == VAL_FUNC) || (v.tag == VAL_CFUNC);
+static void th_load(struct VM *vm, const CoThread *t) {
+    vm->env = t->env;
+    vm->frame = t->frame;
+    vm->err_frame = t->err_frame;
+    vm->stack = t->stack;
+    vm->top = t->top;
+    vm->stack_max = t->stack_max;
+    vm->nret = t->nret;
+    vm->current_line = t->current_line;
+    vm->has_ret = t->has_ret;
+    vm->break_flag = t->break_flag;
+    vm->pending_goto = t->pending_goto;
+    vm->tailcall = t->tailcall;
+    vm->in_hook = t->in_hook;
+    vm->ret_val = t->ret_val;
+    vm->goto_label = t->goto_label;
 }
 
-/* ---------------------------
- * Memory management
- * --------------------------- */
+/* Suspends from (its VM fields, scratch list and C stack are kept in it)
+   and continues to. Returns when some thread switches back to from;
+   final: from is finished and never will be. */
+static void co_switch(struct VM *vm, Coroutine *from, Coroutine *to, int final) {
+    th_save(vm, &from->th);
+    th_load(vm, &to->th);
+    to->th.stack = NULL;
+    from->th.scratch = gc_scratch_switch(to->th.scratch);
+    to->th.scratch = NULL;
+    from->stack_hi = gc_stack_switch(to->stack_hi);
+    g_current_coroutine = to;
+    vm->active_co = to == g_main_coroutine ? NULL : to;
+    vm->cstack_limit = to->cstack_limit;
+    coctx_switch(&from->ctx, &to->ctx, final);
+}
 
-static void co_unref(Coroutine *co) {
-    if (!co) return;
-    co->ref_count--;
-    if (co->ref_count <= 0) {
-        co_frame_destroy(co->call_stack);
-        if (co->yield_values)  free(co->yield_values);
-        if (co->resume_values) free(co->resume_values);
-        free(co);
+/* First code on a coroutine's stack: runs the body under its own error
+   frame, leaves the results (or the error) for the resumer, and never
+   returns. */
+static void co_main(void *arg) {
+    Coroutine *co = arg;
+    struct VM *vm = co->vm;
+    ErrFrame frame;
+    vm_err_push(vm, &frame);
+    if (setjmp(frame.jb) == 0) {
+        int argc = co->resume_count;
+        vm_stack_check(vm, argc);
+        Value *args = vm->stack + vm->top;
+        if (argc) memcpy(args, co->resume_values, sizeof(Value) * (size_t)argc);
+        vm->top += argc;
+        int n = call_multi(vm, co->fn, argc, args);
+        set_values(&co->yield_values, &co->yield_count, &co->yield_cap, vm->stack + vm->top - n, n);
+        vm_err_pop(vm);
+    } else {
+        vm_err_pop(vm);
+        co->has_error = true;
+        co->error_value = vm->err_obj;
     }
+    co->status = CO_DEAD;
+    co_switch(vm, co, co->caller, 1);
+}
+
+/* Maps the coroutine's stacks and prepares its first switch. */
+static bool co_start(struct VM *vm, Coroutine *co) {
+    co->mem = coctx_stack_alloc(CO_MEM_SIZE);
+    if (!co->mem) return false;
+    gc_account(CO_STACK_CHARGE);
+    co->vm = vm;
+    co->stack_hi = co->mem + CO_CSTACK_SIZE;
+    co->cstack_limit = co->mem + CSTACK_MARGIN;
+    coctx_make(&co->ctx, co->mem, CO_CSTACK_SIZE, co_main, co);
+    co->th = (CoThread){0};
+    co->th.env = vm->env;
+    co->th.stack = (Value*)(void*)(co->mem + CO_CSTACK_SIZE);
+    co->th.stack_max = CO_VSTACK_SLOTS;
+    co->th.current_line = vm->current_line;
+    co->th.ret_val = V_nil();
+    co->started = 1;
+    return true;
 }
 
 /* ---------------------------
  * Enhanced result handling
  * --------------------------- */
 
-static Value make_result_tuple(bool success, int value_count, Value *values) {
-    Value tup = V_table();
-    tbl_set_public(tup.as.t, V_int(1), V_bool(success ? 1 : 0));
-
+/* resume's results: the success flag followed by the values, as multiple
+   values on the resumer's stack */
+static Value make_result_tuple(struct VM *vm, bool success, int value_count, Value *values) {
+    int base = vm->top;
+    vm_stack_check(vm, value_count + 1);
+    vm->stack[base] = V_bool(success ? 1 : 0);
     for (int i = 0; i < value_count; i++) {
-        tbl_set_public(tup.as.t, V_int(i + 2), values[i]);
+        vm->stack[base + 1 + i] = values[i];
     }
-
-    return tup;
+    vm->top = base + 1 + value_count;
+    return V_multi(base, value_count + 1);
 }
 
-static Value make_ok_result(int value_count, Value *values) {
-    return make_result_tuple(true, value_count, values);
+static Value make_ok_result(struct VM *vm, int value_count, Value *values) {
+    return make_result_tuple(vm, true, value_count, values);
 }
 
-static Value make_error_result(const char *msg) {
+static Value make_error_result(struct VM *vm, const char *msg) {
     Value err = V_str_from_c(msg);
-    return make_result_tuple(false, 1, &err);
+    return make_result_tuple(vm, false, 1, &err);
 }
 
 /* ---------------------------
@@ -283,16 +301,14 @@ static Value make_error_result(const char *msg) {
 static void ensure_main_coroutine(struct VM *vm) {
     if (g_main_coroutine) return;
 
-    g_main_coroutine = (Coroutine*)calloc(1, sizeof(Coroutine));
-    if (!g_main_coroutine) {
-        fprintf(stderr, "Coroutine: Failed to create main coroutine\n");
-        exit(1);
-    }
+    g_main_coroutine = gc_alloc(GC_CO, sizeof(Coroutine));
+    gc_root_fn(co_mark_globals);
 
     g_main_coroutine->status    = CO_RUNNING;
     g_main_coroutine->started   = 1;
-    g_main_coroutine->ref_count = 1;
     g_main_coroutine->fn        = V_nil(); /* Main thread has no function */
+    g_main_coroutine->cstack_limit = vm->cstack_limit;
+    g_main_coroutine->vm        = vm;
 
     g_current_coroutine = g_main_coroutine;
 }
@@ -308,185 +324,80 @@ static Value co_create(struct VM *vm, int argc, Value *argv) {
         return vm_error_simple(vm, "coroutine.create: function expected");
     }
 
-    Coroutine *co = (Coroutine*)calloc(1, sizeof(Coroutine));
-    if (!co) {
-        return vm_error_simple(vm, "coroutine.create: out of memory");
-    }
+    Coroutine *co = gc_alloc(GC_CO, sizeof(Coroutine));
 
     co->fn        = argv[0];
     co->status    = CO_SUSPENDED;
     co->started   = 0;
-    co->ref_count = 0;
-    co->caller    = g_current_coroutine;
-    co->pending_yield_return = false;
+    co->vm        = vm;
 
-    return V_coroutine_box(co);
+    return V_coroutine(co);
 }
 
 static Value co_yield(struct VM *vm, int argc, Value *argv) {
     ensure_main_coroutine(vm);
 
-    if (g_current_coroutine == g_main_coroutine) {
-        return vm_error_simple(vm, "attempt to yield from outside a coroutine");
-    }
-
     Coroutine *co = g_current_coroutine;
-
-    /* If we were resumed into this callsite, yield() should RETURN the resume values */
-    if (co->pending_yield_return) {
-        co->pending_yield_return = false;
-        if (co->resume_count > 0) return co->resume_values[0];
-        return V_nil();
+    if (co == g_main_coroutine) {
+        vm_raise(vm, V_str_from_c("attempt to yield from outside a coroutine"));
     }
 
-    if (co->status != CO_RUNNING) {
-        return vm_error_simple(vm, "attempt to yield from non-running coroutine");
-    }
-
-    /* Store yield values for the resumer */
-    if (co->yield_values) { free(co->yield_values); co->yield_values = NULL; }
-    co->yield_count = argc;
-    if (argc > 0) {
-        co->yield_values = (Value*)malloc(sizeof(Value) * (size_t)argc);
-        if (co->yield_values) memcpy(co->yield_values, argv, sizeof(Value) * (size_t)argc);
-    }
-
-    /* Save complete execution context */
-    co_save_stack_frame(co, vm);
-    co->point        = vm->co_point;
-    co->env_on_yield = vm->env;
+    /* Hand the values to the resumer and sleep until resumed */
+    set_values(&co->yield_values, &co->yield_count, &co->yield_cap, argv, argc);
+    co->status = CO_SUSPENDED;
+    co_switch(vm, co, co->caller, 0);
 
-    /* Mark for suspension */
-    vm->co_yielding = true;
-    co->status      = CO_SUSPENDED;
-
-    return V_nil();
+    /* resume(co, ...) passed these */
+    return vm_return_values(vm, co->resume_count, co->resume_values);
 }
 
 static Value co_resume(struct VM *vm, int argc, Value *argv) {
     ensure_main_coroutine(vm);
 
     if (argc < 1) {
-        return make_error_result("coroutine expected");
+        return make_error_result(vm, "coroutine expected");
     }
 
     Coroutine *co = co_from_value(argv[0]);
     if (!co) {
-        return make_error_result("bad coroutine");
+        return make_error_result(vm, "bad coroutine");
     }
 
-    if (co->status == CO_RUNNING) {
-        return make_error_result("cannot resume running coroutine");
+    if (co->status == CO_RUNNING || co->status == CO_NORMAL) {
+        return make_error_result(vm, "cannot resume non-suspended coroutine");
     }
 
     if (co->status == CO_DEAD) {
-        return make_error_result("cannot resume dead coroutine");
+        return make_error_result(vm, "cannot resume dead coroutine");
     }
 
-    /* Handle resume arguments */
-    int resume_argc = (argc > 1) ? (argc - 1) : 0;
-    Value *resume_argv = NULL;
-    if (resume_argc > 0) {
-        resume_argv = (Value*)malloc(sizeof(Value) * (size_t)resume_argc);
-        if (resume_argv) memcpy(resume_argv, argv + 1, sizeof(Value) * (size_t)resume_argc);
+    /* Resume arguments become the body's arguments or yield's results */
+    set_values(&co->resume_values, &co->resume_count, &co->resume_cap,
+               argv + 1, argc > 1 ? argc - 1 : 0);
+
+    if (!co->started && !co_start(vm, co)) {
+        return make_error_result(vm, "not enough memory for a coroutine stack");
     }
 
     /* Set up coroutine nesting */
     Coroutine *caller = g_current_coroutine;
-    if (caller != g_main_coroutine) {
-        caller->status = CO_NORMAL;
-        caller->callee = co;
-    }
+    if (caller != g_main_coroutine) caller->status = CO_NORMAL;
+    caller->callee = co;
     co->caller = caller;
+    co->status = CO_RUNNING;
 
-    /* Store resume values for the coroutine to access (as yield() return) */
-    if (co->resume_values) { free(co->resume_values); co->resume_values = NULL; }
-    co->resume_values = resume_argv;
-    co->resume_count  = resume_argc;
-
-    /* Switch to target coroutine */
-    g_current_coroutine = co;
-    co->status     = CO_RUNNING;
-    vm->active_co  = co;
-    vm->co_yielding = false;
-
-    Value ret = V_nil();
-
-    if (!co->started) {
-        /* First resume: call the function with resume args */
-        co->started = 1;
-        ret = call_any_public(vm, co->fn, resume_argc, resume_argv);
-
-        if (vm->co_yielding) {
-            /* Coroutine yielded */
-            Value result = make_ok_result(co->yield_count, co->yield_values);
-
-            /* Restore caller */
-            g_current_coroutine = caller;
-            if (caller != g_main_coroutine) {
-                caller->status = CO_RUNNING;
-                caller->callee = NULL;
-            }
-            co->caller = NULL;
-            vm->co_yielding = false;
-
-            return result;
-        } else {
-            /* Coroutine completed normally */
-            co->status = CO_DEAD;
-
-            /* Restore caller */
-            g_current_coroutine = caller;
-            if (caller != g_main_coroutine) {
-                caller->status = CO_RUNNING;
-                caller->callee = NULL;
-            }
-            co->caller = NULL;
-
-            return make_ok_result(1, &ret);
-        }
-    } else {
-        /* Resume from yield point:
-           - restore frame and env
-           - arm yield() to return resume values
-           - re-enter function (your exec path consults vm->co_point) */
-        co_restore_stack_frame(co, vm);
-        vm->co_point = co->point;
-        vm->env      = co->env_on_yield;
-
-        co->pending_yield_return = true;
-
-        ret = call_any_public(vm, co->fn, 0, NULL);
-
-        if (vm->co_yielding) {
-            /* Yielded again */
-            Value result = make_ok_result(co->yield_count, co->yield_values);
-
-            /* Restore caller */
-            g_current_coroutine = caller;
-            if (caller != g_main_coroutine) {
-                caller->status = CO_RUNNING;
-                caller->callee = NULL;
-            }
-            co->caller = NULL;
-            vm->co_yielding = false;
-
-            return result;
-        } else {
-            /* Completed */
-            co->status = CO_DEAD;
-
-            /* Restore caller */
-            g_current_coroutine = caller;
-            if (caller != g_main_coroutine) {
-                caller->status = CO_RUNNING;
-                caller->callee = NULL;
-            }
-            co->caller = NULL;
-
-            return make_ok_result(1, &ret);
-        }
+    co_switch(vm, caller, co, 0);
+
+    /* Back here when co yielded, returned or failed */
+    caller->status = CO_RUNNING;
+    caller->callee = NULL;
+    co->caller = NULL;
+
+    if (co->status == CO_DEAD) {
+        co_release(co);
+        if (co->has_error) return make_result_tuple(vm, false, 1, &co->error_value);
     }
+    return make_ok_result(vm, co->yield_count, co->yield_values);
 }
 
 static Value co_running(struct VM *vm, int argc, Value *argv) {
@@ -497,7 +408,7 @@ static Value co_running(struct VM *vm, int argc, Value *argv) {
         return V_nil(); /* Main thread returns nil */
     }
 
-    return V_coroutine_box(g_current_coroutine);
+    return V_coroutine(g_current_coroutine);
 }
 
 static Value co_status(struct VM *vm, int argc, Value *argv) {
@@ -547,32 +458,23 @@ static Value co_wrap_call(struct VM *vm, int argc, Value *argv) {
     /* Build resume args: (co_val, user_args...) */
     int user_n = (argc >= 1) ? (argc - 1) : 0;
     int total  = 1 + user_n;
-    Value *res_argv = total ? (Value*)malloc(sizeof(Value) * (size_t)total) : NULL;
+    Value *res_argv = total ? gc_scratch((size_t)total) : NULL;
     if (res_argv) {
         res_argv[0] = co_val;
         for (int i = 0; i < user_n; i++) res_argv[1 + i] = argv[1 + i];
     }
 
     Value rr = co_resume(vm, total, res_argv);
-    if (res_argv) free(res_argv);
-
-    /* rr is tuple: [1]=bool ok, [2..]=values or error msg */
-    Value ok;
-    if (rr.tag != VAL_TABLE || !tbl_get_public(rr.as.t, V_int(1), &ok) || ok.tag != VAL_BOOL)
-        return V_nil();
-
-    if (!ok.as.b) {
-        Value err;
-        if (tbl_get_public(rr.as.t, V_int(2), &err)) {
-            vm_raise(vm, (err.tag == VAL_STR) ? err : V_str_from_c("coroutine error"));
-        }
-        vm_raise(vm, V_str_from_c("coroutine error"));
+    gc_scratch_free(res_argv);
+
+    /* rr is resume's results: ok, then the values or the error */
+    int base = MULTI_BASE(rr), n = MULTI_COUNT(rr);
+    if (!vm->stack[base].as.b) {
+        Value err = vm->stack[base + 1];
+        vm->top = base;
+        vm_raise(vm, (err.tag == VAL_STR) ? err : V_str_from_c("coroutine error"));
     }
-
-    /* return first value to match your single-return expression behavior */
-    Value v;
-    if (tbl_get_public(rr.as.t, V_int(2), &v)) return v;
-    return V_nil();
+    return V_multi(base + 1, n - 1);
 }
 
 static Value co_wrap(struct VM *vm, int argc, Value *argv) {
@@ -581,12 +483,12 @@ static Value co_wrap(struct VM *vm, int argc, Value *argv) {
     }
 
     /* Create coroutine */
-    Value co_tbl = co_create(vm, 1, argv);
-    if (co_tbl.tag != VAL_TABLE) return V_nil();
+    Value co = co_create(vm, 1, argv);
+    if (co.tag != VAL_COROUTINE) return V_nil();
 
     /* wrapper is a table with metatable { __call = co_wrap_call }, and holds 'co' */
     Value wrapper = V_table();
-    tbl_set_public(wrapper.as.t, V_str_from_c("co"), co_tbl);
+    tbl_set_public(wrapper.as.t, V_str_from_c("co"), co);
 
     Value mt = V_table();
     Value c; c.tag = VAL_CFUNC; c.as.cfunc = co_wrap_call;
@@ -634,9 +536,7 @@ void register_coroutine_lib(VM *vm) {
  * --------------------------- */
 
 void cleanup_coroutine_lib(void) {
-    if (g_main_coroutine) {
-        co_unref(g_main_coroutine);
-        g_main_coroutine = NULL;
-    }
+    /* the collector owns the coroutines; just drop the roots */
+    g_main_coroutine = NULL;
     g_current_coroutine = NULL;
 }
@@ -6,19 +6,44 @@
 #include <ctype.h>
 #include <setjmp.h> 
 #include "../include/env.h"
+#include "../include/gc.h"
 
 Env *env_push(Env *parent){
-  Env *e=xmalloc(sizeof(*e));
+  Table *index = parent ? NULL : tbl_new();   /* allocated first: e is stored to without a barrier */
+  Env *e=gc_alloc(GC_ENV, sizeof(*e));
   e->parent=parent; e->count=0; e->cap=8;
   e->names=xmalloc(sizeof(char*)*e->cap);
   e->vals =xmalloc(sizeof(Value)*e->cap);
   e->is_local=xmalloc(sizeof(bool)*e->cap);
-  e->closers = NULL;
-  e->ccount  = 0;
-  e->ccap    = 0;
+  e->index = index;
   return e;
 }
+/* A resolved scope: n nil-initialised slots, vals allocated inline. */
+Env *env_push_slots(Env *parent, int n, const char **names){
+  Env *e=gc_alloc(GC_ENV, sizeof(*e) + sizeof(Value)*(size_t)n);
+  e->parent=parent; e->count=n; e->cap=n;
+  e->names=names;
+  e->vals=(Value*)(e+1);   /* zeroed: all nil */
+  return e;
+}
+/* Reserves n nil slots at the stack top; the caller resets vm->top. */
+Env *env_push_stack(VM *vm, StackEnv *se, Env *parent, int n, const char **names){
+  vm_stack_check(vm, n);
+  Value *vals = vm->stack + vm->top;
+  for(int i=0;i<n;i++) vals[i] = V_nil();
+  vm->top += n;
+  memset(se, 0, sizeof(*se));
+  se->h.type = GC_ENV;
+  Env *e=&se->e;
+  e->parent=parent; e->count=n; e->cap=n;
+  e->names=names;
+  e->vals=vals;
+  return e;
+}
+/* Defines a global: scope envs have a fixed layout, so this always
+   appends to the root. The first definition of a name stays visible. */
 void env_add(Env *e, const char *name, Value v, bool is_local){
+  e = env_root(e);
   if(e->count==e->cap){
     e->cap*=2;
     e->names=realloc(e->names,sizeof(char*)*e->cap);
@@ -28,32 +53,44 @@ void env_add(Env *e, const char *name, Value v, bool is_local){
   e->names[e->count]=xstrdup(name);
   e->vals [e->count]=v;
   e->is_local[e->count]=is_local;
+  Value key = (Value){.tag=VAL_STR,.as.s=Str_new_len(name,(int)strlen(name))}, old;
+  if(!tbl_get(e->index, key, &old)) tbl_set(e->index, key, V_int(e->count));
   e->count++;
+  gc_barrier(e);   /* after the count: the key's allocation may have traversed e */
 }
-int env_set(Env *e, const char *name, Value v){
-  for(Env *cur=e; cur; cur=cur->parent){
-    for(int i=0;i<cur->count;i++){
-      if(strcmp(cur->names[i],name)==0){ cur->vals[i]=v; return 1; }
-    }
-  }
-  return 0;
-}
-int env_get(Env *e, const char *name, Value *out){
-  for(Env *cur=e; cur; cur=cur->parent){
-    for(int i=0;i<cur->count;i++){
-      if(strcmp(cur->names[i],name)==0){ *out=cur->vals[i]; return 1; }
-    }
-  }
-  return 0;
+/* Slot of a global in the root env, or -1. */
+int env_global_slot(Env *root, Str *name){
+  Value v;
+  if(!root->index || !tbl_get(root->index, (Value){.tag=VAL_STR,.as.s=name}, &v)) return -1;
+  return (int)v.as.i;
 }
+/* By-name lookup for libraries and debugging; the interpreter itself
+   goes through resolved slots. */
 int env_find(Env *e, const char *name, Env **owner, int *slot){
   for(Env *cur=e; cur; cur=cur->parent){
-    for(int i=0;i<cur->count;i++){
-      if(strcmp(cur->names[i],name)==0){ if(owner)*owner=cur; if(slot)*slot=i; return 1; }
+    int i=-1;
+    if(cur->index){
+      i=env_global_slot(cur, Str_new_len(name,(int)strlen(name)));
+    } else if(cur->names){
+      for(i=cur->count-1;i>=0;i--) if(cur->names[i] && strcmp(cur->names[i],name)==0) break;
     }
+    if(i>=0){ if(owner)*owner=cur; if(slot)*slot=i; return 1; }
   }
   return 0;
 }
+int env_set(Env *e, const char *name, Value v){
+  Env *owner; int slot;
+  if(!env_find(e,name,&owner,&slot)) return 0;
+  owner->vals[slot]=v;
+  gc_barrier(owner);
+  return 1;
+}
+int env_get(Env *e, const char *name, Value *out){
+  Env *owner; int slot;
+  if(!env_find(e,name,&owner,&slot)) return 0;
+  *out=owner->vals[slot];
+  return 1;
+}
 Env* env_root(Env *e){
   if(!e) return NULL;
   while(e->parent) e = e->parent;
@@ -1,7 +1,11 @@
 #include "../include/err.h"
+#include "../include/gc.h"
 void vm_err_push(struct VM *vm, ErrFrame *f){
   f->prev = (ErrFrame*)vm->err_frame;
   f->env_at_push = vm->env;  // ← ADD THIS LINE
+  f->scratch = gc_scratch_mark();
+  f->top = vm->top;
+  f->frame = vm->frame;
   vm->err_frame = f;
 }
 void vm_err_pop(struct VM *vm){
@@ -27,6 +31,10 @@ void vm_raise(struct VM *vm, Value err) {
         env_close_all(vm, vm->env, vm->err_obj);
         vm->env = vm->env->parent;
     }
+    vm->env = top->env_at_push;
+    gc_scratch_unwind(top->scratch);
+    vm->top = top->top;
+    vm->frame = top->frame;
     longjmp(top->jb, 1);
 }
 
@@ -0,0 +1,792 @@
+// gc.c — incremental mark & sweep collector (see include/gc.h)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include "../include/gc.h"
+#include "../include/bytecode.h"
+#include "../include/icache.h"
+
+/* A cycle: PAUSE until the heap grows past estimate * pause%, then mark
+   from the roots (PROPAGATE, in steps), finish marking in one go (ATOMIC:
+   roots again, the C stack, tables written behind the marker), then free
+   the unmarked objects (SWEEP, in steps).
+
+   Two whites, as in Lua: objects allocated after ATOMIC get the new white
+   and survive the sweep still walking the list. Each step does
+   stepsize_kb * stepmul% bytes of marking or sweeping, and the next one
+   runs after another stepsize_kb of allocation.
+
+   Generational mode (collectgarbage("generational")) allocates small
+   objects by bumping a pointer through 64KB nursery chunks and runs
+   stop-the-world minor collections that mark and sweep only the young
+   list. Objects move nowhere (the stack scan could not update them): a
+   survivor of two minors is promoted in place and its chunk is reused
+   once everything in it has died. Old objects are kept black; the
+   barrier puts one that gets written on the touched list, which the
+   next two minors traverse as roots (its young referents need two
+   minors to become old). Freshly promoted objects (OLD1) are traversed
+   once more for the same reason. A major collection runs when the heap
+   has grown majormul% since the last one.
+
+   -DGC_STRESS steps on every allocation (for sanitizer runs). */
+enum { GCS_PAUSE, GCS_PROPAGATE, GCS_ATOMIC, GCS_SWEEP };
+
+/* generational ages */
+enum { AGE_NEW, AGE_SURVIVAL, AGE_OLD1, AGE_OLD, AGE_TOUCHED1, AGE_TOUCHED2 };
+
+#define GC_WHITES    (GC_WHITE0 | GC_WHITE1)
+#define GC_MIN_HEAP  (1 << 20)   /* no cycle starts below this */
+#define GC_SWEEPMAX  64          /* objects per sweep step */
+#define GC_INTERIOR  64          /* stack words this far into an object keep it */
+#define GC_MAXVMS    8
+
+#define GC_CHUNK        (1 << 16)        /* nursery chunk, aligned to its size */
+#define GC_GRANULE      16
+#define GC_CHUNKOBJ     (GC_CHUNK / 16)  /* larger objects are malloc'd */
+#define GC_NURSERY_MIN  (256 << 10)      /* smallest gap between minors */
+#define GC_SPARECHUNKS  8
+
+typedef struct Scratch {
+  struct Scratch *prev, *next;
+  unsigned long seq;
+  size_t n;
+  Value v[];
+} Scratch;
+
+typedef struct { void **v; int n, cap; } PtrVec;
+typedef struct { void **v; size_t cap, count; } AddrSet;
+
+typedef struct Chunk {
+  struct Chunk *next;    /* spare list */
+  int live;              /* objects not yet freed */
+  unsigned char starts[GC_CHUNK / GC_GRANULE / 8];   /* object-start bitmap */
+} Chunk;
+#define CHUNK_FIRST  ((sizeof(Chunk) + GC_GRANULE - 1) & ~(size_t)(GC_GRANULE - 1))
+#define chunk_of(h)  ((Chunk*)((uintptr_t)(h) & ~(uintptr_t)(GC_CHUNK - 1)))
+
+static struct {
+  GCObj *all;            /* every object, newest first */
+  GCObj **sweep;         /* sweep cursor into all */
+  int state;
+  unsigned char white;   /* the current white */
+  int busy;
+  size_t total;          /* bytes in use */
+  long long debt;        /* bytes allocated past the point of the next step */
+  size_t estimate;       /* heap after the last cycle */
+
+  int running;
+  GCMode mode;
+  int pause, stepmul, stepsize_kb, minormul, majormul;
+
+  PtrVec gray, grayagain;
+  PtrVec roots, rootfns;
+  struct VM *vms[GC_MAXVMS]; int nvms;
+  Scratch *scratch; unsigned long scratch_seq;
+  void *stack_base;
+
+  /* generational mode */
+  GCObj *young;          /* NEW and SURVIVAL objects */
+  PtrVec touched, old1, oldco;
+  Chunk *cur, *spare; int nspare;
+  char *bump, *bump_end;
+
+  /* malloc'd object and nursery chunk addresses, for the stack scan */
+  AddrSet objs, chunks;
+  uintptr_t lo, hi;
+} G = {
+  .white = GC_WHITE0, .running = 1, .mode = GC_MODE_INCREMENTAL,
+  .pause = 200, .stepmul = 200, .stepsize_kb = 64, .minormul = 20, .majormul = 100,
+  .debt = -GC_MIN_HEAP, .lo = UINTPTR_MAX,
+};
+
+static void vec_push(PtrVec *v, void *p){
+  if (v->n == v->cap) {
+    v->cap = v->cap ? v->cap * 2 : 64;
+    v->v = realloc(v->v, sizeof(void*) * (size_t)v->cap);
+    if (!v->v) { fprintf(stderr, "OOM\n"); exit(1); }
+  }
+  v->v[v->n++] = p;
+}
+
+/* ---- address sets: open addressing, backward-shift deletion ---- */
+
+static inline size_t set_home(AddrSet *S, void *p){
+  unsigned long long h = (unsigned long long)(uintptr_t)p >> 4;
+  h *= 0x9E3779B97F4A7C15ULL;
+  return (size_t)(h >> 17) & (S->cap - 1);
+}
+static void set_insert(AddrSet *S, void *p){
+  size_t i = set_home(S, p);
+  while (S->v[i]) i = (i + 1) & (S->cap - 1);
+  S->v[i] = p;
+}
+static void set_add(AddrSet *S, void *p){
+  if ((S->count + 1) * 2 > S->cap) {
+    void **old = S->v; size_t ocap = S->cap;
+    S->cap = ocap ? ocap * 2 : 64;
+    S->v = calloc(S->cap, sizeof(void*));
+    if (!S->v) { fprintf(stderr, "OOM\n"); exit(1); }
+    for (size_t i = 0; i < ocap; i++) if (old[i]) set_insert(S, old[i]);
+    free(old);
+  }
+  set_insert(S, p);
+  S->count++;
+}
+static int set_has(AddrSet *S, void *p){
+  if (!S->cap) return 0;
+  for (size_t i = set_home(S, p); S->v[i]; i = (i + 1) & (S->cap - 1))
+    if (S->v[i] == p) return 1;
+  return 0;
+}
+static void set_remove(AddrSet *S, void *p){
+  size_t mask = S->cap - 1, i = set_home(S, p);
+  while (S->v[i] != p) i = (i + 1) & mask;
+  for (size_t j = i;;) {
+    S->v[i] = NULL;
+    for (;;) {
+      j = (j + 1) & mask;
+      if (!S->v[j]) { S->count--; return; }
+      size_t h = set_home(S, S->v[j]);
+      /* j's entry may fill the hole unless its home lies cyclically in (i, j] */
+      if (i <= j ? (i < h && h <= j) : (i < h || h <= j)) continue;
+      break;
+    }
+    S->v[i] = S->v[j];
+    i = j;
+  }
+}
+
+static void note_range(uintptr_t lo, uintptr_t hi){
+  if (lo < G.lo) G.lo = lo;
+  if (hi > G.hi) G.hi = hi;
+}
+
+/* ---- nursery chunks ---- */
+
+static void chunk_reset(Chunk *c){
+  c->live = 0;
+  memset(c->starts, 0, sizeof(c->starts));
+}
+
+static void nursery_refill(void){
+  Chunk *c = G.spare;
+  if (c) { G.spare = c->next; G.nspare--; }
+  else {
+    c = aligned_alloc(GC_CHUNK, GC_CHUNK);
+    if (!c) { fprintf(stderr, "OOM\n"); exit(1); }
+    note_range((uintptr_t)c, (uintptr_t)c + GC_CHUNK);
+  }
+  chunk_reset(c);
+  set_add(&G.chunks, c);
+  G.cur = c;
+  G.bump = (char*)c + CHUNK_FIRST;
+  G.bump_end = (char*)c + GC_CHUNK;
+}
+
+static inline GCObj *nursery_alloc(size_t size){
+  size_t need = (sizeof(GCObj) + size + GC_GRANULE - 1) & ~(size_t)(GC_GRANULE - 1);
+  if ((size_t)(G.bump_end - G.bump) < need) nursery_refill();
+  GCObj *h = (GCObj*)G.bump;
+  G.bump += need;
+  memset(h, 0, need);
+  Chunk *c = G.cur;
+  size_t g = (size_t)((char*)h - (char*)c) / GC_GRANULE;
+  c->starts[g >> 3] |= (unsigned char)(1u << (g & 7));
+  c->live++;
+  h->flags = GC_INCHUNK;
+  return h;
+}
+
+/* An emptied chunk goes back to the spare list; the current one just
+   rewinds. */
+static void chunk_release(GCObj *h){
+  Chunk *c = chunk_of(h);
+  h->flags |= GC_FREED;
+  if (--c->live) return;
+  if (c == G.cur) {
+    chunk_reset(c);
+    G.bump = (char*)c + CHUNK_FIRST;
+    return;
+  }
+  set_remove(&G.chunks, c);
+  if (G.nspare < GC_SPARECHUNKS) { c->next = G.spare; G.spare = c; G.nspare++; }
+  else free(c);
+}
+
+/* The object whose block holds address w, if any. */
+static GCObj *chunk_find(Chunk *c, uintptr_t w){
+  size_t g = (size_t)(w - (uintptr_t)c) / GC_GRANULE;
+  size_t first = CHUNK_FIRST / GC_GRANULE;
+  if (g < first) return NULL;
+  for (size_t byte = g >> 3;; byte--) {
+    unsigned bits = c->starts[byte];
+    if (byte == g >> 3) bits &= (2u << (g & 7)) - 1;
+    if (bits) {
+      size_t at = byte * 8 + (size_t)(31 - __builtin_clz(bits));
+      GCObj *h = (GCObj*)((char*)c + at * GC_GRANULE);
+      if (w >= (uintptr_t)(h + 1) + h->size || (h->flags & GC_FREED)) return NULL;
+      return h;
+    }
+    if (byte <= first >> 3) return NULL;
+  }
+}
+
+/* ---- marking ---- */
+
+static inline void mark_hdr(GCObj *h){
+  if (!(h->mark & GC_WHITES)) return;        /* gray or black already */
+  if (h->type == GC_STR) { h->mark = GC_BLACK; return; }
+  h->mark = 0;
+  vec_push(&G.gray, h);
+}
+void gc_mark(void *o){ if (o) mark_hdr(gc_hdr(o)); }
+void gc_mark_value(Value v){
+  switch (v.tag) {
+    case VAL_STR:       gc_mark(v.as.s);  break;
+    case VAL_TABLE:     gc_mark(v.as.t);  break;
+    case VAL_FUNC:      gc_mark(v.as.fn); break;
+    case VAL_COROUTINE: gc_mark(v.as.co); break;
+    case VAL_PROMISE:   gc_mark(v.as.pr); break;
+    default: break;
+  }
+}
+
+static size_t traverse(GCObj *h){
+  void *o = h + 1;
+  size_t work = sizeof(GCObj) + h->size;
+  h->mark = GC_BLACK;
+  switch (h->type) {
+    case GC_TABLE: {
+      Table *t = o;
+      for (int i = 0; i < t->asize; i++) gc_mark_value(t->arr[i]);
+      for (int i = 0; i < t->cap; i++) {
+        TableEntry *e = &t->entries[i];
+        if (e->key.tag == VAL_NIL) continue;
+        gc_mark_value(e->key);   /* dead keys too: probes still compare them */
+        gc_mark_value(e->val);
+      }
+      work += (size_t)t->asize * sizeof(Value) + (size_t)t->cap * sizeof(TableEntry);
+      break;
+    }
+    case GC_ENV: {
+      Env *e = o;
+      gc_mark(e->parent);
+      gc_mark(e->index);
+      for (int i = 0; i < e->count; i++) gc_mark_value(e->vals[i]);
+      break;
+    }
+    case GC_FUNC: {
+      Func *fn = o;
+      gc_mark(fn->env);
+      if (fn->upvals && fn->proto)
+        for (int i = 0; i < fn->proto->nupvals; i++) gc_mark(fn->upvals[i]);
+      break;
+    }
+    case GC_CELL:
+      gc_mark_value(((BcCell*)o)->v);
+      break;
+    case GC_CO:
+      co_gc_traverse(o);
+      /* a suspended coroutine changes without barriers: look again at the end */
+      if (G.state == GCS_PROPAGATE) { h->mark = 0; vec_push(&G.grayagain, h); }
+      break;
+    case GC_PROMISE:
+      promise_gc_traverse(o);
+      break;
+  }
+  return work;
+}
+
+static size_t propagate_all(void){
+  size_t work = 0;
+  while (G.gray.n) work += traverse(G.gray.v[--G.gray.n]);
+  return work;
+}
+
+void gc_barrier_back(void *o){
+  GCObj *h = gc_hdr(o);
+  if (G.mode == GC_MODE_GENERATIONAL) {
+    /* an old object may now point at a young one */
+    if (h->age != AGE_TOUCHED2) vec_push(&G.touched, h);
+    h->age = AGE_TOUCHED1;
+    h->mark = 0;
+    return;
+  }
+  if (G.state != GCS_PROPAGATE) return;   /* only marking needs black -> white kept out */
+  h->mark = 0;
+  vec_push(&G.grayagain, h);
+}
+
+/* Any word pointing at an object, or up to GC_INTERIOR bytes into it. */
+static inline void mark_word(uintptr_t w){
+  if (w < G.lo || w >= G.hi) return;
+  if (G.chunks.count) {
+    Chunk *c = chunk_of(w);
+    if (set_has(&G.chunks, c)) {
+      GCObj *h = chunk_find(c, w);
+      if (h) mark_hdr(h);
+      return;
+    }
+  }
+  w &= ~(uintptr_t)7;
+  for (uintptr_t off = 0; off <= GC_INTERIOR && off <= w - G.lo; off += 8)
+    if (set_has(&G.objs, (void*)(w - off))) { gc_mark((void*)(w - off)); return; }
+}
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define GC_NO_ASAN __attribute__((no_sanitize_address))
+#endif
+#endif
+#if !defined(GC_NO_ASAN) && defined(__SANITIZE_ADDRESS__)
+#define GC_NO_ASAN __attribute__((no_sanitize_address))
+#endif
+#ifndef GC_NO_ASAN
+#define GC_NO_ASAN
+#endif
+
+static GC_NO_ASAN void mark_range(uintptr_t lo, uintptr_t hi){
+  for (lo = (lo + 7) & ~(uintptr_t)7; lo + sizeof(uintptr_t) <= hi; lo += sizeof(uintptr_t))
+    mark_word(*(uintptr_t*)lo);
+}
+
+/* The C stack from here up to main's frame, callee-saved registers
+   spilled first. */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline))
+#endif
+static void mark_stack(void){
+  if (!G.stack_base) return;
+  jmp_buf regs;
+  setjmp(regs);
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_unwind_init();
+#endif
+  volatile uintptr_t here = (uintptr_t)&here;
+  uintptr_t base = (uintptr_t)G.stack_base;
+  if (here < base) mark_range(here, base);
+  else mark_range(base, here);
+  mark_range((uintptr_t)&regs, (uintptr_t)&regs + sizeof(regs));
+}
+
+static void mark_vm(struct VM *vm){
+  gc_mark(vm->env);
+  gc_mark_value(vm->ret_val);
+  gc_mark_value(vm->err_obj);
+  gc_mark_value(vm->last_exception);
+  gc_mark_value(vm->hook_fn);
+  for (int i = 0; i < vm->top; i++) gc_mark_value(vm->stack[i]);
+  gc_mark(vm->active_co);
+}
+
+static void mark_roots(void){
+  for (int i = 0; i < G.nvms; i++) mark_vm(G.vms[i]);
+  for (int i = 0; i < G.roots.n; i++) gc_mark_value(*(Value*)G.roots.v[i]);
+  for (int i = 0; i < G.rootfns.n; i++) ((void (*)(void))G.rootfns.v[i])();
+  for (Scratch *s = G.scratch; s; s = s->next)
+    for (size_t i = 0; i < s->n; i++) gc_mark_value(s->v[i]);
+  mark_stack();
+}
+
+static void atomic(void){
+  G.state = GCS_ATOMIC;
+  mark_roots();
+  propagate_all();
+  while (G.grayagain.n) {
+    PtrVec again = G.grayagain;
+    G.grayagain = G.gray;
+    G.gray = again;
+    propagate_all();
+  }
+  strtab_prune();
+  G.white ^= GC_WHITES;
+  G.sweep = &G.all;
+  G.state = GCS_SWEEP;
+}
+
+/* ---- sweeping ---- */
+
+static size_t free_obj(GCObj *h){
+  void *o = h + 1;
+  size_t sz = sizeof(GCObj) + h->size;
+  switch (h->type) {
+    case GC_TABLE: {
+      Table *t = o;
+      sz += (size_t)t->asize * sizeof(Value) + (size_t)t->cap * sizeof(TableEntry);
+      free(t->arr); free(t->entries);
+      /* cached lookup chains may name it: drop them before its address
+         can come back, even mid-sweep */
+      if (t->proto) ic_epoch++;
+      break;
+    }
+    case GC_ENV: {
+      Env *e = o;
+      if (e->vals != (Value*)(e + 1)) {   /* env_push: separately grown arrays */
+        if (e->index) for (int i = 0; i < e->count; i++) free((void*)e->names[i]);
+        free((void*)e->names); free(e->vals); free(e->is_local);
+      }
+      free(e->closers);
+      break;
+    }
+    case GC_FUNC: {
+      Func *fn = o;
+      if (fn->upvals) sz += sizeof(BcCell*) * (size_t)fn->proto->nupvals;
+      free(fn->upvals);
+      ast_arena_release(fn->arena);
+      break;
+    }
+    case GC_CO: co_gc_free(o); break;
+    case GC_PROMISE: promise_gc_free(o); break;
+    default: break;
+  }
+  G.total -= sz; G.debt -= (long long)sz;
+  if (h->flags & GC_INCHUNK) chunk_release(h);
+  else { set_remove(&G.objs, o); free(h); }
+  return sz;
+}
+
+static size_t sweep_step(void){
+  size_t work = 0;
+  unsigned char dead = G.white ^ GC_WHITES;
+  for (int n = 0; n < GC_SWEEPMAX && *G.sweep; n++) {
+    GCObj *h = *G.sweep;
+    if (!(h->flags & GC_FIXED) && (h->mark & dead)) {
+      *G.sweep = h->next;
+      work += free_obj(h);
+    } else {
+      h->mark = G.white;
+      G.sweep = &h->next;
+      work += sizeof(GCObj);
+    }
+  }
+  if (!*G.sweep) {
+    G.state = GCS_PAUSE;
+    G.estimate = G.total;
+  }
+  return work;
+}
+
+/* ---- generational collections ---- */
+
+static void promote(GCObj *h){
+  h->age = AGE_OLD;
+  h->mark = GC_BLACK;
+  h->next = G.all;
+  G.all = h;
+  if (h->type == GC_CO) vec_push(&G.oldco, h);
+}
+
+/* Marks the young objects reachable from the roots and from the old
+   objects that may point at them, then sweeps the young list. */
+static void minor_collect(void){
+  G.state = GCS_ATOMIC;
+  G.gray.n = 0;
+  for (int i = 0; i < G.old1.n; i++) traverse(G.old1.v[i]);
+  for (int i = 0; i < G.touched.n; i++) traverse(G.touched.v[i]);
+  for (int i = 0; i < G.oldco.n; i++) traverse(G.oldco.v[i]);
+  mark_roots();
+  propagate_all();
+  strtab_prune();
+
+  for (int i = 0; i < G.old1.n; i++) {
+    GCObj *h = G.old1.v[i];
+    if (h->age == AGE_OLD1) h->age = AGE_OLD;
+  }
+  G.old1.n = 0;
+  int n = 0;
+  for (int i = 0; i < G.touched.n; i++) {
+    GCObj *h = G.touched.v[i];
+    if (h->age == AGE_TOUCHED1) { h->age = AGE_TOUCHED2; G.touched.v[n++] = h; }
+    else h->age = AGE_OLD;
+  }
+  G.touched.n = n;
+
+  for (GCObj **p = &G.young; *p;) {
+    GCObj *h = *p;
+    if (!(h->flags & GC_FIXED) && (h->mark & G.white)) {
+      *p = h->next;
+      free_obj(h);
+    } else if (h->age == AGE_NEW) {
+      h->age = AGE_SURVIVAL;
+      h->mark = G.white;
+      p = &h->next;
+    } else {
+      *p = h->next;
+      promote(h);
+      h->age = AGE_OLD1;
+      vec_push(&G.old1, h);
+    }
+  }
+  G.state = GCS_PAUSE;
+}
+
+/* A full collection that leaves every survivor old. */
+static void major_collect(void){
+  G.state = GCS_ATOMIC;
+  for (GCObj *h = G.all; h; h = h->next) h->mark = G.white;
+  for (GCObj *h = G.young; h; h = h->next) h->mark = G.white;
+  G.gray.n = G.grayagain.n = 0;
+  G.touched.n = G.old1.n = G.oldco.n = 0;
+  mark_roots();
+  propagate_all();
+  strtab_prune();
+
+  GCObj *list[2] = { G.all, G.young };
+  G.all = G.young = NULL;
+  for (int k = 0; k < 2; k++) {
+    for (GCObj *h = list[k], *next; h; h = next) {
+      next = h->next;
+      if (!(h->flags & GC_FIXED) && (h->mark & G.white)) free_obj(h);
+      else promote(h);
+    }
+  }
+  G.estimate = G.total;
+  G.state = GCS_PAUSE;
+}
+
+/* The next minor comes after minormul% of the heap left by the last
+   major; a major once the heap has grown majormul% past it. */
+static int gen_step(void){
+  G.busy = 1;
+  if (G.total > GC_MIN_HEAP && G.total > G.estimate / 100 * (size_t)(100 + G.majormul))
+    major_collect();
+  else
+    minor_collect();
+  G.busy = 0;
+  size_t gap = G.estimate / 100 * (size_t)G.minormul;
+  if (gap < GC_NURSERY_MIN) gap = GC_NURSERY_MIN;
+  G.debt = -(long long)gap;
+  return 1;
+}
+
+/* ---- driving ---- */
+
+static size_t single_step(void){
+  switch (G.state) {
+    case GCS_PAUSE:
+      G.gray.n = G.grayagain.n = 0;
+      G.state = GCS_PROPAGATE;
+      mark_roots();
+      return 1024;
+    case GCS_PROPAGATE:
+      if (G.gray.n) return traverse(G.gray.v[--G.gray.n]);
+      atomic();
+      return 1024;
+    default:
+      return sweep_step();
+  }
+}
+
+static void set_threshold(void){
+  size_t threshold = G.estimate / 100 * (size_t)G.pause;
+  if (threshold < GC_MIN_HEAP) threshold = GC_MIN_HEAP;
+  G.debt = (long long)G.total - (long long)threshold;
+}
+
+/* Runs `work` bytes worth of steps; 1 if that ended a cycle. */
+static int run_steps(long long work){
+  int done = 0;
+  G.busy = 1;
+  do {
+    work -= (long long)single_step();
+    if (G.state == GCS_PAUSE) { done = 1; break; }
+  } while (work > 0);
+  G.busy = 0;
+  if (done) set_threshold();
+  else G.debt = -(long long)G.stepsize_kb * 1024;
+  return done;
+}
+
+static void full_gc(void){
+  G.busy = 1;
+  /* finish a cycle in progress, then run a whole one */
+  while (G.state != GCS_PAUSE) single_step();
+  do single_step(); while (G.state != GCS_PAUSE);
+  G.busy = 0;
+  set_threshold();
+}
+
+void *gc_alloc(GCType type, size_t size){
+  int gen = G.mode == GC_MODE_GENERATIONAL;
+#ifdef GC_STRESS
+  if (G.running && G.stack_base && !G.busy) {
+    if (gen) gen_step(); else run_steps(1);
+  }
+#else
+  if (G.debt > 0 && G.running && G.stack_base && !G.busy) {
+    if (gen) gen_step();
+    else run_steps((long long)G.stepsize_kb * 1024 / 100 * G.stepmul);
+  }
+#endif
+  GCObj *h;
+  if (gen && size <= GC_CHUNKOBJ) {
+    h = nursery_alloc(size);
+    h->next = G.young;
+    G.young = h;
+  } else {
+    h = calloc(1, sizeof(GCObj) + size);
+    if (!h) { fprintf(stderr, "OOM\n"); exit(1); }
+    set_add(&G.objs, h + 1);
+    note_range((uintptr_t)(h + 1), (uintptr_t)(h + 1) + size);
+    if (gen) { h->next = G.young; G.young = h; }
+    else { h->next = G.all; G.all = h; }
+  }
+  h->size = (unsigned)size;
+  h->type = (unsigned char)type;
+  h->mark = G.white;
+  G.total += sizeof(GCObj) + size;
+  G.debt += (long long)(sizeof(GCObj) + size);
+  return h + 1;
+}
+
+void gc_fix(void *o){ gc_hdr(o)->flags |= GC_FIXED; }
+void gc_account(long long delta){ G.total += (size_t)delta; G.debt += delta; }
+
+int gc_isdead(void *o){
+  GCObj *h = gc_hdr(o);
+  if (h->flags & GC_FIXED) return 0;
+  if (G.state == GCS_ATOMIC) return (h->mark & G.white) != 0;
+  if (G.state == GCS_SWEEP) return (h->mark & (G.white ^ GC_WHITES)) != 0;
+  return 0;
+}
+
+void gc_root(Value *slot){ vec_push(&G.roots, slot); }
+void gc_root_fn(void (*mark)(void)){ vec_push(&G.rootfns, (void*)mark); }
+
+void gc_init(void *stack_base){ G.stack_base = stack_base; }
+void gc_attach(struct VM *vm){
+  if (G.nvms < GC_MAXVMS) G.vms[G.nvms++] = vm;
+}
+void gc_detach(struct VM *vm){
+  for (int i = 0; i < G.nvms; i++)
+    if (G.vms[i] == vm) { G.vms[i] = G.vms[--G.nvms]; return; }
+}
+
+static void enter_generational(void){
+  G.busy = 1;
+  while (G.state != GCS_PAUSE) single_step();
+  G.mode = GC_MODE_GENERATIONAL;
+  major_collect();
+  G.busy = 0;
+  G.debt = -(long long)GC_NURSERY_MIN;
+}
+
+static void enter_incremental(void){
+  while (G.young) { GCObj *h = G.young; G.young = h->next; h->next = G.all; G.all = h; }
+  for (GCObj *h = G.all; h; h = h->next) h->mark = G.white;
+  G.touched.n = G.old1.n = G.oldco.n = 0;
+  G.mode = GC_MODE_INCREMENTAL;
+}
+
+/* ---- scratch buffers ---- */
+
+Value *gc_scratch(size_t n){
+  Scratch *s = malloc(sizeof(Scratch) + sizeof(Value) * n);
+  if (!s) { fprintf(stderr, "OOM\n"); exit(1); }
+  for (size_t i = 0; i < n; i++) s->v[i] = V_nil();
+  s->n = n;
+  s->seq = ++G.scratch_seq;
+  s->prev = NULL;
+  s->next = G.scratch;
+  if (G.scratch) G.scratch->prev = s;
+  G.scratch = s;
+  return s->v;
+}
+static void scratch_unlink(Scratch *s){
+  if (s->prev) s->prev->next = s->next; else G.scratch = s->next;
+  if (s->next) s->next->prev = s->prev;
+  free(s);
+}
+void gc_scratch_free(Value *v){
+  if (v) scratch_unlink((Scratch*)((char*)v - offsetof(Scratch, v)));
+}
+unsigned long gc_scratch_mark(void){ return G.scratch_seq; }
+void gc_scratch_unwind(unsigned long mark){
+  while (G.scratch && G.scratch->seq > mark) scratch_unlink(G.scratch);
+}
+void *gc_scratch_switch(void *list){
+  void *old = G.scratch;
+  G.scratch = list;
+  return old;
+}
+void gc_scratch_mark_list(void *list){
+  for (Scratch *s = list; s; s = s->next)
+    for (size_t i = 0; i < s->n; i++) gc_mark_value(s->v[i]);
+}
+void gc_scratch_release(void *list){
+  while (list) { Scratch *s = list; list = s->next; free(s); }
+}
+
+/* ---- coroutine stacks ---- */
+
+void *gc_stack_switch(void *base){
+  void *old = G.stack_base;
+  G.stack_base = base;
+  return old;
+}
+void gc_mark_stack_range(const void *lo, const void *hi){
+  if (lo && hi) mark_range((uintptr_t)lo, (uintptr_t)hi);
+}
+
+/* ---- collectgarbage() ---- */
+
+void vm_gc_collect(struct VM *vm){
+  (void)vm;
+  if (!G.stack_base || G.busy) return;
+  if (G.mode == GC_MODE_GENERATIONAL) {
+    G.busy = 1; major_collect(); G.busy = 0;
+    G.debt = -(long long)GC_NURSERY_MIN;
+  } else full_gc();
+}
+void vm_gc_stop(struct VM *vm){ (void)vm; G.running = 0; }
+void vm_gc_restart(struct VM *vm){
+  (void)vm;
+  G.running = 1;
+  if (G.mode == GC_MODE_GENERATIONAL) G.debt = -(long long)GC_NURSERY_MIN;
+  else set_threshold();
+}
+int  vm_gc_isrunning(struct VM *vm){ (void)vm; return G.running; }
+
+/* kb == 0: one basic step; otherwise the work owed for kb of allocation */
+int vm_gc_step(struct VM *vm, int kb){
+  (void)vm;
+  if (!G.stack_base || G.busy) return 0;
+  if (G.mode == GC_MODE_GENERATIONAL) return gen_step();
+  long long work = (long long)(kb > 0 ? kb : G.stepsize_kb) * 1024 / 100 * G.stepmul;
+  return run_steps(work > 0 ? work : 1);
+}
+int vm_gc_setpause(struct VM *vm, int pause){
+  (void)vm;
+  int old = G.pause;
+  if (pause >= 0) {
+    G.pause = pause;
+    if (G.state == GCS_PAUSE && G.mode == GC_MODE_INCREMENTAL) set_threshold();
+  }
+  return old;
+}
+int vm_gc_setstepmul(struct VM *vm, int mul){
+  (void)vm;
+  int old = G.stepmul;
+  if (mul > 0) G.stepmul = mul;
+  return old;
+}
+int vm_gc_set_incremental(struct VM *vm, int pause, int stepmul, int stepsize_kb){
+  (void)vm;
+  int old = G.mode;
+  if (pause > 0) G.pause = pause;
+  if (stepmul > 0) G.stepmul = stepmul;
+  if (stepsize_kb > 0) G.stepsize_kb = stepsize_kb;
+  if (G.mode != GC_MODE_INCREMENTAL && !G.busy) { enter_incremental(); set_threshold(); }
+  return old;
+}
+int vm_gc_set_generational(struct VM *vm, int minormul, int majormul){
+  (void)vm;
+  int old = G.mode;
+  if (minormul > 0) G.minormul = minormul;
+  if (majormul > 0) G.majormul = majormul;
+  if (G.mode != GC_MODE_GENERATIONAL && !G.busy) enter_generational();
+  return old;
+}
+size_t vm_gc_total_bytes(struct VM *vm){ (void)vm; return G.total; }
@@ -0,0 +1,118 @@
+// icache.c — inline caches for field access (see include/icache.h)
+#include <stdlib.h>
+#include "../include/icache.h"
+#include "../include/table.h"
+#include "../include/builtins.h"
+#include "../include/gc.h"
+
+unsigned ic_epoch = 1;
+
+static Str *s_mt, *s_index;   /* interned "_mt" and "__index" */
+
+static inline Value *slot_hit(Table *t, int slot, Str *key){
+  if ((unsigned)slot >= (unsigned)t->cap) return NULL;
+  TableEntry *e = &t->entries[slot];
+  if (e->key.tag != VAL_STR || e->key.as.s != key || e->val.tag == VAL_NIL) return NULL;
+  return &e->val;
+}
+
+static void ic_record(FieldIC **icp, Table *mt, int mt_slot, Table *holder, int slot, unsigned shape){
+  FieldIC *ic = *icp;
+  if (!ic) ic = *icp = calloc(1, sizeof(*ic));
+  for (int i = 0; i < ic->n; i++) {
+    ICEntry *e = &ic->e[i];
+    if (e->mt == mt && e->holder == holder && e->slot == slot && e->mt_slot == mt_slot) {
+      e->shape = shape;
+      e->epoch = ic_epoch;
+      return;
+    }
+  }
+  ICEntry ne = { mt, holder, slot, mt_slot, shape, ic_epoch };
+  if (ic->n < IC_WAYS) { ic->e[ic->n++] = ne; return; }
+  ic->e[ic->next] = ne;
+  ic->next = (ic->next + 1) % IC_WAYS;
+}
+
+/* The generic lookup, recording how the key resolved. */
+static Value ic_miss(VM *vm, FieldIC **icp, Value t, Str *key){
+  if (!s_mt) {
+    s_mt = V_str_from_c(MT_STORE).as.s;
+    s_index = V_str_from_c("__index").as.s;
+    gc_fix(s_mt); gc_fix(s_index);
+  }
+  Value k = { .tag = VAL_STR, .as.s = key };
+  Value mtk = { .tag = VAL_STR, .as.s = s_mt }, idxk = { .tag = VAL_STR, .as.s = s_index };
+  Table *mt0 = NULL;
+  int ms0 = -1;
+  unsigned shape0 = t.tag == VAL_TABLE ? t.as.t->shape : TBL_SHAPE_NONE;
+  for (int depth = 0; depth < IC_MAX_CHAIN; depth++) {
+    if (t.tag != VAL_TABLE) return V_nil();
+    Table *T = t.as.t;
+    int slot = tbl_slot(T, k);
+    if (slot >= 0) {
+      if (key->interned) ic_record(icp, mt0, ms0, depth ? T : NULL, slot, depth ? shape0 : TBL_SHAPE_NONE);
+      return T->entries[slot].val;
+    }
+    int ms = tbl_slot(T, mtk);
+    if (ms < 0 || T->entries[ms].val.tag != VAL_TABLE) return V_nil();
+    Table *mt = T->entries[ms].val.as.t;
+    int is = tbl_slot(mt, idxk);
+    if (is < 0) return V_nil();
+    Value idx = mt->entries[is].val;
+    if (idx.tag != VAL_TABLE) {
+      Value argv[2] = { t, k };
+      return call_any(vm, idx, 2, argv);
+    }
+    if (depth == 0) { mt0 = mt; ms0 = ms; }
+    mt->proto = 1;
+    idx.as.t->proto = 1;
+    t = idx;
+  }
+  return V_nil();
+}
+
+Value ic_index(VM *vm, FieldIC **icp, Value t, Str *key){
+  if (t.tag != VAL_TABLE) return vm_index(vm, t, (Value){ .tag = VAL_STR, .as.s = key });
+  Table *T = t.as.t;
+  FieldIC *ic = *icp;
+  if (ic) {
+    for (int i = 0; i < ic->n; i++) {
+      ICEntry *e = &ic->e[i];
+      Value *v;
+      if (!e->mt) {
+        if ((v = slot_hit(T, e->slot, key))) return *v;
+        continue;
+      }
+      /* the epoch vouches for the chain past the receiver's metatable */
+      if (e->epoch != ic_epoch) continue;
+      Value *mt = slot_hit(T, e->mt_slot, s_mt);
+      if (!mt || mt->tag != VAL_TABLE || mt->as.t != e->mt) continue;
+      if (T->shape != e->shape || T->shape == TBL_SHAPE_NONE) {
+        if (T->cap && tbl_slot(T, (Value){ .tag = VAL_STR, .as.s = key }) >= 0) break;   /* shadowed */
+        e->shape = T->shape;
+      }
+      if ((v = slot_hit(e->holder, e->slot, key))) return *v;
+    }
+  }
+  return ic_miss(vm, icp, t, key);
+}
+
+void ic_setindex(VM *vm, FieldIC **icp, Value t, Str *key, Value v){
+  if (t.tag != VAL_TABLE) return;
+  Table *T = t.as.t;
+  FieldIC *ic = *icp;
+  /* overwriting a live field; removals and metatable-side tables take
+     the slow path so the key set bookkeeping (and ic_epoch) stays right */
+  if (ic && v.tag != VAL_NIL && !T->proto) {
+    for (int i = 0; i < ic->n; i++) {
+      Value *slot;
+      if (!ic->e[i].mt && (slot = slot_hit(T, ic->e[i].slot, key))) { *slot = v; gc_barrier(T); return; }
+    }
+  }
+  Value k = { .tag = VAL_STR, .as.s = key };
+  vm_setindex(vm, t, k, v);
+  if (key->interned) {
+    int slot = tbl_slot(T, k);
+    if (slot >= 0) ic_record(icp, NULL, -1, NULL, slot, TBL_SHAPE_NONE);
+  }
+}
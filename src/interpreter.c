@@ -3,6 +3,7 @@
 #include <string.h>
 #include <math.h>
 #include <stdint.h> 
+#include <limits.h>
 #include <ctype.h>
 #include <setjmp.h>
 #include <dlfcn.h>
@@ -10,27 +11,29 @@
 #include "../include/parser.h"
 #include "../include/builtins.h"
 #include "../include/lexer.h"
+#include "../include/util.h"
 #include "../include/err.h"
+#include "../include/resolver.h"
+#include "../include/bytecode.h"
+#include "../include/icache.h"
+#include "../include/gc.h"
+#include "../include/chunk.h"
 unsigned long long hash_value(Value v){
   switch(v.tag){
     case VAL_NIL:  return 1469598103934665603ULL;
     case VAL_BOOL: return v.as.b?0x9e3779b97f4a7c15ULL:0x51d7348a2f0f3ad9ULL;
-    case VAL_INT: { 
-      union { double d; unsigned long long u; } u = { .d = (double)v.as.i };
-      return hash_mix(u.u);
-    }
+    /* tables normalize integral float keys to ints, so ints can hash raw */
+    case VAL_INT: return hash_mix((unsigned long long)v.as.i);
     case VAL_NUM: { 
       union{ double d; unsigned long long u; }u={.d=v.as.n};
       return hash_mix(u.u);
     }
-    case VAL_STR: {
-      unsigned long long h=1469598103934665603ULL;
-      for(int i=0;i<v.as.s->len;i++){ h^=(unsigned char)v.as.s->data[i]; h*=1099511628211ULL; }
-      return h;
-    }
-    case VAL_TABLE: return (unsigned long long)(uintptr_t)v.as.t;
-    case VAL_FUNC:  return (unsigned long long)(uintptr_t)v.as.fn;
-    case VAL_CFUNC: return (unsigned long long)(uintptr_t)v.as.cfunc;
+    case VAL_STR: return Str_hash(v.as.s);
+    /* pointers are aligned; mix so the low bits used for slot masks vary */
+    case VAL_TABLE: return hash_mix((unsigned long long)(uintptr_t)v.as.t);
+    case VAL_FUNC:  return hash_mix((unsigned long long)(uintptr_t)v.as.fn);
+    case VAL_CFUNC: return hash_mix((unsigned long long)(uintptr_t)v.as.cfunc);
+    case VAL_PROMISE: return hash_mix((unsigned long long)(uintptr_t)v.as.pr);
     default: return 0x12345678ULL;
   }
 }
@@ -55,17 +58,30 @@ static long long as_int(Value v){
   return 0;
 }
 static inline Value V_cstr(const char *s){ return V_str_from_c(s); }
+/* Metamethod names are mostly string literals: keep their interned Str by
+   address so lookups do not rehash the name every time. */
+static Value mm_name(const char *name){
+  static struct { const char *c; Str *s; } names[32];
+  static int n;
+  for (int i = 0; i < n; i++)
+    if (names[i].c == name && strcmp(names[i].s->data, name) == 0) return (Value){.tag=VAL_STR,.as.s=names[i].s};
+  Value v = V_cstr(name);
+  if (n < 32) { gc_fix(v.as.s); names[n].c = name; names[n].s = v.as.s; n++; }
+  return v;
+}
+Value promise_mt;
 static Value mt_of(Value v){
+  if (v.tag == VAL_PROMISE) return promise_mt;
   if (v.tag != VAL_TABLE) return V_nil();
   Value mt;
-  if (tbl_get(v.as.t, V_cstr(MT_STORE), &mt) && mt.tag == VAL_TABLE) return mt;
+  if (tbl_get(v.as.t, mm_name(MT_STORE), &mt) && mt.tag == VAL_TABLE) return mt;
   return V_nil();
 }
 Value mm_of(Value v, const char *name){
   Value mt = mt_of(v);
   if (mt.tag != VAL_TABLE) return V_nil();
   Value f;
-  if (tbl_get(mt.as.t, V_cstr(name), &f)) return f;
+  if (tbl_get(mt.as.t, mm_name(name), &f)) return f;
   return V_nil();
 }
 static int try_bin_mm(struct VM *vm, const char *mm, Value a, Value b, Value *out){
@@ -87,19 +103,31 @@ static int try_un_mm(struct VM *vm, const char *mm, Value a, Value *out){
   }
   return 0;
 }
-Value call_any(VM *vm, Value cal, int argc, Value *argv) {
-    if (cal.tag == VAL_CFUNC) return cal.as.cfunc(vm, argc, argv);
+/* Calls cal and leaves its n results in stack[top-n, top), with top
+   advanced by n from where it was on entry; returns n. */
+int call_multi(VM *vm, Value cal, int argc, Value *argv) {
+    if (cal.tag == VAL_CFUNC) {
+        int base = vm->top;
+        Value r = cal.as.cfunc(vm, argc, argv);
+        if (r.tag != VAL_MULTI) { vm->top = base; vm_push(vm, r); return 1; }
+        int n = MULTI_COUNT(r);
+        if (MULTI_BASE(r) != base) memmove(vm->stack + base, vm->stack + MULTI_BASE(r), sizeof(Value) * (size_t)n);
+        vm->top = base + n;
+        return n;
+    }
     if (cal.tag == VAL_FUNC)  return call_function(vm, cal.as.fn, argc, argv);
     Value f = mm_of(cal, "__call");
     if (f.tag != VAL_NIL) {
-        Value *args = NULL;
-        int n = argc + 1;
-        if (n > 0) args = (Value*)malloc(sizeof(Value) * (size_t)n);
+        int base = vm->top;
+        vm_stack_check(vm, argc + 1);
+        Value *args = vm->stack + base;
         args[0] = cal;
         for (int i = 0; i < argc; i++) args[i+1] = argv[i];
-        Value r = call_any(vm, f, n, args);
-        if (args) free(args);
-        return r;
+        vm->top = base + argc + 1;
+        int n = call_multi(vm, f, argc + 1, args);
+        memmove(vm->stack + base, vm->stack + vm->top - n, sizeof(Value) * (size_t)n);
+        vm->top = base + n;
+        return n;
     }
     const char *type_name = "unknown";
     switch(cal.tag) {
@@ -113,6 +141,7 @@ Value call_any(VM *vm, Value cal, int argc, Value *argv) {
         case VAL_CFUNC: type_name = "cfunction"; break;
         case VAL_FUNC:  type_name = "function"; break;
         case VAL_MULTI: type_name = "multi"; break;
+        case VAL_PROMISE: type_name = "userdata"; break;
     }
     char err_msg[512];
     snprintf(err_msg, sizeof(err_msg),
@@ -130,7 +159,52 @@ Value call_any(VM *vm, Value cal, int argc, Value *argv) {
         }
     }
     vm_raise(vm, V_str_from_c(err_msg));
-    return V_nil();
+    return 0;
+}
+/* A call in single-value position: the first result or nil. */
+Value call_any(VM *vm, Value cal, int argc, Value *argv) {
+    int base = vm->top;
+    int n = call_multi(vm, cal, argc, argv);
+    Value r = n ? vm->stack[base] : V_nil();
+    vm->top = base;
+    return r;
+}
+/* Returned by a C function to hand back n values. */
+Value vm_return_values(VM *vm, int n, const Value *v) {
+    int base = vm->top;
+    vm_stack_check(vm, n);
+    for (int i = 0; i < n; i++) vm->stack[base + i] = v[i];
+    vm->top = base + n;
+    return V_multi(base, n);
+}
+/* `...` is a window over the stack of the thread its function runs on. */
+static inline int varargs_count(VM *vm, Value va){
+    if (va.tag == VAL_MULTI) {
+        int n = MULTI_COUNT(va);
+        return MULTI_BASE(va) + n <= vm->top ? n : 0;
+    }
+    return 0;
+}
+Value vm_vararg(VM *vm, Value va, int i) {
+    if (i >= varargs_count(vm, va)) return V_nil();
+    return vm->stack[MULTI_BASE(va) + i];
+}
+int vm_push_varargs(VM *vm, Value va) {
+    int n = varargs_count(vm, va);
+    vm_stack_check(vm, n);
+    for (int i = 0; i < n; i++) vm->stack[vm->top + i] = vm_vararg(vm, va, i);
+    vm->top += n;
+    return n;
+}
+/* One step of a generic for: calls the iterator and returns its first two
+   results in a and b, or 0 once the first is nil. */
+int call_iter(VM *vm, Value f, int argc, Value *argv, Value *a, Value *b) {
+    int base = vm->top;
+    int n = call_multi(vm, f, argc, argv);
+    *a = n > 0 ? vm->stack[base] : V_nil();
+    *b = n > 1 ? vm->stack[base + 1] : V_nil();
+    vm->top = base;
+    return a->tag != VAL_NIL;
 }
 static Value op_concat(Value a, Value b){
   char tmpa[64], tmpb[64];
@@ -139,6 +213,11 @@ static Value op_concat(Value a, Value b){
   else { snprintf(tmpa,sizeof(tmpa),"%g", as_num(a)); sa=tmpa; la=(int)strlen(sa); }
   if(b.tag==VAL_STR){ sb=b.as.s->data; lb=b.as.s->len; }
   else { snprintf(tmpb,sizeof(tmpb),"%g", as_num(b)); sb=tmpb; lb=(int)strlen(sb); }
+  if(la+lb<=STR_SHORT_MAX){
+    char buf[STR_SHORT_MAX+1];
+    memcpy(buf, sa, la); memcpy(buf+la, sb, lb);
+    return (Value){.tag=VAL_STR,.as.s=Str_new_len(buf, la+lb)};
+  }
   Str *s=Str_new_len(NULL, la+lb);
   memcpy(s->data, sa, la); memcpy(s->data+la, sb, lb); s->data[la+lb]='\0';
   return (Value){.tag=VAL_STR,.as.s=s};
@@ -149,20 +228,15 @@ int to_int_val(Value v, int dflt){
   return dflt;
 }
 Value ipairs_iter(struct VM *vm, int argc, Value *argv){
-  (void)vm;
   if (argc < 2 || argv[0].tag != VAL_TABLE) return V_nil();
   long long i = 0;
   if (argv[1].tag == VAL_INT) i = argv[1].as.i;
   else if (argv[1].tag == VAL_NUM) i = (long long)argv[1].as.n;
   i += 1;
   Value val;
-  if (tbl_get(argv[0].as.t, V_int(i), &val)) {
-    Value pair = V_table();
-    tbl_set(pair.as.t, V_int(1), V_int(i));
-    tbl_set(pair.as.t, V_int(2), val);
-    return pair;
-  }
-  return V_nil();
+  if (!tbl_geti(argv[0].as.t, i, &val)) return V_nil();
+  Value out[2] = { V_int(i), val };
+  return vm_return_values(vm, 2, out);
 }
  Value tostring_default(Value v) {
   char buf[64];
@@ -185,10 +259,12 @@ Value ipairs_iter(struct VM *vm, int argc, Value *argv){
       return V_str_from_c("function");
     case VAL_CFUNC:
       return V_str_from_c("function");
-#ifdef VAL_COROUTINE
     case VAL_COROUTINE:
-      return V_str_from_c("thread");
-#endif
+      snprintf(buf, sizeof(buf), "thread: %p", (void*)v.as.co);
+      return V_str_from_c(buf);
+    case VAL_PROMISE:
+      snprintf(buf, sizeof(buf), "promise:%p", (void*)v.as.pr);
+      return V_str_from_c(buf);
     default:
       return V_str_from_c("<value>");
   }
@@ -221,6 +297,8 @@ Value builtin_type(struct VM *vm, int argc, Value *argv){
     case VAL_STR: return V_str_from_c("string");
     case VAL_TABLE: return V_str_from_c("table");
     case VAL_FUNC: case VAL_CFUNC: return V_str_from_c("function");
+    case VAL_COROUTINE: return V_str_from_c("thread");
+    case VAL_PROMISE: return V_str_from_c("userdata");
     default: return V_str_from_c("unknown");
   }
 }
@@ -228,107 +306,160 @@ static Value builtin__VERSION(struct VM *vm, int argc, Value *argv){
   (void)vm;(void)argc;(void)argv;
   return V_str_from_c("LuaX 1.0.4");
 }
-char* read_entire_file(const char *path, size_t *out_len){
-    FILE *f = fopen(path, "rb");
-    if (!f) return NULL;
-    fseek(f, 0, SEEK_END);
-    long n = ftell(f);
-    if (n < 0) { fclose(f); return NULL; }
-    fseek(f, 0, SEEK_SET);
-    char *buf = (char*)malloc((size_t)n + 1);
-    if (!buf) { fclose(f); return NULL; }
-    size_t rd = fread(buf, 1, (size_t)n, f);
-    fclose(f);
-    buf[rd] = '\0';
-    if (out_len) *out_len = rd;
-    return buf;
-}
-AST* compile_chunk_from_FILE(FILE *fp){
-  Token *toks = NULL; int count = 0, cap = 0;
-  for (;;) {
-    Token t = next(fp);
-    if (count >= cap){ cap = cap? cap*2 : 64; toks = (Token*)realloc(toks, sizeof(Token)*cap); }
-    toks[count++] = t;
-    if (t.type == TOK_EOF) break;
-  }
-  Parser *p = parser_create(toks, count);
-  ASTVec stmts = (ASTVec){0};
-  while (parser_curr(p).type != TOK_EOF) {
-    AST *s = statement(p);
-    if (!s) break;
-    if (parser_curr(p).type == TOK_EOF && p->had_error) break;
-    astvec_push(&stmts, s);
-  }
-  AST *program = ast_make_block(stmts, count ? toks[count-1].line : 1);
-  for (int i=0;i<count;i++) free(toks[i].lexeme);
-  free(toks);
+AST* compile_chunk(const char *src, size_t len){
+  Lexer lx;
+  lexer_init(&lx, src, len);
+  Parser *p = parser_create(&lx);
+  AST *program = parse_chunk(p);
   parser_destroy(p);
+  lexer_free(&lx);
+  resolve_chunk(program);
+  return program;
+}
+AST* compile_file(const char *path){
+  size_t len;
+  const char *src = map_file(path, &len);
+  if (!src) return NULL;
+  AST *program;
+  if (chunk_is_binary(src, len)) {
+    if ((program = chunk_undump(src, len))) resolve_chunk(program);
+  } else program = compile_chunk(src, len);
+  unmap_file(src, len);
   return program;
 }
 static Value eval_expr(VM *vm, AST *n);
+static int   eval_call(VM *vm, AST *n);
 static void  exec_stmt(VM *vm, AST *n);
-static Func *func_new(ASTVec params, bool vararg, AST *body, Env *capt){
-  Func *fn = xmalloc(sizeof(*fn));
+static Func *func_new(ASTVec params, bool vararg, AST *body, const char **pnames, bool heap_env, Env *capt){
+  Func *fn = gc_alloc(GC_FUNC, sizeof(*fn));
   fn->params = params; 
   fn->vararg = vararg;
   fn->body   = body;
+  fn->pnames = pnames;
+  fn->heap_env = heap_env;
   fn->env    = capt;
+  fn->arena  = body && body->kind == AST_BLOCK ? body->as.block.arena : NULL;
+  ast_arena_retain(fn->arena);
+  return fn;
+}
+/* A loaded chunk as a function of no params over the globals; compiled to
+   bytecode when that engine is selected and supports the chunk. */
+Func *make_chunk_func(VM *vm, AST *program){
+  Func *fn = func_new((ASTVec){0}, false, program, NULL, true, env_root(vm->env));
+  bc_attach_chunk(fn, program);
   return fn;
 }
-static Value call_function(VM *vm, Func *fn, int argc, Value *argv){
-  Env *saved_env = vm->env;
-  bool saved_has_ret = vm->has_ret;
-  Value saved_ret = vm->ret_val;
-  bool saved_break = vm->break_flag;
-  bool saved_pg = vm->pending_goto;
-  const char *saved_gl = vm->goto_label;
-  vm->env = env_push(fn->env);
-  if (vm->active_co && !vm->co_call_env) {
-    vm->co_call_env = vm->env;
+/* Resolved variable access. Locals sit at (depth, slot) from the current
+   env; globals live in the root env and each AST_IDENT caches its slot. */
+static inline Env *local_env(VM *vm, AST *id){
+  Env *e = vm->env;
+  for(int d = id->as.ident.depth; d > 0; d--) e = e->parent;
+  return e;
+}
+static Value *global_ref(VM *vm, AST *id){
+  if(id->as.ident.genv) return &id->as.ident.genv->vals[id->as.ident.gslot];
+  Env *root = env_root(vm->env);
+  int slot = env_global_slot(root, id->as.ident.key);
+  if(slot < 0) return NULL;
+  id->as.ident.genv  = root;
+  id->as.ident.gslot = slot;
+  return &root->vals[slot];
+}
+static inline Value get_var(VM *vm, AST *id){
+  if(id->as.ident.depth >= 0) return local_env(vm, id)->vals[id->as.ident.slot];
+  Value *g = global_ref(vm, id);
+  return g ? *g : V_nil();
+}
+static void set_var(VM *vm, AST *id, Value v){
+  if(id->as.ident.depth >= 0){
+    Env *e = local_env(vm, id);
+    e->vals[id->as.ident.slot] = v;
+    gc_barrier(e);
+    return;
   }
-  int pcount = (int)fn->params.count;
-  for(int i=0;i<pcount;i++){
-    AST *id = fn->params.items[i];
-    const char *nm = (id && id->kind==AST_IDENT) ? id->as.ident.name : "";
-    Value val = (i<argc)? argv[i] : V_nil();
-    if(!env_set(vm->env,nm,val)){
-        env_add(vm->env, nm, val, true);
+  Value *g = global_ref(vm, id);
+  if(g){ *g = v; gc_barrier(id->as.ident.genv); }
+  else env_add(vm->env, id->as.ident.name, v, false);
+}
+/* Runs a walker closure; its results end up at the stack top it was
+   called with (see call_multi). Unless a closure may capture it, the
+   params env lives on the value stack, so a call allocates nothing.
+   A tail call reuses the frame: the loop runs the callee at the same
+   base, so `return f(x)` chains need constant C stack and value stack. */
+static int call_function(VM *vm, Func *fn, int argc, Value *argv){
+  if (fn->proto) return bc_call(vm, fn, argc, argv);
+  vm_cstack_check(vm);
+  CallFrame fr = { .prev = vm->frame, .fn = fn, .base = vm->top, .env = vm->env,
+                   .has_ret = vm->has_ret, .break_flag = vm->break_flag, .pending_goto = vm->pending_goto,
+                   .ret_val = vm->ret_val, .goto_label = vm->goto_label };
+  int base = fr.base;
+  int n;
+  StackEnv se;
+  vm->frame = &fr;
+  for (;;) {
+    vm_step(vm);
+    int pcount = (int)fn->params.count;
+    int nslots = pcount + (fn->vararg ? 1 : 0);
+    Env *fenv;
+    if (fn->heap_env) fenv = env_push_slots(fn->env, nslots, fn->pnames);
+    else fenv = env_push_stack(vm, &se, fn->env, nslots, fn->pnames);
+    vm->env = fenv;
+    for(int i=0;i<pcount && i<argc;i++) fenv->vals[i] = argv[i];
+    if(fn->vararg){
+      int nv = argc > pcount ? argc - pcount : 0;
+      int at = vm->top;
+      vm_stack_check(vm, nv);
+      for(int i=0;i<nv;i++) vm->stack[at + i] = argv[pcount + i];
+      vm->top = at + nv;
+      fenv->vals[pcount] = V_multi(at, nv);
     }
-  }
-  if(fn->vararg){
-    Value vargs = V_table();
-    int k=1;
-    for(int i=pcount;i<argc;i++){
-      tbl_set(vargs.as.t, V_int(k++), argv[i]);
+    vm->has_ret = false;
+    vm->break_flag = false;
+    vm->pending_goto = false;
+    exec_stmt(vm, fn->body);
+    n = 0;
+    if (vm->has_ret) {
+      n = vm->nret;
+      memmove(vm->stack + base, vm->stack + vm->top - n, sizeof(Value) * (size_t)n);
     }
-    env_add(vm->env, "...", vargs, true);
+    vm->top = base + n;
+    if (!vm->tailcall) break;
+    /* return f(...): f sits at base with its args after it */
+    vm->tailcall = false;
+    vm->env = fr.env;
+    Value cal = vm->stack[base];
+    argc = n - 1;
+    argv = vm->stack + base + 1;
+    if (cal.tag == VAL_FUNC && !cal.as.fn->proto) { fn = fr.fn = cal.as.fn; continue; }
+    n = call_multi(vm, cal, argc, argv);
+    memmove(vm->stack + base, vm->stack + vm->top - n, sizeof(Value) * (size_t)n);
+    vm->top = base + n;
+    break;
   }
-  vm->has_ret = false;
-  vm->break_flag = false;
-  vm->pending_goto = false;
-  exec_stmt(vm, fn->body);
-  Value ret = vm->has_ret ? vm->ret_val : V_nil();
-  vm->env = saved_env;
-  vm->has_ret = saved_has_ret;
-  vm->ret_val = saved_ret;
-  vm->break_flag = saved_break;
-  vm->pending_goto = saved_pg;
-  vm->goto_label = saved_gl;
-  return ret;
+  vm->frame = fr.prev;
+  vm->env = fr.env;
+  vm->has_ret = fr.has_ret;
+  vm->ret_val = fr.ret_val;
+  vm->break_flag = fr.break_flag;
+  vm->pending_goto = fr.pending_goto;
+  vm->goto_label = fr.goto_label;
+  return n;
 }
+/* __index tables are indexed in turn (so class chains work); a function ends the chain.
+   Other values only have the fields their type's metatable gives them. */
 static Value eval_index(VM *vm, Value table, Value key){
-  if(table.tag!=VAL_TABLE) return V_nil();
-  Value out;
-  if(tbl_get(table.as.t, key, &out)) return out;
-  Value mm = mm_of(table, "__index");
-  if (mm.tag == VAL_NIL) return V_nil();
-  if (mm.tag == VAL_TABLE){
-    Value v;
-    if (tbl_get(mm.as.t, key, &v)) return v;
-    return V_nil();
+  for (int depth = 0; depth < IC_MAX_CHAIN; depth++) {
+    Value out;
+    if(table.tag==VAL_TABLE && tbl_get(table.as.t, key, &out)) return out;
+    Value mm = mm_of(table, "__index");
+    if (mm.tag == VAL_NIL) return V_nil();
+    if (mm.tag != VAL_TABLE){
+      Value argv2[2] = { table, key };
+      return call_any(vm, mm, 2, argv2);
+    }
+    table = mm;
   }
-  Value argv2[2] = { table, key };
-  return call_any(vm, mm, 2, argv2);
+  return V_nil();
 }
 static void assign_index(VM *vm, Value table, Value key, Value val){
   if(table.tag!=VAL_TABLE) return;
@@ -349,45 +480,340 @@ static void assign_index(VM *vm, Value table, Value key, Value val){
   Value argv3[3] = { table, key, val };
   (void)call_any(vm, mm, 3, argv3);
 }
+/* Operator semantics shared by the AST walker and the bytecode VM. */
+Value vm_binop(VM *vm, OpKind op, Value L, Value R){
+  switch(op){
+    case OP_ADD: {
+      if (L.tag==VAL_INT && R.tag==VAL_INT) return V_int(L.as.i + R.as.i);
+      if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
+        return V_num(as_num(L) + as_num(R));
+      Value out; if (try_bin_mm(vm, "__add", L, R, &out)) return out;
+      vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
+      return V_nil();
+    }
+    case OP_SUB: {
+      if (L.tag==VAL_INT && R.tag==VAL_INT) return V_int(L.as.i - R.as.i);
+      if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
+        return V_num(as_num(L) - as_num(R));
+      Value out; if (try_bin_mm(vm, "__sub", L, R, &out)) return out;
+      vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
+      return V_nil();
+    }
+    case OP_MUL: {
+      if (L.tag==VAL_INT && R.tag==VAL_INT) return V_int(L.as.i * R.as.i);
+      if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
+        return V_num(as_num(L) * as_num(R));
+      Value out; if (try_bin_mm(vm, "__mul", L, R, &out)) return out;
+      vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
+      return V_nil();
+    }
+    case OP_DIV: {
+      if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
+        return V_num(as_num(L) / as_num(R));
+      Value out; if (try_bin_mm(vm, "__div", L, R, &out)) return out;
+      vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
+      return V_nil();
+    }
+                 case OP_IDIV: {
+  if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM)) {
+double l = as_num(L);
+double r = as_num(R);
+if (r == 0.0) {
+  vm_raise(vm, V_str_from_c("integer division by zero"));
+  return V_nil();
+}
+return V_int((long long)floor(l / r));
+  }
+  Value out; 
+  if (try_bin_mm(vm, "__idiv", L, R, &out)) return out;
+  vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
+  return V_nil();
+}
+    case OP_MOD: {
+      if (L.tag==VAL_INT && R.tag==VAL_INT) return V_int(L.as.i % R.as.i);
+      if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
+        return V_num(fmod(as_num(L), as_num(R)));
+      Value out; if (try_bin_mm(vm, "__mod", L, R, &out)) return out;
+      vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
+      return V_nil();
+    }
+    case OP_POW: {
+      if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
+        return V_num(pow(as_num(L), as_num(R)));
+      Value out; if (try_bin_mm(vm, "__pow", L, R, &out)) return out;
+      vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
+      return V_nil();
+    }
+    case OP_CONCAT: {
+      if ((L.tag==VAL_STR || L.tag==VAL_INT || L.tag==VAL_NUM) &&
+          (R.tag==VAL_STR || R.tag==VAL_INT || R.tag==VAL_NUM))
+        return op_concat(L, R);
+      Value out; if (try_bin_mm(vm, "__concat", L, R, &out)) return out;
+      vm_raise(vm, V_str_from_c("attempt to concatenate a non-string value"));
+      return V_nil();
+    }
+    case OP_EQ: {
+      int eq = value_equal(L, R);
+      Value fL = mm_of(L, "__eq"); Value fR = mm_of(R, "__eq");
+      if (fL.tag != VAL_NIL || fR.tag != VAL_NIL){
+        Value out;
+        if (try_bin_mm(vm, "__eq", L, R, &out)) return V_bool(as_truthy(out));
+      }
+      return V_bool(eq);
+    }
+    case OP_NE: {
+      Value fL = mm_of(L, "__eq"); Value fR = mm_of(R, "__eq");
+      if (fL.tag != VAL_NIL || fR.tag != VAL_NIL){
+        Value out;
+        if (try_bin_mm(vm, "__eq", L, R, &out)) return V_bool(!as_truthy(out));
+      }
+      return V_bool(!value_equal(L, R));
+    }
+    case OP_LT: {
+      if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
+        return V_bool(as_num(L) < as_num(R));
+      if (L.tag==VAL_STR && R.tag==VAL_STR){
+        int min = (L.as.s->len < R.as.s->len) ? L.as.s->len : R.as.s->len;
+        int cmp = memcmp(L.as.s->data, R.as.s->data, (size_t)min);
+        if (cmp < 0) return V_bool(1);
+        if (cmp > 0) return V_bool(0);
+        return V_bool(L.as.s->len < R.as.s->len);
+      }
+      Value out; if (try_bin_mm(vm, "__lt", L, R, &out)) return V_bool(as_truthy(out));
+      const char *tL =
+        (L.tag==VAL_NIL)?"nil":(L.tag==VAL_BOOL)?"boolean":
+        (L.tag==VAL_INT||L.tag==VAL_NUM)?"number":
+        (L.tag==VAL_STR)?"string":
+        (L.tag==VAL_TABLE)?"table":
+        (L.tag==VAL_FUNC||L.tag==VAL_CFUNC)?"function":"value";
+      const char *tR =
+        (R.tag==VAL_NIL)?"nil":(R.tag==VAL_BOOL)?"boolean":
+        (R.tag==VAL_INT||R.tag==VAL_NUM)?"number":
+        (R.tag==VAL_STR)?"string":
+        (R.tag==VAL_TABLE)?"table":
+        (R.tag==VAL_FUNC||R.tag==VAL_CFUNC)?"function":"value";
+      char buf[128];
+      snprintf(buf,sizeof(buf),"attempt to compare %s with %s", tL, tR);
+      vm_raise(vm, V_str_from_c(buf));
+      return V_bool(0);
+    }
+    case OP_LE: {
+      if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
+        return V_bool(as_num(L) <= as_num(R));
+      if (L.tag==VAL_STR && R.tag==VAL_STR){
+        int min = (L.as.s->len < R.as.s->len) ? L.as.s->len : R.as.s->len;
+        int cmp = memcmp(L.as.s->data, R.as.s->data, (size_t)min);
+        if (cmp < 0) return V_bool(1);
+        if (cmp > 0) return V_bool(0);
+        return V_bool(L.as.s->len <= R.as.s->len);
+      }
+      Value out;
+      if (try_bin_mm(vm, "__le", L, R, &out)) return V_bool(as_truthy(out));
+      Value out2;
+      if (try_bin_mm(vm, "__lt", R, L, &out2)) return V_bool(!as_truthy(out2));
+      const char *tL =
+        (L.tag==VAL_NIL)?"nil":(L.tag==VAL_BOOL)?"boolean":
+        (L.tag==VAL_INT||L.tag==VAL_NUM)?"number":
+        (L.tag==VAL_STR)?"string":
+        (L.tag==VAL_TABLE)?"table":
+        (L.tag==VAL_FUNC||L.tag==VAL_CFUNC)?"function":"value";
+      const char *tR =
+        (R.tag==VAL_NIL)?"nil":(R.tag==VAL_BOOL)?"boolean":
+        (R.tag==VAL_INT||R.tag==VAL_NUM)?"number":
+        (R.tag==VAL_STR)?"string":
+        (R.tag==VAL_TABLE)?"table":
+        (R.tag==VAL_FUNC||R.tag==VAL_CFUNC)?"function":"value";
+      char buf[128];
+      snprintf(buf,sizeof(buf),"attempt to compare %s with %s", tL, tR);
+      vm_raise(vm, V_str_from_c(buf));
+      return V_bool(0);
+    }
+    case OP_GT: {
+      if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
+        return V_bool(as_num(L) > as_num(R));
+      if (L.tag==VAL_STR && R.tag==VAL_STR){
+        int min = (L.as.s->len < R.as.s->len) ? L.as.s->len : R.as.s->len;
+        int cmp = memcmp(L.as.s->data, R.as.s->data, (size_t)min);
+        if (cmp > 0) return V_bool(1);
+        if (cmp < 0) return V_bool(0);
+        return V_bool(L.as.s->len > R.as.s->len);
+      }
+      Value out; if (try_bin_mm(vm, "__lt", R, L, &out)) return V_bool(as_truthy(out));
+      const char *tL =
+        (L.tag==VAL_NIL)?"nil":(L.tag==VAL_BOOL)?"boolean":
+        (L.tag==VAL_INT||L.tag==VAL_NUM)?"number":
+        (L.tag==VAL_STR)?"string":
+        (L.tag==VAL_TABLE)?"table":
+        (L.tag==VAL_FUNC||L.tag==VAL_CFUNC)?"function":"value";
+      const char *tR =
+        (R.tag==VAL_NIL)?"nil":(R.tag==VAL_BOOL)?"boolean":
+        (R.tag==VAL_INT||R.tag==VAL_NUM)?"number":
+        (R.tag==VAL_STR)?"string":
+        (R.tag==VAL_TABLE)?"table":
+        (R.tag==VAL_FUNC||R.tag==VAL_CFUNC)?"function":"value";
+      char buf[128];
+      snprintf(buf,sizeof(buf),"attempt to compare %s with %s", tL, tR);
+      vm_raise(vm, V_str_from_c(buf));
+      return V_bool(0);
+    }
+    case OP_GE: {
+      if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
+        return V_bool(as_num(L) >= as_num(R));
+      if (L.tag==VAL_STR && R.tag==VAL_STR){
+        int min = (L.as.s->len < R.as.s->len) ? L.as.s->len : R.as.s->len;
+        int cmp = memcmp(L.as.s->data, R.as.s->data, (size_t)min);
+        if (cmp > 0) return V_bool(1);
+        if (cmp < 0) return V_bool(0);
+        return V_bool(L.as.s->len >= R.as.s->len);
+      }
+      Value out; if (try_bin_mm(vm, "__lt", L, R, &out)) return V_bool(!as_truthy(out));
+      const char *tL =
+        (L.tag==VAL_NIL)?"nil":(L.tag==VAL_BOOL)?"boolean":
+        (L.tag==VAL_INT||L.tag==VAL_NUM)?"number":
+        (L.tag==VAL_STR)?"string":
+        (L.tag==VAL_TABLE)?"table":
+        (L.tag==VAL_FUNC||L.tag==VAL_CFUNC)?"function":"value";
+      const char *tR =
+        (R.tag==VAL_NIL)?"nil":(R.tag==VAL_BOOL)?"boolean":
+        (R.tag==VAL_INT||R.tag==VAL_NUM)?"number":
+        (R.tag==VAL_STR)?"string":
+        (R.tag==VAL_TABLE)?"table":
+        (R.tag==VAL_FUNC||R.tag==VAL_CFUNC)?"function":"value";
+      char buf[128];
+      snprintf(buf,sizeof(buf),"attempt to compare %s with %s", tL, tR);
+      vm_raise(vm, V_str_from_c(buf));
+      return V_bool(0);
+    }
+    default: return V_nil();
+  }
+}
+Value vm_unop(VM *vm, OpKind op, Value r){
+  switch(op){
+    case OP_NEG: return (r.tag==VAL_INT)?V_int(-r.as.i):V_num(-as_num(r));
+    case OP_NOT: return V_bool(!as_truthy(r));
+    case OP_LEN: {
+      {
+        Value out;
+        if (try_un_mm(vm, "__len", r, &out)) return out;
+      }
+      if (r.tag == VAL_STR) return V_int(r.as.s->len);
+      if (r.tag == VAL_TABLE) return op_len(r);
+      const char *tname =
+        (r.tag == VAL_NIL)                     ? "nil" :
+        (r.tag == VAL_BOOL)                    ? "boolean" :
+        (r.tag == VAL_INT || r.tag == VAL_NUM) ? "number" :
+        (r.tag == VAL_STR)                     ? "string" :
+        (r.tag == VAL_TABLE)                   ? "table" :
+        (r.tag == VAL_FUNC || r.tag == VAL_CFUNC) ? "function" :
+                                                   "value";
+      char buf[96];
+      snprintf(buf, sizeof(buf), "attempt to get length of a %s value", tname);
+      vm_raise(vm, V_str_from_c(buf));
+      return V_nil(); 
+    }
+    default: return V_nil();
+  }
+}
+Value vm_index(VM *vm, Value t, Value k){ return eval_index(vm, t, k); }
+void vm_setindex(VM *vm, Value t, Value k, Value v){ assign_index(vm, t, k, v); }
+/* literals are floats: integral values count as integers here */
+static bool for_integral(Value v, long long *out){
+  if (v.tag == VAL_INT) { *out = v.as.i; return true; }
+  if (v.tag == VAL_NUM && v.as.n == floor(v.as.n) &&
+      v.as.n >= -9223372036854775808.0 && v.as.n < 9223372036854775808.0) {
+    *out = (long long)v.as.n;
+    return true;
+  }
+  return false;
+}
+bool vm_forprep(VM *vm, Value start, Value limit, Value step, ForNum *f){
+  const char *bad = start.tag != VAL_INT && start.tag != VAL_NUM ? "'for' initial value must be a number"
+                  : limit.tag != VAL_INT && limit.tag != VAL_NUM ? "'for' limit must be a number"
+                  : step.tag != VAL_INT && step.tag != VAL_NUM ? "'for' step must be a number" : NULL;
+  if (bad) { vm_raise(vm, V_str_from_c(bad)); return false; }
+  if (as_num(step) == 0) { vm_raise(vm, V_str_from_c("'for' step is zero")); return false; }
+  f->isint = for_integral(start, &f->i) && for_integral(step, &f->step);
+  if (!f->isint) {
+    f->x = as_num(start); f->limit = as_num(limit); f->fstep = as_num(step);
+    return f->fstep > 0 ? f->x <= f->limit : f->x >= f->limit;
+  }
+  long long lim;
+  if (limit.tag == VAL_INT) lim = limit.as.i;
+  else {
+    double l = f->step > 0 ? floor(limit.as.n) : ceil(limit.as.n);
+    if (l != l) return false;   /* NaN */
+    if (l >= 9223372036854775808.0) { if (f->step < 0) return false; lim = LLONG_MAX; }
+    else if (l < -9223372036854775808.0) { if (f->step > 0) return false; lim = LLONG_MIN; }
+    else lim = (long long)l;
+  }
+  if (f->step > 0 ? f->i > lim : f->i < lim) return false;
+  unsigned long long span = f->step > 0 ? (unsigned long long)lim - (unsigned long long)f->i
+                                        : (unsigned long long)f->i - (unsigned long long)lim;
+  unsigned long long st = f->step > 0 ? (unsigned long long)f->step
+                                      : (unsigned long long)(-(f->step + 1)) + 1u;
+  f->count = span / st;
+  return true;
+}
+static inline bool is_dots(AST *n){
+  return n->kind == AST_IDENT && n->as.ident.name[0] == '.';
+}
+/* calls and `...` yield every value when last in a list, unless
+   parenthesized */
+static inline bool is_multi(AST *n){
+  return n && !n->paren && (n->kind == AST_CALL || is_dots(n));
+}
+/* Pushes the values of an expression in multi-value position; returns
+   how many. */
+static int eval_multi(VM *vm, AST *n){
+  if (n->paren) { vm_push(vm, eval_expr(vm, n)); return 1; }
+  if (n->kind == AST_CALL) return eval_call(vm, n);
+  if (is_dots(n)) return vm_push_varargs(vm, get_var(vm, n));
+  vm_push(vm, eval_expr(vm, n));
+  return 1;
+}
+/* Evaluates args onto the stack (the last one expanded) and calls; the
+   results replace the args. */
+/* Pushes a call's arguments, the last one expanded, and returns the
+   callee. A method call evaluates its receiver only once. */
+static Value push_args(VM *vm, AST *n){
+  AST *callee = n->as.call.callee;
+  size_t na = n->as.call.args.count;
+  size_t i = 0;
+  Value cal;
+  if (n->as.call.method) {
+    Value self = eval_expr(vm, callee->as.field.target);
+    cal = ic_index(vm, &callee->as.field.ic, self, callee->as.field.key);
+    vm_push(vm, self);
+    i = 1;
+  } else {
+    cal = eval_expr(vm, callee);
+  }
+  for (; i < na; i++) {
+    AST *arg = n->as.call.args.items[i];
+    if (i == na - 1) eval_multi(vm, arg);
+    else vm_push(vm, eval_expr(vm, arg));
+  }
+  return cal;
+}
+static int eval_call(VM *vm, AST *n){
+  int base = vm->top;
+  Value cal = push_args(vm, n);
+  int cnt = call_multi(vm, cal, vm->top - base, vm->stack + base);
+  memmove(vm->stack + base, vm->stack + vm->top - cnt, sizeof(Value) * (size_t)cnt);
+  vm->top = base + cnt;
+  return cnt;
+}
 static Value eval_expr(VM *vm, AST *n){
   vm->current_line=n->line;
   switch(n->kind){
     case AST_NIL:   return V_nil();
     case AST_BOOL:  return V_bool(n->as.bval.v);
     case AST_NUMBER:return V_num(n->as.nval.v);
-    case AST_STRING:return V_str_from_c(n->as.sval.s);
-    case AST_IDENT: {
-      Value v; if(env_get(vm->env, n->as.ident.name, &v)) return v;
-      return V_nil();
-    }
-    case AST_UNARY: {
-      Value r = eval_expr(vm, n->as.unary.expr);
-      switch(n->as.unary.op){
-        case OP_NEG: return (r.tag==VAL_INT)?V_int(-r.as.i):V_num(-as_num(r));
-        case OP_NOT: return V_bool(!as_truthy(r));
-        case OP_LEN: {
-          {
-            Value out;
-            if (try_un_mm(vm, "__len", r, &out)) return out;
-          }
-          if (r.tag == VAL_STR) return V_int(r.as.s->len);
-          if (r.tag == VAL_TABLE) return op_len(r);
-          const char *tname =
-            (r.tag == VAL_NIL)                     ? "nil" :
-            (r.tag == VAL_BOOL)                    ? "boolean" :
-            (r.tag == VAL_INT || r.tag == VAL_NUM) ? "number" :
-            (r.tag == VAL_STR)                     ? "string" :
-            (r.tag == VAL_TABLE)                   ? "table" :
-            (r.tag == VAL_FUNC || r.tag == VAL_CFUNC) ? "function" :
-                                                       "value";
-          char buf[96];
-          snprintf(buf, sizeof(buf), "attempt to get length of a %s value", tname);
-          vm_raise(vm, V_str_from_c(buf));
-          return V_nil(); 
-        }
-        default: return V_nil();
-      }
-    }
+    case AST_STRING:return (Value){.tag=VAL_STR,.as.s=n->as.sval.str};
+    case AST_IDENT:
+      if (is_dots(n)) return vm_vararg(vm, get_var(vm, n), 0);
+      return get_var(vm, n);
+    case AST_UNARY: return vm_unop(vm, n->as.unary.op, eval_expr(vm, n->as.unary.expr));
     case AST_BINARY: {
       if(n->as.binary.op==OP_AND){
         Value L = eval_expr(vm, n->as.binary.lhs);
@@ -401,224 +827,21 @@ static Value eval_expr(VM *vm, AST *n){
       }
       Value L = eval_expr(vm, n->as.binary.lhs);
       Value R = eval_expr(vm, n->as.binary.rhs);
-      switch(n->as.binary.op){
-        case OP_ADD: {
-          if (L.tag==VAL_INT && R.tag==VAL_INT) return V_int(L.as.i + R.as.i);
-          if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
-            return V_num(as_num(L) + as_num(R));
-          Value out; if (try_bin_mm(vm, "__add", L, R, &out)) return out;
-          vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
-          return V_nil();
-        }
-        case OP_SUB: {
-          if (L.tag==VAL_INT && R.tag==VAL_INT) return V_int(L.as.i - R.as.i);
-          if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
-            return V_num(as_num(L) - as_num(R));
-          Value out; if (try_bin_mm(vm, "__sub", L, R, &out)) return out;
-          vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
-          return V_nil();
-        }
-        case OP_MUL: {
-          if (L.tag==VAL_INT && R.tag==VAL_INT) return V_int(L.as.i * R.as.i);
-          if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
-            return V_num(as_num(L) * as_num(R));
-          Value out; if (try_bin_mm(vm, "__mul", L, R, &out)) return out;
-          vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
-          return V_nil();
-        }
-        case OP_DIV: {
-          if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
-            return V_num(as_num(L) / as_num(R));
-          Value out; if (try_bin_mm(vm, "__div", L, R, &out)) return out;
-          vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
-          return V_nil();
-        }
-                     case OP_IDIV: {
-  if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM)) {
-    double l = as_num(L);
-    double r = as_num(R);
-    if (r == 0.0) {
-      vm_raise(vm, V_str_from_c("integer division by zero"));
-      return V_nil();
-    }
-    return V_int((long long)floor(l / r));
-  }
-  Value out; 
-  if (try_bin_mm(vm, "__idiv", L, R, &out)) return out;
-  vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
-  return V_nil();
-}
-        case OP_MOD: {
-          if (L.tag==VAL_INT && R.tag==VAL_INT) return V_int(L.as.i % R.as.i);
-          if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
-            return V_num(fmod(as_num(L), as_num(R)));
-          Value out; if (try_bin_mm(vm, "__mod", L, R, &out)) return out;
-          vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
-          return V_nil();
-        }
-        case OP_POW: {
-          if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
-            return V_num(pow(as_num(L), as_num(R)));
-          Value out; if (try_bin_mm(vm, "__pow", L, R, &out)) return out;
-          vm_raise(vm, V_str_from_c("attempt to perform arithmetic on a non-number"));
-          return V_nil();
-        }
-        case OP_CONCAT: {
-          if ((L.tag==VAL_STR || L.tag==VAL_INT || L.tag==VAL_NUM) &&
-              (R.tag==VAL_STR || R.tag==VAL_INT || R.tag==VAL_NUM))
-            return op_concat(L, R);
-          Value out; if (try_bin_mm(vm, "__concat", L, R, &out)) return out;
-          vm_raise(vm, V_str_from_c("attempt to concatenate a non-string value"));
-          return V_nil();
-        }
-        case OP_EQ: {
-          int eq = value_equal(L, R);
-          Value fL = mm_of(L, "__eq"); Value fR = mm_of(R, "__eq");
-          if (fL.tag != VAL_NIL || fR.tag != VAL_NIL){
-            Value out;
-            if (try_bin_mm(vm, "__eq", L, R, &out)) return V_bool(as_truthy(out));
-          }
-          return V_bool(eq);
-        }
-        case OP_NE: {
-          Value fL = mm_of(L, "__eq"); Value fR = mm_of(R, "__eq");
-          if (fL.tag != VAL_NIL || fR.tag != VAL_NIL){
-            Value out;
-            if (try_bin_mm(vm, "__eq", L, R, &out)) return V_bool(!as_truthy(out));
-          }
-          return V_bool(!value_equal(L, R));
-        }
-        case OP_LT: {
-          if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
-            return V_bool(as_num(L) < as_num(R));
-          if (L.tag==VAL_STR && R.tag==VAL_STR){
-            int min = (L.as.s->len < R.as.s->len) ? L.as.s->len : R.as.s->len;
-            int cmp = memcmp(L.as.s->data, R.as.s->data, (size_t)min);
-            if (cmp < 0) return V_bool(1);
-            if (cmp > 0) return V_bool(0);
-            return V_bool(L.as.s->len < R.as.s->len);
-          }
-          Value out; if (try_bin_mm(vm, "__lt", L, R, &out)) return V_bool(as_truthy(out));
-          const char *tL =
-            (L.tag==VAL_NIL)?"nil":(L.tag==VAL_BOOL)?"boolean":
-            (L.tag==VAL_INT||L.tag==VAL_NUM)?"number":
-            (L.tag==VAL_STR)?"string":
-            (L.tag==VAL_TABLE)?"table":
-            (L.tag==VAL_FUNC||L.tag==VAL_CFUNC)?"function":"value";
-          const char *tR =
-            (R.tag==VAL_NIL)?"nil":(R.tag==VAL_BOOL)?"boolean":
-            (R.tag==VAL_INT||R.tag==VAL_NUM)?"number":
-            (R.tag==VAL_STR)?"string":
-            (R.tag==VAL_TABLE)?"table":
-            (R.tag==VAL_FUNC||R.tag==VAL_CFUNC)?"function":"value";
-          char buf[128];
-          snprintf(buf,sizeof(buf),"attempt to compare %s with %s", tL, tR);
-          vm_raise(vm, V_str_from_c(buf));
-          return V_bool(0);
-        }
-        case OP_LE: {
-          if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
-            return V_bool(as_num(L) <= as_num(R));
-          if (L.tag==VAL_STR && R.tag==VAL_STR){
-            int min = (L.as.s->len < R.as.s->len) ? L.as.s->len : R.as.s->len;
-            int cmp = memcmp(L.as.s->data, R.as.s->data, (size_t)min);
-            if (cmp < 0) return V_bool(1);
-            if (cmp > 0) return V_bool(0);
-            return V_bool(L.as.s->len <= R.as.s->len);
-          }
-          Value out;
-          if (try_bin_mm(vm, "__le", L, R, &out)) return V_bool(as_truthy(out));
-          Value out2;
-          if (try_bin_mm(vm, "__lt", R, L, &out2)) return V_bool(!as_truthy(out2));
-          const char *tL =
-            (L.tag==VAL_NIL)?"nil":(L.tag==VAL_BOOL)?"boolean":
-            (L.tag==VAL_INT||L.tag==VAL_NUM)?"number":
-            (L.tag==VAL_STR)?"string":
-            (L.tag==VAL_TABLE)?"table":
-            (L.tag==VAL_FUNC||L.tag==VAL_CFUNC)?"function":"value";
-          const char *tR =
-            (R.tag==VAL_NIL)?"nil":(R.tag==VAL_BOOL)?"boolean":
-            (R.tag==VAL_INT||R.tag==VAL_NUM)?"number":
-            (R.tag==VAL_STR)?"string":
-            (R.tag==VAL_TABLE)?"table":
-            (R.tag==VAL_FUNC||R.tag==VAL_CFUNC)?"function":"value";
-          char buf[128];
-          snprintf(buf,sizeof(buf),"attempt to compare %s with %s", tL, tR);
-          vm_raise(vm, V_str_from_c(buf));
-          return V_bool(0);
-        }
-        case OP_GT: {
-          if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
-            return V_bool(as_num(L) > as_num(R));
-          if (L.tag==VAL_STR && R.tag==VAL_STR){
-            int min = (L.as.s->len < R.as.s->len) ? L.as.s->len : R.as.s->len;
-            int cmp = memcmp(L.as.s->data, R.as.s->data, (size_t)min);
-            if (cmp > 0) return V_bool(1);
-            if (cmp < 0) return V_bool(0);
-            return V_bool(L.as.s->len > R.as.s->len);
-          }
-          Value out; if (try_bin_mm(vm, "__lt", R, L, &out)) return V_bool(as_truthy(out));
-          const char *tL =
-            (L.tag==VAL_NIL)?"nil":(L.tag==VAL_BOOL)?"boolean":
-            (L.tag==VAL_INT||L.tag==VAL_NUM)?"number":
-            (L.tag==VAL_STR)?"string":
-            (L.tag==VAL_TABLE)?"table":
-            (L.tag==VAL_FUNC||L.tag==VAL_CFUNC)?"function":"value";
-          const char *tR =
-            (R.tag==VAL_NIL)?"nil":(R.tag==VAL_BOOL)?"boolean":
-            (R.tag==VAL_INT||R.tag==VAL_NUM)?"number":
-            (R.tag==VAL_STR)?"string":
-            (R.tag==VAL_TABLE)?"table":
-            (R.tag==VAL_FUNC||R.tag==VAL_CFUNC)?"function":"value";
-          char buf[128];
-          snprintf(buf,sizeof(buf),"attempt to compare %s with %s", tL, tR);
-          vm_raise(vm, V_str_from_c(buf));
-          return V_bool(0);
-        }
-        case OP_GE: {
-          if ((L.tag==VAL_INT||L.tag==VAL_NUM) && (R.tag==VAL_INT||R.tag==VAL_NUM))
-            return V_bool(as_num(L) >= as_num(R));
-          if (L.tag==VAL_STR && R.tag==VAL_STR){
-            int min = (L.as.s->len < R.as.s->len) ? L.as.s->len : R.as.s->len;
-            int cmp = memcmp(L.as.s->data, R.as.s->data, (size_t)min);
-            if (cmp > 0) return V_bool(1);
-            if (cmp < 0) return V_bool(0);
-            return V_bool(L.as.s->len >= R.as.s->len);
-          }
-          Value out; if (try_bin_mm(vm, "__lt", L, R, &out)) return V_bool(!as_truthy(out));
-          const char *tL =
-            (L.tag==VAL_NIL)?"nil":(L.tag==VAL_BOOL)?"boolean":
-            (L.tag==VAL_INT||L.tag==VAL_NUM)?"number":
-            (L.tag==VAL_STR)?"string":
-            (L.tag==VAL_TABLE)?"table":
-            (L.tag==VAL_FUNC||L.tag==VAL_CFUNC)?"function":"value";
-          const char *tR =
-            (R.tag==VAL_NIL)?"nil":(R.tag==VAL_BOOL)?"boolean":
-            (R.tag==VAL_INT||R.tag==VAL_NUM)?"number":
-            (R.tag==VAL_STR)?"string":
-            (R.tag==VAL_TABLE)?"table":
-            (R.tag==VAL_FUNC||R.tag==VAL_CFUNC)?"function":"value";
-          char buf[128];
-          snprintf(buf,sizeof(buf),"attempt to compare %s with %s", tL, tR);
-          vm_raise(vm, V_str_from_c(buf));
-          return V_bool(0);
-        }
-        default: return V_nil();
-      }
+      return vm_binop(vm, n->as.binary.op, L, R);
     }
     case AST_TABLE: {
       Value t = V_table();
       int nexti = 1;
-      for(size_t i=0;i<n->as.table.values.count;i++){
+      size_t nv = n->as.table.values.count;
+      for(size_t i=0;i<nv;i++){
         AST *k = n->as.table.keys.items[i];
         AST *v = n->as.table.values.items[i];
-        if(!k && v && v->kind==AST_IDENT && v->as.ident.name && strcmp(v->as.ident.name,"...")==0){
-          Value dots;
-          if(env_get(vm->env, "...", &dots) && dots.tag==VAL_TABLE){
-            Value elem; int j=1;
-            while(tbl_get(dots.as.t, V_int((long long)j), &elem)){ tbl_set(t.as.t, V_int(nexti++), elem); j++; }
-            continue;
-          }
+        if(!k && i==nv-1 && is_multi(v)){
+          int base = vm->top;
+          int cnt = eval_multi(vm, v);
+          for(int j=0;j<cnt;j++) tbl_seti(t.as.t, nexti++, vm->stack[base + j]);
+          vm->top = base;
+          continue;
         }
         Value key = k? eval_expr(vm,k) : V_int((long long)nexti++);
         Value val = eval_expr(vm,v);
@@ -628,110 +851,70 @@ static Value eval_expr(VM *vm, AST *n){
     }
     case AST_INDEX: {
       Value t = eval_expr(vm, n->as.index.target);
-      Value k = eval_expr(vm, n->as.index.index);
+      AST *ix = n->as.index.index;
+      if (ix && ix->kind == AST_STRING) return ic_index(vm, &n->as.index.ic, t, ix->as.sval.str);
+      Value k = eval_expr(vm, ix);
       return eval_index(vm, t, k);
     }
     case AST_FIELD: {
       Value t = eval_expr(vm, n->as.field.target);
-      Value k = V_str_from_c(n->as.field.field);
-      return eval_index(vm, t, k);
+      return ic_index(vm, &n->as.field.ic, t, n->as.field.key);
     }
     case AST_FUNCTION: {
-      Func *fn = func_new(n->as.fn.params, n->as.fn.vararg, n->as.fn.body, vm->env);
+      Func *fn = func_new(n->as.fn.params, n->as.fn.vararg, n->as.fn.body, n->as.fn.slot_names,
+                          n->as.fn.heap_env, vm->env);
       Value v; v.tag=VAL_FUNC; v.as.fn=fn; return v;
     }
     case AST_CALL: {
-      Value cal = eval_expr(vm, n->as.call.callee);
-      int final_argc = 0;
-      for (int i = 0; i < (int)n->as.call.args.count; i++) {
-        AST *arg = n->as.call.args.items[i];
-        if (arg && arg->kind == AST_IDENT && arg->as.ident.name &&
-            strcmp(arg->as.ident.name, "...") == 0) {
-          Value dots;
-          if (env_get(vm->env, "...", &dots) && dots.tag == VAL_TABLE) {
-            int j = 1; Value tmp;
-            while (tbl_get(dots.as.t, V_int(j), &tmp)) { final_argc++; j++; }
-          }
-        } else {
-          final_argc++;
-        }
-      }
-      Value *argv = final_argc ? xmalloc(sizeof(Value) * final_argc) : NULL;
-      int ai = 0;
-      for (int i = 0; i < (int)n->as.call.args.count; i++) {
-        AST *arg = n->as.call.args.items[i];
-        if (arg && arg->kind == AST_IDENT && arg->as.ident.name &&
-            strcmp(arg->as.ident.name, "...") == 0) {
-          Value dots;
-          if (env_get(vm->env, "...", &dots) && dots.tag == VAL_TABLE) {
-            int j = 1; Value tmp;
-            while (tbl_get(dots.as.t, V_int(j), &tmp)) { argv[ai++] = tmp; j++; }
-          }
-        } else {
-          argv[ai++] = eval_expr(vm, arg);
-        }
-      }
-      Value ret = call_any(vm, cal, final_argc, argv);
-      if(argv) free(argv);
+      int base = vm->top;
+      int cnt = eval_call(vm, n);
+      Value ret = cnt ? vm->stack[base] : V_nil();
+      vm->top = base;
       return ret;
     }
     default: return V_nil();
   }
 }
-static void assign_loop_vars(VM *vm, AST *forin, Value a, Value b){
-  size_t nvars = forin->as.forin.names.count;
-  if (nvars >= 1) {
-    AST *id0 = forin->as.forin.names.items[0];
-    if (id0 && id0->kind==AST_IDENT) env_set(vm->env, id0->as.ident.name, a);
-  }
-  if (nvars >= 2) {
-    AST *id1 = forin->as.forin.names.items[1];
-    if (id1 && id1->kind==AST_IDENT) env_set(vm->env, id1->as.ident.name, b);
-  }
-  for (size_t i=2;i<nvars;i++){
-    AST *id = forin->as.forin.names.items[i];
-    if (id && id->kind==AST_IDENT) env_set(vm->env, id->as.ident.name, V_nil());
-  }
-}
-typedef struct LabelMap {
-  const char *name;
-  size_t index; 
-} LabelMap;
-static int find_label_index(LabelMap *labels, size_t lab_count, const char *nm){
-  for(size_t j=0;j<lab_count;j++){
-    if(strcmp(labels[j].name, nm)==0) return (int)labels[j].index;
+static int find_label_index(const BlockLabel *labels, const char *nm){
+  for(; labels && labels->name; labels++){
+    if(strcmp(labels->name, nm)==0) return (int)labels->index;
   }
   return -1;
 }
-static void exec_block(VM *vm, AST *blk){
+static void exec_block_ex(VM *vm, AST *blk, const Value *init, int ninit, AST *until, bool *until_res);
+static inline void exec_block(VM *vm, AST *blk){ exec_block_ex(vm, blk, NULL, 0, NULL, NULL); }
+/* for-in body: the loop variables are the first slots of the body env */
+static void exec_forin_body(VM *vm, AST *forin, Value a, Value b){
+  Value init[2] = { a, b };
+  size_t nvars = forin->as.forin.names.count;
+  exec_block_ex(vm, forin->as.forin.body, init, nvars < 2 ? (int)nvars : 2, NULL, NULL);
+}
+/* Runs a block in a fresh env laid out by the resolver (none if it
+   declares no locals). init seeds the first slots (loop variables);
+   until, if given, is evaluated inside the block's scope after a normal
+   completion (repeat-until). */
+static void exec_block_ex(VM *vm, AST *blk, const Value *init, int ninit, AST *until, bool *until_res){
   Env *saved = vm->env;
-  vm->env = env_push(saved);
+  int base = vm->top;
+  int nslots = blk->as.block.nslots;
+  StackEnv se;
+  bool own = nslots > 0;
+  bool onstack = own && !blk->as.block.heap_env;
+  if (onstack) vm->env = env_push_stack(vm, &se, saved, nslots, blk->as.block.slot_names);
+  else if (own) vm->env = env_push_slots(saved, nslots, blk->as.block.slot_names);
+  for(int i=0;i<ninit && i<nslots;i++) vm->env->vals[i] = init[i];
   ASTVec *S = &blk->as.block.stmts;
-  LabelMap *labels = NULL; size_t lab_count=0, lab_cap=0;
-  for(size_t i=0;i<S->count;i++){
-    AST *st = S->items[i];
-    if(st->kind==AST_LABEL){
-      if(lab_count==lab_cap){ lab_cap=lab_cap?lab_cap*2:8; labels=realloc(labels, lab_cap*sizeof(LabelMap)); }
-      labels[lab_count++] = (LabelMap){ .name = st->as.label.label, .index = i };
-    }
-  }
+  const BlockLabel *labels = blk->as.block.labels;
   size_t pc = 0;
   if (vm->pending_goto) {
-    int idx = find_label_index(labels, lab_count, vm->goto_label);
+    int idx = find_label_index(labels, vm->goto_label);
     if (idx >= 0) {
       pc = (size_t)idx + 1;
       vm->pending_goto = false;
     } else {
-      vm->env = saved;
-      if(labels) free(labels);
-      return;
+      goto leave;
     }
   }
-  if (vm->active_co && vm->co_point.blk == blk && vm->co_point.pc > 0) {
-    pc = vm->co_point.pc;
-    vm->co_point.blk = NULL;
-    vm->co_point.pc  = 0;
-  }
   for(; pc<S->count; ){
     AST *st = S->items[pc];
     if(vm->has_ret) break;
@@ -743,10 +926,8 @@ static void exec_block(VM *vm, AST *blk){
 case AST_GOTO: {
   vm->pending_goto = true;
   vm->goto_label   = st->as.go.label;
-  env_close_all(vm, vm->env, V_nil());
-  vm->env = saved;
-  if(labels) free(labels);
-  return;
+  if (own) env_close_all(vm, vm->env, V_nil());
+  goto leave;
 }
       case AST_STMT_EXPR:
         (void)eval_expr(vm, st->as.stmt_expr.expr);
@@ -756,20 +937,14 @@ case AST_GOTO: {
         Value rv = eval_expr(vm, st->as.assign.rhs);
         AST *lhs = st->as.assign.lhs_ident;
         if(lhs->kind==AST_IDENT){
-          Env *owner=NULL; int slot=-1;
-          if(env_find(vm->env, lhs->as.ident.name, &owner, &slot)){
-            owner->vals[slot]=rv;
-          } else {
-            env_add(env_root(vm->env), lhs->as.ident.name, rv, false);
-          }
+          set_var(vm, lhs, rv);
         } else if(lhs->kind==AST_INDEX){
           Value t = eval_expr(vm, lhs->as.index.target);
           Value k = eval_expr(vm, lhs->as.index.index);
           assign_index(vm, t, k, rv);
         } else if(lhs->kind==AST_FIELD){
           Value t = eval_expr(vm, lhs->as.field.target);
-          Value k = V_str_from_c(lhs->as.field.field);
-          assign_index(vm, t, k, rv);
+          ic_setindex(vm, &lhs->as.field.ic, t, lhs->as.field.key, rv);
         }
         pc++;
         break;
@@ -777,9 +952,9 @@ case AST_GOTO: {
       case AST_BLOCK:
         exec_block(vm, st);
         if (vm->pending_goto) {
-          int idx = find_label_index(labels, lab_count, vm->goto_label);
+          int idx = find_label_index(labels, vm->goto_label);
           if (idx >= 0) { pc = (size_t)idx + 1; vm->pending_goto=false; }
-          else { vm->env = saved; if(labels) free(labels); return; }
+          else goto leave;
         } else {
           pc++;
         }
@@ -799,29 +974,24 @@ case AST_GOTO: {
           if(!node) break;
         }
         if (vm->pending_goto) {
-          int idx = find_label_index(labels, lab_count, vm->goto_label);
+          int idx = find_label_index(labels, vm->goto_label);
           if (idx >= 0) { pc = (size_t)idx + 1; vm->pending_goto=false; }
-          else { vm->env = saved; if(labels) free(labels); return; }
+          else goto leave;
         } else {
           pc++;
         }
         break;
       }
       case AST_WHILE: {
-        long long iters = 0;
         while(as_truthy(eval_expr(vm, st->as.whiles.cond))){
-          if(++iters > LUA_PLUS_MAX_LOOP_ITERS){
-            fprintf(stderr,"[LuaX]: while loop exceeded %d iterations (possible infinite loop) at line %d\n",
-                    LUA_PLUS_MAX_LOOP_ITERS, st->line);
-            break;
-          }
+          vm_step(vm);
           vm->break_flag=false;
           exec_block(vm, st->as.whiles.body);
           if(vm->has_ret) break;
           if(vm->pending_goto){
-            int idx = find_label_index(labels, lab_count, vm->goto_label);
-            if (idx >= 0) { pc = (size_t)idx + 1; vm->pending_goto=false; break; }
-            else { vm->env = saved; if(labels) free(labels); return; }
+            int idx = find_label_index(labels, vm->goto_label);
+            if (idx >= 0) { pc = (size_t)idx; vm->pending_goto=false; break; }
+            else goto leave;
           }
           if(vm->break_flag){ vm->break_flag=false; break; }
         }
@@ -829,179 +999,111 @@ case AST_GOTO: {
         break;
       }
       case AST_REPEAT: {
-        long long iters = 0;
         for(;;){
-          if(++iters > LUA_PLUS_MAX_LOOP_ITERS){
-            fprintf(stderr,"[LuaX]: repeat-until loop exceeded %d iterations (possible infinite loop) at line %d\n",
-                    LUA_PLUS_MAX_LOOP_ITERS, st->line);
-            break;
-          }
+          vm_step(vm);
           vm->break_flag=false;
-          exec_block(vm, st->as.repeatstmt.body);
+          bool done=false;
+          exec_block_ex(vm, st->as.repeatstmt.body, NULL, 0, st->as.repeatstmt.cond, &done);
           if(vm->has_ret) break;
           if(vm->pending_goto){
-            int idx = find_label_index(labels, lab_count, vm->goto_label);
-            if (idx >= 0) { pc = (size_t)idx + 1; vm->pending_goto=false; break; }
-            else { vm->env = saved; if(labels) free(labels); return; }
+            int idx = find_label_index(labels, vm->goto_label);
+            if (idx >= 0) { pc = (size_t)idx; vm->pending_goto=false; break; }
+            else goto leave;
           }
           if(vm->break_flag){ vm->break_flag=false; break; }
-          if(as_truthy(eval_expr(vm, st->as.repeatstmt.cond))) break;
+          if(done) break;
         }
         pc++;
         break;
       }
       case AST_FOR_NUM: {
-        const char *vname = st->as.fornum.var;
-        long long start = as_int(eval_expr(vm, st->as.fornum.start));
-        long long end   = as_int(eval_expr(vm, st->as.fornum.end));
-        long long step  = st->as.fornum.step? as_int(eval_expr(vm, st->as.fornum.step)) : 1;
-        if(step==0){ fprintf(stderr,"[LuaX]: numeric for with step=0 at line %d; skipping loop\n", st->line); pc++; break; }
-        env_add(vm->env, vname, V_int(start), true);
-        long long iters=0;
-        if(step>0){
-          for(long long i=start; i<=end; i+=step){
-            if(++iters > LUA_PLUS_MAX_LOOP_ITERS){ fprintf(stderr,"[LuaX]: for loop exceeded %d iterations at line %d\n", LUA_PLUS_MAX_LOOP_ITERS, st->line); break; }
-            env_set(vm->env, vname, V_int(i));
-            vm->break_flag=false;
-            exec_block(vm, st->as.fornum.body);
-            if(vm->has_ret) break;
-            if(vm->pending_goto){
-              int idx = find_label_index(labels, lab_count, vm->goto_label);
-              if (idx >= 0) { pc = (size_t)idx + 1; vm->pending_goto=false; break; }
-              else { vm->env = saved; if(labels) free(labels); return; }
-            }
-            if(vm->break_flag){ vm->break_flag=false; break; }
-          }
-        } else {
-          for(long long i=start; i>=end; i+=step){
-            if(++iters > LUA_PLUS_MAX_LOOP_ITERS){ fprintf(stderr,"[LuaX]: for loop exceeded %d iterations at line %d\n", LUA_PLUS_MAX_LOOP_ITERS, st->line); break; }
-            env_set(vm->env, vname, V_int(i));
-            vm->break_flag=false;
-            exec_block(vm, st->as.fornum.body);
-            if(vm->has_ret) break;
-            if(vm->pending_goto){
-              int idx = find_label_index(labels, lab_count, vm->goto_label);
-              if (idx >= 0) { pc = (size_t)idx + 1; vm->pending_goto=false; break; }
-              else { vm->env = saved; if(labels) free(labels); return; }
-            }
-            if(vm->break_flag){ vm->break_flag=false; break; }
+        Value v0 = eval_expr(vm, st->as.fornum.start);
+        Value v1 = eval_expr(vm, st->as.fornum.end);
+        Value v2 = st->as.fornum.step ? eval_expr(vm, st->as.fornum.step) : V_int(1);
+        ForNum f;
+        if (!vm_forprep(vm, v0, v1, v2, &f)) { pc++; break; }
+        for (;;) {
+          vm_step(vm);
+          Value iv = vm_forvalue(&f);
+          vm->break_flag=false;
+          exec_block_ex(vm, st->as.fornum.body, &iv, 1, NULL, NULL);
+          if(vm->has_ret) break;
+          if(vm->pending_goto){
+            int idx = find_label_index(labels, vm->goto_label);
+            if (idx >= 0) { pc = (size_t)idx; vm->pending_goto=false; break; }
+            else goto leave;
           }
+          if(vm->break_flag){ vm->break_flag=false; break; }
+          if (!vm_fornext(&f)) break;
         }
-        pc++;
+        pc++;   /* past the loop, or past the label a goto left it for */
         break;
       }
       case AST_FOR_IN: {
         size_t nvars = st->as.forin.names.count;
-        for (size_t i = 0; i < nvars; i++) {
-          AST *id = st->as.forin.names.items[i];
-          const char *nm = (id && id->kind == AST_IDENT) ? id->as.ident.name : "";
-          env_add(vm->env, nm, V_nil(), true);
-        }
 
         size_t niters = st->as.forin.iters.count;
+        Value it0 = V_nil(), state = V_nil(), ctrl = V_nil();
+        if (niters == 1 && st->as.forin.iters.items[0]->kind == AST_CALL) {
+          /* `for ... in f()` takes up to three results of f */
+          int base = vm->top;
+          int cnt = eval_call(vm, st->as.forin.iters.items[0]);
+          if (cnt > 0) it0 = vm->stack[base];
+          if (cnt > 1) state = vm->stack[base + 1];
+          if (cnt > 2) ctrl = vm->stack[base + 2];
+          if (cnt > 1) niters = cnt > 3 ? 3 : (size_t)cnt;
+          vm->top = base;
+        } else {
+          it0 = eval_expr(vm, st->as.forin.iters.items[0]);
+          if (niters >= 2) state = eval_expr(vm, st->as.forin.iters.items[1]);
+          if (niters >= 3) ctrl  = eval_expr(vm, st->as.forin.iters.items[2]);
+        }
         if (niters == 1) {
-          Value it0 = eval_expr(vm, st->as.forin.iters.items[0]);
-
-          /* --- generic iterator triple {iterF, state, ctrl} --- */
-          if (it0.tag == VAL_TABLE) {
-            Value iterV, stateV, ctrlV;
-            int has1 = tbl_get(it0.as.t, V_int(1), &iterV);
-            int has2 = tbl_get(it0.as.t, V_int(2), &stateV);
-            int has3 = tbl_get(it0.as.t, V_int(3), &ctrlV);
-            if (has1 && has2 && has3 && is_callable(iterV)) {
-              long long iters_guard = 0;
-              Value iterF = iterV, state = stateV, ctrl = ctrlV;
-              for (;;) {
-                if (++iters_guard > LUA_PLUS_MAX_LOOP_ITERS) {
-                  fprintf(stderr, "[LuaX]: for-in (ipairs/generic) exceeded %d iterations at line %d\n",
-                          LUA_PLUS_MAX_LOOP_ITERS, st->line);
-                  break;
-                }
-                Value argv2[2]; int argc2 = 0;
-                argv2[argc2++] = state;
-                argv2[argc2++] = ctrl;
-                Value res = call_any(vm, iterF, argc2, argv2);
-                if (res.tag == VAL_NIL) break;
-                Value a = res, b = V_nil();
-                if (res.tag == VAL_TABLE) {
-                  Value tmp;
-                  if (tbl_get(res.as.t, V_int(1), &tmp)) a = tmp;
-                  if (tbl_get(res.as.t, V_int(2), &tmp)) b = tmp;
-                }
-                assign_loop_vars(vm, st, a, b);
-                ctrl = a;
-                vm->break_flag = false;
-                exec_block(vm, st->as.forin.body);
-                if (vm->has_ret) break;
-                if (vm->pending_goto) {
-                  int idx = find_label_index(labels, lab_count, vm->goto_label);
-                  if (idx >= 0) { pc = (size_t)idx + 1; vm->pending_goto = false; break; }
-                  else { vm->env = saved; if (labels) free(labels); return; }
-                }
-                if (vm->break_flag) { vm->break_flag = false; break; }
-              }
-              pc++; break;
-            }
-          }
 
           /* --- direct table iteration --- */
           if (it0.tag == VAL_TABLE) {
             Table *tt = it0.as.t;
-            long long iters_guard = 0;
             int stop = 0;
 
             Value tmp;
-            bool is_array_like = tbl_get(tt, V_int(1), &tmp);
+            bool is_array_like = tbl_geti(tt, 1, &tmp);
 
             if (is_array_like) {
               /* Ordered numeric iteration (array-like) */
               for (long long i = 1;; i++) {
-                if (++iters_guard > LUA_PLUS_MAX_LOOP_ITERS) {
-                  fprintf(stderr, "[LuaX]: for-in (array) exceeded %d iterations at line %d\n",
-                          LUA_PLUS_MAX_LOOP_ITERS, st->line);
-                  break;
-                }
+                vm_step(vm);
                 Value val;
-                if (!tbl_get(tt, V_int(i), &val)) break;
+                if (!tbl_geti(tt, i, &val)) break;
+                vm->break_flag = false;
                 if (nvars <= 1)
-                  assign_loop_vars(vm, st, val, V_nil());
+                  exec_forin_body(vm, st, val, V_nil());
                 else
-                  assign_loop_vars(vm, st, V_int(i), val);
-
-                vm->break_flag = false;
-                exec_block(vm, st->as.forin.body);
+                  exec_forin_body(vm, st, V_int(i), val);
                 if (vm->has_ret) { stop = 1; break; }
                 if (vm->pending_goto) {
-                  int idx = find_label_index(labels, lab_count, vm->goto_label);
-                  if (idx >= 0) { pc = (size_t)idx + 1; vm->pending_goto = false; stop = 1; break; }
-                  else { vm->env = saved; if (labels) free(labels); return; }
+                  int idx = find_label_index(labels, vm->goto_label);
+                  if (idx >= 0) { pc = (size_t)idx; vm->pending_goto = false; stop = 1; break; }
+                  else goto leave;
                 }
                 if (vm->break_flag) { vm->break_flag = false; stop = 1; break; }
               }
             } else {
               /* Unordered hash iteration */
-              for (int bi = 0; bi < tt->cap && !stop; ++bi) {
-                for (TableEntry *e = tt->buckets[bi]; e && !stop; e = e->next) {
-                  if (++iters_guard > LUA_PLUS_MAX_LOOP_ITERS) {
-                    fprintf(stderr, "[LuaX]: for-in (table) exceeded %d iterations at line %d\n",
-                            LUA_PLUS_MAX_LOOP_ITERS, st->line);
-                    break;
-                  }
-                  if (nvars <= 1)
-                    assign_loop_vars(vm, st, e->val, V_nil());
-                  else
-                    assign_loop_vars(vm, st, e->key, e->val);
-
-                  vm->break_flag = false;
-                  exec_block(vm, st->as.forin.body);
-                  if (vm->has_ret) { stop = 1; break; }
-                  if (vm->pending_goto) {
-                    int idx = find_label_index(labels, lab_count, vm->goto_label);
-                    if (idx >= 0) { pc = (size_t)idx + 1; vm->pending_goto = false; stop = 1; break; }
-                    else { vm->env = saved; if (labels) free(labels); return; }
-                  }
-                  if (vm->break_flag) { vm->break_flag = false; stop = 1; break; }
+              int it = 0; Value hk, hv;
+              while (!stop && tbl_next(tt, &it, &hk, &hv)) {
+                vm_step(vm);
+                vm->break_flag = false;
+                if (nvars <= 1)
+                  exec_forin_body(vm, st, hv, V_nil());
+                else
+                  exec_forin_body(vm, st, hk, hv);
+                if (vm->has_ret) { stop = 1; break; }
+                if (vm->pending_goto) {
+                  int idx = find_label_index(labels, vm->goto_label);
+                  if (idx >= 0) { pc = (size_t)idx; vm->pending_goto = false; stop = 1; break; }
+                  else goto leave;
                 }
+                if (vm->break_flag) { vm->break_flag = false; stop = 1; break; }
               }
             }
             pc++; break;
@@ -1009,29 +1111,17 @@ case AST_GOTO: {
 
           /* --- callable iterator function --- */
           if (is_callable(it0)) {
-            long long iters_guard = 0;
             for (;;) {
-              if (++iters_guard > LUA_PLUS_MAX_LOOP_ITERS) {
-                fprintf(stderr, "[LuaX]: for-in (iter) exceeded %d iterations at line %d\n",
-                        LUA_PLUS_MAX_LOOP_ITERS, st->line);
-                break;
-              }
-              Value res = call_any(vm, it0, 0, NULL);
-              if (res.tag == VAL_NIL) break;
-              Value a = res, b = V_nil();
-              if (res.tag == VAL_TABLE) {
-                Value tmp;
-                if (tbl_get(res.as.t, V_int(1), &tmp)) a = tmp;
-                if (tbl_get(res.as.t, V_int(2), &tmp)) b = tmp;
-              }
-              assign_loop_vars(vm, st, a, b);
+              vm_step(vm);
+              Value a, b;
+              if (!call_iter(vm, it0, 0, NULL, &a, &b)) break;
               vm->break_flag = false;
-              exec_block(vm, st->as.forin.body);
+              exec_forin_body(vm, st, a, b);
               if (vm->has_ret) break;
               if (vm->pending_goto) {
-                int idx = find_label_index(labels, lab_count, vm->goto_label);
-                if (idx >= 0) { pc = (size_t)idx + 1; vm->pending_goto = false; break; }
-                else { vm->env = saved; if (labels) free(labels); return; }
+                int idx = find_label_index(labels, vm->goto_label);
+                if (idx >= 0) { pc = (size_t)idx; vm->pending_goto = false; break; }
+                else goto leave;
               }
               if (vm->break_flag) { vm->break_flag = false; break; }
             }
@@ -1043,40 +1133,24 @@ case AST_GOTO: {
 
         /* --- generic multi-expression for-in --- */
         {
-          Value iter = eval_expr(vm, st->as.forin.iters.items[0]);
-          Value state = V_nil();
-          Value ctrl  = V_nil();
-          if (niters >= 2) state = eval_expr(vm, st->as.forin.iters.items[1]);
-          if (niters >= 3) ctrl  = eval_expr(vm, st->as.forin.iters.items[2]);
+          Value iter = it0;
           if (!is_callable(iter)) { pc++; break; }
 
-          long long iters_guard = 0;
           for (;;) {
-            if (++iters_guard > LUA_PLUS_MAX_LOOP_ITERS) {
-              fprintf(stderr, "[LuaX]: for-in (generic) exceeded %d iterations at line %d\n",
-                      LUA_PLUS_MAX_LOOP_ITERS, st->line);
-              break;
-            }
+            vm_step(vm);
             Value argv2[2]; int argc2 = 0;
-            if (niters >= 2) argv2[argc2++] = state;
-            if (niters >= 3) argv2[argc2++] = ctrl;
-            Value res = call_any(vm, iter, argc2, argv2);
-            if (res.tag == VAL_NIL) break;
-            Value a = res, b = V_nil();
-            if (res.tag == VAL_TABLE) {
-              Value tmp;
-              if (tbl_get(res.as.t, V_int(1), &tmp)) a = tmp;
-              if (tbl_get(res.as.t, V_int(2), &tmp)) b = tmp;
-            }
-            assign_loop_vars(vm, st, a, b);
+            /* iter(state, ctrl), ctrl starting nil when it was not given */
+            if (niters >= 2) { argv2[argc2++] = state; argv2[argc2++] = ctrl; }
+            Value a, b;
+            if (!call_iter(vm, iter, argc2, argv2, &a, &b)) break;
             ctrl = a;
             vm->break_flag = false;
-            exec_block(vm, st->as.forin.body);
+            exec_forin_body(vm, st, a, b);
             if (vm->has_ret) break;
             if (vm->pending_goto) {
-              int idx = find_label_index(labels, lab_count, vm->goto_label);
-              if (idx >= 0) { pc = (size_t)idx + 1; vm->pending_goto = false; break; }
-              else { vm->env = saved; if (labels) free(labels); return; }
+              int idx = find_label_index(labels, vm->goto_label);
+              if (idx >= 0) { pc = (size_t)idx; vm->pending_goto = false; break; }
+              else goto leave;
             }
             if (vm->break_flag) { vm->break_flag = false; break; }
           }
@@ -1086,120 +1160,85 @@ case AST_GOTO: {
       case AST_BREAK:
         vm->break_flag=true; pc++; break;
 case AST_RETURN: {
-  Value rv = V_nil();
-  if(st->as.ret.values.count == 0){
-    rv = V_nil();
-  } else if(st->as.ret.values.count == 1){
-    rv = eval_expr(vm, st->as.ret.values.items[0]);
-  } else {
-    rv = V_table();
-    for(size_t i = 0; i < st->as.ret.values.count; i++){
-      Value v = eval_expr(vm, st->as.ret.values.items[i]);
-      tbl_set(rv.as.t, V_int((long long)(i + 1)), v);
-    }
+  /* the values stay on the stack; call_function moves them into place */
+  int base = vm->top;
+  size_t nv = st->as.ret.values.count;
+  /* a tail call leaves the callee and its args instead: call_function
+     makes the call in place of this frame */
+  if(st->as.ret.tail && vm->frame){
+    AST *call = st->as.ret.values.items[0];
+    int fslot = vm->top;
+    vm_push(vm, V_nil());
+    Value cal = push_args(vm, call);
+    vm->stack[fslot] = cal;
+    vm->tailcall = true;
+    nv = 0;
+  }
+  for(size_t i = 0; i < nv; i++){
+    AST *e = st->as.ret.values.items[i];
+    if(i == nv - 1) eval_multi(vm, e);
+    else vm_push(vm, eval_expr(vm, e));
   }
+  vm->nret = vm->top - base;
+  Value rv = vm->nret ? vm->stack[base] : V_nil();
   vm->ret_val = rv; 
   vm->has_ret = true;
-  env_close_all(vm, vm->env, V_nil());
-  vm->env = saved;
-  if(labels) free(labels);
-  return;
+  if (own) env_close_all(vm, vm->env, V_nil());
+  goto leave;
 }
 case AST_ASSIGN_LIST: {
     size_t rn = st->as.massign.rvals.count;
-    Value *rv = rn? xmalloc(sizeof(Value)*rn):NULL;
-    bool *is_call = rn? xmalloc(sizeof(bool)*rn):NULL;
-    for(size_t i=0;i<rn;i++) {
-        AST *rhs = st->as.massign.rvals.items[i];
-        is_call[i] = (rhs && rhs->kind == AST_CALL);
-        rv[i]=eval_expr(vm, rhs);
-    }
-    Value *all_vals = rv;
-    size_t total_vals = rn;
-    bool expanded = false;
-    if(rn > 0 && st->as.massign.lvals.count > rn && is_call[rn-1]){
-        Value last = rv[rn-1];
-        if(last.tag == VAL_TABLE){
-            Value test;
-            if(tbl_get(last.as.t, V_int(1), &test) && test.tag != VAL_NIL){
-                size_t needed = st->as.massign.lvals.count;
-                all_vals = xmalloc(sizeof(Value) * needed);
-                expanded = true;
-                for(size_t i=0; i<rn-1; i++){
-                    all_vals[i] = rv[i];
-                }
-                size_t idx = rn-1;
-                for(long long j=1; idx < needed; j++){
-                    Value v;
-                    if(tbl_get(last.as.t, V_int(j), &v)){
-                        all_vals[idx++] = v;
-                    } else {
-                        all_vals[idx++] = V_nil();
-                    }
-                }
-                total_vals = needed;
+    size_t nl = st->as.massign.lvals.count;
+    int base = vm->top;
+    if(nl == 1 && rn == 1){
+        vm_push(vm, eval_expr(vm, st->as.massign.rvals.items[0]));
+    } else {
+        for(size_t i=0;i<rn;i++) {
+            AST *rhs = st->as.massign.rvals.items[i];
+            if(i == rn-1){
+                eval_multi(vm, rhs);
+            } else {
+                vm_push(vm, eval_expr(vm, rhs));
             }
         }
     }
-    for(size_t i=0;i<st->as.massign.lvals.count;i++){
+    size_t total_vals = (size_t)(vm->top - base);
+    for(size_t i=0;i<nl;i++){
         AST *lhs = st->as.massign.lvals.items[i];
-        Value val = (i<total_vals)?all_vals[i]:V_nil();
+        Value val = (i<total_vals)?vm->stack[base + i]:V_nil();
         if(lhs->kind==AST_IDENT){
-            Env *owner=NULL; int slot=-1;
-            if(env_find(vm->env, lhs->as.ident.name, &owner, &slot)){
-                owner->vals[slot]=val;
-            } else {
-                env_add(env_root(vm->env), lhs->as.ident.name, val, false);
-            }
+            set_var(vm, lhs, val);
         } else if(lhs->kind==AST_INDEX){
             Value t = eval_expr(vm, lhs->as.index.target);
             Value k = eval_expr(vm, lhs->as.index.index);
             assign_index(vm, t, k, val);
         } else if(lhs->kind==AST_FIELD){
             Value t = eval_expr(vm, lhs->as.field.target);
-            Value k = V_str_from_c(lhs->as.field.field);
-            assign_index(vm, t, k, val);
+            ic_setindex(vm, &lhs->as.field.ic, t, lhs->as.field.key, val);
         }
     }
-    if(expanded) free(all_vals);
-    if(rv) free(rv);
-    if(is_call) free(is_call);
+    vm->top = base;
     pc++;
     break;
 }
 case AST_VAR: {
   Value init = st->as.var.init? eval_expr(vm, st->as.var.init): V_nil();
-  env_add(vm->env, st->as.var.name, init, st->as.var.is_local);
-  if (st->as.var.is_close) {
-    Env *owner=NULL; int slot=-1;
-    if (env_find(vm->env, st->as.var.name, &owner, &slot) && owner == vm->env) {
-      env_register_close(owner, slot);
-    }
-  }
+  vm->env->vals[st->as.var.slot] = init;
+  gc_barrier(vm->env);
+  if (st->as.var.is_close) env_register_close(vm->env, st->as.var.slot);
   pc++;
   break;
 }
       case AST_FUNC_STMT: {
         AST *name = st->as.fnstmt.name;
-        Value fval; fval.tag = VAL_FUNC; fval.as.fn = NULL;
-        if(st->as.fnstmt.is_local && name->kind==AST_IDENT){
-          env_add(vm->env, name->as.ident.name, V_nil(), true);
-        } else if(name->kind==AST_IDENT){
-          Env *owner=NULL; int slot=-1;
-          if(!env_find(vm->env, name->as.ident.name, &owner, &slot)){
-            env_add(env_root(vm->env), name->as.ident.name, V_nil(), false);
-          }
-        }
-        Func *fn = func_new(st->as.fnstmt.params, st->as.fnstmt.vararg, st->as.fnstmt.body, vm->env);
-        fval.tag = VAL_FUNC; fval.as.fn = fn;
+        Func *fn = func_new(st->as.fnstmt.params, st->as.fnstmt.vararg, st->as.fnstmt.body,
+                            st->as.fnstmt.slot_names, st->as.fnstmt.heap_env, vm->env);
+        Value fval; fval.tag = VAL_FUNC; fval.as.fn = fn;
         if(name->kind==AST_IDENT){
-          Env *owner=NULL; int slot=-1;
-          if(env_find(vm->env, name->as.ident.name, &owner, &slot)) owner->vals[slot]=fval;
-          else env_add(env_root(vm->env), name->as.ident.name, fval, false);
+          set_var(vm, name, fval);
         } else if(name->kind==AST_FIELD){
           Value t = eval_expr(vm, name->as.field.target);
-          Value k = V_str_from_c(name->as.field.field);
-          assign_index(vm, t, k, fval);
+          ic_setindex(vm, &name->as.field.ic, t, name->as.field.key, fval);
         } else if(name->kind==AST_INDEX){
           Value t = eval_expr(vm, name->as.index.target);
           Value k = eval_expr(vm, name->as.index.index);
@@ -1212,26 +1251,23 @@ case AST_VAR: {
         pc++;
         break;
     }
-    if (vm->co_yielding) {
-      vm->co_point.blk = blk;
-      vm->co_point.pc  = pc;  
-      vm->env = saved;
-      if(labels) free(labels);
-      return;
-    }
   }
-  env_close_all(vm, vm->env, V_nil());      
+  if (until && !vm->has_ret && !vm->break_flag && !vm->pending_goto)
+    *until_res = as_truthy(eval_expr(vm, until));
+  if (own) env_close_all(vm, vm->env, V_nil());
+leave:
+  if (onstack) {
+    /* drop the block's slots, keeping a pending return's values on top */
+    int n = vm->has_ret ? vm->nret : 0;
+    memmove(vm->stack + base, vm->stack + vm->top - n, sizeof(Value) * (size_t)n);
+    vm->top = base + n;
+  }
   vm->env = saved;
-  if(labels) free(labels);
 }
+/* chunks and function bodies: always blocks */
 static void exec_stmt(VM *vm, AST *n){
   vm->current_line = n->line;
-  if(n->kind==AST_BLOCK){ exec_block(vm,n); return; }
-  AST fake; memset(&fake,0,sizeof(fake));
-  fake.kind=AST_BLOCK;
-  ASTVec v={0}; v.count=1; v.cap=1; v.items=&n;
-  fake.as.block.stmts=v;
-  exec_block(vm,&fake);
+  exec_block(vm, n);
 }
 static Value ensure_package(VM *vm){
   Value pkg;
@@ -1452,8 +1488,8 @@ static Value builtin_file_searcher(VM *vm, int argc, Value *argv) {
     }
     
     // Create a loader function that will compile and run the file
-    AST *program = compile_chunk_from_FILE(f);
     fclose(f);
+    AST *program = compile_module(used_path);
     
     if (!program) {
         if (used_path) free(used_path);
@@ -1461,12 +1497,8 @@ static Value builtin_file_searcher(VM *vm, int argc, Value *argv) {
     }
     
     // Create a function that wraps this module
-    Func *fn = xmalloc(sizeof(*fn));
-    memset(fn, 0, sizeof(*fn));
-    fn->params = (ASTVec){0};
-    fn->vararg = false;
-    fn->body = program;
-    fn->env = vm->env;
+    Func *fn = make_chunk_func(vm, program);
+    ast_free(program);
     
     Value loader;
     loader.tag = VAL_FUNC;
@@ -1640,12 +1672,9 @@ static const char *default_package_cpath(void) {
 int interpret(AST *root){
   VM vm; 
   memset(&vm, 0, sizeof(vm));
+  vm_stack_init(&vm);
+  gc_attach(&vm);
   vm.env = env_push(NULL);
-  vm.co_yielding   = false;
-  vm.co_yield_vals = V_table();
-  vm.co_point.blk  = NULL;
-  vm.co_point.pc   = 0;
-  vm.co_call_env   = NULL;
   vm.active_co     = NULL;
   vm.err_frame = NULL;
   vm.err_obj   = V_nil();
@@ -1715,42 +1744,36 @@ int interpret(AST *root){
   }
   
   register_libs(&vm);
-  exec_stmt(&vm, root);
-  
+  resolve_chunk(root);
+  Func *main_fn = bc_engine ? make_chunk_func(&vm, root) : NULL;
+  if (main_fn && main_fn->proto) bc_call(&vm, main_fn, 0, NULL);
+  else exec_stmt(&vm, root);
+  gc_detach(&vm);
   return 0;
 }
 
 // Keep your existing exec_stmt_repl and vm_load_and_run_file functions
 void exec_stmt_repl(VM *vm, AST *n) {
-    exec_stmt(vm, n);
+    resolve_chunk(n);
+    int base = vm->top;
+    Func *fn = bc_engine ? make_chunk_func(vm, n) : NULL;
+    if (fn && fn->proto) bc_call(vm, fn, 0, NULL);
+    else exec_stmt(vm, n);
+    vm->top = base;   /* drop what a top-level return left */
 }
 
 Value vm_load_and_run_file(VM *vm, const char *path, const char *modname) {
     (void)modname; 
-    size_t n = 0;
-    char *src = read_entire_file(path, &n);
-    if (!src) {
+    AST *program = compile_module(path);
+    if (!program) {
         char err_buf[512];
         snprintf(err_buf, sizeof(err_buf), "cannot open file '%s'", path);
         return V_str_from_c(err_buf);
     }
     
-    FILE *fp = open_string_as_FILE(src);
-    free(src);
-    if (!fp) {
-        return V_str_from_c("failed to create string FILE");
-    }
-    
-    AST *program = compile_chunk_from_FILE(fp);
-    fclose(fp);
-    
-    Func *fn = xmalloc(sizeof(*fn));
-    memset(fn, 0, sizeof(*fn));
-    fn->params = (ASTVec){0};
-    fn->vararg = false;
-    fn->body = program;
-    fn->env = vm->env;
+    Func *fn = make_chunk_func(vm, program);
+    ast_free(program);
     
-    Value result = call_function(vm, fn, 0, NULL);
+    Value result = call_any(vm, (Value){.tag=VAL_FUNC,.as.fn=fn}, 0, NULL);
     return (result.tag == VAL_NIL) ? V_bool(true) : result;
 }
@@ -1,448 +1,357 @@
+// lexer.c — buffer scanner (see include/lexer.h)
 #include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "../include/lexer.h"
 
+#define OOM() do { fprintf(stderr, "out of memory\n"); exit(1); } while (0)
 
-// Peek the next character without consuming it
-static int peek(FILE *fp) {
-    int c = fgetc(fp);
-    if (c != EOF) ungetc(c, fp);
-    return c;
+/* ===== keywords: perfect hash over (first, last, length) ===== */
+typedef struct { const char *word; size_t len; TokenType token; } Keyword;
+
+#define KW_HASH(s, n) (((unsigned char)(s)[0] * 3u + (unsigned char)(s)[(n) - 1] * 13u + (unsigned)(n)) & 63u)
+
+static const Keyword keywords[64] = {
+    [ 0] = { "repeat",   6, TOK_KW_REPEAT },
+    [ 1] = { "true",     4, TOK_KW_TRUE },
+    [ 5] = { "local",    5, TOK_KW_LOCAL },
+    [ 6] = { "end",      3, TOK_KW_END },
+    [ 9] = { "nil",      3, TOK_KW_NIL },
+    [11] = { "while",    5, TOK_KW_WHILE },
+    [16] = { "function", 8, TOK_KW_FUNCTION },
+    [17] = { "do",       2, TOK_KW_DO },
+    [19] = { "in",       2, TOK_KW_IN },
+    [20] = { "else",     4, TOK_KW_ELSE },
+    [24] = { "false",    5, TOK_KW_FALSE },
+    [25] = { "or",       2, TOK_KW_OR },
+    [26] = { "break",    5, TOK_KW_BREAK },
+    [28] = { "goto",     4, TOK_KW_GOTO },
+    [32] = { "until",    5, TOK_KW_UNTIL },
+    [35] = { "elseif",   6, TOK_KW_ELSEIF },
+    [43] = { "if",       2, TOK_KW_IF },
+    [49] = { "not",      3, TOK_KW_NOT },
+    [50] = { "return",   6, TOK_KW_RETURN },
+    [54] = { "then",     4, TOK_KW_THEN },
+    [58] = { "and",      3, TOK_KW_AND },
+    [63] = { "for",      3, TOK_KW_FOR },
+};
+
+static const Keyword *lookup_keyword(const char *s, size_t n) {
+    if (n < 2 || n > 8) return NULL;
+    const Keyword *k = &keywords[KW_HASH(s, n)];
+    return k->len == n && memcmp(k->word, s, n) == 0 ? k : NULL;
 }
-static TokenType lookup_keyword(const char *word) {
-    for (int i = 0; keywords[i].word; i++) {
-        if (strcmp(word, keywords[i].word) == 0) {
-            return keywords[i].token;
-        }
+
+/* ===== lexeme arena and intern table ===== */
+struct LexChunk { LexChunk *next; size_t used, cap; char data[]; };
+
+/* Each entry is a uint32_t length, the bytes and a NUL. */
+#define ENTRY_LEN(s) (((const uint32_t *)(const void *)(s))[-1])
+#define ENTRY_LEN_SET(s, n) (((uint32_t *)(void *)(s))[-1] = (n))
+
+static char *arena_alloc(Lexer *lx, size_t n) {
+    n = (n + 3) & ~(size_t)3;
+    LexChunk *c = lx->chunks;
+    if (!c || c->cap - c->used < n) {
+        size_t cap = n > 8192 ? n : 8192;
+        c = (LexChunk *)malloc(sizeof(LexChunk) + cap);
+        if (!c) OOM();
+        c->next = lx->chunks; c->used = 0; c->cap = cap;
+        lx->chunks = c;
     }
-    return TOK_ID;
+    char *p = c->data + c->used;
+    c->used += n;
+    return p;
 }
 
-/* ===== helpers for dynamic buffer ===== */
-#define OOM() do { fprintf(stderr, "out of memory\n"); exit(1); } while (0)
-#define GBUF_INIT() \
-    size_t cap = 32, n = 0; \
-    char *buf = (char*)malloc(cap); \
-    if (!buf) OOM();
-#define GBUF_PUSH(CH) do { \
-    if (n >= cap - 1) { \
-        cap *= 2; \
-        char *tmp = (char*)realloc(buf, cap); \
-        if (!tmp) { free(buf); OOM(); } \
-        buf = tmp; \
-    } \
-    buf[n++] = (char)(CH); \
-} while (0)
-
-/* ===== token construction ===== */
-#define MAKE_TOK(TTYPE, BUF, N) do { \
-    Token _t; \
-    _t.type = (TTYPE); \
-    _t.len  = (N); \
-    _t.line = token_line; \
-    _t.lexeme = NULL; \
-    if ((BUF) && (N)) { \
-        _t.lexeme = (char *)malloc((N) + 1); \
-        if (!_t.lexeme) OOM(); \
-        memcpy(_t.lexeme, (BUF), (N)); \
-        _t.lexeme[(N)] = '\0'; \
-    } \
-    return _t; \
-} while (0)
-
-/* ===== long bracket utilities (Lua style) ===== */
-static int read_long_open(FILE *fp, int *eq) {
-    int c;
-    long pos = ftell(fp);
-    int equals = 0;
-    while ((c = fgetc(fp)) == '=') equals++;
-    if (c == '[') { *eq = equals; return 1; }
-    if (c != EOF) fseek(fp, pos, SEEK_SET);
-    return 0;
+static uint32_t hash_bytes(const char *s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) { h ^= (unsigned char)s[i]; h *= 16777619u; }
+    return h;
 }
 
-static int matches_long_close(FILE *fp, int eq) {
-    long pos = ftell(fp);
-    int c, k = 0;
-    while (k < eq) {
-        c = fgetc(fp);
-        if (c != '=') { fseek(fp, pos, SEEK_SET); return 0; }
-        k++;
+static void intern_grow(Lexer *lx) {
+    size_t n = lx->nslots ? lx->nslots * 2 : 256;
+    const char **slots = (const char **)calloc(n, sizeof(*slots));
+    if (!slots) OOM();
+    for (size_t i = 0; i < lx->nslots; i++) {
+        const char *s = lx->slots[i];
+        if (!s) continue;
+        size_t j = hash_bytes(s, ENTRY_LEN(s)) & (n - 1);
+        while (slots[j]) j = (j + 1) & (n - 1);
+        slots[j] = s;
     }
-    c = fgetc(fp);
-    if (c == ']') return 1;
-    fseek(fp, pos, SEEK_SET);
-    return 0;
+    free(lx->slots);
+    lx->slots = slots;
+    lx->nslots = n;
 }
 
-static void skip_long_comment(FILE *fp, int eq) {
-    int c;
-    while ((c = fgetc(fp)) != EOF) {
-        if (c == '\n') { line_no++; continue; }
-        if (c == ']' && matches_long_close(fp, eq)) return;
-    }
+static const char *intern(Lexer *lx, const char *s, size_t n) {
+    if (2 * (lx->nused + 1) > lx->nslots) intern_grow(lx);
+    size_t j = hash_bytes(s, n) & (lx->nslots - 1);
+    for (const char *e; (e = lx->slots[j]); j = (j + 1) & (lx->nslots - 1))
+        if (ENTRY_LEN(e) == n && memcmp(e, s, n) == 0) return e;
+    char *e = arena_alloc(lx, sizeof(uint32_t) + n + 1) + sizeof(uint32_t);
+    ENTRY_LEN_SET(e, (uint32_t)n);
+    memcpy(e, s, n);
+    e[n] = '\0';
+    lx->slots[j] = e;
+    lx->nused++;
+    return e;
 }
 
-/* return string in out_buf/out_len; set *closed=1 if found matching ]=...=], else 0 */
-static void read_long_string(FILE *fp, int eq, char **out_buf, size_t *out_len, int *closed) {
-    GBUF_INIT();
-    int c;
-    *closed = 0;
-
-    /* Skip optional first newline as in Lua */
-    long pos_after_open = ftell(fp);
-    c = fgetc(fp);
-    if (c != '\n' && c != '\r') {
-        if (c != EOF) fseek(fp, pos_after_open, SEEK_SET);
-    } else {
-        if (c == '\r') {
-            int d = fgetc(fp);
-            if (d != '\n' && d != EOF) ungetc(d, fp);
-        }
-        line_no++;
-    }
-
-    while ((c = fgetc(fp)) != EOF) {
-        if (c == '\n') { GBUF_PUSH('\n'); line_no++; continue; }
-        if (c == ']' && matches_long_close(fp, eq)) { *closed = 1; break; }
-        GBUF_PUSH(c);
+/* scratch buffer for literals that are rewritten while scanned */
+static void buf_push(Lexer *lx, size_t *n, int ch) {
+    if (*n + 1 >= lx->bufcap) {
+        lx->bufcap = lx->bufcap ? lx->bufcap * 2 : 64;
+        lx->buf = (char *)realloc(lx->buf, lx->bufcap);
+        if (!lx->buf) OOM();
     }
+    lx->buf[(*n)++] = (char)ch;
+}
 
-    buf[n] = '\0';
-    *out_buf = buf;
-    *out_len = n;
+void lexer_init(Lexer *lx, const char *src, size_t len) {
+    memset(lx, 0, sizeof(*lx));
+    lx->p = src;
+    lx->end = src + len;
+    lx->line = 1;
 }
 
-/* ===== main lexer ===== */
-Token next(FILE *fp) {
-    int c;
+void lexer_free(Lexer *lx) {
+    for (LexChunk *c = lx->chunks, *nx; c; c = nx) { nx = c->next; free(c); }
+    free(lx->slots);
+    free(lx->buf);
+    memset(lx, 0, sizeof(*lx));
+}
 
-    #define IS_IDENT_START(ch) (isalpha((unsigned char)(ch)) || (ch) == '_')
-    #define IS_IDENT_CHAR(ch)  (isalnum((unsigned char)(ch)) || (ch) == '_')
+/* ===== scanning ===== */
+#define PEEK(k) (lx->p + (k) < lx->end ? (unsigned char)lx->p[k] : EOF)
 
-    /* Skip whitespace and comments */
-    for (;;) {
-        c = fgetc(fp);
-        if (c == '\n') { line_no++; continue; }
-        if (c == EOF) { Token eof = {TOK_EOF, NULL, 0, line_no}; return eof; }
+static Token make(TokenType type, const char *lexeme, size_t len, int line) {
+    Token t = { type, lexeme, len, (size_t)line };
+    return t;
+}
 
-        if (isspace(c)) continue;
+/* At '[' (already consumed): a long bracket opener [=*[ ; leaves p after it. */
+static int long_open(Lexer *lx, int *eq) {
+    size_t k = 0;
+    while (PEEK(k) == '=') k++;
+    if (PEEK(k) != '[') return 0;
+    *eq = (int)k;
+    lx->p += k + 1;
+    return 1;
+}
 
-        /* Comments */
-        if (c == '-') {
-            int d = fgetc(fp);
-            if (d == '-') {
-                int e = fgetc(fp);
-                if (e == '[') {
-                    int eq;
-                    if (read_long_open(fp, &eq)) { skip_long_comment(fp, eq); continue; }
-                    else { if (e != EOF) ungetc(e, fp); }
-                } else {
-                    if (e != EOF) ungetc(e, fp);
-                }
-                while ((c = fgetc(fp)) != EOF && c != '\n') { /* skip */ }
-                if (c == '\n') line_no++;
-                continue;
-            } else {
-                if (d != EOF) ungetc(d, fp);
-                break;
-            }
+/* Scans to the matching ]=*] ; with keep, copies the body to lx->buf. */
+static int long_body(Lexer *lx, int eq, int keep, size_t *out_n) {
+    size_t n = 0;
+    while (lx->p < lx->end) {
+        int c = (unsigned char)*lx->p++;
+        if (c == ']') {
+            int k = 0;
+            while (k < eq && PEEK(k) == '=') k++;
+            if (k == eq && PEEK(k) == ']') { lx->p += k + 1; *out_n = n; return 1; }
         }
-        break;
+        if (c == '\n') lx->line++;
+        if (keep) buf_push(lx, &n, c);
     }
+    *out_n = n;
+    return 0;
+}
 
-    int token_line = line_no;
-
-    /* Single/compound tokens */
-    switch (c) {
-        case '(': MAKE_TOK(TOK_LPAREN, "(", 1);
-        case ')': MAKE_TOK(TOK_RPAREN, ")", 1);
-        case '{': MAKE_TOK(TOK_LBRACE,"{", 1);
-        case '}': MAKE_TOK(TOK_RBRACE, "}", 1);
-
-        case '[': {
-            int eq;
-            if (read_long_open(fp, &eq)) {
-                char *s; size_t n; int closed;
-                read_long_string(fp, eq, &s, &n, &closed);
-                if (!closed) {
-                    static const char *msg = "unterminated long string literal";
-                    MAKE_TOK(TOK_ERROR, msg, strlen(msg));
-                }
-                MAKE_TOK(TOK_STR, s, n);
-            }
-            MAKE_TOK(TOK_LBRACK, "[", 1);
-        }
-
-        case ']': MAKE_TOK(TOK_RBRACK, "]", 1);
-        case ',': MAKE_TOK(TOK_COMMA,  ",", 1);
-        case ':': MAKE_TOK(TOK_COLON,  ":", 1);
-        case ';': MAKE_TOK(TOK_SEMICOLON, ";", 1);
-        case '+': MAKE_TOK(TOK_PLUS,   "+", 1);
-        case '*': MAKE_TOK(TOK_STAR,   "*", 1);
-case '/': {
-    int d = peek(fp);
-    if (d == '/') {
-        fgetc(fp); // consume the second '/'
-        MAKE_TOK(TOK_IDIV, "//", 2);  // This returns the token
-    } else {
-        MAKE_TOK(TOK_SLASH, "/", 1);  // This returns the token
+static Token long_string(Lexer *lx, int eq, int line) {
+    /* a newline right after the opener is skipped, as in Lua */
+    if (PEEK(0) == '\r') { lx->p++; if (PEEK(0) == '\n') lx->p++; lx->line++; }
+    else if (PEEK(0) == '\n') { lx->p++; lx->line++; }
+    size_t n;
+    if (!long_body(lx, eq, 1, &n)) {
+        static const char msg[] = "unterminated long string literal";
+        return make(TOK_ERROR, msg, sizeof(msg) - 1, line);
     }
+    return make(TOK_STR, intern(lx, lx->buf ? lx->buf : "", n), n, line);
 }
-        case '%': MAKE_TOK(TOK_MOD,    "%", 1);
-        case '#': MAKE_TOK(TOK_LEN,    "#", 1);
-        case '^': MAKE_TOK(TOK_POW,    "^", 1);
-        case '-': MAKE_TOK(TOK_MINUS,  "-", 1);
-
-        case '=': {
-            int d = fgetc(fp);
-            if (d == '=') { MAKE_TOK(TOK_EQ, "==", 2); }
-            if (d != EOF) ungetc(d, fp);
-            MAKE_TOK(TOK_ASSIGN, "=", 1);
-        }
-
-        case '~': {
-            int d = fgetc(fp);
-            if (d == '=') { MAKE_TOK(TOK_NE, "~=", 2); }
-            if (d != EOF) ungetc(d, fp);
-            char tmp[2] = {(char)c, '\0'};
-            MAKE_TOK(TOK_UNKNOWN, tmp, 1);
-        }
 
-        case '<': {
-            int d = fgetc(fp);
-            if (d == '=') { MAKE_TOK(TOK_LE, "<=", 2); }
-            if (d != EOF) ungetc(d, fp);
-            MAKE_TOK(TOK_LT, "<", 1);
+static Token quoted_string(Lexer *lx, int quote, int line) {
+    static const char unterminated[] = "unterminated string literal";
+    size_t n = 0;
+    while (lx->p < lx->end) {
+        int ch = (unsigned char)*lx->p++;
+        if (ch == quote) return make(TOK_STR, intern(lx, lx->buf ? lx->buf : "", n), n, line);
+        if (ch == '\n') {   /* a raw newline ends a short string: error */
+            lx->line++;
+            return make(TOK_ERROR, unterminated, sizeof(unterminated) - 1, line);
         }
-
-        case '>': {
-            int d = fgetc(fp);
-            if (d == '=') { MAKE_TOK(TOK_GE, ">=", 2); }
-            if (d != EOF) ungetc(d, fp);
-            MAKE_TOK(TOK_GT, ">", 1);
-        }
-
-        case '.': {
-            int d = fgetc(fp);
-            if (d == '.') {
-                int d2 = fgetc(fp);
-                if (d2 == '.') { MAKE_TOK(TOK_VARARG, "...", 3); }
-                if (d2 != EOF) { ungetc(d2, fp); }
-                MAKE_TOK(TOK_CONCAT, "..", 2);
-            } else if (isdigit(d)) {
-                /* .123 -> normalize to 0.xxx */
-                GBUF_INIT();
-                GBUF_PUSH('0');
-                GBUF_PUSH('.');
-                GBUF_PUSH(d);
-                int ch;
-                while ((ch = fgetc(fp)) != EOF && isdigit(ch)) GBUF_PUSH(ch);
-                if (ch == 'e' || ch == 'E') {
-                    GBUF_PUSH(ch);
-                    int s = fgetc(fp);
-                    if (s == '+' || s == '-') { GBUF_PUSH(s); s = fgetc(fp); }
-                    if (isdigit(s)) {
-                        GBUF_PUSH(s);
-                        while ((ch = fgetc(fp)) != EOF && isdigit(ch)) GBUF_PUSH(ch);
-                    }
-                }
-                /* optional 'f' suffix: consume it if present */
-                if (ch == 'f' || ch == 'F') { /* eat it */ }
-                else if (ch != 0 && ch != EOF) ungetc(ch, fp);
-                MAKE_TOK(TOK_NUMBER, buf, n);
-            } else {
-                if (d != EOF) ungetc(d, fp);
-                MAKE_TOK(TOK_DOT, ".", 1);
-            }
-        }
-
-        case '"':
-        case '\'': {
-            int quote = c;
-            GBUF_INIT();
-            int ch, escaped = 0;
-            int closed = 0;
-            while ((ch = fgetc(fp)) != EOF) {
-                /* raw newline inside a short-quoted string is an error in Lua */
-                if (!escaped && ch == '\n') {
-                    line_no++;
-                    static const char *msg = "unterminated string literal";
-                    MAKE_TOK(TOK_ERROR, msg, strlen(msg));
+        if (ch != '\\') { buf_push(lx, &n, ch); continue; }
+        if (lx->p >= lx->end) break;
+        ch = (unsigned char)*lx->p++;
+        switch (ch) {
+            case 'n': ch = '\n'; break;
+            case 't': ch = '\t'; break;
+            case 'r': ch = '\r'; break;
+            case 'b': ch = '\b'; break;
+            case 'f': ch = '\f'; break;
+            case 'a': ch = '\a'; break;
+            case 'v': ch = '\v'; break;
+            case '"': case '\'': case '\\': break;
+            case '0': ch = '\0'; break;
+            case 'x':
+                if (isxdigit(PEEK(0)) && isxdigit(PEEK(1))) {
+                    char hex[3] = { lx->p[0], lx->p[1], '\0' };
+                    ch = (int)strtol(hex, NULL, 16);
+                    lx->p += 2;
+                } else {
+                    buf_push(lx, &n, '\\');
                 }
-
-                if (!escaped && ch == quote) { closed = 1; break; }
-                if (!escaped && ch == '\\') { escaped = 1; continue; }
-
-                if (escaped) {
-                    switch (ch) {
-                        case 'n': ch = '\n'; break;
-                        case 't': ch = '\t'; break;
-                        case 'r': ch = '\r'; break;
-                        case 'b': ch = '\b'; break;
-                        case 'f': ch = '\f'; break;
-                        case 'a': ch = '\a'; break;
-                        case 'v': ch = '\v'; break;
-                        case '"': ch = '"';  break;
-                        case '\'': ch = '\''; break;
-                        case '\\': ch = '\\'; break;
-                        case '0': ch = '\0'; break;
-                        case 'x': {
-                            char h1 = fgetc(fp), h2 = fgetc(fp);
-                            if (isxdigit((unsigned char)h1) && isxdigit((unsigned char)h2)) {
-                                char hexbuf[3] = {h1, h2, '\0'};
-                                ch = (char)strtol(hexbuf, NULL, 16);
-                            } else {
-                                if (h2 != EOF) ungetc(h2, fp);
-                                if (h1 != EOF) ungetc(h1, fp);
-                                GBUF_PUSH('\\'); ch = 'x';
-                            }
-                            break;
-                        }
-                        case 'u': {
-                            int brace = fgetc(fp);
-                            if (brace == '{') {
-                                unsigned code = 0; int hc;
-                                while ((hc = fgetc(fp)) != EOF && hc != '}') {
-                                    if (!isxdigit((unsigned char)hc)) break;
-                                    code = code * 16 + (isdigit(hc) ? (hc - '0') : (tolower(hc) - 'a' + 10));
-                                }
-                                ch = (char)(code & 0xFF);
-                            } else {
-                                if (brace != EOF) ungetc(brace, fp);
-                                GBUF_PUSH('\\'); ch = 'u';
-                            }
-                            break;
-                        }
-                        default: GBUF_PUSH('\\'); break;
+                break;
+            case 'u':
+                if (PEEK(0) == '{') {
+                    unsigned code = 0;
+                    lx->p++;
+                    while (lx->p < lx->end && *lx->p != '}' && isxdigit((unsigned char)*lx->p)) {
+                        int hc = (unsigned char)*lx->p++;
+                        code = code * 16 + (unsigned)(isdigit(hc) ? hc - '0' : tolower(hc) - 'a' + 10);
                     }
-                    escaped = 0;
+                    if (PEEK(0) == '}') lx->p++;
+                    ch = (int)(code & 0xFF);
+                } else {
+                    buf_push(lx, &n, '\\');
                 }
-                GBUF_PUSH(ch);
-            }
-
-            if (!closed) {
-                static const char *msg = "unterminated string literal";
-                MAKE_TOK(TOK_ERROR, msg, strlen(msg));
-            }
-
-            MAKE_TOK(TOK_STR, buf, n);
+                break;
+            default:
+                if (ch == '\n') lx->line++;
+                buf_push(lx, &n, '\\');
+                break;
         }
+        buf_push(lx, &n, ch);
     }
+    return make(TOK_ERROR, unterminated, sizeof(unterminated) - 1, line);
+}
 
-    /* Backslash alone */
-    if (c == '\\') {
-        char tmp[2] = {'\\', '\0'};
-        MAKE_TOK(TOK_UNKNOWN, tmp, 1);
-    }
+/* Exponent: marker, optional sign, digits. Only taken when digits follow. */
+static void exponent(Lexer *lx, size_t *n) {
+    size_t k = (PEEK(1) == '+' || PEEK(1) == '-') ? 2 : 1;
+    if (!isdigit(PEEK(k))) return;
+    while (k--) buf_push(lx, n, *lx->p++);
+    while (isdigit(PEEK(0))) buf_push(lx, n, *lx->p++);
+}
 
-    /* identifiers */
-    if ((isalpha((unsigned char)c)) || c == '_') {
-        GBUF_INIT();
-        GBUF_PUSH(c);
-        int ch;
-        while ((ch = fgetc(fp)) != EOF && (isalnum((unsigned char)ch) || ch == '_')) {
-            GBUF_PUSH(ch);
+/* Decimal or hex numeral; ".5" is spelled "0.5" and an 'f' suffix is
+   dropped. A '.' not followed by a digit is left for ".." and friends. */
+static Token number(Lexer *lx, int line) {
+    size_t n = 0;
+    if (PEEK(0) == '0' && (PEEK(1) == 'x' || PEEK(1) == 'X')) {
+        buf_push(lx, &n, *lx->p++);
+        buf_push(lx, &n, *lx->p++);
+        if (!isxdigit(PEEK(0))) return make(TOK_UNKNOWN, intern(lx, lx->buf, n), n, line);
+        while (isxdigit(PEEK(0))) buf_push(lx, &n, *lx->p++);
+        if (PEEK(0) == '.' && isxdigit(PEEK(1))) {
+            buf_push(lx, &n, *lx->p++);
+            while (isxdigit(PEEK(0))) buf_push(lx, &n, *lx->p++);
+        }
+        if (PEEK(0) == 'p' || PEEK(0) == 'P') exponent(lx, &n);
+    } else {
+        if (PEEK(0) == '.') buf_push(lx, &n, '0');
+        else while (isdigit(PEEK(0))) buf_push(lx, &n, *lx->p++);
+        if (PEEK(0) == '.' && isdigit(PEEK(1))) {
+            buf_push(lx, &n, *lx->p++);
+            while (isdigit(PEEK(0))) buf_push(lx, &n, *lx->p++);
         }
-        if (ch != EOF) ungetc(ch, fp);
-        buf[n] = '\0';
-        TokenType token_type = lookup_keyword(buf);
-        MAKE_TOK(token_type, buf, n);
+        if (PEEK(0) == 'e' || PEEK(0) == 'E') exponent(lx, &n);
     }
+    if (PEEK(0) == 'f' || PEEK(0) == 'F') lx->p++;
+    return make(TOK_NUMBER, intern(lx, lx->buf, n), n, line);
+}
 
-    /* numbers (decimal or hex, including hex floats) */
-    if (isdigit((unsigned char)c) || (c == '0')) {
-        GBUF_INIT();
-        GBUF_PUSH(c);
-
-        if (c == '0') {
-            int nc = fgetc(fp);
-            if (nc == 'x' || nc == 'X') {
-                GBUF_PUSH(nc);
-                int ch, has_digits = 0;
-                while ((ch = fgetc(fp)) != EOF && isxdigit((unsigned char)ch)) { GBUF_PUSH(ch); has_digits = 1; }
-                if (!has_digits) { if (ch != EOF) ungetc(ch, fp); MAKE_TOK(TOK_UNKNOWN, buf, n); }
+Token lexer_next(Lexer *lx) {
+    int c;
 
-                int is_real = 0;
-                if (ch == '.') {
-                    int peek = fgetc(fp);
-                    if (isxdigit((unsigned char)peek)) {
-                        is_real = 1;
-                        GBUF_PUSH('.');
-                        GBUF_PUSH(peek);
-                        while ((ch = fgetc(fp)) != EOF && isxdigit((unsigned char)ch)) GBUF_PUSH(ch);
-                    } else {
-                        if (peek != EOF) ungetc(peek, fp);
-                        ungetc('.', fp);
-                        ch = 0;
-                    }
-                }
-                if (ch == 'p' || ch == 'P') {
-                    is_real = 1;
-                    GBUF_PUSH(ch);
-                    int s = fgetc(fp);
-                    if (s == '+' || s == '-') { GBUF_PUSH(s); s = fgetc(fp); }
-                    if (isdigit((unsigned char)s)) {
-                        GBUF_PUSH(s);
-                        while ((ch = fgetc(fp)) != EOF && isdigit((unsigned char)ch)) GBUF_PUSH(ch);
-                    } else if (s != EOF) {
-                        ungetc(s, fp);
-                    }
-                }
-                /* optional 'f' suffix: eat it */
-                if (ch == 'f' || ch == 'F') { /* eat */ }
-                else if (ch != 0 && ch != EOF) ungetc(ch, fp);
-                MAKE_TOK(TOK_NUMBER, buf, n);
-            } else {
-                if (nc != EOF) ungetc(nc, fp);
+    /* Skip whitespace and comments */
+    for (;;) {
+        if (lx->p >= lx->end) return make(TOK_EOF, NULL, 0, lx->line);
+        c = (unsigned char)*lx->p;
+        if (c == '\n') { lx->line++; lx->p++; continue; }
+        if (isspace(c)) { lx->p++; continue; }
+        if (c == '-' && PEEK(1) == '-') {
+            lx->p += 2;
+            int eq;
+            size_t n;
+            if (PEEK(0) == '[') {
+                lx->p++;
+                if (long_open(lx, &eq)) { long_body(lx, eq, 0, &n); continue; }
             }
+            while (lx->p < lx->end && *lx->p != '\n') lx->p++;
+            continue;
         }
+        break;
+    }
 
-        int ch;
-        while ((ch = fgetc(fp)) != EOF && isdigit((unsigned char)ch)) GBUF_PUSH(ch);
+    int line = lx->line;
+    const char *start = lx->p++;
 
-        int is_real = 0;
-        if (ch == '.') {
-            int peek = fgetc(fp);
-            if (isdigit((unsigned char)peek)) {
-                is_real = 1;
-                GBUF_PUSH('.');
-                GBUF_PUSH(peek);
-                while ((ch = fgetc(fp)) != EOF && isdigit((unsigned char)ch)) GBUF_PUSH(ch);
-            } else {
-                if (peek != EOF) ungetc(peek, fp);
-                ungetc('.', fp);
-                ch = 0;
-            }
+    #define TOK(T, S) return make((T), (S), sizeof(S) - 1, line)
+    switch (c) {
+        case '(': TOK(TOK_LPAREN, "(");
+        case ')': TOK(TOK_RPAREN, ")");
+        case '{': TOK(TOK_LBRACE, "{");
+        case '}': TOK(TOK_RBRACE, "}");
+        case '[': {
+            int eq;
+            if (long_open(lx, &eq)) return long_string(lx, eq, line);
+            TOK(TOK_LBRACK, "[");
         }
-        if (ch == 'e' || ch == 'E') {
-            is_real = 1;
-            GBUF_PUSH(ch);
-            int s = fgetc(fp);
-            if (s == '+' || s == '-') { GBUF_PUSH(s); s = fgetc(fp); }
-            if (isdigit((unsigned char)s)) {
-                GBUF_PUSH(s);
-                while ((ch = fgetc(fp)) != EOF && isdigit((unsigned char)ch)) GBUF_PUSH(ch);
-            } else if (s != EOF) {
-                ungetc(s, fp);
+        case ']': TOK(TOK_RBRACK, "]");
+        case ',': TOK(TOK_COMMA, ",");
+        case ':': TOK(TOK_COLON, ":");
+        case ';': TOK(TOK_SEMICOLON, ";");
+        case '+': TOK(TOK_PLUS, "+");
+        case '*': TOK(TOK_STAR, "*");
+        case '/':
+            if (PEEK(0) == '/') { lx->p++; TOK(TOK_IDIV, "//"); }
+            TOK(TOK_SLASH, "/");
+        case '%': TOK(TOK_MOD, "%");
+        case '#': TOK(TOK_LEN, "#");
+        case '^': TOK(TOK_POW, "^");
+        case '-': TOK(TOK_MINUS, "-");
+        case '=':
+            if (PEEK(0) == '=') { lx->p++; TOK(TOK_EQ, "=="); }
+            TOK(TOK_ASSIGN, "=");
+        case '~':
+            if (PEEK(0) == '=') { lx->p++; TOK(TOK_NE, "~="); }
+            TOK(TOK_UNKNOWN, "~");
+        case '<':
+            if (PEEK(0) == '=') { lx->p++; TOK(TOK_LE, "<="); }
+            TOK(TOK_LT, "<");
+        case '>':
+            if (PEEK(0) == '=') { lx->p++; TOK(TOK_GE, ">="); }
+            TOK(TOK_GT, ">");
+        case '.':
+            if (PEEK(0) == '.') {
+                lx->p++;
+                if (PEEK(0) == '.') { lx->p++; TOK(TOK_VARARG, "..."); }
+                TOK(TOK_CONCAT, "..");
             }
-        }
-        /* optional 'f' suffix: eat it */
-        if (ch == 'f' || ch == 'F') { /* eat */ }
-        else if (ch != 0 && ch != EOF) ungetc(ch, fp);
-        (void)is_real; /* kept for clarity; we always emit TOK_NUMBER */
-        MAKE_TOK(TOK_NUMBER, buf, n);
+            if (isdigit(PEEK(0))) { lx->p = start; return number(lx, line); }
+            TOK(TOK_DOT, ".");
+        case '"':
+        case '\'':
+            return quoted_string(lx, c, line);
+        case '\\':
+            TOK(TOK_UNKNOWN, "\\");
+    }
+    #undef TOK
+
+    /* identifiers and keywords: sliced from the source, then interned */
+    if (isalpha(c) || c == '_') {
+        while (lx->p < lx->end && (isalnum((unsigned char)*lx->p) || *lx->p == '_')) lx->p++;
+        size_t n = (size_t)(lx->p - start);
+        const Keyword *kw = lookup_keyword(start, n);
+        if (kw) return make(kw->token, kw->word, n, line);
+        return make(TOK_ID, intern(lx, start, n), n, line);
     }
 
-    char tmp[2] = {(char)c, '\0'};
-    MAKE_TOK(TOK_UNKNOWN, tmp, 1);
+    if (isdigit(c)) { lx->p = start; return number(lx, line); }
 
-    #undef OOM
-    #undef GBUF_INIT
-    #undef GBUF_PUSH
-    #undef MAKE_TOK
-    #undef IS_IDENT_START
-    #undef IS_IDENT_CHAR
+    return make(TOK_UNKNOWN, intern(lx, start, 1), 1, line);
 }
@@ -9,13 +9,13 @@
 #include "../include/parser.h"
 #include "../include/util.h"
 #include "../include/interpreter.h"
+#include "../include/bytecode.h"
+#include "../include/gc.h"
+#include "../include/chunk.h"
+#include "../include/optimize.h"
 
 #define LUAX_VERSION "1.0.4"
 
-Token *tokens = NULL;
-int tokenCount = 0;
-int tokenCap = 0;
-
 static const char *TokenTypeNames[] = {
     [TOK_NUMBER]    = "NUMBER",
     [TOK_STR]       = "STR",
@@ -77,19 +77,13 @@ static const char *TokenTypeNames[] = {
     [TOK_EOF]       = "EOF",
 };
 
-static void free_tokens(void){
-    for (int i = 0; i < tokenCount; i++) free(tokens[i].lexeme);
-    free(tokens);
-    tokens = NULL; tokenCount = tokenCap = 0;
-}
-
 static int has_ext(const char *path, const char *ext) {
     size_t n = strlen(path), m = strlen(ext);
     return n >= m && strcmp(path + (n - m), ext) == 0;
 }
 
 static int allowed_ext(const char *path) {
-    return has_ext(path, ".lua") || has_ext(path, ".lx");
+    return has_ext(path, ".lua") || has_ext(path, ".lx") || has_ext(path, CHUNK_EXT);
 }
 
 
@@ -121,9 +115,12 @@ static void print_help(const char *progname) {
     printf("Usage: %s [options] [file|code]\n\n", progname);
     printf("Options:\n");
     printf("  -h, --help     Show this help message\n");
-    printf("  -v, --version  Show version information\n\n");
+    printf("  -v, --version  Show version information\n");
+    printf("  --engine=bc    Run on the bytecode VM (default: ast, the tree walker)\n");
+    printf("  --dump-ast     Print the optimized syntax tree instead of running\n");
+    printf("  -c out in      Compile in to the binary chunk out (run it like a source file)\n\n");
     printf("Arguments:\n");
-    printf("  file           Execute a .lua or .lx file\n");
+    printf("  file           Execute a .lua, .lx or .luaxc file\n");
     printf("  code           Execute code string directly\n");
     printf("  (none)         Start interactive REPL\n\n");
     printf("Examples:\n");
@@ -136,45 +133,38 @@ static void print_version(void) {
     printf("LuaX version %s\n", LUAX_VERSION);
 }
 
-static int execute_code(FILE *fp) {
-    free_tokens();
-    
-    /* ===== LEX ===== */
-    for (;;) {
-        Token t = next(fp);
-        if (t.type == TOK_EOF) break;
+static int dump_ast;   /* --dump-ast: print the optimized tree instead of running */
 
-        if (tokenCount >= tokenCap) {
-            int newCap = tokenCap ? tokenCap * 2 : 8;
-            Token *tmp = (Token *)realloc(tokens, newCap * sizeof(Token));
-            if (!tmp) {
-                perror("realloc");
-                free_tokens();
-                return 1;
-            }
-            tokens = tmp;
-            tokenCap = newCap;
+static int execute_code(const char *src, size_t len) {
+    AST *program;
+    if (chunk_is_binary(src, len)) {
+        program = chunk_undump(src, len);
+        if (!program) {
+            fprintf(stderr, "[LuaX]: bad binary chunk\n");
+            return 1;
         }
-        tokens[tokenCount++] = t;
+    } else {
+        Lexer lx;
+        lexer_init(&lx, src, len);
+
+        /* ===== PARSE (tokens are lexed on demand) ===== */
+        Parser *p = parser_create(&lx);
+        program = parse_chunk(p);
+        parser_destroy(p);
+        lexer_free(&lx);
     }
 
-    /* ===== PARSE ===== */
-    Parser *p = parser_create(tokens, tokenCount);
-    ASTVec stmts = (ASTVec){0};
-    while (parser_curr(p).type != TOK_EOF) {
-        AST *s = statement(p);
-        if (!s) break;
-        if (parser_curr(p).type == TOK_EOF && p->had_error) break;
-        astvec_push(&stmts, s);
+    if (dump_ast) {
+        ast_dump(stdout, program);
+        ast_free(program);
+        return 0;
     }
-    AST *program = ast_make_block(stmts, tokenCount ? tokens[tokenCount-1].line : 1);
 
     /* ===== RUN ===== */
     int result = interpret(program);
 
     /* ===== CLEANUP ===== */
     ast_free(program);
-    parser_destroy(p);
     
     return result;
 }
@@ -222,59 +212,25 @@ static void run_repl(void) {
         }
         
         /* Parse and execute the line using the persistent VM */
-        FILE *fp = open_string_as_FILE(line);
-        if (!fp) {
-            fprintf(stderr, "Error: failed to process input\n");
-            continue;
-        }
-        
-        // Lex the input
-        free_tokens();
-        for (;;) {
-            Token t = next(fp);
-            if (t.type == TOK_EOF) break;
-            
-            if (tokenCount >= tokenCap) {
-                int newCap = tokenCap ? tokenCap * 2 : 8;
-                Token *tmp = (Token *)realloc(tokens, newCap * sizeof(Token));
-                if (!tmp) {
-                    perror("realloc");
-                    free_tokens();
-                    fclose(fp);
-                    continue;
-                }
-                tokens = tmp;
-                tokenCap = newCap;
-            }
-            tokens[tokenCount++] = t;
-        }
-        fclose(fp);
+        Lexer lx;
+        lexer_init(&lx, line, (size_t)nread);
         
         // Parse the input
-        Parser *p = parser_create(tokens, tokenCount);
-        ASTVec stmts = (ASTVec){0};
-        while (parser_curr(p).type != TOK_EOF) {
-            AST *s = statement(p);
-            if (!s) break;
-            if (parser_curr(p).type == TOK_EOF && p->had_error) break;
-            astvec_push(&stmts, s);
-        }
+        Parser *p = parser_create(&lx);
+        AST *program = parse_chunk(p);
+        parser_destroy(p);
+        lexer_free(&lx);
         
-        if (stmts.count == 0) {
-            parser_destroy(p);
-            free_tokens();
+        if (program->as.block.stmts.count == 0) {
+            ast_free(program);
             continue;
         }
         
-        AST *program = ast_make_block(stmts, tokenCount ? tokens[tokenCount-1].line : 1);
-        
         // Execute using persistent VM
         exec_stmt_repl(vm, program);
         
         // Cleanup
         ast_free(program);
-        parser_destroy(p);
-        free_tokens();
     }
     
     free(line);
@@ -285,6 +241,21 @@ static void run_repl(void) {
 int main(int argc, char **argv) {
     FILE *fp = NULL;
     char *stdin_buf = NULL;
+    gc_init(&fp);   /* the collector scans the C stack up to here */
+
+    /* Engine selection and --dump-ast come before the file/code argument */
+    while (argc >= 2 && (strncmp(argv[1], "--engine=", 9) == 0 || strcmp(argv[1], "--dump-ast") == 0)) {
+        const char *eng = argv[1] + 9;
+        if (strcmp(argv[1], "--dump-ast") == 0) dump_ast = 1;
+        else if (strcmp(eng, "bc") == 0) bc_engine = 1;
+        else if (strcmp(eng, "ast") == 0) bc_engine = 0;
+        else {
+            fprintf(stderr, "unknown engine '%s' (expected 'ast' or 'bc')\n", eng);
+            return 1;
+        }
+        argv[1] = argv[0];
+        argv++; argc--;
+    }
 
     /* Handle flags */
     if (argc >= 2) {
@@ -299,26 +270,30 @@ int main(int argc, char **argv) {
             print_version();
             return 0;
         }
+
+        if (strcmp(arg, "-c") == 0) {
+            if (argc != 4) {
+                fprintf(stderr, "usage: %s -c out%s in.lua\n", argv[0], CHUNK_EXT);
+                return 1;
+            }
+            return chunk_compile_file(argv[3], argv[2]);
+        }
         
         /* File or code string */
+        int result;
         if (allowed_ext(arg)) {
-            fp = fopen(arg, "r");
-            if (!fp) {
+            size_t len;
+            const char *src = map_file(arg, &len);
+            if (!src) {
                 fprintf(stderr, "failed to open input '%s': %s\n", arg, strerror(errno));
                 return 1;
             }
+            result = execute_code(src, len);
+            unmap_file(src, len);
         } else {
             /* not a .lua/.lx file -> treat as a literal source string */
-            fp = open_string_as_FILE(arg);
-            if (!fp) {
-                fprintf(stderr, "failed to open input: %s\n", strerror(errno));
-                return 1;
-            }
+            result = execute_code(arg, strlen(arg));
         }
-        
-        int result = execute_code(fp);
-        fclose(fp);
-        free_tokens();
         return result;
         
     } else {
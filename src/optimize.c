@@ -0,0 +1,364 @@
+// optimize.c — constant folding and dead-branch removal (see include/optimize.h)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../include/optimize.h"
+#include "../include/interpreter.h"
+#include "../include/util.h"
+
+static AST *fold_expr(AST *n);
+static AST *fold_stmt(AST *n);
+static void fold_block(AST *blk);
+
+static bool is_literal(AST *n){
+  return n && (n->kind == AST_NIL || n->kind == AST_BOOL ||
+               n->kind == AST_NUMBER || n->kind == AST_STRING);
+}
+
+/* 1 / 0 for a literal's truth, -1 if n is not a literal */
+static int truth(AST *n){
+  if (!is_literal(n)) return -1;
+  if (n->kind == AST_NIL) return 0;
+  if (n->kind == AST_BOOL) return n->as.bval.v;
+  return 1;
+}
+
+/* calls and `...` would expand where a folded operand used to stand */
+static bool is_multi(AST *n){
+  return !n->paren && (n->kind == AST_CALL || (n->kind == AST_IDENT && n->as.ident.name[0] == '.'));
+}
+
+static void fold_vec(ASTVec *v){
+  for (unsigned i = 0; i < v->count; i++)
+    if (v->items[i]) v->items[i] = fold_expr(v->items[i]);
+}
+
+/* number ..: formatted the way op_concat does */
+static const char *concat_text(AST *n, char *buf, size_t cap){
+  if (n->kind == AST_STRING) return n->as.sval.s;
+  snprintf(buf, cap, "%g", n->as.nval.v);
+  return buf;
+}
+
+/* the string order of vm_binop: bytes, then length */
+static int str_cmp(AST *l, AST *r){
+  Str *a = l->as.sval.str, *b = r->as.sval.str;
+  int min = a->len < b->len ? a->len : b->len;
+  int c = memcmp(a->data, b->data, (size_t)min);
+  return c ? c : (a->len > b->len) - (a->len < b->len);
+}
+
+static bool lit_equal(AST *l, AST *r){
+  if (l->kind != r->kind) return false;
+  switch (l->kind) {
+    case AST_NIL:    return true;
+    case AST_BOOL:   return l->as.bval.v == r->as.bval.v;
+    case AST_NUMBER: return l->as.nval.v == r->as.nval.v;
+    default:         return str_cmp(l, r) == 0;
+  }
+}
+
+static AST *fold_binary(AST *n){
+  OpKind op = n->as.binary.op;
+  AST *l = n->as.binary.lhs = fold_expr(n->as.binary.lhs);
+  AST *r = n->as.binary.rhs = fold_expr(n->as.binary.rhs);
+  if (!l || !r) return n;
+  int t = truth(l);
+  if (op == OP_AND && t >= 0) return t ? (is_multi(r) ? n : r) : l;
+  if (op == OP_OR && t >= 0)  return t ? l : (is_multi(r) ? n : r);
+  if (!is_literal(l) || !is_literal(r)) return n;
+
+  bool nums = l->kind == AST_NUMBER && r->kind == AST_NUMBER;
+  bool strs = l->kind == AST_STRING && r->kind == AST_STRING;
+  double a = nums ? l->as.nval.v : 0, b = nums ? r->as.nval.v : 0;
+  switch (op) {
+    case OP_ADD: if (nums) return ast_make_number(a + b, n->line); break;
+    case OP_SUB: if (nums) return ast_make_number(a - b, n->line); break;
+    case OP_MUL: if (nums) return ast_make_number(a * b, n->line); break;
+    case OP_DIV: if (nums) return ast_make_number(a / b, n->line); break;
+    case OP_MOD: if (nums) return ast_make_number(fmod(a, b), n->line); break;
+    case OP_POW: if (nums) return ast_make_number(pow(a, b), n->line); break;
+    case OP_CONCAT: {
+      if ((l->kind != AST_STRING && l->kind != AST_NUMBER) ||
+          (r->kind != AST_STRING && r->kind != AST_NUMBER)) break;
+      char lb[64], rb[64];
+      const char *ls = concat_text(l, lb, sizeof(lb)), *rs = concat_text(r, rb, sizeof(rb));
+      size_t ll = strlen(ls), rl = strlen(rs);
+      char small[256];
+      char *s = ll + rl < sizeof(small) ? small : xmalloc(ll + rl + 1);
+      memcpy(s, ls, ll);
+      memcpy(s + ll, rs, rl + 1);
+      AST *k = ast_make_string(s, n->line);
+      if (s != small) free(s);
+      return k;
+    }
+    case OP_EQ: return ast_make_bool(lit_equal(l, r), n->line);
+    case OP_NE: return ast_make_bool(!lit_equal(l, r), n->line);
+    case OP_LT: case OP_LE: case OP_GT: case OP_GE: {
+      if (!nums && !strs) break;   /* a runtime error, raised at runtime */
+      int c = nums ? (a < b ? -1 : a > b ? 1 : a == b ? 0 : 2) : str_cmp(l, r);
+      bool v = op == OP_LT ? c == -1 : op == OP_LE ? (c == -1 || c == 0)
+             : op == OP_GT ? c == 1 : (c == 1 || c == 0);   /* NaN (2) compares false */
+      return ast_make_bool(v, n->line);
+    }
+    default: break;
+  }
+  return n;
+}
+
+static AST *fold_expr(AST *n){
+  if (!n) return n;
+  switch (n->kind) {
+    case AST_UNARY: {
+      AST *e = n->as.unary.expr = fold_expr(n->as.unary.expr);
+      if (!e) break;
+      if (n->as.unary.op == OP_NEG && e->kind == AST_NUMBER) return ast_make_number(-e->as.nval.v, n->line);
+      if (n->as.unary.op == OP_NOT && truth(e) >= 0) return ast_make_bool(!truth(e), n->line);
+      break;
+    }
+    case AST_BINARY: return fold_binary(n);
+    case AST_CALL:
+      n->as.call.callee = fold_expr(n->as.call.callee);
+      fold_vec(&n->as.call.args);
+      break;
+    case AST_INDEX:
+      n->as.index.target = fold_expr(n->as.index.target);
+      n->as.index.index = fold_expr(n->as.index.index);
+      break;
+    case AST_FIELD: n->as.field.target = fold_expr(n->as.field.target); break;
+    case AST_TABLE:
+      fold_vec(&n->as.table.keys);
+      fold_vec(&n->as.table.values);
+      break;
+    case AST_FUNCTION: fold_block(n->as.fn.body); break;
+    case AST_ASSIGN:
+    case AST_ASSIGN_LIST:
+      return fold_stmt(n);
+    default: break;
+  }
+  return n;
+}
+
+/* if/elseif chain with literal conditions: the branch taken, or NULL */
+static AST *fold_if(AST *n){
+  n->as.ifs.cond = fold_expr(n->as.ifs.cond);
+  fold_block(n->as.ifs.then_blk);
+  AST *e = n->as.ifs.else_blk;
+  if (e) n->as.ifs.else_blk = e->kind == AST_IF ? fold_if(e) : (fold_block(e), e);
+  int t = truth(n->as.ifs.cond);
+  if (t == 1) return n->as.ifs.then_blk;
+  if (t == 0) return n->as.ifs.else_blk;
+  return n;
+}
+
+/* the statement to keep in n's place, NULL to drop it */
+static AST *fold_stmt(AST *n){
+  if (!n) return n;
+  switch (n->kind) {
+    case AST_STMT_EXPR: n->as.stmt_expr.expr = fold_expr(n->as.stmt_expr.expr); break;
+    case AST_ASSIGN:
+      n->as.assign.lhs_ident = fold_expr(n->as.assign.lhs_ident);
+      n->as.assign.rhs = fold_expr(n->as.assign.rhs);
+      break;
+    case AST_ASSIGN_LIST:
+      fold_vec(&n->as.massign.lvals);
+      fold_vec(&n->as.massign.rvals);
+      break;
+    case AST_VAR: n->as.var.init = fold_expr(n->as.var.init); break;
+    case AST_BLOCK: fold_block(n); break;
+    case AST_IF: return fold_if(n);
+    case AST_WHILE:
+      n->as.whiles.cond = fold_expr(n->as.whiles.cond);
+      if (truth(n->as.whiles.cond) == 0) return NULL;
+      fold_block(n->as.whiles.body);
+      break;
+    case AST_REPEAT:
+      fold_block(n->as.repeatstmt.body);
+      n->as.repeatstmt.cond = fold_expr(n->as.repeatstmt.cond);
+      break;
+    case AST_FOR_NUM:
+      n->as.fornum.start = fold_expr(n->as.fornum.start);
+      n->as.fornum.end = fold_expr(n->as.fornum.end);
+      n->as.fornum.step = fold_expr(n->as.fornum.step);
+      fold_block(n->as.fornum.body);
+      break;
+    case AST_FOR_IN:
+      fold_vec(&n->as.forin.iters);
+      fold_block(n->as.forin.body);
+      break;
+    case AST_RETURN: fold_vec(&n->as.ret.values); break;
+    case AST_FUNC_STMT: fold_block(n->as.fnstmt.body); break;
+    case AST_TRY:
+      fold_block(n->as.trycatch.try_block);
+      fold_block(n->as.trycatch.catch_block);
+      fold_block(n->as.trycatch.finally_block);
+      break;
+    default: break;
+  }
+  return n;
+}
+
+static void fold_block(AST *blk){
+  if (!blk) return;
+  if (blk->kind != AST_BLOCK) { fold_stmt(blk); return; }
+  ASTVec *S = &blk->as.block.stmts;
+  unsigned j = 0;
+  for (unsigned i = 0; i < S->count; i++) {
+    AST *s = fold_stmt(S->items[i]);
+    if (s) S->items[j++] = s;
+  }
+  S->count = j;
+}
+
+void optimize_chunk(AST *program){
+  fold_block(program);
+}
+
+/* ===== dump ===== */
+
+static const char *op_name(OpKind op){
+  static const char *names[] = {
+    [OP_NONE] = "?", [OP_NEG] = "-", [OP_NOT] = "not", [OP_LEN] = "#",
+    [OP_ADD] = "+", [OP_SUB] = "-", [OP_MUL] = "*", [OP_DIV] = "/", [OP_MOD] = "%",
+    [OP_POW] = "^", [OP_CONCAT] = "..", [OP_EQ] = "==", [OP_NE] = "~=", [OP_LT] = "<",
+    [OP_LE] = "<=", [OP_GT] = ">", [OP_GE] = ">=", [OP_AND] = "and", [OP_OR] = "or",
+    [OP_IDIV] = "//",
+  };
+  return (unsigned)op < sizeof(names) / sizeof(*names) && names[op] ? names[op] : "?";
+}
+
+static void dump(FILE *out, AST *n, int depth, const char *role);
+
+static void dump_vec(FILE *out, ASTVec *v, int depth, const char *role){
+  for (unsigned i = 0; i < v->count; i++) dump(out, v->items[i], depth, role);
+}
+
+static void dump(FILE *out, AST *n, int depth, const char *role){
+  fprintf(out, "%*s", depth * 2, "");
+  if (role) fprintf(out, "%s: ", role);
+  if (!n) { fprintf(out, "-\n"); return; }
+  int d = depth + 1;
+  switch (n->kind) {
+    case AST_NIL:    fprintf(out, "nil"); break;
+    case AST_BOOL:   fprintf(out, "%s", n->as.bval.v ? "true" : "false"); break;
+    case AST_NUMBER: fprintf(out, "number %.17g", n->as.nval.v); break;
+    case AST_STRING: fprintf(out, "string \"%s\"", n->as.sval.s); break;
+    case AST_IDENT:  fprintf(out, "name %s", n->as.ident.name); break;
+    case AST_BREAK:  fprintf(out, "break"); break;
+    case AST_GOTO:   fprintf(out, "goto %s", n->as.go.label); break;
+    case AST_LABEL:  fprintf(out, "label %s", n->as.label.label); break;
+    default: break;
+  }
+  switch (n->kind) {
+    case AST_UNARY:
+      fprintf(out, "unary %s @%d\n", op_name(n->as.unary.op), n->line);
+      dump(out, n->as.unary.expr, d, NULL);
+      return;
+    case AST_BINARY:
+      fprintf(out, "binary %s @%d\n", op_name(n->as.binary.op), n->line);
+      dump(out, n->as.binary.lhs, d, NULL);
+      dump(out, n->as.binary.rhs, d, NULL);
+      return;
+    case AST_ASSIGN:
+      fprintf(out, "assign @%d\n", n->line);
+      dump(out, n->as.assign.lhs_ident, d, "target");
+      dump(out, n->as.assign.rhs, d, "value");
+      return;
+    case AST_ASSIGN_LIST:
+      fprintf(out, "%sassign @%d\n", n->as.massign.is_local ? "local " : "", n->line);
+      dump_vec(out, &n->as.massign.lvals, d, "target");
+      dump_vec(out, &n->as.massign.rvals, d, "value");
+      return;
+    case AST_CALL:
+      fprintf(out, "call @%d\n", n->line);
+      dump(out, n->as.call.callee, d, "callee");
+      dump_vec(out, &n->as.call.args, d, "arg");
+      return;
+    case AST_INDEX:
+      fprintf(out, "index @%d\n", n->line);
+      dump(out, n->as.index.target, d, NULL);
+      dump(out, n->as.index.index, d, "key");
+      return;
+    case AST_FIELD:
+      fprintf(out, "field .%s @%d\n", n->as.field.field, n->line);
+      dump(out, n->as.field.target, d, NULL);
+      return;
+    case AST_TABLE:
+      fprintf(out, "table @%d\n", n->line);
+      for (unsigned i = 0; i < n->as.table.values.count; i++) {
+        if (n->as.table.keys.items[i]) dump(out, n->as.table.keys.items[i], d, "key");
+        dump(out, n->as.table.values.items[i], d, "value");
+      }
+      return;
+    case AST_FUNCTION:
+      fprintf(out, "function%s @%d\n", n->as.fn.vararg ? " ..." : "", n->line);
+      dump_vec(out, &n->as.fn.params, d, "param");
+      dump(out, n->as.fn.body, d, NULL);
+      return;
+    case AST_STMT_EXPR:
+      fprintf(out, "expr @%d\n", n->line);
+      dump(out, n->as.stmt_expr.expr, d, NULL);
+      return;
+    case AST_VAR:
+      fprintf(out, "%s%s %s @%d\n", n->as.var.is_local ? "local" : "var",
+              n->as.var.is_close ? " <close>" : "", n->as.var.name, n->line);
+      if (n->as.var.init) dump(out, n->as.var.init, d, NULL);
+      return;
+    case AST_BLOCK:
+      fprintf(out, "block @%d\n", n->line);
+      dump_vec(out, &n->as.block.stmts, d, NULL);
+      return;
+    case AST_IF:
+      fprintf(out, "if @%d\n", n->line);
+      dump(out, n->as.ifs.cond, d, "cond");
+      dump(out, n->as.ifs.then_blk, d, "then");
+      if (n->as.ifs.else_blk) dump(out, n->as.ifs.else_blk, d, "else");
+      return;
+    case AST_WHILE:
+      fprintf(out, "while @%d\n", n->line);
+      dump(out, n->as.whiles.cond, d, "cond");
+      dump(out, n->as.whiles.body, d, NULL);
+      return;
+    case AST_REPEAT:
+      fprintf(out, "repeat @%d\n", n->line);
+      dump(out, n->as.repeatstmt.body, d, NULL);
+      dump(out, n->as.repeatstmt.cond, d, "until");
+      return;
+    case AST_FOR_NUM:
+      fprintf(out, "for %s @%d\n", n->as.fornum.var, n->line);
+      dump(out, n->as.fornum.start, d, "start");
+      dump(out, n->as.fornum.end, d, "limit");
+      if (n->as.fornum.step) dump(out, n->as.fornum.step, d, "step");
+      dump(out, n->as.fornum.body, d, NULL);
+      return;
+    case AST_FOR_IN:
+      fprintf(out, "for in @%d\n", n->line);
+      dump_vec(out, &n->as.forin.names, d, "name");
+      dump_vec(out, &n->as.forin.iters, d, "iter");
+      dump(out, n->as.forin.body, d, NULL);
+      return;
+    case AST_RETURN:
+      fprintf(out, "return @%d\n", n->line);
+      dump_vec(out, &n->as.ret.values, d, NULL);
+      return;
+    case AST_FUNC_STMT:
+      fprintf(out, "%sfunction%s @%d\n", n->as.fnstmt.is_local ? "local " : "",
+              n->as.fnstmt.vararg ? " ..." : "", n->line);
+      dump(out, n->as.fnstmt.name, d, "name");
+      dump_vec(out, &n->as.fnstmt.params, d, "param");
+      dump(out, n->as.fnstmt.body, d, NULL);
+      return;
+    case AST_TRY:
+      fprintf(out, "try @%d\n", n->line);
+      dump(out, n->as.trycatch.try_block, d, NULL);
+      if (n->as.trycatch.catch_block) dump(out, n->as.trycatch.catch_block, d, "catch");
+      if (n->as.trycatch.finally_block) dump(out, n->as.trycatch.finally_block, d, "finally");
+      return;
+    default:
+      fprintf(out, " @%d\n", n->line);
+      return;
+  }
+}
+
+void ast_dump(FILE *out, AST *n){ dump(out, n, 0, NULL); }
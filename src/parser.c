@@ -3,72 +3,144 @@
 #include <string.h>
 #include <stdarg.h>
 #include "../include/parser.h"
+#include "../include/gc.h"
+#include "../include/optimize.h"
 
-AST* ast_make_try_catch_finally(AST *tryBlock, AST *catchBlock, AST *finallyBlock, char *exceptionVar, int line) {
-    AST *node = malloc(sizeof(AST));
-    node->kind = AST_TRY;
-    node->line = line;
-node->as.trycatch.try_block = tryBlock;
-node->as.trycatch.catch_block = catchBlock;
-node->as.trycatch.finally_block = finallyBlock;
-node->as.trycatch.catch_var = exceptionVar ? strdup(exceptionVar) : NULL;
-    return node;
-}
-static void *xmalloc(size_t n){ void *p=malloc(n); if(!p){fprintf(stderr,"OOM\n"); exit(1);} return p; }
-static char *xstrdup(const char*s){ size_t n=strlen(s)+1; char *p=xmalloc(n); memcpy(p,s,n); return p; }
+/* Nodes, names and vectors of the chunk being parsed live in its arena */
+static AstArena *cur_arena;
+
+AstArena *ast_arena_enter(AstArena *a){ AstArena *prev = cur_arena; cur_arena = a; return prev; }
+
+static void *ast_alloc(size_t n){ return ast_arena_alloc(cur_arena, n); }
+static char *ast_strdup(const char *s){ return ast_arena_strdup(cur_arena, s); }
+static Str  *ast_str(const char *s){ return ast_arena_str(cur_arena, s); }
 
 void astvec_push(ASTVec *v, AST *node){
-  if(!v->cap){ v->cap=8; v->items=xmalloc(v->cap*sizeof(AST*)); }
-  else if(v->count==v->cap){ v->cap<<=1; v->items=realloc(v->items,v->cap*sizeof(AST*)); }
+  if(v->count==v->cap){
+    unsigned cap = v->cap ? v->cap*2 : 4;
+    AST **items = ast_alloc(cap*sizeof(AST*));
+    if(v->count) memcpy(items, v->items, v->count*sizeof(AST*));
+    v->items=items; v->cap=cap;
+  }
   v->items[v->count++]=node;
 }
 
-static AST *node_new(ASTKind k,int line){ AST*n=xmalloc(sizeof(*n)); memset(n,0,sizeof(*n)); n->kind=k; n->line=line; return n; }
+static AST *node_new(ASTKind k,int line){ AST*n=ast_alloc(sizeof(*n)); n->kind=k; n->line=line; return n; }
+AST* ast_make_try_catch_finally(AST *tryBlock, AST *catchBlock, AST *finallyBlock, const char *exceptionVar, int line) {
+    AST *node = node_new(AST_TRY, line);
+    node->as.trycatch.try_block = tryBlock;
+    node->as.trycatch.catch_block = catchBlock;
+    node->as.trycatch.finally_block = finallyBlock;
+    node->as.trycatch.catch_var = exceptionVar ? ast_strdup(exceptionVar) : NULL;
+    return node;
+}
 AST *ast_make_nil(int l){return node_new(AST_NIL,l);}
 AST *ast_make_bool(bool v,int l){AST*n=node_new(AST_BOOL,l); n->as.bval.v=v; return n;}
 AST *ast_make_number(double v,int l){AST*n=node_new(AST_NUMBER,l); n->as.nval.v=v; return n;}
-AST *ast_make_string(const char*s,int l){AST*n=node_new(AST_STRING,l); n->as.sval.s=xstrdup(s?s:""); return n;}
-AST *ast_make_ident(const char*name,int l){AST*n=node_new(AST_IDENT,l); n->as.ident.name=xstrdup(name?name:""); return n;}
+AST *ast_make_string(const char*s,int l){AST*n=node_new(AST_STRING,l); n->as.sval.s=ast_strdup(s?s:""); n->as.sval.str=ast_str(n->as.sval.s); return n;}
+AST *ast_make_ident(const char*name,int l){AST*n=node_new(AST_IDENT,l); n->as.ident.name=ast_strdup(name?name:""); n->as.ident.depth=-1; n->as.ident.slot=-1; n->as.ident.key=ast_str(n->as.ident.name); return n;}
 AST *ast_make_unary(OpKind op,AST*e,int l){AST*n=node_new(AST_UNARY,l); n->as.unary.op=op; n->as.unary.expr=e; return n;}
 AST *ast_make_binary(OpKind op,AST*l,AST*r,int ln){AST*n=node_new(AST_BINARY,ln); n->as.binary.lhs=l; n->as.binary.rhs=r; n->as.binary.op=op; return n;}
 AST *ast_make_assign(AST*lhs,AST*rhs,int l){AST*n=node_new(AST_ASSIGN,l); n->as.assign.lhs_ident=lhs; n->as.assign.rhs=rhs; return n;}
 AST *ast_make_assign_list(ASTVec L, ASTVec R, int l){AST*n=node_new(AST_ASSIGN_LIST,l); n->as.massign.lvals=L; n->as.massign.rvals=R; return n;}
 AST *ast_make_call(AST*callee,ASTVec args,int l){AST*n=node_new(AST_CALL,l); n->as.call.callee=callee; n->as.call.args=args; return n;}
-AST *ast_make_index(AST*t,AST*i,int l){AST*n=node_new(AST_INDEX,l); n->as.index.target=t; n->as.index.index=i; return n;}
-AST *ast_make_field(AST*t,const char*name,int l){AST*n=node_new(AST_FIELD,l); n->as.field.target=t; n->as.field.field=xstrdup(name); return n;}
+AST *ast_make_index(AST*t,AST*i,int l){AST*n=node_new(AST_INDEX,l); n->as.index.target=t; n->as.index.index=i; ast_arena_track_ic(cur_arena,&n->as.index.ic); return n;}
+AST *ast_make_field(AST*t,const char*name,int l){AST*n=node_new(AST_FIELD,l); n->as.field.target=t; n->as.field.field=ast_strdup(name); n->as.field.key=ast_str(n->as.field.field); ast_arena_track_ic(cur_arena,&n->as.field.ic); return n;}
 AST *ast_make_table(ASTVec K,ASTVec V,int l){AST*n=node_new(AST_TABLE,l); n->as.table.keys=K; n->as.table.values=V; return n;}
 AST *ast_make_function(ASTVec ps,bool vararg,AST*body,int l){AST*n=node_new(AST_FUNCTION,l); n->as.fn.params=ps; n->as.fn.vararg=vararg; n->as.fn.body=body; return n;}
 AST *ast_make_func_stmt(bool is_local, AST *name, ASTVec ps, bool vararg, AST *body, int l){AST*n=node_new(AST_FUNC_STMT,l); n->as.fnstmt.is_local=is_local; n->as.fnstmt.name=name; n->as.fnstmt.params=ps; n->as.fnstmt.vararg=vararg; n->as.fnstmt.body=body; return n;}
 AST *ast_make_stmt_expr(AST*e,int l){AST*n=node_new(AST_STMT_EXPR,l); n->as.stmt_expr.expr=e; return n;}
-AST *ast_make_var(bool is_local,const char*name,AST*init,int l){AST*n=node_new(AST_VAR,l); n->as.var.is_local=is_local; n->as.var.name=xstrdup(name?name:""); n->as.var.init=init; return n;}
-AST *ast_make_block(ASTVec s,int l){AST*n=node_new(AST_BLOCK,l); n->as.block.stmts=s; return n;}
+AST *ast_make_var(bool is_local,const char*name,AST*init,int l){AST*n=node_new(AST_VAR,l); n->as.var.is_local=is_local; n->as.var.name=ast_strdup(name?name:""); n->as.var.init=init; return n;}
+AST *ast_make_block(ASTVec s,int l){AST*n=node_new(AST_BLOCK,l); n->as.block.stmts=s; n->as.block.arena=cur_arena; return n;}
 AST *ast_make_if(AST*cond,AST*thenb,AST*elseb,int l){AST*n=node_new(AST_IF,l); n->as.ifs.cond=cond; n->as.ifs.then_blk=thenb; n->as.ifs.else_blk=elseb; return n;}
 AST *ast_make_while(AST*cond,AST*body,int l){AST*n=node_new(AST_WHILE,l); n->as.whiles.cond=cond; n->as.whiles.body=body; return n;}
 AST *ast_make_repeat(AST*body,AST*cond,int l){AST*n=node_new(AST_REPEAT,l); n->as.repeatstmt.body=body; n->as.repeatstmt.cond=cond; return n;}
-AST *ast_make_for_num(const char*var,AST*a,AST*b,AST*c,AST*body,int l){AST*n=node_new(AST_FOR_NUM,l); n->as.fornum.var=xstrdup(var); n->as.fornum.start=a; n->as.fornum.end=b; n->as.fornum.step=c; n->as.fornum.body=body; return n;}
+AST *ast_make_for_num(const char*var,AST*a,AST*b,AST*c,AST*body,int l){AST*n=node_new(AST_FOR_NUM,l); n->as.fornum.var=ast_strdup(var); n->as.fornum.start=a; n->as.fornum.end=b; n->as.fornum.step=c; n->as.fornum.body=body; return n;}
 AST *ast_make_for_in(ASTVec names,ASTVec iters,AST*body,int l){AST*n=node_new(AST_FOR_IN,l); n->as.forin.names=names; n->as.forin.iters=iters; n->as.forin.body=body; return n;}
 AST *ast_make_break(int l){return node_new(AST_BREAK,l);}
-AST *ast_make_label(const char*lab,int l){AST*n=node_new(AST_LABEL,l); n->as.label.label=xstrdup(lab); return n;}
-AST *ast_make_goto(const char*lab,int l){AST*n=node_new(AST_GOTO,l); n->as.go.label=xstrdup(lab); return n;}
+AST *ast_make_label(const char*lab,int l){AST*n=node_new(AST_LABEL,l); n->as.label.label=ast_strdup(lab); return n;}
+AST *ast_make_goto(const char*lab,int l){AST*n=node_new(AST_GOTO,l); n->as.go.label=ast_strdup(lab); return n;}
 AST *ast_make_return_list(ASTVec vals,int l){AST*n=node_new(AST_RETURN,l); n->as.ret.values=vals; return n;}
 
-void ast_free(AST *n){ /* TODO: implement deep free later */ (void)n; }
 
-Parser *parser_create(Token*tokens,int count){
+void ast_free(AST *n){
+  if (n && n->kind == AST_BLOCK) ast_arena_release(n->as.block.arena);
+}
+
+/* ----- token window -----
+   Tokens are pulled from the lexer on demand into a ring that holds the
+   current token, the lookahead and, while a backtrack mark is open,
+   everything since the outermost mark. Consumed tokens are dropped, so
+   the window stays a few slots wide however long the chunk is. */
+#define RING_MIN 16
+
+Parser *parser_create(Lexer *lx){
   Parser*p=xmalloc(sizeof(*p));
-  p->toks=tokens;
-  p->count=count;
-  p->pos=0;
-  p->had_error=false;
-  p->err_count=0;   /* NEW */
-  p->panic=false;   /* NEW */
+  memset(p,0,sizeof(*p));
+  p->lx=lx;
+  p->arena=ast_arena_new();
+  p->outer=ast_arena_enter(p->arena);
+  p->cap=RING_MIN;
+  p->ring=xmalloc(sizeof(Token)*p->cap);
   return p;
 }
-void parser_destroy(Parser*p){ free(p); }
+void parser_destroy(Parser*p){
+  ast_arena_enter(p->outer);
+  ast_arena_release(p->arena);
+  free(p->ring); free(p);
+}
+
+static void ring_grow(Parser *p){
+  int cap = p->cap*2;
+  Token *r = xmalloc(sizeof(Token)*cap);
+  for (int i = p->lo; i < p->hi; i++) r[i & (cap-1)] = p->ring[i & (p->cap-1)];
+  free(p->ring);
+  p->ring = r; p->cap = cap;
+}
 
-static inline Token curr(Parser*p){ return (p->pos<p->count)?p->toks[p->pos]:(Token){TOK_EOF,NULL,0,p->count?p->toks[p->count-1].line:1}; }
-static inline Token advance(Parser*p){ Token t=curr(p); if(p->pos<p->count) p->pos++; return t; }
-static inline bool  check(Parser*p,TokenType t){ return curr(p).type==t; }
+static void pull(Parser *p){
+  if (p->hi - p->lo == p->cap) {
+    p->lo = p->marks ? p->keep : p->pos;
+    if (p->hi - p->lo == p->cap) ring_grow(p);
+  }
+  Token t = lexer_next(p->lx);
+  p->ring[p->hi++ & (p->cap-1)] = t;
+  if (t.type == TOK_EOF) p->at_eof = true;
+}
+
+static const Token *tok_at(Parser *p, int i){
+  if (p->aborted) return &p->eof;
+  while (i >= p->hi) {
+    if (p->at_eof) return &p->ring[(p->hi-1) & (p->cap-1)];  /* EOF repeats */
+    pull(p);
+  }
+  return &p->ring[i & (p->cap-1)];
+}
+
+/* Backtrack points nest; tokens from the outermost one stay buffered
+   until it is released. */
+static inline int mark(Parser *p){ if (p->marks++ == 0) p->keep = p->pos; return p->pos; }
+static inline void unmark(Parser *p){ p->marks--; }
+
+static inline const Token *curr(Parser*p){ return tok_at(p, p->pos); }
+static inline const Token *peek(Parser*p,int la){ return tok_at(p, p->pos + la); }
+static inline Token advance(Parser*p){ Token t=*curr(p); if(t.type!=TOK_EOF) p->pos++; return t; }
+static inline bool  check(Parser*p,TokenType t){ return curr(p)->type==t; }
+Token parser_curr(Parser *p){ return *curr(p); }
+
+AST *parse_chunk(Parser *p){
+  ASTVec stmts = (ASTVec){0};
+  while (!check(p, TOK_EOF)) {
+    AST *s = statement(p);
+    if (!s) break;
+    if (check(p, TOK_EOF) && p->had_error) break;
+    astvec_push(&stmts, s);
+  }
+  AST *root = ast_make_block(stmts, (int)curr(p)->line);
+  if (!p->had_error) optimize_chunk(root);
+  ast_arena_retain(p->arena);   /* the root's reference, see ast_free */
+  return root;
+}
 static inline bool  match(Parser*p,TokenType t){ if(check(p,t)){ advance(p); return true;} return false; }
 
 /* ----- robust error reporting & recovery ----- */
@@ -145,7 +217,10 @@ static void verror_at(Parser *p, int line, const char *fmt, va_list ap){
   fputc('\n', stderr);
   if (p->err_count >= PARSER_MAX_ERRORS) {
     fprintf(stderr, "[LuaX]: too many errors (%d). Aborting parse.\n", p->err_count);
-    p->pos = p->count; /* force-EOF to unwind gracefully */
+    /* force-EOF to unwind gracefully */
+    p->eof = *tok_at(p, p->hi);
+    while (p->eof.type != TOK_EOF) p->eof = lexer_next(p->lx);
+    p->aborted = true;
   }
 }
 
@@ -157,7 +232,7 @@ static void error_at(Parser *p, int line, const char *fmt, ...){
 static void synchronize(Parser *p){
   p->panic = false;
   for (;;) {
-    Token t = curr(p);
+    Token t = *curr(p);
     if (t.type == TOK_EOF) return;
 
     switch (t.type) {
@@ -181,7 +256,7 @@ static void synchronize(Parser *p){
 /* Expect with detailed message; enter panic+sync on failure.
    Avoid duplicating "expected ..." if the hint already says that. */
 static bool expect(Parser *p, TokenType want, const char *hint_msg){
-  Token got = curr(p);
+  Token got = *curr(p);
   if (got.type == want) { advance(p); return true; }
 
   /* suppress repetitive hints like "expected ')'" */
@@ -246,7 +321,7 @@ static AST *parse_primary(Parser *p);
 
 /* blocks */
 static AST *parse_block(Parser*p){
-  int line=curr(p).line; ASTVec stmts={0};
+  int line=curr(p)->line; ASTVec stmts={0};
   while(!check(p,TOK_KW_END)&&!check(p,TOK_KW_ELSE)&&!check(p,TOK_KW_ELSEIF)&&!check(p,TOK_KW_UNTIL)&&!check(p,TOK_EOF)){
     astvec_push(&stmts, statement(p));
   }
@@ -259,7 +334,7 @@ static void parse_paramlist(Parser*p, ASTVec *params, bool *vararg){
   if(check(p,TOK_RPAREN)) return;
   for(;;){
     if(match(p,TOK_VARARG)){ *vararg=true; break; } /* '...' */
-    Token id=curr(p);
+    Token id = *curr(p);
     if(!match(p,TOK_ID)){ error_at(p,id.line,"expected parameter name or '...'"); break; }
     astvec_push(params, ast_make_ident(id.lexeme?id.lexeme:"", id.line));
     if(!match(p,TOK_COMMA)) break;
@@ -268,7 +343,7 @@ static void parse_paramlist(Parser*p, ASTVec *params, bool *vararg){
 
 /* tables: assumes '{' already consumed */
 static AST *parse_table(Parser*p){
-  int line=curr(p).line; ASTVec keys={0}, values={0};
+  int line=curr(p)->line; ASTVec keys={0}, values={0};
   while(!check(p,TOK_RBRACE) && !check(p,TOK_EOF)){
     if(match(p,TOK_LBRACK)){ /* [expr] = expr */
       AST *k = expression(p); expect(p,TOK_RBRACK,"expected ']'");
@@ -276,8 +351,8 @@ static AST *parse_table(Parser*p){
       AST *v = expression(p);
       astvec_push(&keys,k); astvec_push(&values,v);
     } else if(check(p,TOK_ID)){ /* name = expr  OR positional expr */
-      Token id = curr(p);
-      if(p->pos+1 < p->count && p->toks[p->pos+1].type == TOK_ASSIGN){
+      Token id = *curr(p);
+      if(peek(p,1)->type == TOK_ASSIGN){
         advance(p); advance(p); /* name and '=' */
         AST *v = expression(p);
         astvec_push(&keys, ast_make_string(id.lexeme?id.lexeme:"", id.line));
@@ -300,7 +375,7 @@ static AST *parse_table(Parser*p){
 
 /* function literal: NOTE KW_FUNCTION already consumed by caller */
 static AST *parse_function_literal(Parser*p){
-  int line = curr(p).line; /* approx location */
+  int line = curr(p)->line; /* approx location */
   expect(p,TOK_LPAREN,"expected '(' after 'function'");
   ASTVec params={0}; bool vararg=false; parse_paramlist(p,&params,&vararg);
   expect(p,TOK_RPAREN,"expected ')'");
@@ -311,14 +386,14 @@ static AST *parse_function_literal(Parser*p){
 
 /* a.b.c or a:b */
 static AST *parse_name_chain(Parser*p){
-  Token id = curr(p); if(!match(p,TOK_ID)){ error_at(p,id.line,"expected name"); return ast_make_ident("",id.line); }
+  Token id = *curr(p); if(!match(p,TOK_ID)){ error_at(p,id.line,"expected name"); return ast_make_ident("",id.line); }
   AST *base = ast_make_ident(id.lexeme?id.lexeme:"", id.line);
   for(;;){
     if(match(p,TOK_DOT)){
-      Token f=curr(p); if(!match(p,TOK_ID)){ error_at(p,f.line,"expected field after '.'"); break; }
+      Token f = *curr(p); if(!match(p,TOK_ID)){ error_at(p,f.line,"expected field after '.'"); break; }
       base = ast_make_field(base, f.lexeme?f.lexeme:"", f.line);
     } else if(match(p,TOK_COLON)){
-      Token m=curr(p); if(!match(p,TOK_ID)){ error_at(p,m.line,"expected method name after ':'"); break; }
+      Token m = *curr(p); if(!match(p,TOK_ID)){ error_at(p,m.line,"expected method name after ':'"); break; }
       base = ast_make_field(base, m.lexeme?m.lexeme:"", m.line);
       break; /* only one ':' allowed here */
     } else break;
@@ -329,7 +404,7 @@ static AST *parse_name_chain(Parser*p){
 static AST *parse_postfix(Parser*p, AST*base){
   for(;;){
     if(match(p,TOK_LPAREN)){
-      ASTVec args={0}; int line=curr(p).line;
+      ASTVec args={0}; int line=curr(p)->line;
       if(!check(p,TOK_RPAREN)){ do{ astvec_push(&args, expression(p)); } while(match(p,TOK_COMMA)); }
       expect(p,TOK_RPAREN,"expected ')'");
       base = ast_make_call(base,args,line);
@@ -344,7 +419,7 @@ static AST *parse_postfix(Parser*p, AST*base){
     }
 
     if(match(p,TOK_DOT)){
-      Token f=curr(p);
+      Token f = *curr(p);
       expect(p,TOK_ID,"expected field name after '.'");
       base=ast_make_field(base,f.lexeme?f.lexeme:"",f.line);
       continue;
@@ -352,10 +427,8 @@ static AST *parse_postfix(Parser*p, AST*base){
 
     /* method sugar: only if we see  ':' ID '('  ahead */
     if (check(p, TOK_COLON)) {
-      size_t pos = p->pos;
-      if (pos + 2 < (size_t)p->count &&
-          p->toks[pos+1].type == TOK_ID &&
-          p->toks[pos+2].type == TOK_LPAREN)
+      if (peek(p,1)->type == TOK_ID &&
+          peek(p,2)->type == TOK_LPAREN)
       {
         advance(p);                /* ':' */
         Token m = advance(p);      /* method name (ID) */
@@ -369,6 +442,7 @@ static AST *parse_postfix(Parser*p, AST*base){
         }
         expect(p, TOK_RPAREN, "expected ')'");
         base = ast_make_call(callee, args, m.line);
+        base->as.call.method = true;
         continue;
       } else {
         break;
@@ -386,7 +460,7 @@ static AST *parse_postfix(Parser*p, AST*base){
 
     /* call sugar: f { ... } */
     if(check(p, TOK_LBRACE)){
-      int line = curr(p).line;
+      int line = curr(p)->line;
       advance(p);                  /* consume '{' */
       AST *tbl = parse_table(p);   /* '{' already consumed */
       ASTVec args = (ASTVec){0};
@@ -418,6 +492,7 @@ static AST *parse_primary(Parser*p){
     }
     case TOK_LPAREN: {
       AST*e=expression(p); expect(p,TOK_RPAREN,"expected ')'");
+      e->paren=true;
       return e;
     }
     default: error_at(p,t.line,"unexpected %s%s%s",
@@ -428,16 +503,16 @@ static AST *parse_primary(Parser*p){
   }
 }
 static AST *parse_unary(Parser*p){
-  Token t=curr(p); OpKind op=unaop(t.type);
+  Token t = *curr(p); OpKind op=unaop(t.type);
   if(op!=OP_NONE){ advance(p); AST*rhs=parse_precedence(p,8); return ast_make_unary(op,rhs,t.line); }
   return parse_primary(p);
 }
 static AST *parse_precedence(Parser*p,int prec_min){
   AST *left=parse_unary(p);
   for(;;){
-    TokenType tt=curr(p).type; int prec=precedence_of(tt);
+    TokenType tt=curr(p)->type; int prec=precedence_of(tt);
     if(prec<prec_min||prec==0) break;
-    OpKind op=binop(tt); int line=curr(p).line; advance(p);
+    OpKind op=binop(tt); int line=curr(p)->line; advance(p);
     int next_min = right_assoc(tt)?prec:(prec+1);
     AST *right=parse_precedence(p,next_min);
     left=ast_make_binary(op,left,right,line);
@@ -446,20 +521,19 @@ static AST *parse_precedence(Parser*p,int prec_min){
 }
 
 /* -------- lvalues (with soft/backtracking mode) -------- */
-static AST *parse_lvalue_ex(Parser *p, bool soft){
-  int start = p->pos;
+static AST *lvalue_body(Parser *p, bool soft, int start){
 
   if (check(p, TOK_LPAREN)) {
     advance(p);
     AST *base = expression(p);
     if (!expect(p, TOK_RPAREN, "expected ')'")) {
       if (soft) { p->pos = start; return NULL; }
-      return ast_make_ident("", curr(p).line);
+      return ast_make_ident("", curr(p)->line);
     }
     bool had_selector = false;
     for (;;) {
       if (match(p, TOK_DOT)) {
-        Token f = curr(p);
+        Token f = *curr(p);
         if (!match(p, TOK_ID)) {
           if (soft) { p->pos = start; return NULL; }
           error_at(p, f.line, "expected field");
@@ -473,7 +547,7 @@ static AST *parse_lvalue_ex(Parser *p, bool soft){
         AST *idx = expression(p);
         if (!expect(p, TOK_RBRACK, "expected ']'")) {
           if (soft) { p->pos = start; return NULL; }
-          return ast_make_ident("", curr(p).line);
+          return ast_make_ident("", curr(p)->line);
         }
         base = ast_make_index(base, idx, base->line);
         had_selector = true;
@@ -483,22 +557,22 @@ static AST *parse_lvalue_ex(Parser *p, bool soft){
     }
     if (!had_selector) {
       if (soft) { p->pos = start; return NULL; }
-      error_at(p, curr(p).line, "expected lvalue");
+      error_at(p, curr(p)->line, "expected lvalue");
     }
     return base;
   }
 
   if (!check(p, TOK_ID)) {
     if (soft) { p->pos = start; return NULL; }
-    error_at(p, curr(p).line, "expected lvalue");
-    return ast_make_ident("", curr(p).line);
+    error_at(p, curr(p)->line, "expected lvalue");
+    return ast_make_ident("", curr(p)->line);
   }
   Token id = advance(p);
   AST *base = ast_make_ident(id.lexeme ? id.lexeme : "", id.line);
 
   for (;;) {
     if (match(p, TOK_DOT)) {
-      Token f = curr(p);
+      Token f = *curr(p);
       if (!match(p, TOK_ID)) {
         if (soft) { p->pos = start; return NULL; }
         error_at(p, f.line, "expected field");
@@ -521,6 +595,14 @@ static AST *parse_lvalue_ex(Parser *p, bool soft){
   return base;
 }
 
+static AST *parse_lvalue_ex(Parser *p, bool soft){
+  if (!soft) return lvalue_body(p, false, p->pos);
+  int start = mark(p);
+  AST *lv = lvalue_body(p, true, start);
+  unmark(p);
+  return lv;
+}
+
 static AST *parse_lvalue(Parser *p){
   return parse_lvalue_ex(p, /*soft=*/false);
 }
@@ -540,7 +622,7 @@ static ASTVec parse_explist(Parser*p){
 
 /* public: expression (with safe varlist '=' lookahead) */
 AST *expression(Parser*p){
-  int save = p->pos;
+  int save = mark(p);
 
   ASTVec L = (ASTVec){0};
   AST *lv = parse_lvalue_ex(p, /*soft=*/true);
@@ -555,11 +637,13 @@ AST *expression(Parser*p){
     }
 
     if (ok_list && match(p, TOK_ASSIGN)) {
+      unmark(p);
       ASTVec R = parse_explist(p);
-      return ast_make_assign_list(L, R, curr(p).line);
+      return ast_make_assign_list(L, R, curr(p)->line);
     }
     p->pos = save;
   }
+  unmark(p);
 
   return parse_precedence(p,1);
 }
@@ -570,30 +654,32 @@ AST *statement(Parser*p){
   if (p->panic) synchronize(p);
 
   {
-    int save = p->pos;
+    int save = mark(p);
     if (match(p, TOK_COLON) && match(p, TOK_COLON)) {
-      Token nameTok = curr(p);
+      Token nameTok = *curr(p);
       if (match(p, TOK_ID) && match(p, TOK_COLON) && match(p, TOK_COLON)) {
+        unmark(p);
         return ast_make_label(nameTok.lexeme ? nameTok.lexeme : "", nameTok.line);
       }
       p->pos = save;
     }
+    unmark(p);
   }
   if (match(p, TOK_SEMICOLON)) {
-    return ast_make_nil(curr(p).line);  // optional: an empty statement AST node
+    return ast_make_nil(curr(p)->line);  // optional: an empty statement AST node
 }
 
-  if(match(p,TOK_KW_GOTO)){ Token name=curr(p);
+  if(match(p,TOK_KW_GOTO)){ Token name = *curr(p);
     expect(p,TOK_ID,"expected label name after 'goto'");
     return ast_make_goto(name.lexeme?name.lexeme:"", name.line);
   }
 
-  if(match(p,TOK_KW_BREAK)) return ast_make_break(curr(p).line);
+  if(match(p,TOK_KW_BREAK)) return ast_make_break(curr(p)->line);
 
   if(match(p,TOK_KW_DO)){ AST*body=parse_block(p); expect(p,TOK_KW_END,"expected 'end'"); return body; }
 
   if(match(p,TOK_KW_IF)){
-    int line=curr(p).line;
+    int line=curr(p)->line;
 
     AST *cond0 = expression(p);
     expect(p,TOK_KW_THEN,"expected 'then'");
@@ -624,11 +710,11 @@ if (match(p, TOK_KW_TRY)) {
     AST *tryBlock = parse_block(p);   // parse code inside try
     AST *catchBlock = NULL;
     AST *finallyBlock = NULL;
-    char *exceptionVar = NULL;
+    const char *exceptionVar = NULL;
 
     if (match(p, TOK_KW_CATCH)) {
-        if (curr(p).type == TOK_ID) {
-            exceptionVar = strdup(curr(p).lexeme);
+        if (curr(p)->type == TOK_ID) {
+            exceptionVar = curr(p)->lexeme;   /* interned: outlives the parse */
             advance(p);
         }
         catchBlock = parse_block(p);
@@ -640,40 +726,40 @@ if (match(p, TOK_KW_TRY)) {
 
     expect(p, TOK_KW_END, "expected 'end' after try/catch/finally");
 
-int line = parser_curr(p).line;
+int line = curr(p)->line;
 return ast_make_try_catch_finally(tryBlock, catchBlock, finallyBlock, exceptionVar, line);
 }
   if(match(p,TOK_KW_WHILE)){
-    int line=curr(p).line; AST*cond=expression(p);
+    int line=curr(p)->line; AST*cond=expression(p);
     expect(p,TOK_KW_DO,"expected 'do'"); AST *body=parse_block(p); expect(p,TOK_KW_END,"expected 'end'");
     return ast_make_while(cond, body, line);
   }
 
   if(match(p,TOK_KW_REPEAT)){
-    int line=curr(p).line; AST *body=parse_block(p);
+    int line=curr(p)->line; AST *body=parse_block(p);
     expect(p,TOK_KW_UNTIL,"expected 'until'"); AST *cond=expression(p);
     return ast_make_repeat(body, cond, line);
   }
 
   if(match(p,TOK_KW_FOR)){
-    Token name=curr(p); expect(p,TOK_ID,"expected identifier after 'for'");
+    Token name = *curr(p); expect(p,TOK_ID,"expected identifier after 'for'");
     if(match(p,TOK_ASSIGN)){
       AST *start=expression(p); expect(p,TOK_COMMA,"expected ','");
       AST *end=expression(p); AST *step=NULL;
       if(match(p,TOK_COMMA)) step=expression(p);
       expect(p,TOK_KW_DO,"expected 'do'"); AST *body=parse_block(p); expect(p,TOK_KW_END,"expected 'end'");
       return ast_make_for_num(name.lexeme?name.lexeme:"", start, end, step, body, name.line);
-    } else if(match(p,TOK_COMMA) || match(p,TOK_KW_IN)){
+    } else if(check(p,TOK_COMMA) || check(p,TOK_KW_IN)){
       ASTVec names={0};
       astvec_push(&names, ast_make_ident(name.lexeme?name.lexeme:"", name.line));
-      if(p->toks[p->pos-1].type==TOK_COMMA){
+      if(match(p,TOK_COMMA)){
         for(;;){
-          Token id=curr(p); expect(p,TOK_ID,"expected identifier");
+          Token id = *curr(p); expect(p,TOK_ID,"expected identifier");
           astvec_push(&names, ast_make_ident(id.lexeme?id.lexeme:"", id.line));
           if(!match(p,TOK_COMMA)) break;
         }
         expect(p,TOK_KW_IN,"expected 'in'");
-      }
+      } else advance(p); /* 'in' */
       ASTVec iters = parse_explist(p);
       expect(p,TOK_KW_DO,"expected 'do'"); AST *body=parse_block(p); expect(p,TOK_KW_END,"expected 'end'");
       return ast_make_for_in(names, iters, body, name.line);
@@ -695,40 +781,43 @@ return ast_make_try_catch_finally(tryBlock, catchBlock, finallyBlock, exceptionV
 
   if(match(p,TOK_KW_LOCAL)){
     if(match(p,TOK_KW_FUNCTION)){
-      Token nm=curr(p); expect(p,TOK_ID,"expected function name");
+      Token nm = *curr(p); expect(p,TOK_ID,"expected function name");
       AST *name = ast_make_ident(nm.lexeme?nm.lexeme:"", nm.line);
       expect(p,TOK_LPAREN,"expected '('"); ASTVec params={0}; bool vararg=false; parse_paramlist(p,&params,&vararg);
       expect(p,TOK_RPAREN,"expected ')'");
       AST *body=parse_block(p); expect(p,TOK_KW_END,"expected 'end'");
       return ast_make_func_stmt(true, name, params, vararg, body, nm.line);
     } else {
-      Token nm=curr(p); expect(p,TOK_ID,"expected identifier after 'local'");
+      Token nm = *curr(p); expect(p,TOK_ID,"expected identifier after 'local'");
       ASTVec names={0}; astvec_push(&names, ast_make_ident(nm.lexeme?nm.lexeme:"", nm.line));
       while(match(p,TOK_COMMA)){
-        Token nx=curr(p); expect(p,TOK_ID,"expected identifier");
+        Token nx = *curr(p); expect(p,TOK_ID,"expected identifier");
         astvec_push(&names, ast_make_ident(nx.lexeme?nx.lexeme:"", nx.line));
       }
       ASTVec inits={0}; bool has_init=false;
       if(match(p,TOK_ASSIGN)){ has_init=true; inits = parse_explist(p); }
       ASTVec lvals={0}; for(size_t i=0;i<names.count;i++) astvec_push(&lvals, names.items[i]);
+      AST *decl;
       if(has_init){
-        return ast_make_assign_list(lvals, inits, nm.line);
+        decl = ast_make_assign_list(lvals, inits, nm.line);
       } else {
         ASTVec emptyR = {0};
-        return ast_make_assign_list(lvals, emptyR, nm.line);
+        decl = ast_make_assign_list(lvals, emptyR, nm.line);
       }
+      decl->as.massign.is_local = true;
+      return decl;
     }
   }
 
   if(match(p,TOK_KW_RETURN)){
-    int line=curr(p).line; ASTVec xs={0};
+    int line=curr(p)->line; ASTVec xs={0};
     if(!check(p,TOK_KW_END)&&!check(p,TOK_KW_ELSE)&&!check(p,TOK_KW_UNTIL)&&!check(p,TOK_EOF)){
       xs = parse_explist(p);
     }
     return ast_make_return_list(xs,line);
   }
 
-  int line = curr(p).line;
+  int line = curr(p)->line;
   AST *e = expression(p);
   if (e && (e->kind == AST_ASSIGN || e->kind == AST_ASSIGN_LIST)) {
     return e;
@@ -0,0 +1,290 @@
+// resolver.c — static scope resolution (see include/resolver.h)
+#include <stdlib.h>
+#include <string.h>
+#include "../include/resolver.h"
+#include "../include/util.h"
+
+/* One Scope per runtime Env: a function's parameter env or a block env. */
+typedef struct Scope {
+  struct Scope *parent;
+  bool is_func;        /* parameter scope: "..." does not look past it */
+  const char **names;  /* slot -> name, in declaration order */
+  unsigned char *captured; /* slot -> referenced from a nested function */
+  int count, cap;
+  bool noenv;          /* block declaring no locals: no env at runtime, no hop */
+  bool heap;           /* the env may outlive its activation */
+  bool closes;         /* declares <close> locals */
+  int protect;         /* function scope: open try statements */
+} Scope;
+
+static AstArena *arena;   /* the chunk being resolved */
+
+static void resolve_expr(Scope *s, AST *n);
+static void resolve_stmt(Scope *s, AST *n);
+static void resolve_block(Scope *parent, AST *blk, ASTVec *pre, const char *pre_name, AST *until);
+
+static int declare(Scope *s, const char *name){
+  if (s->count == s->cap) {
+    s->cap = s->cap ? s->cap * 2 : 4;
+    s->names = realloc(s->names, sizeof(char*) * (size_t)s->cap);
+    s->captured = realloc(s->captured, (size_t)s->cap);
+  }
+  s->names[s->count] = name;
+  s->captured[s->count] = 0;
+  return s->count++;
+}
+
+/* Moves a finished scope's layout into the chunk's arena. */
+static void keep_layout(Scope *s, const char ***names, unsigned char **captured){
+  *names = NULL; *captured = NULL;
+  if (s->count) {
+    *names = ast_arena_alloc(arena, sizeof(char*) * (size_t)s->count);
+    memcpy(*names, s->names, sizeof(char*) * (size_t)s->count);
+    *captured = ast_arena_alloc(arena, (size_t)s->count);
+    memcpy(*captured, s->captured, (size_t)s->count);
+  }
+  free(s->names);
+  free(s->captured);
+}
+
+/* The newest declaration wins, so later locals shadow earlier ones. */
+static void bind(Scope *s, AST *id){
+  const char *name = id->as.ident.name;
+  bool dots = strcmp(name, "...") == 0;
+  int depth = 0;
+  bool crossed = false;  /* left the current function: the binding is an upvalue */
+  for (Scope *cur = s; cur; cur = cur->parent) {
+    for (int i = cur->count - 1; i >= 0; i--) {
+      if (strcmp(cur->names[i], name) == 0) {
+        id->as.ident.depth = depth;
+        id->as.ident.slot  = i;
+        if (crossed) cur->captured[i] = 1;
+        return;
+      }
+    }
+    if (cur->is_func) {
+      if (dots) break;
+      crossed = true;
+    }
+    if (!cur->noenv) depth++;
+  }
+  id->as.ident.depth = -1;
+  id->as.ident.slot  = -1;
+}
+
+static void declare_ident(Scope *s, AST *id){
+  id->as.ident.depth = 0;
+  id->as.ident.slot  = declare(s, id->as.ident.name);
+}
+
+/* A closure keeps its defining env and every env above it, so those
+   cannot live on the value stack. */
+static void mark_heap(Scope *s){
+  for (; s; s = s->parent) s->heap = true;
+}
+
+static Scope *func_scope(Scope *s){
+  while (!s->is_func) s = s->parent;
+  return s;
+}
+
+/* `return f()` can reuse the frame unless something must still run after
+   f returns: a try statement or a <close> local of this function. */
+static bool tail_ok(Scope *s){
+  for (; !s->is_func; s = s->parent) if (s->closes) return false;
+  return !s->closes && s->protect == 0;
+}
+
+static const char **resolve_function(Scope *parent, ASTVec *params, bool vararg, AST *body,
+                                     unsigned char **captured, bool *heap){
+  mark_heap(parent);
+  Scope fs = { .parent = parent, .is_func = true };
+  for (size_t i = 0; i < params->count; i++) {
+    AST *id = params->items[i];
+    if (id && id->kind == AST_IDENT) declare_ident(&fs, id);
+    else declare(&fs, "");
+  }
+  if (vararg) declare(&fs, "...");
+  if (body) resolve_block(&fs, body, NULL, NULL, NULL);
+  const char **names;
+  keep_layout(&fs, &names, captured);
+  *heap = fs.heap;
+  return names;
+}
+
+static void resolve_vec(Scope *s, ASTVec *v){
+  for (size_t i = 0; i < v->count; i++) resolve_expr(s, v->items[i]);
+}
+
+static void resolve_expr(Scope *s, AST *n){
+  if (!n) return;
+  switch (n->kind) {
+    case AST_IDENT:  bind(s, n); break;
+    case AST_UNARY:  resolve_expr(s, n->as.unary.expr); break;
+    case AST_BINARY:
+      resolve_expr(s, n->as.binary.lhs);
+      resolve_expr(s, n->as.binary.rhs);
+      break;
+    case AST_CALL:
+      resolve_expr(s, n->as.call.callee);
+      resolve_vec(s, &n->as.call.args);
+      break;
+    case AST_INDEX:
+      resolve_expr(s, n->as.index.target);
+      resolve_expr(s, n->as.index.index);
+      break;
+    case AST_FIELD:  resolve_expr(s, n->as.field.target); break;
+    case AST_TABLE:
+      resolve_vec(s, &n->as.table.keys);
+      resolve_vec(s, &n->as.table.values);
+      break;
+    case AST_FUNCTION:
+      n->as.fn.slot_names = resolve_function(s, &n->as.fn.params, n->as.fn.vararg, n->as.fn.body,
+                                             &n->as.fn.slot_captured, &n->as.fn.heap_env);
+      break;
+    case AST_ASSIGN:
+    case AST_ASSIGN_LIST:
+      resolve_stmt(s, n);
+      break;
+    default: break;
+  }
+}
+
+static void resolve_stmt(Scope *s, AST *n){
+  if (!n) return;
+  switch (n->kind) {
+    case AST_STMT_EXPR: resolve_expr(s, n->as.stmt_expr.expr); break;
+    case AST_ASSIGN:
+      resolve_expr(s, n->as.assign.rhs);
+      resolve_expr(s, n->as.assign.lhs_ident);
+      break;
+    case AST_ASSIGN_LIST:
+      resolve_vec(s, &n->as.massign.rvals);
+      if (n->as.massign.is_local) {
+        for (size_t i = 0; i < n->as.massign.lvals.count; i++)
+          declare_ident(s, n->as.massign.lvals.items[i]);
+      } else {
+        resolve_vec(s, &n->as.massign.lvals);
+      }
+      break;
+    case AST_VAR:
+      resolve_expr(s, n->as.var.init);
+      n->as.var.slot = declare(s, n->as.var.name);
+      if (n->as.var.is_close) s->heap = s->closes = true;   /* closers are swept with the env */
+      break;
+    case AST_BLOCK: resolve_block(s, n, NULL, NULL, NULL); break;
+    case AST_IF:
+      resolve_expr(s, n->as.ifs.cond);
+      resolve_block(s, n->as.ifs.then_blk, NULL, NULL, NULL);
+      if (n->as.ifs.else_blk) {
+        if (n->as.ifs.else_blk->kind == AST_IF) resolve_stmt(s, n->as.ifs.else_blk);
+        else resolve_block(s, n->as.ifs.else_blk, NULL, NULL, NULL);
+      }
+      break;
+    case AST_WHILE:
+      resolve_expr(s, n->as.whiles.cond);
+      resolve_block(s, n->as.whiles.body, NULL, NULL, NULL);
+      break;
+    case AST_REPEAT:
+      /* the condition can see the body's locals */
+      resolve_block(s, n->as.repeatstmt.body, NULL, NULL, n->as.repeatstmt.cond);
+      break;
+    case AST_FOR_NUM:
+      resolve_expr(s, n->as.fornum.start);
+      resolve_expr(s, n->as.fornum.end);
+      resolve_expr(s, n->as.fornum.step);
+      resolve_block(s, n->as.fornum.body, NULL, n->as.fornum.var, NULL);
+      break;
+    case AST_FOR_IN:
+      resolve_vec(s, &n->as.forin.iters);
+      resolve_block(s, n->as.forin.body, &n->as.forin.names, NULL, NULL);
+      break;
+    case AST_RETURN:
+      resolve_vec(s, &n->as.ret.values);
+      n->as.ret.tail = n->as.ret.values.count == 1 && n->as.ret.values.items[0]->kind == AST_CALL &&
+                       !n->as.ret.values.items[0]->paren && tail_ok(s);
+      break;
+    case AST_FUNC_STMT: {
+      AST *name = n->as.fnstmt.name;
+      /* local function f: f is in scope inside its own body */
+      if (n->as.fnstmt.is_local && name->kind == AST_IDENT) declare_ident(s, name);
+      else resolve_expr(s, name);
+      n->as.fnstmt.slot_names = resolve_function(s, &n->as.fnstmt.params, n->as.fnstmt.vararg, n->as.fnstmt.body,
+                                                 &n->as.fnstmt.slot_captured, &n->as.fnstmt.heap_env);
+      break;
+    }
+    case AST_TRY: {
+      Scope *fs = func_scope(s);
+      fs->protect++;
+      resolve_block(s, n->as.trycatch.try_block, NULL, NULL, NULL);
+      if (n->as.trycatch.catch_block)
+        resolve_block(s, n->as.trycatch.catch_block, NULL, n->as.trycatch.catch_var, NULL);
+      if (n->as.trycatch.finally_block)
+        resolve_block(s, n->as.trycatch.finally_block, NULL, NULL, NULL);
+      fs->protect--;
+      break;
+    }
+    default: break;
+  }
+}
+
+/* Whether a block's own statements declare locals (the declare() calls
+   resolve_stmt will make), known before its body is resolved. */
+static bool declares_locals(AST *blk){
+  ASTVec *S = &blk->as.block.stmts;
+  for (size_t i = 0; i < S->count; i++) {
+    AST *st = S->items[i];
+    switch (st->kind) {
+      case AST_VAR: return true;
+      case AST_ASSIGN_LIST: if (st->as.massign.is_local && st->as.massign.lvals.count) return true; break;
+      case AST_FUNC_STMT: if (st->as.fnstmt.is_local && st->as.fnstmt.name->kind == AST_IDENT) return true; break;
+      default: break;
+    }
+  }
+  return false;
+}
+
+static BlockLabel *label_table(AST *blk){
+  ASTVec *S = &blk->as.block.stmts;
+  unsigned n = 0;
+  for (size_t i = 0; i < S->count; i++) n += S->items[i]->kind == AST_LABEL;
+  if (!n) return NULL;
+  BlockLabel *t = ast_arena_alloc(arena, sizeof(*t) * (n + 1));   /* zeroed: the terminator */
+  n = 0;
+  for (size_t i = 0; i < S->count; i++)
+    if (S->items[i]->kind == AST_LABEL) t[n++] = (BlockLabel){ S->items[i]->as.label.label, (unsigned)i };
+  return t;
+}
+
+/* pre / pre_name: loop control variables, bound to the first slots of the body.
+   until: repeat-until condition, resolved inside the body scope. */
+static void resolve_block(Scope *parent, AST *blk, ASTVec *pre, const char *pre_name, AST *until){
+  if (!blk) return;
+  if (blk->kind != AST_BLOCK) { resolve_stmt(parent, blk); return; }
+  Scope bs = { .parent = parent, .is_func = false };
+  bs.noenv = !pre_name && !(pre && pre->count) && !declares_locals(blk);
+  if (pre_name) declare(&bs, pre_name);
+  if (pre) {
+    for (size_t i = 0; i < pre->count; i++) {
+      AST *id = pre->items[i];
+      if (id && id->kind == AST_IDENT) declare_ident(&bs, id);
+      else declare(&bs, "");
+    }
+  }
+  ASTVec *S = &blk->as.block.stmts;
+  for (size_t i = 0; i < S->count; i++) resolve_stmt(&bs, S->items[i]);
+  resolve_expr(&bs, until);
+  blk->as.block.nslots = bs.count;
+  blk->as.block.labels = label_table(blk);
+  keep_layout(&bs, &blk->as.block.slot_names, &blk->as.block.slot_captured);
+  blk->as.block.heap_env = bs.heap;
+}
+
+void resolve_chunk(AST *program){
+  if (!program) return;
+  arena = program->as.block.arena;
+  Scope cs = { .parent = NULL, .is_func = true };
+  resolve_block(&cs, program, NULL, NULL, NULL);
+  free(cs.names);
+  free(cs.captured);
+}
@@ -1,15 +1,26 @@
 #include "../include/table.h"
 #include "../include/interpreter.h"
+#include "../include/icache.h"
+#include "../include/gc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/* Hybrid table: integer keys 1..asize live in a dense array part that grows
+   by doubling when a store lands just past its end; everything else goes to
+   the hash part.
+   Open-addressing hash part: power-of-two slot array, linear probing.
+   A key whose value is set to nil stays in its slot as a dead entry (so
+   probe chains and in-progress traversals stay valid); dead entries are
+   reused by later inserts on the same chain and dropped on rehash. */
+#define TBL_MIN_CAP 4
 
 void  tbl_set_public(Table *t, Value key, Value val) { tbl_set(t, key, val); }
 int   tbl_get_public(Table *t, Value key, Value *out) { return tbl_get(t, key, out); }
 void tbl_foreach_public(struct Table *t, TableIterCallback callback, void *userdata) {
     if (!t || !callback) return;
-    for (int i = 0; i < t->cap; i++) {
-        for (TableEntry *e = t->buckets[i]; e; e = e->next) {
-            callback(e->key, e->val, userdata);
-        }
-    }
+    int it = 0; Value k, v;
+    while (tbl_next(t, &it, &k, &v)) callback(k, v, userdata);
 }
 
 Value V_table(void){ return (Value){.tag=VAL_TABLE,.as.t=tbl_new()}; }
@@ -24,31 +35,257 @@ int value_equal(Value a, Value b){
     case VAL_BOOL: return a.as.b==b.as.b;
     case VAL_INT: return a.as.i==b.as.i;
     case VAL_NUM: return a.as.n==b.as.n;
-    case VAL_STR: return a.as.s->len==b.as.s->len && memcmp(a.as.s->data,b.as.s->data,a.as.s->len)==0;
+    case VAL_STR:
+      if(a.as.s==b.as.s) return 1;
+      if(a.as.s->interned && b.as.s->interned) return 0;
+      if(a.as.s->len!=b.as.s->len) return 0;
+      if(a.as.s->hashed && b.as.s->hashed && a.as.s->hash!=b.as.s->hash) return 0;
+      return memcmp(a.as.s->data,b.as.s->data,a.as.s->len)==0;
     default: return a.as.t==b.as.t;
   }
 }
-void tbl_set(Table *t, Value key, Value val){
-  unsigned long long h=hash_value(key);
-  int idx = (int)(h % t->cap);
-  for(TableEntry *e=t->buckets[idx]; e; e=e->next){
-    if(value_equal(e->key,key)){ e->val=val; return; }
+/* integer-valued keys (including integral floats) share one identity */
+static int key_index(Value key, long long *i){
+  if(key.tag==VAL_INT){ *i=key.as.i; return 1; }
+  if(key.tag==VAL_NUM && key.as.n>=-9.2e18 && key.as.n<=9.2e18 && (double)(long long)key.as.n==key.as.n){
+    *i=(long long)key.as.n; return 1;
+  }
+  return 0;
+}
+/* slot holding key, or -1 */
+static int tbl_find(Table *t, Value key){
+  if(!t->cap) return -1;
+  unsigned mask=(unsigned)t->cap-1;
+  unsigned i=(unsigned)hash_value(key)&mask;
+  for(;;){
+    TableEntry *e=&t->entries[i];
+    if(e->key.tag==VAL_NIL) return -1;
+    if(value_equal(e->key,key)) return (int)i;
+    i=(i+1)&mask;
+  }
+}
+static TableEntry *hash_live(Table *t, Value key){
+  int slot=tbl_find(t,key);
+  if(slot<0 || t->entries[slot].val.tag==VAL_NIL) return NULL;
+  return &t->entries[slot];
+}
+static void tbl_resize(Table *t, int ncap){
+  TableEntry *old=t->entries; int ocap=t->cap;
+  t->entries=xmalloc(sizeof(TableEntry)*(size_t)ncap);
+  memset(t->entries,0,sizeof(TableEntry)*(size_t)ncap);
+  gc_account((long long)(ncap-ocap)*(long long)sizeof(TableEntry));
+  t->cap=ncap; t->count=0; t->used=0;
+  unsigned mask=(unsigned)ncap-1;
+  for(int j=0;j<ocap;j++){
+    TableEntry *e=&old[j];
+    if(e->key.tag==VAL_NIL || e->val.tag==VAL_NIL) continue;
+    unsigned i=(unsigned)hash_value(e->key)&mask;
+    while(t->entries[i].key.tag!=VAL_NIL) i=(i+1)&mask;
+    t->entries[i]=*e;
+    t->count++; t->used++;
+  }
+  free(old);
+}
+/* Shapes: a table's string keys, in insertion order, as a node of one
+   global transition tree (0 is the empty table, which is what a zeroed
+   Table starts as). Tables built the same way share a shape, so an
+   inline cache can tell that a receiver lacks a key without probing it.
+   Removing a key, a non-interned key, too many keys or running out of
+   shapes leaves a table untracked. An edge's key may outlive its string:
+   a later string at that address is a different key, which is still
+   absent from anything the shape was known to lack. */
+#define SHAPE_MAX      (1u << 16)
+#define SHAPE_MAX_KEYS 64
+typedef struct { unsigned parent, child; Str *key; } ShapeEdge;
+static ShapeEdge *shape_edges;
+static unsigned shape_cap, shape_count = 1;
+static unsigned char shape_keys[SHAPE_MAX];
+
+static inline unsigned shape_hash(unsigned parent, Str *key){
+  return (unsigned)((uintptr_t)key >> 4) * 0x9e3779b1u ^ parent;
+}
+static unsigned shape_child(unsigned parent, Str *key){
+  if(parent==TBL_SHAPE_NONE || !key->interned || shape_keys[parent]>=SHAPE_MAX_KEYS) return TBL_SHAPE_NONE;
+  if(shape_count*4 >= shape_cap*3){
+    unsigned ncap=shape_cap? shape_cap*2 : 256;
+    ShapeEdge *ne=calloc(ncap, sizeof(*ne));
+    if(!ne){ fprintf(stderr,"OOM\n"); exit(1); }
+    for(unsigned j=0;j<shape_cap;j++){
+      if(!shape_edges[j].key) continue;
+      unsigned i=shape_hash(shape_edges[j].parent, shape_edges[j].key)&(ncap-1);
+      while(ne[i].key) i=(i+1)&(ncap-1);
+      ne[i]=shape_edges[j];
+    }
+    free(shape_edges);
+    shape_edges=ne; shape_cap=ncap;
+  }
+  unsigned mask=shape_cap-1, i=shape_hash(parent,key)&mask;
+  for(; shape_edges[i].key; i=(i+1)&mask)
+    if(shape_edges[i].parent==parent && shape_edges[i].key==key) return shape_edges[i].child;
+  if(shape_count>=SHAPE_MAX) return TBL_SHAPE_NONE;
+  shape_edges[i]=(ShapeEdge){ parent, shape_count, key };
+  shape_keys[shape_count]=(unsigned char)(shape_keys[parent]+1);
+  return shape_count++;
+}
+/* key joined (added) or left t's key set */
+static inline void shape_note(Table *t, Value key, bool added){
+  if(key.tag!=VAL_STR) return;
+  t->shape = added? shape_child(t->shape, key.as.s) : TBL_SHAPE_NONE;
+}
+
+/* Inline caches trust the key sets of the tables they resolved through
+   (t->proto) until ic_epoch moves: bump it when such a key set changes,
+   or when a metafield ("_mt", "__index", ...) is rebound. */
+static inline void proto_write(Table *t, Value key, bool keyset){
+  if(t->proto && (keyset || (key.tag==VAL_STR && key.as.s->len && key.as.s->data[0]=='_'))) ic_epoch++;
+}
+static void hash_set(Table *t, Value key, Value val){
+  gc_barrier(t);
+  int slot=tbl_find(t,key);
+  if(slot>=0){
+    TableEntry *e=&t->entries[slot];
+    bool was=e->val.tag!=VAL_NIL, is=val.tag!=VAL_NIL;
+    if(!was && is) t->count++;
+    else if(was && !is) t->count--;
+    proto_write(t, key, was!=is);
+    if(was!=is) shape_note(t, key, is);
+    e->val=val;
+    return;
+  }
+  if(val.tag==VAL_NIL) return;
+  proto_write(t, key, true);
+  shape_note(t, key, true);
+  /* keep load (live + dead) under 3/4; size from live entries so churn shrinks */
+  if((t->used+1)*4 > t->cap*3){
+    int ncap=TBL_MIN_CAP;
+    while(ncap*3 < (t->count+1)*4) ncap<<=1;
+    tbl_resize(t, ncap);
+  }
+  unsigned mask=(unsigned)t->cap-1;
+  unsigned i=(unsigned)hash_value(key)&mask;
+  int reuse=-1;
+  while(t->entries[i].key.tag!=VAL_NIL){
+    if(reuse<0 && t->entries[i].val.tag==VAL_NIL) reuse=(int)i;
+    i=(i+1)&mask;
   }
-  TableEntry *ne=xmalloc(sizeof(*ne));
-  ne->key=key; ne->val=val; ne->next=t->buckets[idx];
-  t->buckets[idx]=ne;
+  if(reuse>=0) i=(unsigned)reuse; else t->used++;
+  t->entries[i].key=key; t->entries[i].val=val;
+  t->count++;
+}
+static void arr_extend(Table *t){
+  while(t->alen<t->asize && t->arr[t->alen].tag!=VAL_NIL) t->alen++;
+}
+/* double the array part, pulling the keys it now covers out of the hash */
+static void arr_grow(Table *t){
+  int nsize=t->asize? t->asize*2 : TBL_MIN_CAP;
+  t->arr=realloc(t->arr, sizeof(Value)*(size_t)nsize);
+  if(!t->arr){ fprintf(stderr,"OOM\n"); exit(1); }
+  gc_account((long long)(nsize-t->asize)*(long long)sizeof(Value));
+  for(int k=t->asize;k<nsize;k++){
+    t->arr[k]=V_nil();
+    if(t->count){
+      TableEntry *e=hash_live(t, V_int(k+1));
+      if(e){ t->arr[k]=e->val; e->val=V_nil(); t->count--; }
+    }
+  }
+  t->asize=nsize;
+  arr_extend(t);
+}
+void tbl_seti(Table *t, long long i, Value val){
+  gc_barrier(t);
+  if(i>=1 && i<=t->asize){
+    t->arr[i-1]=val;
+    if(val.tag==VAL_NIL){ if(i<=t->alen) t->alen=(int)i-1; }
+    else if(i==t->alen+1) arr_extend(t);
+    return;
+  }
+  /* appending just past the array part grows it, unless the key already
+     lives in the hash (existing fields must stay put during traversal) */
+  if(i==(long long)t->asize+1 && val.tag!=VAL_NIL && t->asize<(1<<26) && !hash_live(t,V_int(i))){
+    arr_grow(t);
+    t->arr[i-1]=val;
+    arr_extend(t);
+    while(t->alen==t->asize && t->count && hash_live(t,V_int((long long)t->asize+1))) arr_grow(t);
+    return;
+  }
+  hash_set(t, V_int(i), val);
+}
+int tbl_geti(Table *t, long long i, Value *out){
+  if(i>=1 && i<=t->asize){
+    if(t->arr[i-1].tag==VAL_NIL) return 0;
+    *out=t->arr[i-1];
+    return 1;
+  }
+  TableEntry *e=hash_live(t, V_int(i));
+  if(!e) return 0;
+  *out=e->val;
+  return 1;
+}
+void tbl_set(Table *t, Value key, Value val){
+  long long i;
+  if(key_index(key,&i)){ tbl_seti(t,i,val); return; }
+  if(key.tag==VAL_NIL) return;
+  if(key.tag==VAL_NUM && key.as.n!=key.as.n) return; /* NaN is never a key */
+  hash_set(t,key,val);
+}
+/* Hash slot holding a live non-integer key, or -1. */
+int tbl_slot(Table *t, Value key){
+  int slot=tbl_find(t,key);
+  return (slot>=0 && t->entries[slot].val.tag!=VAL_NIL)? slot : -1;
 }
 int tbl_get(Table *t, Value key, Value *out){
-  unsigned long long h=hash_value(key);
-  int idx = (int)(h % t->cap);
-  for(TableEntry *e=t->buckets[idx]; e; e=e->next){
-    if(value_equal(e->key,key)){ *out=e->val; return 1; }
+  long long i;
+  if(key_index(key,&i)) return tbl_geti(t,i,out);
+  TableEntry *e=hash_live(t,key);
+  if(!e) return 0;
+  *out=e->val;
+  return 1;
+}
+/* A border (#t): O(1) unless the sequence continues into the hash part. */
+long long tbl_len(Table *t){
+  if(t->alen<t->asize || !t->count) return t->alen;
+  long long n=t->alen;
+  while(hash_live(t,V_int(n+1))) n++;
+  return n;
+}
+/* Direct access to t[1..n] when all of it sits in the array part, else NULL.
+   The pointer is invalidated by any insertion into t. */
+Value *tbl_array_part(Table *t, long long n){
+  return (n>=0 && n<=t->alen)? t->arr : NULL;
+}
+/* Iterate live entries, array part first; *iter starts at 0. */
+int tbl_next(Table *t, int *iter, Value *key, Value *val){
+  int i=*iter;
+  for(;i<t->asize;i++){
+    if(t->arr[i].tag!=VAL_NIL){
+      *key=V_int(i+1); *val=t->arr[i]; *iter=i+1;
+      return 1;
+    }
+  }
+  for(i-=t->asize;i<t->cap;i++){
+    TableEntry *e=&t->entries[i];
+    if(e->key.tag!=VAL_NIL && e->val.tag!=VAL_NIL){
+      *key=e->key; *val=e->val; *iter=t->asize+i+1;
+      return 1;
+    }
   }
+  *iter=t->asize+t->cap;
   return 0;
 }
+/* Lua-style next(): entry following key (nil key = first). Returns 0 at end
+   or if key is not in the table. */
+int tbl_next_key(Table *t, Value key, Value *nkey, Value *nval){
+  int it=0;
+  long long i;
+  if(key_index(key,&i) && i>=1 && i<=t->asize) it=(int)i;
+  else if(key.tag!=VAL_NIL){
+    if(key_index(key,&i)) key=V_int(i);
+    int slot=tbl_find(t,key);
+    if(slot<0) return 0;
+    it=t->asize+slot+1;
+  }
+  return tbl_next(t,&it,nkey,nval);
+}
 Table *tbl_new(void){
-  Table *t=xmalloc(sizeof(*t));
-  t->cap=32; t->buckets=xmalloc(sizeof(TableEntry*)*t->cap);
-  for(int i=0;i<t->cap;i++) t->buckets[i]=NULL;
-  return t;
+  return gc_alloc(GC_TABLE, sizeof(Table));
 }
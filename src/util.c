@@ -1,33 +1,52 @@
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "../include/util.h"
+#include "../include/gc.h"
 
 void *xmalloc(size_t n){ void *p=malloc(n); if(!p){fprintf(stderr,"OOM\n"); exit(1);} return p; }
 char *xstrdup(const char*s){ if(!s) s=""; size_t n=strlen(s)+1; char *p=xmalloc(n); memcpy(p,s,n); return p; }
 Value op_len(Value v){
   if (v.tag == VAL_STR)  return V_int(v.as.s->len);
-  if (v.tag == VAL_TABLE){
-    long long n = 0, i = 1; Value out;
-    while (tbl_get(v.as.t, V_int(i), &out)) { n++; i++; }
-    return V_int(n);
-  }
+  if (v.tag == VAL_TABLE) return V_int(tbl_len(v.as.t));
   return V_int(0);
 }
-FILE *open_string_as_FILE(const char *code) {
-#ifdef __APPLE__
-    // macOS doesn’t support fmemopen
-    FILE *f = tmpfile();
+/* Source files are mapped read-only rather than copied; the lexer scans
+   the mapping directly. */
+const char *map_file(const char *path, size_t *len){
+#if defined(_WIN32)
+    FILE *f = fopen(path, "rb");
     if (!f) return NULL;
-    fwrite(code, 1, strlen(code), f);
-    rewind(f);
-    return f;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = (n >= 0) ? malloc((size_t)n + 1) : NULL;
+    size_t rd = buf ? fread(buf, 1, (size_t)n, f) : 0;
+    fclose(f);
+    if (buf) buf[rd] = '\0';
+    *len = rd;
+    return buf;
 #else
-    FILE *f = fmemopen((void *)code, strlen(code), "r");
-    if (!f) {
-        f = tmpfile();
-        if (!f) return NULL;
-        fwrite(code, 1, strlen(code), f);
-        rewind(f);
-    }
-    return f;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) { close(fd); return NULL; }
+    *len = (size_t)st.st_size;
+    if (*len == 0) { close(fd); return ""; }
+    void *p = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return p == MAP_FAILED ? NULL : p;
+#endif
+}
+void unmap_file(const char *p, size_t len){
+#if defined(_WIN32)
+    (void)len;
+    free((void*)p);
+#else
+    if (len) munmap((void*)p, len);
 #endif
 }
 void print_value(Value v){
@@ -40,6 +59,9 @@ void print_value(Value v){
     case VAL_TABLE: printf("table:%p", (void*)v.as.t); break;
     case VAL_CFUNC: printf("function:%p", (void*)v.as.cfunc); break;
     case VAL_FUNC:  printf("function:%p",  (void*)v.as.fn); break;
+    case VAL_COROUTINE: printf("thread: %p", (void*)v.as.co); break;
+    case VAL_PROMISE: printf("promise:%p", (void*)v.as.pr); break;
+    case VAL_MULTI: break;
   }
 }
 Str *to_string_buf(Value v){
@@ -53,6 +75,9 @@ Str *to_string_buf(Value v){
     case VAL_TABLE: snprintf(tmp,sizeof(tmp),"table:%p",(void*)v.as.t); return Str_new_len(tmp,(int)strlen(tmp));
     case VAL_CFUNC: snprintf(tmp,sizeof(tmp),"function:%p",(void*)v.as.cfunc); return Str_new_len(tmp,(int)strlen(tmp));
     case VAL_FUNC:  snprintf(tmp,sizeof(tmp),"function:%p",(void*)v.as.fn); return Str_new_len(tmp,(int)strlen(tmp));
+    case VAL_COROUTINE: snprintf(tmp,sizeof(tmp),"thread: %p",(void*)v.as.co); return Str_new_len(tmp,(int)strlen(tmp));
+    case VAL_PROMISE: snprintf(tmp,sizeof(tmp),"promise:%p",(void*)v.as.pr); return Str_new_len(tmp,(int)strlen(tmp));
+    case VAL_MULTI: break;
   }
   return Str_new_len("<unknown>",9);
 }
@@ -61,6 +86,68 @@ Value V_nil(void){ Value v={.tag=VAL_NIL}; return v; }
 Value V_bool(bool b){ Value v={.tag=VAL_BOOL}; v.as.b=b?1:0; return v; }
 Value V_int(long long x){ Value v={.tag=VAL_INT}; v.as.i=x; return v; }
 Value V_num(double x){ Value v={.tag=VAL_NUM}; v.as.n=x; return v; }
-Str *Str_new_len(const char *s,int len){ Str *st=xmalloc(sizeof(*st)); st->len=len; st->data=xmalloc(len+1); if(s&&len) memcpy(st->data,s,len); st->data[len]='\0'; return st; }
+static unsigned long long str_hash_bytes(const char *s, int len){
+  unsigned long long h=1469598103934665603ULL;
+  for(int i=0;i<len;i++){ h^=(unsigned char)s[i]; h*=1099511628211ULL; }
+  return h;
+}
+/* one block: the bytes follow the header */
+static Str *str_alloc(const char *s, int len){
+  Str *st=gc_alloc(GC_STR, sizeof(*st)+(size_t)len+1); st->len=len; st->data=(char*)(st+1);
+  if(s&&len) memcpy(st->data,s,len);
+  st->data[len]='\0';
+  return st;
+}
+unsigned long long Str_hash(Str *s){
+  if(!s->hashed){ s->hash=str_hash_bytes(s->data,s->len); s->hashed=1; }
+  return s->hash;
+}
+
+/* Intern table for short strings: open addressing over Str*. It holds its
+   strings weakly: the collector prunes the dead ones before sweeping. */
+static Str **g_strtab; static int g_strtab_cap, g_strtab_count;
+static void strtab_put(Str **tab, int cap, Str *st){
+  unsigned j=(unsigned)st->hash&(unsigned)(cap-1);
+  while(tab[j]) j=(j+1)&(unsigned)(cap-1);
+  tab[j]=st;
+}
+static void strtab_grow(void){
+  int ncap=g_strtab_cap? g_strtab_cap*2 : 256;
+  Str **nt=xmalloc(sizeof(Str*)*(size_t)ncap);
+  memset(nt,0,sizeof(Str*)*(size_t)ncap);
+  for(int i=0;i<g_strtab_cap;i++) if(g_strtab[i]) strtab_put(nt,ncap,g_strtab[i]);
+  free(g_strtab); g_strtab=nt; g_strtab_cap=ncap;
+}
+void strtab_prune(void){
+  Str **nt=xmalloc(sizeof(Str*)*(size_t)g_strtab_cap);
+  memset(nt,0,sizeof(Str*)*(size_t)g_strtab_cap);
+  g_strtab_count=0;
+  for(int i=0;i<g_strtab_cap;i++){
+    Str *st=g_strtab[i];
+    if(st && !gc_isdead(st)){ strtab_put(nt,g_strtab_cap,st); g_strtab_count++; }
+  }
+  free(g_strtab); g_strtab=nt;
+}
+static Str *str_intern(const char *s, int len){
+  unsigned long long h=str_hash_bytes(s,len);
+  if(g_strtab_cap){
+    unsigned mask=(unsigned)g_strtab_cap-1;
+    for(unsigned j=(unsigned)h&mask; g_strtab[j]; j=(j+1)&mask){
+      Str *st=g_strtab[j];
+      if(st->hash==h && st->len==len && memcmp(st->data,s,(size_t)len)==0) return st;
+    }
+  }
+  /* allocate before probing for a slot: the allocation may prune the table */
+  Str *st=str_alloc(s,len);
+  st->hash=h; st->hashed=1; st->interned=1;
+  if((g_strtab_count+1)*4 > g_strtab_cap*3) strtab_grow();
+  strtab_put(g_strtab,g_strtab_cap,st); g_strtab_count++;
+  return st;
+}
+/* NULL s yields a fresh, writable, uninterned buffer of len bytes. */
+Str *Str_new_len(const char *s,int len){
+  if(s && len<=STR_SHORT_MAX) return str_intern(s,len);
+  return str_alloc(s,len);
+}
 Value V_str_from_c(const char *s){ if(!s) s=""; return (Value){.tag=VAL_STR,.as.s=Str_new_len(s,(int)strlen(s))}; }
 unsigned long long hash_mix(unsigned long long x){ x ^= x>>33; x*=0xff51afd7ed558ccdULL; x ^= x>>33; x*=0xc4ceb9fe1a85ec53ULL; x ^= x>>33; return x; }
@@ -1,30 +1,73 @@
 #include "../include/vm.h"
+#include "../include/gc.h"
+#include "../include/err.h"
+#include <limits.h>
+#include <stdint.h>
+#include <sys/resource.h>
 char path_buf[2048];
 
-Value vm_pop(VM *vm) {
-    if (vm->top < 0) {
-        vm_raise(vm, V_str_from_c("stack underflow"));
-    }
-    return vm->stack[vm->top--];
+/* The whole stack is reserved up front so windows into it stay put;
+   calloc hands out untouched pages, so only the used part costs memory. */
+void vm_stack_init(VM *vm) {
+    vm->stack = calloc(STACK_MAX, sizeof(Value));
+    if (!vm->stack) { fprintf(stderr, "[LuaX]: out of memory\n"); exit(1); }
+    vm->top = 0;
+    vm->stack_max = STACK_MAX;
+    vm_cstack_init(vm);
+}
+
+/* The main thread's C stack ends rlimit bytes below roughly where the
+   VM is set up (an unlimited stack is taken as 8 MiB). */
+void vm_cstack_init(VM *vm) {
+    size_t size = 8u << 20;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_STACK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) size = (size_t)rl.rlim_cur;
+    char *here = __builtin_frame_address(0);
+    vm->cstack_limit = size > 2 * CSTACK_MARGIN && (uintptr_t)here > size ? here - size + CSTACK_MARGIN : NULL;
+}
+
+void vm_stack_overflow(VM *vm) {
+    vm_raise(vm, V_str_from_c("stack overflow"));
 }
 
-void vm_push(VM *vm, Value v) {
-    if (vm->top >= STACK_MAX - 1) {
-        vm_raise(vm, V_str_from_c("stack overflow"));
+void vm_sethook(VM *vm, VmHook hook, void *ud, int count) {
+    if (!hook || count <= 0) { hook = NULL; ud = NULL; count = 0; }
+    vm->hook = hook;
+    vm->hook_ud = ud;
+    vm->hook_count = count;
+    vm->hook_left = count ? count - 1 : INT_MAX;
+}
+
+/* The budget is rearmed before the hook runs, so a hook that raises
+   leaves it armed for whoever catches the error, and again after it,
+   so the hook's own steps are not charged to the script. */
+void vm_hook_fire(VM *vm) {
+    vm->hook_left = vm->hook_count ? vm->hook_count - 1 : INT_MAX;
+    if (!vm->hook || vm->in_hook) return;
+    ErrFrame f;
+    vm->in_hook = true;
+    vm_err_push(vm, &f);
+    if (setjmp(f.jb) == 0) {
+        vm->hook(vm, vm->hook_ud);
+        vm_err_pop(vm);
+        vm->in_hook = false;
+        vm->hook_left = vm->hook_count ? vm->hook_count - 1 : INT_MAX;
+    } else {
+        Value err = vm->err_obj;
+        vm_err_pop(vm);
+        vm->in_hook = false;
+        vm_raise(vm, err);
     }
-    vm->stack[++vm->top] = v;
 }
+
 VM *vm_create_repl(void) {
     VM *vm = (VM*)malloc(sizeof(VM));
     if (!vm) return NULL;
 
     memset(vm, 0, sizeof(VM));
+    vm_stack_init(vm);
+    gc_attach(vm);
     vm->env = env_push(NULL);
-    vm->co_yielding = false;
-    vm->co_yield_vals = V_table();
-    vm->co_point.blk = NULL;
-    vm->co_point.pc = 0;
-    vm->co_call_env = NULL;
     vm->active_co = NULL;
     vm->err_frame = NULL;
     vm->err_obj = V_nil();
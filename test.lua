@@ -139,6 +139,14 @@ test("string length", function()
     assert(#"" == 0)
 end)
 
+test("computed strings as table keys", function()
+    local t = {abc = 1}
+    assert(t["ab" .. "c"] == 1)
+    local long = string.rep("x", 100)
+    t[long] = 2
+    assert(t[string.rep("x", 50) .. string.rep("x", 50)] == 2)
+end)
+
 -- Variables
 test("local variables", function()
     local x = 10
@@ -147,6 +155,21 @@ test("local variables", function()
     assert(x == 20)
 end)
 
+test("block scoping", function()
+    local x = 1
+    do local x = 2; assert(x == 2) end
+    assert(x == 1)
+    local function f() local inner = 10; return inner end
+    f()
+    assert(inner == nil)
+    local fs = {}
+    for i = 1, 3 do fs[i] = function() return i end end
+    assert(fs[1]() == 1 and fs[3]() == 3)
+    local n = 0
+    repeat local k = n; n = n + 1 until k >= 2
+    assert(n == 3)
+end)
+
 test("global variables", function()
     test_global = 42
     assert(test_global == 42)
@@ -185,6 +208,17 @@ test("table length", function()
     assert(#arr == 5)
 end)
 
+test("table insert and remove", function()
+    local t = {}
+    for i = 1, 100 do t[#t + 1] = i end
+    table.insert(t, 1, 0)
+    assert(#t == 101 and t[1] == 0 and t[101] == 100)
+    assert(table.remove(t, 1) == 0)
+    assert(table.remove(t) == 100 and #t == 99)
+    t[2.0] = "two"
+    assert(t[2] == "two")
+end)
+
 -- Functions
 test("function definition", function()
     local function add(a, b)
@@ -382,6 +416,15 @@ test("next function", function()
     assert(k ~= nil and v ~= nil)
 end)
 
+test("many keys and clearing during pairs", function()
+    local t = {}
+    for i = 1, 1000 do t["k" .. i] = i end
+    local n = 0
+    for k, v in pairs(t) do n = n + 1; t[k] = nil end
+    assert(n == 1000)
+    assert(next(t) == nil)
+end)
+
 -- Metatables
 test("setmetatable and getmetatable", function()
     local t = {}
@@ -487,6 +530,511 @@ test("nil in tables", function()
     assert(t[3] == 3)
 end)
 
+-- Closures and goto (run under both --engine=ast and --engine=bc)
+test("captured loop locals", function()
+    local fs = {}
+    for i = 1, 3 do
+        fs[i] = function() return i * 10 end
+    end
+    local n = 0
+    local function bump() n = n + 1; return n end
+    bump(); bump()
+    assert(fs[1]() == 10 and fs[3]() == 30)
+    assert(n == 2)
+end)
+
+test("goto continue", function()
+    local s = 0
+    for i = 1, 5 do
+        if i % 2 == 0 then goto continue end
+        s = s + i
+        ::continue::
+    end
+    assert(s == 9)
+end)
+
+test("small constant arithmetic", function()
+    local x = 10
+    x = x - 3
+    assert(x == 7)
+    local mt = {__add = function() return "added" end, __sub = function() return "subbed" end}
+    local o = setmetatable({}, mt)
+    assert(o + 1 == "added" and o - 1 == "subbed")
+    local n = 0
+    for _, w in ipairs({"a", "b", "c"}) do
+        if w < "b" then n = n + 1 end
+    end
+    assert(n == 1)
+end)
+
+test("__index chain lookups", function()
+    local Base = { kind = function() return "base" end }
+    local Mid = setmetatable({}, { __index = Base })
+    local o = setmetatable({}, { __index = Mid })
+    local function kind(x) return x.kind() end
+    assert(kind(o) == "base")
+    Mid.kind = function() return "mid" end
+    assert(kind(o) == "mid")
+    o.kind = function() return "own" end
+    assert(kind(o) == "own")
+    o.kind = nil
+    Mid.kind = nil
+    assert(kind(o) == "base")
+end)
+
+test("class method dispatch", function()
+    local A = class({ name = "A", init = function(self, n) self.n = n end, get = function(self) return self.n end })
+    local a, b = Class.new(A, 7), Class.new(A, 8)
+    assert(a:get() == 7 and b:get() == 8)
+end)
+
+test("collectgarbage reclaims garbage", function()
+    local keep = {}
+    for i = 1, 100 do keep[i] = { i } end
+    collectgarbage("collect")
+    local base = collectgarbage("count")
+    assert(base > 0)
+    for i = 1, 20000 do local t = { i, tostring(i) } end
+    collectgarbage("collect")
+    assert(collectgarbage("count") < base + 256)
+    assert(keep[100][1] == 100)
+    local old = collectgarbage("setpause", 150)
+    assert(type(old) == "number" and collectgarbage("setpause", old) == 150)
+end)
+
+test("generational collection", function()
+    assert(collectgarbage("generational") == "incremental")
+    local old = {}
+    collectgarbage("collect")
+    for r = 1, 50 do
+        old[r] = { r, "v" .. r }
+        for i = 1, 2000 do local junk = { i } end
+    end
+    for r = 1, 50 do assert(old[r][1] == r and old[r][2] == "v" .. r) end
+    assert(collectgarbage("step") == true)
+    assert(collectgarbage("incremental") == "generational")
+end)
+
+test("multiple returns and varargs", function()
+    local function three() return 1, 2, 3 end
+    local function count(...) return select("#", ...) end
+    local function pass(...) return ... end
+    assert(count(three()) == 3 and count(three(), 10) == 2)
+    assert(count(nil, nil) == 2 and count() == 0)
+    assert(#{three()} == 3 and #{three(), 10} == 2)
+    local a, b, c, d = pass(7, 8, 9)
+    assert(a == 7 and b == 8 and c == 9 and d == nil)
+    assert(select(2, three()) == 2 and select(-1, three()) == 3)
+    local x, y = table.unpack({ 4, 5 })
+    assert(x == 4 and y == 5)
+    local function pairsish(t) return next, t end
+    local n = 0
+    for k, v in pairsish({ p = 1, q = 2 }) do n = n + v end
+    assert(n == 3)
+end)
+
+test("call frames on the value stack", function()
+    local function depth(n)
+        local a, b = n, n * 2
+        if n == 0 then return 0 end
+        local r = depth(n - 1)
+        assert(a == n and b == n * 2)
+        return r + 1
+    end
+    assert(depth(1000) == 1000)
+    local fs = {}
+    for i = 1, 3 do
+        local j = i * 10
+        fs[i] = function() return j end
+    end
+    assert(fs[1]() == 10 and fs[3]() == 30)
+    local function boom(n) local x = n if n == 0 then error("deep") end return boom(n - 1) end
+    local ok, err = pcall(boom, 50)
+    assert(not ok)
+    local function sum(...) local s = 0 for _, v in ipairs({...}) do s = s + v end return s end
+    assert(depth(10) == 10 and sum(1, 2, 3) == 6)
+end)
+
+test("proper tail calls", function()
+    local function loop(n, acc) if n == 0 then return acc end return loop(n - 1, acc + 1) end
+    assert(loop(200000, 0) == 200000)
+    local even, odd
+    even = function(n) if n == 0 then return true end return odd(n - 1) end
+    odd = function(n) if n == 0 then return false end return even(n - 1) end
+    assert(even(100001) == false)
+    local function three() return 1, 2, 3 end
+    local function tail3() return three() end
+    local a, b, c = tail3()
+    assert(a == 1 and b == 2 and c == 3)
+    local function up(s) return string.upper(s) end
+    assert(up("ok") == "OK")
+end)
+
+test("lexing from a buffer", function()
+    local f = load("local endx, ifx = 0x10, .5 return endx + ifx, [==[a]]b]==], \"q\\x41\"")
+    local a, b, c = f()
+    assert(a == 16.5 and b == "a]]b" and c == "qA")
+    assert(load("--[[ long\ncomment ]] return 1e2")() == 100)
+    assert(load("")() == nil)
+end)
+
+test("parser lookahead window", function()
+    local t = {}
+    t[1 + 2 + 3 + 4 + 5 + 6 + 7 + 8 + 9 + 10 + 11 + 12 + 13 + 14 + 15 + 16], t.x = "a", "b"
+    assert(t[136] == "a" and t.x == "b")
+    local function mk() local a, b, c = 1, 2, 3 local d = {a, b, c, a + b + c} return d end
+    local v = mk()[4]
+    assert(v == 6)
+    local src = {}
+    for i = 1, 2000 do src[#src + 1] = "x = x + " .. i end
+    local f = load("x = 0 " .. table.concat(src, " ") .. " return x")
+    assert(f() == 2001000)
+end)
+
+test("loaded chunks are freed with their closures", function()
+    local keep
+    for i = 1, 200 do
+        local f = load("local n = 0 return function(t) n = n + 1 return t.name .. n end")
+        local g = f()
+        if i == 17 then keep = g end
+    end
+    collectgarbage()
+    collectgarbage()
+    assert(keep({name = "x"}) == "x1" and keep({name = "y"}) == "y2")
+end)
+
+test("required modules are cached as binary chunks", function()
+    if os.getenv("LUAX_NOCACHE") then return end
+    local name = "luax_cache_probe"   -- found through ./?.lua
+    local f = io.open(name .. ".lua", "w")
+    f:write("local M = {}\nfunction M.twice(x) return x * 2 end\nM.tag = 'v1'\nreturn M\n")
+    f:close()
+    os.remove(name .. ".luaxc")
+    local a = require(name)
+    local load_cached = loadfile(name .. ".luaxc")
+    os.remove(name .. ".lua")
+    os.remove(name .. ".luaxc")
+    assert(a.twice(21) == 42 and a.tag == "v1")
+    assert(load_cached, "no cache file written")
+    local b = load_cached()
+    assert(b ~= a and b.twice(4) == 8 and b.tag == "v1")
+end)
+
+test("constant folding keeps runtime semantics", function()
+    local two, s = 2, "b"
+    assert(2 * 3.5 == two * 3.5 and 7 % 3 == 7 % (two + 1) and 2 ^ 10 == two ^ 10)
+    assert("a" .. "b" .. 1 == "a" .. s .. 1)
+    assert(("a" < "b") == ("a" < s) and (1 == 1.0) and not (0/0 == 0/0))
+    assert((false or "d") == "d" and (nil and error("folded away")) == nil)
+    local t = { ["k" .. "1"] = 1, [2 * 4] = 2 }
+    assert(t.k1 == 1 and t[8] == 2)
+    local hit = 0
+    if false then hit = 1 elseif 1 < 2 then hit = 2 else hit = 3 end
+    while false do hit = 4 end
+    assert(hit == 2)
+    local function pair() return 1, 2 end
+    assert(select("#", true and pair()) == 1)   -- still one value
+end)
+
+test("blocks without locals share their parent's scope", function()
+    local x, seen = 1, {}
+    local get
+    do do
+        get = function() return x end
+        if x then x = x + 1 end
+    end end
+    for j = 1, 4 do
+        if j == 2 then goto continue end
+        do seen[#seen + 1] = j end
+        ::continue::
+    end
+    assert(get() == 2 and #seen == 3 and seen[2] == 3)
+    local function f(a) do do return a * 2 end end end
+    assert(f(21) == 42)
+end)
+
+test("numeric for follows integer and float loop rules", function()
+    local xs = {}
+    for x = 0, 1, 0.25 do xs[#xs + 1] = x end
+    assert(#xs == 5 and xs[5] == 1)
+    local n = 0
+    for i = 1, 3.7 do n = n + 1 end
+    assert(n == 3)
+    for i = 1, 0/0 do n = n + 1 end
+    assert(n == 3)
+    n = 0
+    for i = 2^53 - 2, 2^53 do n = n + 1 end
+    assert(n == 3)
+    local ok, err = pcall(function() for i = 1, 10, 0 do end end)
+    assert(not ok and string.find(tostring(err), "step is zero"))
+    local order = {}
+    for i = 1, 3 do
+        if i == 2 then goto out end
+        order[#order + 1] = i
+    end
+    ::out::
+    order[#order + 1] = "after"
+    assert(#order == 2 and order[2] == "after")
+end)
+
+test("debug.sethook count hooks and step budgets", function()
+    local n = 0
+    debug.sethook(function(ev) if ev == "count" then n = n + 1 end end, "", 10)
+    local i = 0
+    while i < 100 do i = i + 1 end
+    local h, _, c = debug.gethook()
+    debug.sethook()
+    assert(n == 10 and type(h) == "function" and c == 10)
+    assert(debug.gethook() == nil)
+    debug.sethook(function() error("budget exhausted") end, "", 1000)
+    local ok, err = pcall(function() while true do end end)
+    local ok2, err2 = pcall(function() local function r() return 1 + r() end return r() end)
+    debug.sethook()
+    assert(not ok and string.find(tostring(err), "budget exhausted") and not ok2)
+    local big = 0
+    for j = 1, 12000000 do big = big + 1 end
+    assert(big == 12000000)
+end)
+
+test("coroutines yield from loops, nested calls and pcall", function()
+    local function inner(x) return coroutine.yield(x + 1) * 2 end
+    local co = coroutine.create(function(a, ...)
+        local got = { inner(a) }
+        for i = 1, 2 do
+            local keep = { i }
+            collectgarbage()
+            got[#got + 1] = coroutine.yield(keep[1] * 100)
+        end
+        local ok = pcall(function() coroutine.yield("in pcall") error("boom") end)
+        got[#got + 1] = ok
+        coroutine.yield(select('#', ...), ...)
+        return table.concat({ got[1], got[2], got[3] }, ",")
+    end)
+    local ok, v, w, z = coroutine.resume(co, 1, "x", "y")
+    assert(ok and v == 2)
+    assert(select(2, coroutine.resume(co, 5)) == 100)
+    assert(select(2, coroutine.resume(co, "a")) == 200)
+    assert(select(2, coroutine.resume(co, "b")) == "in pcall")
+    ok, v, w, z = coroutine.resume(co)
+    assert(v == 2 and w == "x" and z == "y")
+    ok, v = coroutine.resume(co)
+    assert(ok and v == "10,a,b" and coroutine.status(co) == "dead")
+    assert(not coroutine.resume(co))
+    local gen = coroutine.wrap(function() local i = 0 while true do i = i + 1 coroutine.yield(i) end end)
+    local sum = 0
+    for _ = 1, 100000 do sum = sum + gen() end
+    assert(sum == 5000050000)
+end)
+
+test("coroutines are thread values with pooled stacks", function()
+    local co = coroutine.create(function() coroutine.yield() end)
+    assert(type(co) == "thread" and coroutine.status(co) == "suspended")
+    local seen = {}
+    seen[co] = true
+    assert(seen[co] and co == co)
+    local n = 0
+    for i = 1, 5000 do
+        local c = coroutine.create(function(a) local b = coroutine.yield(a) return a + b end)
+        local _, r = coroutine.resume(c, i)
+        if i % 2 == 0 then _, r = coroutine.resume(c, 1) end
+        n = n + r
+    end
+    assert(n == 12502500 + 2500)
+    local inside
+    local c = coroutine.create(function() inside = coroutine.running() end)
+    coroutine.resume(c)
+    assert(inside == c and coroutine.running() == nil)
+end)
+
+test("async.run sleeps on timers and wakes parked tasks", function()
+    local order = {}
+    for i = 1, 200 do
+        async.spawn(function()
+            async.await(async.sleep((3 - i % 3) * 0.01))
+            order[#order + 1] = i % 3
+        end)
+    end
+    local ok
+    async.spawn(function() local r, _ = pcall(async.await, async.reject("no")) ok = r end)
+    async.run()
+    assert(#order == 200 and order[1] == 2 and order[200] == 0)
+    assert(ok == false)
+end)
+
+test("async.read and async.lines suspend tasks on pipes", function()
+    local dir = os.tmpname()
+    os.remove(dir)
+    os.execute("mkdir " .. dir .. " && mkfifo " .. dir .. "/a " .. dir .. "/b")
+    local got = {}
+    for _, name in ipairs({"a", "b"}) do
+        local fh = io.open(dir .. "/" .. name, "r", {nonblocking = true})
+        async.spawn(function()
+            for line in async.lines(fh) do got[#got + 1] = name .. line end
+            fh:close()
+        end)
+    end
+    os.execute("(sleep 0.05; printf '1\\n2\\n') > " .. dir .. "/a &")
+    os.execute("(printf '1\\n'; sleep 0.1; printf '2') > " .. dir .. "/b &")
+    async.run()
+    assert(table.concat(got, ",") == "b1,a1,a2,b2")
+    local f = io.open(dir .. "/c", "w", {nonblocking = true})
+    async.write(f, "x\n", 42, "\ny")
+    f:close()
+    f = io.open(dir .. "/c", "r", {nonblocking = true})
+    assert(async.read(f) == "x" and async.read(f, "*L") == "42\n" and async.read(f, "*a") == "y")
+    assert(async.read(f) == nil)
+    f:close()
+    os.execute("rm -rf " .. dir)
+end)
+
+test("promise callbacks settle in order and combine", function()
+    local log = {}
+    async.promise(function(res) res(5) end)
+        :next(function(v) log[#log + 1] = "a" .. v return v * 2 end)
+        :next(function(v) error("boom" .. v) end)
+        :catch(function(e) log[#log + 1] = "caught" return async.resolve(7) end)
+        :next(function(v) log[#log + 1] = "b" .. v end)
+    local src = async.promise(function(res)
+        async.spawn(function() async.await(async.sleep(0.01)) res(1) end)
+    end)
+    local n, kids = 0, {}
+    for i = 1, 1000 do kids[i] = src:next(function(v) n = n + v return i end) end
+    for i = 1, 200 do async.spawn(function() async.await(src) n = n + 1 end) end
+    local r, first, failed
+    async.spawn(function()
+        r = async.await(async.all(kids))
+        first = async.await(async.race({async.sleep(0.05), async.resolve("fast")}))
+        local ok, e = pcall(async.await, async.all({async.reject("e1"), async.sleep(1)}))
+        failed = e
+        assert(async.await(async.any({async.reject("x"), async.resolve(3)})) == 3)
+    end)
+    async.run()
+    assert(table.concat(log, " ") == "a5 caught b7")
+    assert(n == 1200 and #r == 1000 and r[1000] == 1000)
+    assert(first == "fast" and failed == "e1")
+end)
+
+test("parentheses truncate calls and varargs to one value", function()
+    local function two() return 1, 2 end
+    local function count(...) return select("#", ...) end
+    assert(count((two())) == 1 and count(two()) == 2)
+    assert(#{(two())} == 1 and #{two()} == 2)
+    local function first(...) return select("#", (...)) end
+    assert(first(1, 2, 3) == 1)
+    local function wrapped() return (two()) end
+    assert(count(wrapped()) == 1)
+    local a, b = (two())
+    assert(a == 1 and b == nil)
+end)
+
+test("cached chunks evaluate a method receiver once", function()
+    if os.getenv("LUAX_NOCACHE") then return end
+    local name = "luax_method_probe"
+    local f = io.open(name .. ".lua", "w")
+    f:write("local n = 0\nlocal o = {}\nfunction o.m(self, x) return self end\n" ..
+            "local function get() n = n + 1 return o end\n" ..
+            "return function() n = 0 get():m(1) get():m(2):m(3) return n end\n")
+    f:close()
+    os.remove(name .. ".luaxc")
+    local fresh = require(name)
+    local load_cached = loadfile(name .. ".luaxc")
+    os.remove(name .. ".lua")
+    os.remove(name .. ".luaxc")
+    assert(fresh() == 2)
+    assert(load_cached, "no cache file written")
+    assert(load_cached()() == 2)
+end)
+
+test("deep recursion inside a coroutine", function()
+    local function rec(n) if n == 0 then return 0 end return 1 + rec(n - 1) end
+    local co = coroutine.create(function() return rec(5000) end)
+    local ok, v = coroutine.resume(co)
+    assert(ok and v == 5000)
+    local function inf(n) return 1 + inf(n + 1) end
+    co = coroutine.create(function()
+        local r, e = pcall(inf, 1)
+        coroutine.yield(r, e)
+        return "after"
+    end)
+    local _, r, e = coroutine.resume(co)
+    assert(r == false and string.find(e, "stack overflow"))
+    local _, after = coroutine.resume(co)
+    assert(after == "after")
+    co = coroutine.create(function() return inf(1) end)
+    ok, e = coroutine.resume(co)
+    assert(not ok and string.find(e, "stack overflow") and coroutine.status(co) == "dead")
+    ok, e = pcall(inf, 1)   -- the main thread's C stack is checked too
+    assert(not ok and string.find(e, "stack overflow"))
+end)
+
+test("cached lookup chains drop tables freed mid-sweep", function()
+    collectgarbage("incremental")
+    local function get(o) return o.tag end
+    for i = 1, 3000 do
+        local C = i % 2 == 0 and { tag = i } or { a = 1, b = 2, tag = i }
+        local o = setmetatable(i % 3 == 0 and { z = 0 } or {}, { __index = C })
+        assert(get(o) == i)
+        collectgarbage("step", 1)
+    end
+end)
+
+test("method caches notice fields that shadow the class", function()
+    local C = {}
+    C.__index = C
+    function C.get(self) return "method" end
+    local function new() return setmetatable({ x = 1 }, C) end
+    local function look(o) return o.get end
+    local a, b = new(), new()
+    assert(look(a) == C.get and look(b) == C.get)
+    b.get = "own"
+    assert(look(a) == C.get and look(b) == "own")
+    b.get = nil
+    assert(look(b) == C.get)
+    local d = { x = 1 }
+    d.get = "d"
+    setmetatable(d, C)
+    assert(look(d) == "d" and look(new()) == C.get)
+end)
+
+test("library results come back as multiple values", function()
+    local function three() return 1, 2, 3 end
+    local ok, a, b, c = pcall(three)
+    assert(ok == true and a == 1 and b == 2 and c == 3)
+    assert(select('#', pcall(three)) == 4)
+    ok, a = xpcall(function() error("x") end, function(e) return "handled" end)
+    assert(ok == false and a == "handled")
+    local t = { 10, 20 }
+    local x, y = t
+    assert(x == t and y == nil)
+    local triple = { function() end, 0, 0 }
+    local function give() return triple end
+    local n = 0
+    for k, v in give() do n = n + 1 end
+    assert(n == 3)
+    local i, j = string.find("hello", "ll")
+    assert(i == 3 and j == 4)
+    local s, cnt = string.gsub("aaa", "a", "b")
+    assert(s == "bbb" and cnt == 3)
+    local co = coroutine.wrap(function(p) coroutine.yield(p, p + 1) end)
+    local u, v = co(5)
+    assert(u == 5 and v == 6)
+end)
+
+test("promises are opaque userdata", function()
+    local p = async.resolve(7)
+    assert(type(p) == "userdata")
+    assert(p._p == nil and p._mt == nil)
+    p._p = "x"
+    assert(p._p == nil)
+    local seen = {}
+    seen[p] = true
+    assert(seen[p] and seen[async.resolve(7)] == nil)
+    local got
+    p:next(function(v) got = v end)
+    async.run()
+    assert(got == 7)
+end)
+
 -- Final summary
 print("\n=== Test Results ===")
 print("Passed: " .. passed)